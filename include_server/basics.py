@@ -190,6 +190,13 @@ USER_TIME_QUOTA = 3.8  # seconds
 # careful to wait a full 4 s before issuing SIGALRM.
 USER_TIME_QUOTA_CHECK_INTERVAL_TIME = 4  # seconds, an integer
 
+# How much work the native macro evaluator may do on the computed includes of
+# one translation unit before giving up on it. One unit is roughly one
+# evaluation step or one string produced; a million of them take a fraction
+# of USER_TIME_QUOTA. Running out raises NotCoveredError straight away rather
+# than spending the whole quota first.
+MACRO_EVAL_WORK_BUDGET = 1000000
+
 # ALGORITHMS
 
 SIMPLE = 0     # not implemented
@@ -210,6 +217,7 @@ GC_THRESHOLD = 10000
 # FLAGS FOR COMMAND LINE OPTIONS
 
 opt_algorithm = MEMOIZING  # currently, only choice
+opt_closure_memo = None  # file to keep the closure memo in across runs
 opt_debug_pattern = 1  # see DEBUG below
 opt_email_bound = MAX_EMAILS_TO_SEND
 opt_exact_analysis = False         # use CPP instead of include analyzer
@@ -23,6 +23,11 @@
 
 #include "Python.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 static const char *version = ".01";
 
 /* To suppress compiler warnings */
@@ -357,6 +362,816 @@ Realpath(PyObject *dummy, PyObject *args) {
 
 
 
+/***********************************************************************
+EvalExpression
+************************************************************************/
+
+/* A native version of macro_eval.EvalExpression.  It follows the Python
+   implementation step by step, down to its quirks (retokenizing after every
+   substitution, regular expression word boundaries, no whitespace insertion),
+   so that both give the same sets of strings.  What it adds is:
+
+   - memoization: the value of a (string, disabled symbols) pair is computed
+     only once per call, which is what keeps Boost.Preprocessor-style macro
+     stacks from blowing up;
+   - interned symbols, so that looking them up in the symbol table and in
+     the disabled sets is mostly pointer comparison;
+   - a work budget, so that a hopeless expression fails fast instead of
+     running into the include server's timeout. */
+
+typedef struct {
+  PyObject *symbol_table;   /* borrowed */
+  PyObject *memo;           /* (expr, disabled) -> set of expansions */
+  long work;
+  long budget;
+  int exhausted;
+} macro_eval_ctx;
+
+/* How often, in units of work, to give Python signal handlers (the include
+   server's SIGALRM timer) a chance to run. */
+#define MACRO_EVAL_SIGNAL_CHECK_INTERVAL 4096
+
+static int
+macro_eval_is_word(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int
+macro_eval_is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'
+      || c == '\v';
+}
+
+/* Like the regular expression \b at position pos of s[0..len). */
+static int
+macro_eval_at_boundary(const char *s, Py_ssize_t len, Py_ssize_t pos) {
+  int before = pos > 0 && macro_eval_is_word(s[pos - 1]);
+  int after = pos < len && macro_eval_is_word(s[pos]);
+  return before != after;
+}
+
+/* Charge n units of work; returns -1 if the budget ran out or a signal
+   handler raised an exception. */
+static int
+macro_eval_charge(macro_eval_ctx *ctx, long n) {
+  long before = ctx->work;
+  ctx->work += n;
+  if (ctx->work > ctx->budget) {
+    ctx->exhausted = 1;
+    return -1;
+  }
+  if (before / MACRO_EVAL_SIGNAL_CHECK_INTERVAL
+      != ctx->work / MACRO_EVAL_SIGNAL_CHECK_INTERVAL
+      && PyErr_CheckSignals())
+    return -1;
+  return 0;
+}
+
+/* A growable output buffer. */
+typedef struct {
+  char *buf;
+  Py_ssize_t len, size;
+} macro_eval_buf;
+
+static int
+macro_eval_buf_append(macro_eval_buf *b, const char *s, Py_ssize_t n) {
+  if (b->len + n > b->size) {
+    Py_ssize_t new_size = b->size ? b->size : 64;
+    char *new_buf;
+    while (new_size < b->len + n)
+      new_size *= 2;
+    new_buf = PyMem_Realloc(b->buf, new_size);
+    if (new_buf == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    b->buf = new_buf;
+    b->size = new_size;
+  }
+  memcpy(b->buf + b->len, s, n);
+  b->len += n;
+  return 0;
+}
+
+static PyObject *
+macro_eval_buf_finish(macro_eval_buf *b) {
+  PyObject *result = PyString_FromStringAndSize(b->buf ? b->buf : "", b->len);
+  PyMem_Free(b->buf);
+  b->buf = NULL;
+  return result;
+}
+
+/* Like macro_eval._ParseArgs.  Returns a new list, or Py_None (new
+   reference) if there is no balanced argument list at pos. */
+static PyObject *
+macro_eval_parse_args(const char *s, Py_ssize_t len, Py_ssize_t pos,
+                      Py_ssize_t *pos_end_ret) {
+  Py_ssize_t i, start, pos_end = -1;
+  int open_parens = 0, inside_quotes = 0;
+  PyObject *args, *arg;
+
+  *pos_end_ret = pos;
+  if (pos >= len || s[pos] != '(') {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  for (i = pos; i < len; i++) {
+    if (inside_quotes) {
+      if (s[i] == '"')
+        inside_quotes = 0;
+      continue;
+    }
+    if (s[i] == ',' && open_parens == 1)
+      ;
+    else if (s[i] == '(')
+      open_parens++;
+    else if (s[i] == ')') {
+      open_parens--;
+      if (open_parens == 0) {
+        pos_end = i;
+        break;
+      }
+    } else if (s[i] == '"')
+      inside_quotes = 1;
+  }
+  if (pos_end < 0) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  /* Second pass to cut out the arguments, now that we know where the
+     argument list ends. */
+  if ((args = PyList_New(0)) == NULL)
+    return NULL;
+  open_parens = 0;
+  inside_quotes = 0;
+  start = pos + 1;
+  for (i = pos; i <= pos_end; i++) {
+    if (inside_quotes) {
+      if (s[i] == '"')
+        inside_quotes = 0;
+      continue;
+    }
+    if ((s[i] == ',' && open_parens == 1) || i == pos_end) {
+      arg = PyString_FromStringAndSize(s + start, i - start);
+      if (arg == NULL || PyList_Append(args, arg) == -1) {
+        Py_XDECREF(arg);
+        Py_DECREF(args);
+        return NULL;
+      }
+      Py_DECREF(arg);
+      start = i + 1;
+    } else if (s[i] == '(')
+      open_parens++;
+    else if (s[i] == ')')
+      open_parens--;
+    else if (s[i] == '"')
+      inside_quotes = 1;
+  }
+  *pos_end_ret = pos_end + 1;
+  return args;
+}
+
+/* Like macro_eval._SubstituteSymbolInString: replace every occurrence of x
+   in str that is delimited by \b on both sides by y. */
+static PyObject *
+macro_eval_substitute(PyObject *x, PyObject *y, PyObject *str) {
+  const char *xs = PyString_AS_STRING(x);
+  Py_ssize_t xlen = PyString_GET_SIZE(x);
+  const char *s = PyString_AS_STRING(str);
+  Py_ssize_t len = PyString_GET_SIZE(str);
+  macro_eval_buf b = { NULL, 0, 0 };
+  Py_ssize_t p = 0, copied = 0;
+
+  while (p <= len) {
+    if (p + xlen <= len
+        && macro_eval_at_boundary(s, len, p)
+        && memcmp(s + p, xs, xlen) == 0
+        && macro_eval_at_boundary(s, len, p + xlen)) {
+      if (macro_eval_buf_append(&b, s + copied, p - copied) == -1
+          || macro_eval_buf_append(&b, PyString_AS_STRING(y),
+                                   PyString_GET_SIZE(y)) == -1)
+        goto fail;
+      if (xlen == 0) {
+        /* An empty match: keep the next character and move on. */
+        if (p < len && macro_eval_buf_append(&b, s + p, 1) == -1)
+          goto fail;
+        p++;
+        copied = p;
+      } else {
+        p += xlen;
+        copied = p;
+      }
+    } else {
+      p++;
+    }
+  }
+  if (copied < len && macro_eval_buf_append(&b, s + copied, len - copied) == -1)
+    goto fail;
+  return macro_eval_buf_finish(&b);
+ fail:
+  PyMem_Free(b.buf);
+  return NULL;
+}
+
+/* Like macro_eval._MassageAccordingToPoundSigns: drop every "##", then
+   stringify "# token". */
+static PyObject *
+macro_eval_massage(PyObject *str) {
+  const char *s0 = PyString_AS_STRING(str);
+  Py_ssize_t len0 = PyString_GET_SIZE(str);
+  macro_eval_buf pasted = { NULL, 0, 0 }, b = { NULL, 0, 0 };
+  const char *s;
+  Py_ssize_t len, p, q, r, copied;
+
+  if (memchr(s0, '#', len0) == NULL) {
+    Py_INCREF(str);
+    return str;
+  }
+
+  for (p = 0, copied = 0; p + 1 < len0; ) {
+    if (s0[p] == '#' && s0[p + 1] == '#') {
+      if (macro_eval_buf_append(&pasted, s0 + copied, p - copied) == -1)
+        goto fail;
+      p += 2;
+      copied = p;
+    } else {
+      p++;
+    }
+  }
+  if (macro_eval_buf_append(&pasted, s0 + copied, len0 - copied) == -1)
+    goto fail;
+  s = pasted.buf ? pasted.buf : "";
+  len = pasted.len;
+
+  for (p = 0, copied = 0; p < len; ) {
+    if (s[p] == '#' && (p == 0 || !macro_eval_is_word(s[p - 1]))) {
+      for (q = p + 1; q < len && macro_eval_is_space(s[q]); q++)
+        ;
+      for (r = q; r < len && !macro_eval_is_space(s[r]); r++)
+        ;
+      if (macro_eval_buf_append(&b, s + copied, p - copied) == -1
+          || macro_eval_buf_append(&b, "\"", 1) == -1
+          || macro_eval_buf_append(&b, s + q, r - q) == -1
+          || macro_eval_buf_append(&b, "\"", 1) == -1)
+        goto fail;
+      p = r;
+      copied = r;
+    } else {
+      p++;
+    }
+  }
+  if (macro_eval_buf_append(&b, s + copied, len - copied) == -1)
+    goto fail;
+  PyMem_Free(pasted.buf);
+  return macro_eval_buf_finish(&b);
+ fail:
+  PyMem_Free(pasted.buf);
+  PyMem_Free(b.buf);
+  return NULL;
+}
+
+/* Add prefix + e to result for each e in values. */
+static int
+macro_eval_add_prefixed(macro_eval_ctx *ctx, PyObject *result,
+                        const char *prefix, Py_ssize_t prefix_len,
+                        PyObject *values) {
+  PyObject *it, *value, *joined;
+  int ret = 0;
+
+  if (macro_eval_charge(ctx, PySet_GET_SIZE(values)) == -1)
+    return -1;
+  if ((it = PyObject_GetIter(values)) == NULL)
+    return -1;
+  while ((value = PyIter_Next(it)) != NULL) {
+    joined = PyString_FromStringAndSize(NULL,
+                                        prefix_len + PyString_GET_SIZE(value));
+    if (joined == NULL) {
+      Py_DECREF(value);
+      ret = -1;
+      break;
+    }
+    memcpy(PyString_AS_STRING(joined), prefix, prefix_len);
+    memcpy(PyString_AS_STRING(joined) + prefix_len,
+           PyString_AS_STRING(value), PyString_GET_SIZE(value));
+    Py_DECREF(value);
+    ret = PySet_Add(result, joined);
+    Py_DECREF(joined);
+    if (ret == -1)
+      break;
+  }
+  Py_DECREF(it);
+  if (PyErr_Occurred())
+    ret = -1;
+  return ret;
+}
+
+static PyObject *
+macro_eval_helper(macro_eval_ctx *ctx, PyObject *expr, PyObject *disabled);
+
+static PyObject *
+macro_eval_helper_str(macro_eval_ctx *ctx, const char *s, Py_ssize_t len,
+                      PyObject *disabled) {
+  PyObject *expr, *result;
+  if ((expr = PyString_FromStringAndSize(s, len)) == NULL)
+    return NULL;
+  result = macro_eval_helper(ctx, expr, disabled);
+  Py_DECREF(expr);
+  return result;
+}
+
+/* Like _ReEvalRecursivelyForExpansion: add prefix + v to result for every
+   value v of expansion + a, where a ranges over the values of after. */
+static int
+macro_eval_reeval(macro_eval_ctx *ctx, PyObject *result,
+                  const char *prefix, Py_ssize_t prefix_len,
+                  PyObject *expansion,
+                  const char *after, Py_ssize_t after_len,
+                  PyObject *disabled, PyObject *disabled_more) {
+  PyObject *after_values, *it, *a, *joined, *values;
+  int ret = 0;
+
+  if ((after_values = macro_eval_helper_str(ctx, after, after_len,
+                                            disabled)) == NULL)
+    return -1;
+  if ((it = PyObject_GetIter(after_values)) == NULL) {
+    Py_DECREF(after_values);
+    return -1;
+  }
+  while (ret == 0 && (a = PyIter_Next(it)) != NULL) {
+    joined = PyString_FromStringAndSize(NULL, PyString_GET_SIZE(expansion)
+                                        + PyString_GET_SIZE(a));
+    if (joined == NULL) {
+      ret = -1;
+    } else {
+      memcpy(PyString_AS_STRING(joined), PyString_AS_STRING(expansion),
+             PyString_GET_SIZE(expansion));
+      memcpy(PyString_AS_STRING(joined) + PyString_GET_SIZE(expansion),
+             PyString_AS_STRING(a), PyString_GET_SIZE(a));
+      values = macro_eval_helper(ctx, joined, disabled_more);
+      Py_DECREF(joined);
+      if (values == NULL) {
+        ret = -1;
+      } else {
+        ret = macro_eval_add_prefixed(ctx, result, prefix, prefix_len, values);
+        Py_DECREF(values);
+      }
+    }
+    Py_DECREF(a);
+  }
+  Py_DECREF(it);
+  Py_DECREF(after_values);
+  if (PyErr_Occurred())
+    ret = -1;
+  return ret;
+}
+
+/* Expand a function-like macro with formal parameters params and body rhs,
+   applied to the actual arguments args. */
+static int
+macro_eval_function_like(macro_eval_ctx *ctx, PyObject *result,
+                         const char *s, Py_ssize_t match_start,
+                         PyObject *params, PyObject *rhs, PyObject *args,
+                         const char *after, Py_ssize_t after_len,
+                         PyObject *disabled, PyObject *disabled_more) {
+  PyObject *expansions = NULL, *next = NULL, *values = NULL;
+  PyObject *it = NULL, *arg_value, *expansion, *massaged;
+  Py_ssize_t i, j, n_params;
+  int ret = -1;
+
+  n_params = PySequence_Size(params);
+  if (n_params < 0)
+    return -1;
+  if (args == Py_None || n_params != PyList_GET_SIZE(args))
+    return 0;
+
+  if ((expansions = PyList_New(1)) == NULL)
+    return -1;
+  Py_INCREF(rhs);
+  PyList_SET_ITEM(expansions, 0, rhs);
+
+  for (i = 0; i < n_params; i++) {
+    PyObject *param = PySequence_GetItem(params, i);
+    if (param == NULL)
+      goto out;
+    if (!PyString_Check(param)) {
+      PyErr_SetString(PyExc_TypeError, "macro parameters must be strings");
+      Py_DECREF(param);
+      goto out;
+    }
+    values = macro_eval_helper(ctx, PyList_GET_ITEM(args, i), disabled);
+    if (values == NULL
+        || macro_eval_charge(ctx, PyList_GET_SIZE(expansions)
+                                  * PySet_GET_SIZE(values)) == -1
+        || (next = PyList_New(0)) == NULL) {
+      Py_DECREF(param);
+      goto out;
+    }
+    for (j = 0; j < PyList_GET_SIZE(expansions); j++) {
+      if ((it = PyObject_GetIter(values)) == NULL) {
+        Py_DECREF(param);
+        goto out;
+      }
+      while ((arg_value = PyIter_Next(it)) != NULL) {
+        expansion = macro_eval_substitute(param, arg_value,
+                                          PyList_GET_ITEM(expansions, j));
+        Py_DECREF(arg_value);
+        if (expansion == NULL || PyList_Append(next, expansion) == -1) {
+          Py_XDECREF(expansion);
+          Py_DECREF(param);
+          goto out;
+        }
+        Py_DECREF(expansion);
+      }
+      Py_CLEAR(it);
+      if (PyErr_Occurred()) {
+        Py_DECREF(param);
+        goto out;
+      }
+    }
+    Py_DECREF(param);
+    Py_CLEAR(values);
+    Py_DECREF(expansions);
+    expansions = next;
+    next = NULL;
+  }
+
+  for (j = 0; j < PyList_GET_SIZE(expansions); j++) {
+    if ((massaged = macro_eval_massage(PyList_GET_ITEM(expansions, j))) == NULL)
+      goto out;
+    if (macro_eval_reeval(ctx, result, s, match_start, massaged,
+                          after, after_len, disabled, disabled_more) == -1) {
+      Py_DECREF(massaged);
+      goto out;
+    }
+    Py_DECREF(massaged);
+  }
+  ret = 0;
+
+ out:
+  Py_XDECREF(it);
+  Py_XDECREF(values);
+  Py_XDECREF(next);
+  Py_XDECREF(expansions);
+  return ret;
+}
+
+/* Like macro_eval._EvalExprHelper.  disabled is a frozenset of interned
+   symbols.  Returns a new reference to a set that must not be modified,
+   since it may also live in the memo. */
+static PyObject *
+macro_eval_helper(macro_eval_ctx *ctx, PyObject *expr, PyObject *disabled) {
+  const char *s = PyString_AS_STRING(expr);
+  Py_ssize_t len = PyString_GET_SIZE(expr);
+  Py_ssize_t match_start, match_end, args_end;
+  PyObject *key = NULL, *result = NULL, *symbol = NULL, *args = NULL;
+  PyObject *defs, *defs_fast = NULL;
+  PyObject *rest_values = NULL, *disabled_more = NULL;
+  PyObject *tmp;
+  Py_ssize_t i, n_defs;
+
+  if ((key = PyTuple_Pack(2, expr, disabled)) == NULL)
+    return NULL;
+  if ((result = PyDict_GetItem(ctx->memo, key)) != NULL) {
+    Py_INCREF(result);
+    Py_DECREF(key);
+    return result;
+  }
+  if (macro_eval_charge(ctx, 1) == -1) {
+    Py_DECREF(key);
+    return NULL;
+  }
+  if (Py_EnterRecursiveCall(" in EvalExpression")) {
+    Py_DECREF(key);
+    return NULL;
+  }
+
+  if ((result = PySet_New(NULL)) == NULL)
+    goto fail;
+
+  /* Look for a symbol. */
+  for (match_start = 0;
+       match_start < len && !macro_eval_is_word(s[match_start]);
+       match_start++)
+    ;
+  if (match_start == len) {
+    if (PySet_Add(result, expr) == -1)
+      goto fail;
+    goto done;
+  }
+  for (match_end = match_start;
+       match_end < len && macro_eval_is_word(s[match_end]);
+       match_end++)
+    ;
+
+  if ((symbol = PyString_FromStringAndSize(s + match_start,
+                                           match_end - match_start)) == NULL)
+    goto fail;
+  PyString_InternInPlace(&symbol);
+  if ((args = macro_eval_parse_args(s, len, match_end, &args_end)) == NULL)
+    goto fail;
+
+  defs = PyDict_GetItem(ctx->symbol_table, symbol);
+  if (defs == NULL) {
+    /* Not a macro: process the rest of the string. */
+    if ((rest_values = macro_eval_helper_str(ctx, s + match_end,
+                                             len - match_end,
+                                             disabled)) == NULL
+        || macro_eval_add_prefixed(ctx, result, s, match_end,
+                                   rest_values) == -1)
+      goto fail;
+    goto done;
+  }
+
+  /* The string remaining unexpanded is always a possibility. */
+  if (PySet_Add(result, expr) == -1)
+    goto fail;
+  i = PySet_Contains(disabled, symbol);
+  if (i == -1)
+    goto fail;
+  if (i == 1)
+    goto done;
+
+  if ((tmp = PySet_New(disabled)) == NULL)
+    goto fail;
+  if (PySet_Add(tmp, symbol) == -1) {
+    Py_DECREF(tmp);
+    goto fail;
+  }
+  disabled_more = PyFrozenSet_New(tmp);
+  Py_DECREF(tmp);
+  if (disabled_more == NULL)
+    goto fail;
+
+  if ((defs_fast = PySequence_Fast(defs,
+                                   "symbol table entries must be lists"))
+      == NULL)
+    goto fail;
+  n_defs = PySequence_Fast_GET_SIZE(defs_fast);
+  for (i = 0; i < n_defs; i++) {
+    PyObject *definition = PySequence_Fast_GET_ITEM(defs_fast, i);
+
+    /* Consider that this symbol goes unevaluated. */
+    if (rest_values == NULL
+        && (rest_values = macro_eval_helper_str(ctx, s + match_end,
+                                                len - match_end,
+                                                disabled)) == NULL)
+      goto fail;
+    if (macro_eval_add_prefixed(ctx, result, s, match_end, rest_values) == -1)
+      goto fail;
+
+    if (PyString_Check(definition)) {
+      if (macro_eval_reeval(ctx, result, s, match_start, definition,
+                            s + match_end, len - match_end,
+                            disabled, disabled_more) == -1)
+        goto fail;
+    } else if (PyTuple_Check(definition) && PyTuple_GET_SIZE(definition) == 2
+               && PyString_Check(PyTuple_GET_ITEM(definition, 1))) {
+      if (macro_eval_function_like(ctx, result, s, match_start,
+                                   PyTuple_GET_ITEM(definition, 0),
+                                   PyTuple_GET_ITEM(definition, 1),
+                                   args, s + args_end, len - args_end,
+                                   disabled, disabled_more) == -1)
+        goto fail;
+    } else {
+      PyErr_SetString(PyExc_TypeError, "unexpected macro definition");
+      goto fail;
+    }
+  }
+
+ done:
+  Py_LeaveRecursiveCall();
+  if (PyDict_SetItem(ctx->memo, key, result) == -1)
+    Py_CLEAR(result);
+  Py_XDECREF(defs_fast);
+  Py_XDECREF(disabled_more);
+  Py_XDECREF(rest_values);
+  Py_XDECREF(args);
+  Py_XDECREF(symbol);
+  Py_DECREF(key);
+  return result;
+
+ fail:
+  Py_LeaveRecursiveCall();
+  Py_XDECREF(defs_fast);
+  Py_XDECREF(disabled_more);
+  Py_XDECREF(rest_values);
+  Py_XDECREF(args);
+  Py_XDECREF(symbol);
+  Py_XDECREF(result);
+  Py_DECREF(key);
+  return NULL;
+}
+
+static char EvalExpression_doc__[] =
+"EvalExpression(expr, symbol_table, budget):\n"
+"  Native version of macro_eval.EvalExpression.\n"
+"\n"
+"  Arguments:\n"
+"    expr: a string to be macro expanded\n"
+"    symbol_table: as described in macro_eval\n"
+"    budget: an integer; the most work to do before giving up\n"
+"  Returns:\n"
+"    a pair (values, work), where values is the set of possible expansions\n"
+"    of expr, or None if the budget ran out, and work is the amount of the\n"
+"    budget used\n"
+;
+
+static PyObject *
+EvalExpression(PyObject *dummy, PyObject *args) {
+  PyObject *expr, *disabled, *values;
+  macro_eval_ctx ctx;
+  UNUSED(dummy);
+
+  ctx.work = 0;
+  ctx.exhausted = 0;
+  if (!PyArg_ParseTuple(args, "SO!l", &expr, &PyDict_Type, &ctx.symbol_table,
+                        &ctx.budget))
+    return NULL;
+  if ((ctx.memo = PyDict_New()) == NULL)
+    return NULL;
+  if ((disabled = PyFrozenSet_New(NULL)) == NULL) {
+    Py_DECREF(ctx.memo);
+    return NULL;
+  }
+  values = macro_eval_helper(&ctx, expr, disabled);
+  Py_DECREF(disabled);
+  Py_DECREF(ctx.memo);
+  if (values == NULL) {
+    if (!ctx.exhausted || PyErr_Occurred())
+      return NULL;
+    return Py_BuildValue("(Ol)", Py_None, ctx.work);
+  }
+  /* Hand out a fresh set: the caller may modify it. */
+  disabled = PySet_New(values);
+  Py_DECREF(values);
+  if (disabled == NULL)
+    return NULL;
+  return Py_BuildValue("(Nl)", disabled, ctx.work);
+}
+
+
+
+/***********************************************************************
+FindDirectives
+************************************************************************/
+
+/* Whether [p, end) starts with the directive name kw, followed by something
+   that is not a word character (like the \b in parse_file.POUND_SIGN_RE). */
+static int
+directive_name_at(const char *p, const char *end, const char *kw) {
+  size_t n = strlen(kw);
+  if ((size_t)(end - p) < n || memcmp(p, kw, n) != 0)
+    return 0;
+  return p + n == end || !macro_eval_is_word(p[n]);
+}
+
+/* Return the end of the logical line starting at p: the first newline not
+   preceded by a backslash, or end. */
+static const char *
+logical_line_end(const char *p, const char *end) {
+  const char *nl;
+  while ((nl = memchr(p, '\n', end - p)) != NULL) {
+    if (nl == p || nl[-1] != '\\')
+      return nl;
+    p = nl + 1;
+  }
+  return end;
+}
+
+/* Scan buf for lines that parse_file.POUND_SIGN_RE could match and append
+   them to result. */
+static int
+find_directives_in_buffer(const char *buf, size_t len, PyObject *result) {
+  const char *end = buf + len;
+  const char *p = buf, *hash, *line, *q, *stop;
+  PyObject *item, *text;
+
+  while (p < end && (hash = memchr(p, '#', end - p)) != NULL) {
+    /* Find the start of the physical line holding this '#'. */
+    for (line = hash; line > buf && line[-1] != '\n'; line--)
+      ;
+    for (q = line; q < hash && (*q == ' ' || *q == '\t'); q++)
+      ;
+    if (q == hash) {
+      /* The common case: only blanks before '#'. */
+      for (q = hash + 1; q < end && (*q == ' ' || *q == '\t'); q++)
+        ;
+      if (directive_name_at(q, end, "define")
+          || directive_name_at(q, end, "include_next")
+          || directive_name_at(q, end, "include")
+          || directive_name_at(q, end, "import")) {
+        stop = logical_line_end(hash, end);
+        if ((text = PyString_FromStringAndSize(hash, stop - hash)) == NULL)
+          return -1;
+        if (PyList_Append(result, text) == -1) {
+          Py_DECREF(text);
+          return -1;
+        }
+        Py_DECREF(text);
+      }
+    } else if (end - q >= 2 && ((q[0] == '*' && q[1] == '/')
+                                || (q[0] == '/' && q[1] == '*'))) {
+      /* Comments before the '#'.  Leave the fine print to POUND_SIGN_RE,
+         which gets the whole logical line, wrapped in a tuple. */
+      stop = logical_line_end(line, end);
+      if ((text = PyString_FromStringAndSize(line, stop - line)) == NULL)
+        return -1;
+      item = PyTuple_Pack(1, text);
+      Py_DECREF(text);
+      if (item == NULL || PyList_Append(result, item) == -1) {
+        Py_XDECREF(item);
+        return -1;
+      }
+      Py_DECREF(item);
+    }
+    /* Move on to the next physical line. */
+    if ((p = memchr(hash, '\n', end - hash)) == NULL)
+      break;
+    p++;
+  }
+  return 0;
+}
+
+static char FindDirectives_doc__[] =
+"FindDirectives(filepath):\n"
+"  Find the lines of a file that may hold #include, #include_next, #import\n"
+"  or #define directives.\n"
+"\n"
+"  The file is memory-mapped and scanned for '#' characters; all other lines\n"
+"  are skipped without further inspection.\n"
+"\n"
+"  Arguments:\n"
+"    filepath: a string\n"
+"  Returns:\n"
+"    a list, in file order, whose elements are either\n"
+"      a string: the text of a directive, from the '#' to the end of the\n"
+"        line, with backslash-newline continuations included, as matched by\n"
+"        group('directive') of parse_file.POUND_SIGN_RE; or\n"
+"      a 1-tuple holding a whole (logical) line that starts with a comment,\n"
+"        for POUND_SIGN_RE to decide on\n"
+"  Raises:\n"
+"    IOError\n"
+;
+
+static PyObject *
+FindDirectives(PyObject *dummy, PyObject *args) {
+  const char *filepath;
+  int fd;
+  struct stat st;
+  char *buf = NULL;
+  int mapped = 0;
+  PyObject *result;
+  UNUSED(dummy);
+
+  if (!PyArg_ParseTuple(args, "s", &filepath))
+    return NULL;
+
+  if ((fd = open(filepath, O_RDONLY)) == -1)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)filepath);
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)filepath);
+  }
+
+  if (st.st_size > 0) {
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf != MAP_FAILED) {
+      mapped = 1;
+    } else {
+      /* Not mappable (a pipe, say); just read it. */
+      ssize_t n, got = 0;
+      if ((buf = PyMem_Malloc(st.st_size)) == NULL) {
+        close(fd);
+        return PyErr_NoMemory();
+      }
+      while (got < st.st_size
+             && (n = read(fd, buf + got, st.st_size - got)) > 0)
+        got += n;
+      if (got < st.st_size) {
+        PyMem_Free(buf);
+        close(fd);
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                              (char *)filepath);
+      }
+    }
+  }
+  close(fd);
+
+  if ((result = PyList_New(0)) != NULL && st.st_size > 0
+      && find_directives_in_buffer(buf, st.st_size, result) == -1)
+    Py_CLEAR(result);
+
+  if (mapped)
+    munmap(buf, st.st_size);
+  else
+    PyMem_Free(buf);
+  return result;
+}
+
+
+
 /***********************************************************************
 Bindings
 ************************************************************************/
@@ -374,6 +1189,10 @@ static PyMethodDef methods[] = {
   {"XArgv",       (PyCFunction)XArgv,   METH_VARARGS, XArgv_doc__},
   {"CompressLzo1xAlloc", (PyCFunction)CompressLzo1xAlloc, METH_VARARGS, 
    CompressLzo1xAlloc_doc__},
+  {"EvalExpression", (PyCFunction)EvalExpression, METH_VARARGS,
+   EvalExpression_doc__},
+  {"FindDirectives", (PyCFunction)FindDirectives, METH_VARARGS,
+   FindDirectives_doc__},
   {NULL, NULL, 0, NULL}
 };
 
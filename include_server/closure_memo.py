@@ -0,0 +1,122 @@
+#! /usr/bin/python2.4
+
+# Copyright 2007 Google Inc.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""A memo of include closures that is validated by stat stamps.
+
+The include analysis of a translation unit is expensive, but in an incremental
+build the closure of most translation units being recompiled has not changed.
+The memo maps a description of a compilation (in strings, so that it can be
+saved from one run of the include server to the next) to the include closure
+last computed for it, together with the stamps (see basics.Stamp) of the paths
+the closure was derived from. A lookup succeeds only if all these paths still
+have the same stamps.
+
+The paths stamped are the files of the closure and a set of directories in
+which a new file could shadow a file of the closure. As everywhere else in the
+include server, system header files are assumed not to change.
+"""
+
+__author__ = "opensource@google.com"
+
+import marshal
+import os
+import tempfile
+
+import basics
+
+Debug = basics.Debug
+DEBUG_TRACE = basics.DEBUG_TRACE
+DEBUG_WARNING = basics.DEBUG_WARNING
+
+# Stored along with the memo in a file; bump when the format of entries changes.
+MEMO_FORMAT = 1
+
+
+class ClosureMemo(object):
+  """Remember include closures and the stamps they depend on.
+
+  An entry is a pair (value, stamps), where value is whatever the include
+  analyzer wants returned and stamps is a list of pairs (path, stamp). Keys and
+  values must be built from strings, numbers, tuples, and lists only, so that
+  the memo can be saved and loaded.
+  """
+
+  def __init__(self):
+    self.entries = {}
+
+  def Lookup(self, key):
+    """Return the value recorded for key if none of its stamps changed."""
+    try:
+      (value, stamps) = self.entries[key]
+    except KeyError:
+      return None
+    for (path, stamp) in stamps:
+      if basics.Stamp(path) != stamp:
+        Debug(DEBUG_TRACE, "ClosureMemo: '%s' changed", path)
+        del self.entries[key]
+        return None
+    return value
+
+  def Clear(self):
+    """Forget all entries."""
+    self.entries = {}
+
+  def Insert(self, key, value, stamped_paths):
+    """Record value for key, with the current stamps of stamped_paths."""
+    self.entries[key] = (value,
+                         [(path, basics.Stamp(path))
+                          for path in stamped_paths])
+
+  def Load(self, filepath):
+    """Add the entries saved in filepath, if it exists and is readable."""
+    try:
+      f = open(filepath, "rb")
+      try:
+        (memo_format, entries) = marshal.load(f)
+      finally:
+        f.close()
+    except (IOError, OSError, EOFError, ValueError, TypeError), why:
+      if os.path.exists(filepath):
+        Debug(DEBUG_WARNING, "Could not load closure memo '%s': %s",
+              filepath, why)
+      return
+    if memo_format != MEMO_FORMAT or not isinstance(entries, dict):
+      Debug(DEBUG_WARNING, "Ignoring closure memo '%s' of unknown format.",
+            filepath)
+      return
+    self.entries.update(entries)
+
+  def Save(self, filepath):
+    """Write the entries to filepath, replacing it atomically."""
+    tmp_filepath = None
+    try:
+      (fd, tmp_filepath) = tempfile.mkstemp(
+          dir=os.path.dirname(os.path.abspath(filepath)),
+          prefix=os.path.basename(filepath) + ".")
+      f = os.fdopen(fd, "wb")
+      try:
+        marshal.dump((MEMO_FORMAT, self.entries), f)
+      finally:
+        f.close()
+      os.rename(tmp_filepath, filepath)
+    except (IOError, OSError, ValueError), why:
+      Debug(DEBUG_WARNING, "Could not save closure memo '%s': %s",
+            filepath, why)
+      if tmp_filepath and os.path.exists(tmp_filepath):
+        os.unlink(tmp_filepath)
@@ -0,0 +1,88 @@
+#! /usr/bin/python2.4
+
+# Copyright 2007 Google Inc.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""Tests for closure_memo."""
+
+__author__ = "opensource@google.com"
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import basics
+import closure_memo
+
+class ClosureMemoTest(unittest.TestCase):
+
+  def setUp(self):
+    basics.opt_debug_pattern = 1
+    self.tmp = tempfile.mkdtemp()
+    self.file = os.path.join(self.tmp, "a.h")
+    open(self.file, "w").write("int a;\n")
+    os.utime(self.file, (1000, 1000))
+
+  def tearDown(self):
+    shutil.rmtree(self.tmp)
+
+  def test_LookupInsert(self):
+    memo = closure_memo.ClosureMemo()
+    key = ("/dir", "a.c", ("",), ())
+    missing = os.path.join(self.tmp, "missing")
+    self.assertEqual(memo.Lookup(key), None)
+    memo.Insert(key, ([("/dir/a.h", [])], ["/dir/a.h"]), [self.file, missing])
+    self.assertEqual(memo.Lookup(key), ([("/dir/a.h", [])], ["/dir/a.h"]))
+
+    # A change of a stamped file invalidates the entry.
+    os.utime(self.file, (2000, 2000))
+    self.assertEqual(memo.Lookup(key), None)
+    self.assertEqual(memo.Lookup(key), None)
+
+    # So does the appearance of a stamped path that did not exist.
+    memo.Insert(key, "value", [self.file, missing])
+    self.assertEqual(memo.Lookup(key), "value")
+    os.mkdir(missing)
+    self.assertEqual(memo.Lookup(key), None)
+
+    memo.Insert(key, "value", [self.file])
+    memo.Clear()
+    self.assertEqual(memo.Lookup(key), None)
+
+  def test_SaveLoad(self):
+    memo_file = os.path.join(self.tmp, "memo")
+    memo = closure_memo.ClosureMemo()
+    key = ("/dir", "a.c", ("",), ())
+    memo.Insert(key, ([("/dir/a.h", [("/inc", "a.h")])], ["/dir/a.h"]),
+                [self.file])
+    memo.Save(memo_file)
+
+    other_memo = closure_memo.ClosureMemo()
+    other_memo.Load(memo_file)
+    self.assertEqual(other_memo.Lookup(key),
+                     ([("/dir/a.h", [("/inc", "a.h")])], ["/dir/a.h"]))
+
+    # Nonexistent and corrupt files are ignored.
+    other_memo = closure_memo.ClosureMemo()
+    other_memo.Load(os.path.join(self.tmp, "nonexistent"))
+    open(memo_file, "w").write("garbage")
+    basics.opt_debug_pattern = 0
+    other_memo.Load(memo_file)
+    self.assertEqual(other_memo.entries, {})
+
+unittest.main()
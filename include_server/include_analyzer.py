@@ -29,6 +29,7 @@ import os
 import glob
 
 import basics
+import closure_memo
 import macro_eval
 import parse_file
 import parse_command
@@ -41,6 +42,13 @@ Debug = basics.Debug
 DEBUG_TRACE = basics.DEBUG_TRACE
 NotCoveredError = basics.NotCoveredError
 
+def _DirectoryName(directory):
+  """Undo the '/' appended to directories by DirectoryMapToIndex.Index."""
+  if directory in ("", "/"):
+    return directory
+  return directory[:-1]
+
+
 class IncludeAnalyzer(object):
   """The skeleton, including caches, of an include analyzer."""
 
@@ -62,6 +70,9 @@ class IncludeAnalyzer(object):
     self.dirname_cache = caches.dirname_cache
     self.compiler_defaults = caches.compiler_defaults
     self.systemdir_prefix_cache = caches.systemdir_prefix_cache
+    # Make cache for parsed command lines; its results are indices of the maps
+    # above.
+    self.parsed_command_cache = parse_command.ParsedCommandCache()
 
     self.simple_build_stat = caches.simple_build_stat
     self.build_stat_cache = caches.build_stat_cache
@@ -103,6 +114,10 @@ class IncludeAnalyzer(object):
     self.translation_unit = "unknown translation unit"
     self.timer = None
     self.include_server_cwd = os.getcwd()
+    # The closure memo is keyed by strings, not indices, so that it can be
+    # saved and loaded.
+    self.closure_memo = closure_memo.ClosureMemo()
+    self.closure_pairs = []
     self._InitializeAllCaches()
 
   def _ProcessFileFromCommandLine(self, fpath, currdir, kind, search_list):
@@ -168,6 +183,7 @@ class IncludeAnalyzer(object):
 
     statistics.translation_unit = translation_unit
     self.translation_unit = translation_unit
+    macro_eval.ResetWorkBudget()
 
     self.currdir_idx = self.directory_map.Index(currdir)
 
@@ -178,6 +194,15 @@ class IncludeAnalyzer(object):
     statistics.quote_path_total += len(self.quote_dirs)
     statistics.angle_path_total += len(self.angle_dirs)
 
+    memo_key = self._ClosureMemoKey(currdir)
+    memo_value = self.closure_memo.Lookup(memo_key)
+    if memo_value:
+      statistics.closure_memo_hit_counter += 1
+      return self._ClosureFromMemo(memo_value)
+
+    # Filled in by RunAlgorithm: the resolved filepath pairs of all files in
+    # the closure.
+    self.closure_pairs = []
     total_closure = {}
     for include_file in self.include_files:
       total_closure.update(
@@ -190,8 +215,77 @@ class IncludeAnalyzer(object):
                                                           currdir,
                                                           "translation unit",
                                                           ()))
+    self._InsertClosureInMemo(memo_key, currdir, total_closure)
     return total_closure
 
+  def _ClosureMemoKey(self, currdir):
+    """Describe the current compilation command in strings."""
+    dir_string = self.directory_map.string
+    includepath_string = self.includepath_map.string
+    return (currdir,
+            self.translation_unit,
+            tuple([dir_string[d] for d in self.quote_dirs]),
+            tuple([dir_string[d] for d in self.angle_dirs]),
+            tuple([includepath_string[f] for f in self.include_files]),
+            tuple([tuple(d_opt) for d_opt in self.d_opts]))
+
+  def _InsertClosureInMemo(self, memo_key, currdir, include_closure):
+    """Record include_closure in the closure memo.
+
+    Besides the closure itself, record the paths that must be mirrored under
+    the client root when the closure is reused. The paths whose stamps decide
+    whether the closure may be reused are the files of the closure and the
+    directories where a new file could shadow one of them: the non-system
+    search directories and the directories of the files themselves, each
+    combined with the directory parts of the include paths that were
+    resolved.
+    """
+    dir_string = self.directory_map.string
+    includepath_string = self.includepath_map.string
+    realpath_string = self.realpath_map.string
+
+    closure = [(realpath_string[realpath_idx],
+                [(_DirectoryName(dir_string[searchdir_idx]),
+                  includepath_string[includepath_idx])
+                 for (searchdir_idx, includepath_idx) in pairs])
+               for (realpath_idx, pairs) in include_closure.items()]
+    mirrored = [os.path.join(currdir, includepath_string[include_file])
+                for include_file in self.include_files]
+    mirrored.append(os.path.join(currdir, self.translation_unit))
+    subdirs = set([""])
+    for (searchdir_idx, includepath_idx) in self.closure_pairs:
+      includepath = includepath_string[includepath_idx]
+      mirrored.append(os.path.join(currdir, dir_string[searchdir_idx],
+                                   includepath))
+      subdirs.add(os.path.dirname(includepath))
+
+    dirs = set([os.path.dirname(filepath) for filepath in mirrored])
+    dirs.update([os.path.join(currdir, d)
+                 for d in cache_basics.RetrieveDirectoriesExceptSys(
+                     self.directory_map, self.realpath_map,
+                     self.systemdir_prefix_cache, self.quote_dirs)])
+    stamped_paths = [realpath for (realpath, unused_pairs) in closure]
+    stamped_paths.extend(set([os.path.normpath(os.path.join(d, subdir))
+                              for d in dirs for subdir in subdirs]))
+    self.closure_memo.Insert(memo_key, (closure, mirrored), stamped_paths)
+
+  def _ClosureFromMemo(self, memo_value):
+    """Rebuild an include closure, as indices, from the closure memo."""
+    (closure, mirrored) = memo_value
+    client_root = self.client_root_keeper.client_root
+    for filepath in mirrored:
+      self.mirror_path.DoPath(filepath, self.currdir_idx, client_root)
+    directory_map_index = self.directory_map.Index
+    includepath_map_index = self.includepath_map.Index
+    include_closure = {}
+    for (realpath, pairs) in closure:
+      include_closure[self.realpath_map.Index(realpath)] = [
+          (directory_map_index(searchdir),
+           includepath_map_index(includepath,
+                                 ignore_absolute_path_warning=True))
+          for (searchdir, includepath) in pairs]
+    return include_closure
+
   def DoStatResetTriggers(self):
     """Reset stat caches if a glob evaluates differently from earlier.
     
@@ -252,7 +346,8 @@ class IncludeAnalyzer(object):
                                        self.includepath_map,
                                        self.directory_map,
                                        self.compiler_defaults,
-                                       self.timer))
+                                       self.timer,
+                                       self.parsed_command_cache))
     (unused_quote_dirs, unused_angle_dirs, unused_include_files, source_file,
      result_file_prefix, unused_Dopts) = parsed_command
 
@@ -408,3 +503,5 @@ class IncludeAnalyzer(object):
     # around to reading a previous generation client root directory.
     self.client_root_keeper.ClientRootMakedir(self.generation)
     self._InitializeAllCaches()
+    # A reset trigger tells of changes that stamps may not reveal.
+    self.closure_memo.Clear()
@@ -608,6 +608,7 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
     visited = set([])
     starts_with_systemdir = self.systemdir_prefix_cache.cache
     dir_map_string = self.directory_map.string
+    closure_pairs = self.closure_pairs
     if not node: return
     stack = ([node])          # TODO(csilvers): consider using a deque
     if __debug__: statistics.len_calculated_closure_nonsys = 0
@@ -628,6 +629,7 @@ class IncludeAnalyzerMemoizingNode(include_analyzer.IncludeAnalyzer):
         # We ignore "system" includes like /usr/include/stdio.h.
         # These files are not likely to change, so it's safe to skip them.
         if not starts_with_systemdir[node[0]]:
+          closure_pairs.append(node[1])
           # Add the resolved filepath to those found for realpath.
           if node[0] not in include_closure:
             include_closure[node[0]] = []
@@ -361,6 +361,37 @@ class IncludeAnalyzerTest(unittest.TestCase):
       cache_basics._OsPathIsFile = real_cache_basic_OsPathIsFile
 
 
+  def test_ClosureMemo(self):
+    """Check that a closure is taken from the closure memo the second time
+    around, but not after the stat caches have been cleared."""
+
+    tmp = tempfile.mkdtemp()
+    cwd = os.getcwd()
+    try:
+      open(tmp + "/a.c", "w").write('#include "a.h"\n')
+      open(tmp + "/a.h", "w").write('int a;\n')
+      os.chdir(tmp)
+      tmp = os.getcwd()
+
+      def Closure():
+        return self.RetrieveCanonicalPaths(
+          self.ProcessCompilationCommandLine("gcc -c a.c", tmp))
+
+      hits = statistics.closure_memo_hit_counter
+      expected = set([self.canonical_path.Canonicalize(tmp + "/" + f)
+                      for f in ["a.c", "a.h"]])
+      self.assertEqual(Closure(), expected)
+      self.assertEqual(statistics.closure_memo_hit_counter, hits)
+      self.assertEqual(Closure(), expected)
+      self.assertEqual(statistics.closure_memo_hit_counter, hits + 1)
+
+      self.include_analyzer.ClearStatCaches()
+      self.assertEqual(Closure(), expected)
+      self.assertEqual(statistics.closure_memo_hit_counter, hits + 1)
+    finally:
+      os.chdir(cwd)
+      shutil.rmtree(tmp)
+
   def test_DotdotInInclude(self):
     """Set up tricky situation involving an "#include "../foo" occurring in a
     file accessed through a symbolic link.  This include is to be resolved
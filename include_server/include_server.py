@@ -30,8 +30,10 @@ import getopt
 import glob
 import os
 import re
+import select
 import shutil
 import signal
+import socket
 import SocketServer
 import sys
 import tempfile
@@ -73,6 +75,12 @@ server has been spawned.
 
 OPTIONS:
 
+ --closure_memo=FILE         Keep the memo of include closures in FILE, so
+                             that it survives the include server. A
+                             translation unit whose include closure is found
+                             in the memo, with the files it was computed from
+                             unchanged, is answered without include analysis.
+
  -dPAT, --debug_pattern=PAT  Bit vector for turning on warnings and debugging
                                1 = warnings
                                2 = trace some functions
@@ -341,6 +349,24 @@ def DistccIncludeHandlerGenerator(include_analyzer):
     """Define a handle() method that invokes the include closure algorithm ."""
 
     def handle(self):
+      """Serve the requests that a client sends on one connection.
+
+      A client may pipeline requests, that is, send several of them before
+      reading the replies, which are sent in order. Since the include server
+      serves one connection at a time, we only go on to the next request if
+      it has already arrived; otherwise, the connection is closed and other
+      clients get their turn.
+      """
+      while True:
+        self._HandleRequest()
+        (readable, unused_writable, unused_error) = select.select(
+            [self.rfile.fileno()], [], [], 0)
+        if not readable:
+          break
+        if not self.connection.recv(1, socket.MSG_PEEK):
+          break  # the client closed the connection
+
+    def _HandleRequest(self):
       """Using distcc protocol, read command and return include closure.
 
       Do the following:
@@ -477,6 +503,7 @@ def _ParseCommandLineOptions():
 			       "d:estvwx",
 			       ["port=",
                                 "pid_file=",
+                                "closure_memo=",
                                 "debug_pattern=",
                                 "email",
                                 "no-email",
@@ -505,6 +532,8 @@ def _ParseCommandLineOptions():
         include_server_port = arg
       if opt in ("--pid_file",):
         pid_file = arg
+      if opt in ("--closure_memo",):
+        basics.opt_closure_memo = os.path.abspath(arg)
       if opt in ("-e", "--email"):
         basics.opt_send_email = True
       if opt in ("--no-email",):
@@ -615,6 +644,8 @@ def _SetUp(include_server_port):
            client_root_keeper,
            basics.opt_stat_reset_triggers))
   include_analyzer.email_sender = _EmailSender()
+  if basics.opt_closure_memo:
+    include_analyzer.closure_memo.Load(basics.opt_closure_memo)
   
   # Wrap it inside a handler that is a part of a UnixStreamServer.
   server = QueuingSocketServer(
@@ -628,6 +659,8 @@ def _SetUp(include_server_port):
 
 def _CleanOut(include_analyzer, include_server_port):
   """Prepare shutdown by cleaning out files and unlinking port."""
+  if include_analyzer and basics.opt_closure_memo:
+    include_analyzer.closure_memo.Save(basics.opt_closure_memo)
   if include_analyzer and include_analyzer.client_root_keeper:
     include_analyzer.client_root_keeper.CleanOutClientRoots()
   try:
@@ -26,6 +26,7 @@ ultimately the notion of an AssertionError.
 __author__ = "Nils Klarlund"
 
 import os
+import socket
 import sys
 import traceback
 import unittest
@@ -178,6 +179,30 @@ class IncludeServerTest(unittest.TestCase):
     except NotCoveredError:
       pass
 
+    # Exercise 4: serve several requests pipelined on one connection. Each
+    # mock request is a single byte, read by RCwd.
+
+    (server_end, client_end) = socket.socketpair()
+    include_handler.connection = server_end
+    include_handler.rfile.fileno = server_end.fileno
+    include_handler.wfile.fileno = server_end.fileno
+    distcc_pump_c_extensions.RArgv = lambda self: [ "gcc", "parse.c" ]
+    distcc_pump_c_extensions.RCwd = (
+      lambda fd: os.read(fd, 1) and os.getcwd())
+    replies = []
+    distcc_pump_c_extensions.XArgv = lambda _, argv: replies.append(argv)
+
+    class Mock_QuietEmailSender(object):
+      def MaybeSendEmail(self, fd, force=False, never=False):
+        fd.close()
+
+    include_analyzer.email_sender = Mock_QuietEmailSender()
+    client_end.sendall("abc")
+    client_end.close()
+    include_handler.handle()
+    self.assertEqual(replies, [[], [], []])
+    server_end.close()
+
     distcc_pump_c_extensions.RWcd = old_RWcd
     distcc_pump_c_extensions.RArgv = old_RArgv
     distcc_pump_c_extensions.XArgv = old_XArgv
@@ -86,6 +86,14 @@ There are probably several more deviations from CPP semantics.
 
 These deviations should not matter for most common included computes.
 
+Native Evaluation
+-----------------
+If the distcc_pump_c_extensions module is available, EvalExpression uses its
+EvalExpression function, which implements exactly the semantics of
+_EvalExprHelper below but memoizes intermediate expansions and stops after
+basics.MACRO_EVAL_WORK_BUDGET units of work per translation unit. The Python
+implementation is kept as the reference and as a fallback.
+
 What If the Include Processor is Wrong
 --------------------------------------
 Assume that we have
@@ -139,6 +147,21 @@ DEBUG_TRACE1 = basics.DEBUG_TRACE1
 DEBUG_TRACE2 = basics.DEBUG_TRACE2
 NotCoveredError = basics.NotCoveredError
 
+try:
+  import distcc_pump_c_extensions
+  _EvalExpressionNative = distcc_pump_c_extensions.EvalExpression
+except (ImportError, AttributeError):
+  _EvalExpressionNative = None
+
+# Work left for the native evaluator in the current translation unit.
+_work_budget_left = basics.MACRO_EVAL_WORK_BUDGET
+
+
+def ResetWorkBudget():
+  """Give the native evaluator a fresh budget for a new translation unit."""
+  global _work_budget_left
+  _work_budget_left = basics.MACRO_EVAL_WORK_BUDGET
+
 # REGULAR EXPRESSIONS
 
 SINGLE_POUND_RE = re.compile(r"\B#\s*(\S*)") # \B = here: not at end of word
@@ -372,10 +395,22 @@ def EvalExpression(expr, symbol_table):
                      symbol:{((param_1,...,param_n), rhs), ... }
   Returns:
     [ expr_1, expr_2, ...], a list of strings: the possible expansions of expr.
+  Raises:
+    NotCoveredError, if the native evaluator runs out of work budget
   """
+  global _work_budget_left
   if __debug__:
     Debug(DEBUG_TRACE, "EvalExpression: expr: %s", expr)
-  r = set(_EvalExprHelper(expr, symbol_table, set([])))
+  if _EvalExpressionNative:
+    (r, work) = _EvalExpressionNative(expr, symbol_table,
+                                      max(_work_budget_left, 0))
+    _work_budget_left -= work
+    if r is None:
+      raise NotCoveredError(
+        "Computed include '%s' is too costly to analyze." % expr,
+        send_email=False)
+  else:
+    r = set(_EvalExprHelper(expr, symbol_table, set([])))
   if __debug__:
     Debug(DEBUG_TRACE, "EvalExpression: return: %s", r)
   return r
@@ -233,5 +233,42 @@ class MacroEvalTest(unittest.TestCase):
                           'AS_STRING', 'AS_STRING_INTERNAL',
                           'tpl', 'varnames', 'h', 'foo']))
 
+
+  def test_NativeAgreesWithPython(self):
+    if not macro_eval._EvalExpressionNative:
+      return
+    symbol_table = {
+      'A': ['B', 'x', 'A y'],
+      'B': ['A', '"b.h"'],
+      'EMPTY': [''],
+      'max': [(['x', ' y'], "(x < y? y: x)")],
+      'cat': [(['a', 'b'], 'a##b'), (['a'], '#a')],
+      'str': [(['s'], '# s ## .h')],
+      'call': [(['f', 'x'], 'f(x)')],
+      'zero': [([''], 'nil')],
+      }
+    for expr in ['A', 'A.B', 'A##A', 'max(A, B)', 'max(max(1,2), 3)',
+                 'cat(A, B)', 'cat("a,b", (c,d))', 'str(A)', 'str(  x y )',
+                 'call(max, (1, 2))', 'call(cat, A)', 'zero()', 'zero(q)',
+                 '+EMPTY-EMPTY+', '#A', 'x#A', 'max(unbalanced', '']:
+      self.assertEqual(
+        macro_eval._EvalExpressionNative(expr, symbol_table, 100000)[0],
+        macro_eval._EvalExprHelper(expr, symbol_table, set([])))
+
+  def test_WorkBudget(self):
+    if not macro_eval._EvalExpressionNative:
+      return
+    # Each level of this doubles the number of possible expansions.
+    symbol_table = { 'X0': ['a', 'b'] }
+    for i in range(1, 30):
+      symbol_table['X%d' % i] = ['X%d X%d' % (i - 1, i - 1)]
+    macro_eval.ResetWorkBudget()
+    self.assertRaises(NotCoveredError,
+                      macro_eval.EvalExpression, 'X29', symbol_table)
+    macro_eval.ResetWorkBudget()
+    self.assertEqual(len(macro_eval.EvalExpression('X2', symbol_table)),
+                     len(macro_eval._EvalExprHelper('X2', symbol_table,
+                                                    set([]))))
+
                      
 unittest.main()
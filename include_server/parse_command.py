@@ -57,6 +57,11 @@ class ParseState:
     self.iprefix = ""
     self.Dopts = []
 
+    # Where in argv the translation unit and the output file were found, for
+    # ParsedCommandCache.
+    self.file_name_pos = None
+    self.output_file_pos = None
+
   def set_nostdinc(self): self.nostdinc = True
   def set_language(self, x): self.language = x
   def set_isysroot(self, x): self.isysroot = x
@@ -310,8 +315,101 @@ TRANSLATION_UNIT_FILEPATH_RE = (
                        for ext in basics.TRANSLATION_UNIT_MAP.keys()])))
 
 
+class ParsedCommandCache(object):
+  """Remember the search paths computed from command lines.
+
+  The compilations of a build typically differ only in the names of the
+  translation unit and of the output file. So, after a command line has been
+  parsed, the result is recorded under a key consisting of the current
+  directory and the command line with these two arguments blanked out. Another
+  command line that agrees in everything else, and in the language of its
+  translation unit, gets the same quote directories, angle directories,
+  -include files and -D options without being parsed.
+
+  The results hold indices of a particular includepath map and directory map;
+  the cache must be discarded along with them.
+  """
+
+  def __init__(self):
+    # Map (current_dir, len(args)) to the list of "shapes" seen: tuples
+    # (file_name_pos, output_file_pos, language) as recorded in ParseState,
+    # where language is None if it was derived from the translation unit.
+    self.shapes = {}
+    # Map (current_dir, masked args, language) to (quote_dirs, angle_dirs,
+    # include_files, Dopts).
+    self.results = {}
+
+  def Lookup(self, args, current_dir):
+    """Return (source_file, output_file, result) or None."""
+    for (file_name_pos, output_file_pos, language) in self.shapes.get(
+        (current_dir, len(args)), ()):
+      source_file = args[file_name_pos]
+      if (not source_file or source_file[0] == '-'
+          or source_file.startswith('"-')):
+        continue
+      output_file = None
+      if output_file_pos:
+        (pos, prefix) = output_file_pos
+        if not args[pos].startswith(prefix) or args[pos] == prefix:
+          continue
+        output_file = args[pos][len(prefix):]
+      if not language:
+        language = _LanguageOfTranslationUnit(source_file)
+      result = self.results.get(
+          (current_dir,
+           _MaskArgs(args, file_name_pos, output_file_pos),
+           language))
+      if result:
+        return (source_file, output_file, result)
+    return None
+
+  def Insert(self, args, current_dir, parse_state, explicit_language, result):
+    """Record result of parsing args; explicit_language is from -x or None."""
+    shape = (parse_state.file_name_pos, parse_state.output_file_pos,
+             explicit_language)
+    shapes = self.shapes.setdefault((current_dir, len(args)), [])
+    if shape not in shapes:
+      shapes.append(shape)
+    self.results[(current_dir,
+                  _MaskArgs(args, parse_state.file_name_pos,
+                            parse_state.output_file_pos),
+                  parse_state.language)] = result
+
+
+def _MaskArgs(args, file_name_pos, output_file_pos):
+  """Return args as a tuple, with None at the given positions."""
+  masked = list(args)
+  masked[file_name_pos] = None
+  if output_file_pos:
+    masked[output_file_pos[0]] = None
+  return tuple(masked)
+
+
+def _LanguageOfTranslationUnit(source_file):
+  """Return the language given by the filename extension of source_file."""
+  language_match = TRANSLATION_UNIT_FILEPATH_RE.match(source_file)
+  if not language_match:
+    raise NotCoveredError(
+        "For source file '%s': unrecognized filename extension" % source_file)
+  return basics.TRANSLATION_UNIT_MAP[language_match.group('suffix')]
+
+
+def _SourceFilePrefix(source_file, output_file, current_dir):
+  """Return the absolute path, less suffix, that results are named after."""
+  if output_file:
+    # Use output_file to create prefix
+    source_file_prefix = re.sub("[.]o$", "", output_file)
+  else:
+    # Remove suffix from source file
+    source_file_prefix = re.sub("[.](%s)$" %
+                                  "|".join(basics.TRANSLATION_UNIT_MAP.keys()),
+                                  "",
+                                  source_file)
+  return os.path.join(current_dir, source_file_prefix)
+
+
 def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
-                     compiler_defaults, timer=None):
+                     compiler_defaults, timer=None, cache=None):
   """Parse arguments like -I to make include directory lists.
 
   Arguments:
@@ -321,6 +419,7 @@ def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
     dir_map: a DirectoryMapToIndex object
     compiler_defaults: a CompilerDefaults object
     timer: a basics.IncludeAnalyzerTimer object
+    cache: a ParsedCommandCache object, or None
   Returns:
     (quote_dirs, angle_dirs, files, source_file, source_file_prefix, dopts)
     where:
@@ -337,6 +436,14 @@ def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
   assert isinstance(dir_map, cache_basics.DirectoryMapToIndex)
   assert isinstance(includepath_map, cache_basics.MapToIndex)
 
+  if cache:
+    cached = cache.Lookup(args, current_dir)
+    if cached:
+      (source_file, output_file,
+       (quote_dirs, angle_dirs, include_files, Dopts)) = cached
+      return (quote_dirs, angle_dirs, include_files, source_file,
+              _SourceFilePrefix(source_file, output_file, current_dir), Dopts)
+
   parse_state = ParseState()
 
   if len(args) < 2:
@@ -352,6 +459,7 @@ def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
         pass     # TODO(csilvers): parse arg inside quotes?
       else:
         parse_state.file_names.append(args[i])  # if not a flag, it's a file
+        parse_state.file_name_pos = i
       i += 1
       continue
 
@@ -363,10 +471,14 @@ def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
       arg = args[i][2:]
       if arg:                        # the glommed-onto-end case
         action(parse_state, arg)
+        if args[i][1] == 'o':
+          parse_state.output_file_pos = (i, '-o')
         i += 1
       else:                          # the separate-word case
         try:
           action(parse_state, args[i+1])
+          if args[i][1] == 'o':
+            parse_state.output_file_pos = (i + 1, '')
           i += 2
         except IndexError:
           raise NotCoveredError("No argument found for option '%s'" % args[i])
@@ -430,23 +542,13 @@ def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
 
   source_file = parse_state.file_names[0]
   
-  if parse_state.output_file:
-    # Use output_file to create prefix
-    source_file_prefix = re.sub("[.]o$", "", parse_state.output_file)
-  else:
-    # Remove suffix from source file
-    source_file_prefix = re.sub("[.](%s)$" %
-                                  "|".join(basics.TRANSLATION_UNIT_MAP.keys()),
-                                  "",
-                                  source_file)
-  source_file_prefix = os.path.join(current_dir, source_file_prefix)
+  source_file_prefix = _SourceFilePrefix(source_file, parse_state.output_file,
+                                         current_dir)
   if parse_state.language == 'none':    # no explicit -x flag, or -x none
-    language_match = TRANSLATION_UNIT_FILEPATH_RE.match(source_file)
-    if not language_match:
-      raise NotCoveredError(
-          "For source file '%s': unrecognized filename extension" % source_file)
-    suffix = language_match.group('suffix')
-    parse_state.language = basics.TRANSLATION_UNIT_MAP[suffix]
+    explicit_language = None
+    parse_state.language = _LanguageOfTranslationUnit(source_file)
+  else:
+    explicit_language = parse_state.language
   assert parse_state.language in basics.LANGUAGES
 
   sysroot = parse_state.include_sysroot()
@@ -488,5 +590,8 @@ def ParseCommandArgs(args, current_dir, includepath_map, dir_map,
                                     (quote_dirs, angle_dirs, include_files,
                                      source_file, source_file_prefix,
                                      parse_state.Dopts)))
+  if cache:
+    cache.Insert(args, current_dir, parse_state, explicit_language,
+                 (quote_dirs, angle_dirs, include_files, parse_state.Dopts))
   return (quote_dirs, angle_dirs, include_files, source_file, source_file_prefix, 
           parse_state.Dopts)
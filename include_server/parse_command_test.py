@@ -188,4 +188,55 @@ class ParseCommandUnitTest(unittest.TestCase):
         'third_party/zlib'),
        'third_party/libxml/threads.c'))
 
+  def test_ParsedCommandCache(self):
+
+    calls = []
+    SetSystemDirsDefaults = self.compiler_defaults.SetSystemDirsDefaults
+    def Counting_SetSystemDirsDefaults(compiler, sysroot, language, timer=None):
+      calls.append(language)
+      SetSystemDirsDefaults(compiler, sysroot, language, timer)
+    self.compiler_defaults.SetSystemDirsDefaults = (
+      Counting_SetSystemDirsDefaults)
+
+    cache = parse_command.ParsedCommandCache()
+
+    def Parse(command):
+      result = parse_command.ParseCommandArgs(
+        parse_command.ParseCommandLine(
+          self.mock_compiler + " --sysroot=" + self.mock_sysroot
+          + " " + command),
+        "/current", self.includepath_map, self.directory_map,
+        self.compiler_defaults, cache=cache)
+      quote_dirs, angle_dirs, include_files, filepath, prefix, d_opts = result
+      return (self._RetrieveDirectoriesExceptSys(quote_dirs),
+              self._RetrieveDirectoriesExceptSys(angle_dirs),
+              [self.includepath_map.String(i) for i in include_files],
+              filepath, prefix, d_opts)
+
+    self.assertEqual(Parse("-Imice -include a.h -DX=1 -c a.c -o a.o"),
+                     (('mice',), ('mice',), ['a.h'], 'a.c', '/current/a',
+                      [['X', '1']]))
+    self.assertEqual(len(calls), 1)
+    # Only the translation unit and the output file differ: no parsing.
+    self.assertEqual(Parse("-Imice -include a.h -DX=1 -c b.c -o dir/b.o"),
+                     (('mice',), ('mice',), ['a.h'], 'b.c', '/current/dir/b',
+                      [['X', '1']]))
+    self.assertEqual(Parse("-Imice -include a.h -DX=1 -c c.c -oc.o"),
+                     (('mice',), ('mice',), ['a.h'], 'c.c', '/current/c',
+                      [['X', '1']]))
+    self.assertEqual(len(calls), 2)
+    self.assertEqual(Parse("-Imice -include a.h -DX=1 -c d.c -od.o"),
+                     (('mice',), ('mice',), ['a.h'], 'd.c', '/current/d',
+                      [['X', '1']]))
+    self.assertEqual(len(calls), 2)
+    # A different language, or a different option, means a new parse.
+    self.assertEqual(Parse("-Imice -include a.h -DX=1 -c e.cc -o e.o")[3],
+                     'e.cc')
+    self.assertEqual(calls, ['c', 'c', 'c++'])
+    self.assertEqual(Parse("-Imen -include a.h -DX=1 -c f.c -o f.o")[:2],
+                     (('men',), ('men',)))
+    self.assertEqual(len(calls), 4)
+    self.assertRaises(NotCoveredError, Parse,
+                      "-Imice -include a.h -DX=1 -c - -o g.o")
+
 unittest.main()
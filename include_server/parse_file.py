@@ -24,6 +24,12 @@ We parse only the following directives:
   #include_next  (a GNU C/C++ extension)
   #import        (an Objective-C feature, similar to #include)
   #define        (because #defines can affect the results of '#include MACRO')
+
+If the distcc_pump_c_extensions module is available, the lines holding
+directives are located by its FindDirectives function, which memory-maps the
+file and looks only at lines containing a '#'. Otherwise, a coarse regular
+expression search for the directive names is used. Either way, candidate lines
+are then parsed by the regular expressions below.
 """
 
 __author__ = 'Nils Klarlund'
@@ -40,6 +46,12 @@ DEBUG_TRACE = basics.DEBUG_TRACE
 DEBUG_TRACE2 = basics.DEBUG_TRACE2
 NotCoveredError = basics.NotCoveredError
 
+try:
+  import distcc_pump_c_extensions
+  _FindDirectivesNative = distcc_pump_c_extensions.FindDirectives
+except (ImportError, AttributeError):
+  _FindDirectivesNative = None
+
 # For coarse and fast scanning
 RE_INCLUDE_DEFINE = re.compile("include|define|import")
 
@@ -197,20 +209,21 @@ class ParseFile(object):
 
     self.define_callback = callback_function
     
-  def _ParseFine(self, poundsign_match, includepath_map_index, file_contents,
+  def _ParseFine(self, directive, includepath_map_index,
                  symbol_table, quote_includes, angle_includes, expr_includes,
                  next_includes):
-    """Helper function for ParseFile."""
-    Debug(DEBUG_TRACE2, "_ParseFine %s",
-      file_contents[poundsign_match.start('directive'):
-                    poundsign_match.end('directive')])
+    """Helper function for ParseFile.
+
+    Arguments:
+      directive: the text matched by group('directive') of POUND_SIGN_RE
+    """
+    Debug(DEBUG_TRACE2, "_ParseFine %s", directive)
     m = DIRECTIVE_RE.match(  # parse the directive
           PAIRED_COMMENT_RE.sub( # remove possible paired comments
             "",
             BACKSLASH_RE.sub(   # get rid of lines ending in backslash
               "",
-              file_contents[poundsign_match.start('directive'):
-                            poundsign_match.end('directive')])))
+              directive)))
     if m:
       try:
         groupdict = m.groupdict()
@@ -256,42 +269,23 @@ class ParseFile(object):
         else:
           raise
 
-  def Parse(self, filepath, symbol_table):
-    """Parse filepath for preprocessor directives and update symbol table.
+  def _FindDirectives(self, filepath):
+    """Find the directives of interest in filepath using regular expressions.
+
+    This is the fallback for distcc_pump_c_extensions.FindDirectives.
 
     Arguments:
       filepath: a string
-      symbol_table: a dictionary, see module macro_expr
-
     Returns:
-      (quote_includes, angle_includes, expr_includes, next_includes), where
-      all are lists of filepath indices, except for expr_includes, which is a
-      list of expressions.
+      a list of strings, each matched by group('directive') of POUND_SIGN_RE
+    Raises:
+      IOError
     """
-    Debug(DEBUG_TRACE, "ParseFile %s", filepath)
-
-    assert isinstance(filepath, str)
-    self.filepath = filepath
-    parse_file_start_time = time.clock()
-    statistics.parse_file_counter += 1
-
-    includepath_map_index = self.includepath_map.Index
-
-    try:
-      fd = open(filepath, "r")
-    except IOError, msg:
-      # This normally does not happen because the file should be known to
-      # exists. Still there might be, say, a permissions issue that prevents it
-      # from being read.
-      raise NotCoveredError("Parse file: '%s': %s" % (filepath, msg),
-                            send_email=False)
-
+    fd = open(filepath, "r")
     file_contents = fd.read()
     fd.close()
 
-    quote_includes, angle_includes, expr_includes, next_includes = (
-      [], [], [], [])
-
+    directives = []
     i = 0
     line_start_last = None
 
@@ -333,11 +327,57 @@ class ParseFile(object):
       if not poundsign_match:
 	continue
 
-      self._ParseFine(poundsign_match, includepath_map_index, file_contents,
+      directives.append(poundsign_match.group('directive'))
+
+    return directives
+
+  def Parse(self, filepath, symbol_table):
+    """Parse filepath for preprocessor directives and update symbol table.
+
+    Arguments:
+      filepath: a string
+      symbol_table: a dictionary, see module macro_expr
+
+    Returns:
+      (quote_includes, angle_includes, expr_includes, next_includes), where
+      all are lists of filepath indices, except for expr_includes, which is a
+      list of expressions.
+    """
+    Debug(DEBUG_TRACE, "ParseFile %s", filepath)
+
+    assert isinstance(filepath, str)
+    self.filepath = filepath
+    parse_file_start_time = time.clock()
+    statistics.parse_file_counter += 1
+
+    includepath_map_index = self.includepath_map.Index
+
+    quote_includes, angle_includes, expr_includes, next_includes = (
+      [], [], [], [])
+
+    try:
+      if _FindDirectivesNative:
+        directives = _FindDirectivesNative(filepath)
+      else:
+        directives = self._FindDirectives(filepath)
+    except IOError, msg:
+      # This normally does not happen because the file should be known to
+      # exists. Still there might be, say, a permissions issue that prevents it
+      # from being read.
+      raise NotCoveredError("Parse file: '%s': %s" % (filepath, msg),
+                            send_email=False)
+
+    for directive in directives:
+      if isinstance(directive, tuple):
+        # A line starting with a comment; the native scanner leaves it to us.
+        poundsign_match = POUND_SIGN_RE.match(directive[0])
+        if not poundsign_match:
+          continue
+        directive = poundsign_match.group('directive')
+      self._ParseFine(directive, includepath_map_index,
                       symbol_table, quote_includes, angle_includes,
                       expr_includes, next_includes)
 
-
     statistics.parse_file_total_time += time.clock() - parse_file_start_time
 
     return (quote_includes, angle_includes, expr_includes, next_includes)
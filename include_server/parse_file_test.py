@@ -22,6 +22,8 @@
 
 __author__ = "opensource@google.com"
 
+import os
+import tempfile
 import unittest
 
 import basics
@@ -152,4 +154,52 @@ b
                 + "AS_STRING(maps/_filename_.tpl.varnames.h, "
                 + "NOTHANDLED(_filename_))")
 
+  def test_FindDirectivesNative(self):
+    if not parse_file._FindDirectivesNative:
+      return  # the C extension was not built
+
+    def Native(filepath):
+      directives = []
+      for directive in parse_file._FindDirectivesNative(filepath):
+        if isinstance(directive, tuple):
+          m = parse_file.POUND_SIGN_RE.match(directive[0])
+          if not m:
+            continue
+          directive = m.group('directive')
+        directives.append(directive)
+      return directives
+
+    parse_file_obj = parse_file.ParseFile(cache_basics.MapToIndex())
+
+    (fd, filepath) = tempfile.mkstemp(suffix='.h')
+    os.write(fd, '#include "a.h"\n'
+                 ' # define A(x) \\\n   x\n'
+                 '#  include_nextb.h\n'
+                 '#  include_next <b.h>\n'
+                 '# import <c.h>  // comment\n'
+                 'int x; # include "not.h"\n'
+                 '*/ #include "after_comment.h"\n'
+                 '/* # */ /**/ #define B /* x */ 1\n'
+                 '/* #include "in_comment.h"\n'
+                 '#ifdef define\n'
+                 '#define C \\\n#include "continued.h"\n'
+                 '#include')
+    os.close(fd)
+    try:
+      self.assertEqual(Native(filepath),
+                       parse_file_obj._FindDirectives(filepath))
+      self.assertEqual(len(Native(filepath)), 9)
+    finally:
+      os.remove(filepath)
+
+    for (dirpath, unused_dirnames, filenames) in os.walk("test_data"):
+      for filename in filenames:
+        filepath = os.path.join(dirpath, filename)
+        if os.path.isfile(filepath):
+          self.assertEqual(Native(filepath),
+                           parse_file_obj._FindDirectives(filepath))
+
+    self.assertRaises(IOError, parse_file._FindDirectivesNative,
+                      "test_data/does_not_exist.h")
+
 unittest.main()
@@ -56,6 +56,7 @@ len_surplus_nonsys = 0  # the difference between
                         # in exact closure that are not known to compiler
                         
 find_node_counter = 0 # number of times FindNode is called
+closure_memo_hit_counter = 0 # closures reused from the closure memo
 
 
 def StartTiming():
@@ -90,6 +91,7 @@ def PrintStatistics(include_analyzer):
     print "COUNTER: resolve_expr_counter:      %8d" % resolve_expr_counter
     print "COUNTER: master_hit_counter:        %8d" % master_hit_counter
     print "COUNTER: master_miss_counter:       %8d" % master_miss_counter
+    print "COUNTER: closure_memo_hit_counter:  %8d" % closure_memo_hit_counter
     print "SIZE:    master_cache               %8d" % (
       len(include_analyzer.master_cache))
     print "COUNTER: sys_stat_counter:        %10d"  % sys_stat_counter
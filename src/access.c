@@ -312,7 +312,7 @@ static int check_address_inet6(const struct in6_addr *client,
 }
 
 /**
- * Extract the lower 32-bits of a v6 address.
+ * Extract the lower 32-bits of a v6 address, in network order.
  **/
 static uint32_t inet_from_inet6(const struct in6_addr *addr)
 {
@@ -324,7 +324,7 @@ static uint32_t inet_from_inet6(const struct in6_addr *addr)
         dest |= (dest_byte << (8 * (3-i)));
     }
 
-    return dest;
+    return htonl(dest);
 }
 #endif /* ENABLE_RFC2553 */
 
@@ -373,3 +373,248 @@ int dcc_check_address(const struct sockaddr *client,
         return EXIT_ACCESS_DENIED;
     }
 }
+
+
+/*
+ * The allow list is compiled into a binary trie keyed on address bits, so
+ * that checking a client costs at most one step per bit of its address
+ * however many subnets are listed.  IPv4 and IPv6 rules go in separate
+ * tries, so that they match the same clients as dcc_check_address()
+ * would: v4 rules match v4 clients and v4-mapped or v4-compatible v6
+ * clients, and v6 rules match only v6 clients.
+ *
+ * Nodes live in one array and refer to their children by index; index 0
+ * is the v4 root and so can stand for "no child".
+ */
+
+struct dcc_allow_node {
+    unsigned child[2];
+    int allow;
+};
+
+struct dcc_allow_trie {
+    struct dcc_allow_node *nodes;
+    unsigned n_nodes, max_nodes;
+};
+
+enum { DCC_TRIE_INET = 0, DCC_TRIE_INET6 = 1 };
+
+
+/* Returns the index of a new empty node, or 0 if out of memory. */
+static unsigned dcc_allow_trie_node(struct dcc_allow_trie *trie)
+{
+    if (trie->n_nodes == trie->max_nodes) {
+        unsigned max = trie->max_nodes ? trie->max_nodes * 2 : 64;
+        struct dcc_allow_node *nodes;
+
+        if (!(nodes = realloc(trie->nodes, max * sizeof *nodes))) {
+            rs_log_error("failed to allocate %u trie nodes", max);
+            return 0;
+        }
+        trie->nodes = nodes;
+        trie->max_nodes = max;
+    }
+    memset(&trie->nodes[trie->n_nodes], 0, sizeof *trie->nodes);
+    return trie->n_nodes++;
+}
+
+
+/**
+ * Make an empty allow list, which denies everybody.
+ **/
+struct dcc_allow_trie *dcc_allow_trie_new(void)
+{
+    struct dcc_allow_trie *trie;
+
+    if (!(trie = calloc(1, sizeof *trie))) {
+        rs_log_error("failed to allocate allow list");
+        return NULL;
+    }
+    /* The two roots; the first can't fail to be index 0. */
+    dcc_allow_trie_node(trie);
+    if (dcc_allow_trie_node(trie) != DCC_TRIE_INET6) {
+        dcc_allow_trie_free(trie);
+        return NULL;
+    }
+    return trie;
+}
+
+
+void dcc_allow_trie_free(struct dcc_allow_trie *trie)
+{
+    if (!trie)
+        return;
+    free(trie->nodes);
+    free(trie);
+}
+
+
+/* Number of leading one bits in a mask of @p len bytes. */
+static int dcc_mask_prefix_len(const uint8_t *mask, int len)
+{
+    int i, bits = 0;
+
+    for (i = 0; i < len && mask[i] == allones8; i++)
+        bits += 8;
+    if (i < len) {
+        uint8_t b = mask[i];
+        while (b & 0x80) {
+            bits++;
+            b <<= 1;
+        }
+    }
+    return bits;
+}
+
+
+static int dcc_allow_trie_insert(struct dcc_allow_trie *trie,
+                                 unsigned root,
+                                 const uint8_t *key,
+                                 int bits)
+{
+    unsigned n = root;
+    int i;
+
+    /* Stop early if a shorter prefix already allows all of this one. */
+    for (i = 0; i < bits && !trie->nodes[n].allow; i++) {
+        int b = (key[i / 8] >> (7 - i % 8)) & 1;
+
+        if (!trie->nodes[n].child[b]) {
+            unsigned c;
+
+            if (!(c = dcc_allow_trie_node(trie)))
+                return EXIT_OUT_OF_MEMORY;
+            trie->nodes[n].child[b] = c;
+        }
+        n = trie->nodes[n].child[b];
+    }
+    trie->nodes[n].allow = 1;
+    return 0;
+}
+
+
+static int dcc_allow_trie_lookup(const struct dcc_allow_trie *trie,
+                                 unsigned root,
+                                 const uint8_t *key,
+                                 int bits)
+{
+    unsigned n = root;
+    int i;
+
+    for (i = 0; ; i++) {
+        if (trie->nodes[n].allow)
+            return 1;
+        if (i == bits)
+            return 0;
+        if (!(n = trie->nodes[n].child[(key[i / 8] >> (7 - i % 8)) & 1]))
+            return 0;
+    }
+}
+
+
+/**
+ * Add one rule, as parsed by dcc_parse_mask(), to the allow list.
+ **/
+int dcc_allow_trie_add(struct dcc_allow_trie *trie,
+                       const dcc_address_t *value,
+                       const dcc_address_t *mask)
+{
+#ifndef ENABLE_RFC2553
+    return dcc_allow_trie_insert(trie, DCC_TRIE_INET,
+                                 (const uint8_t *) &value->s_addr,
+                                 dcc_mask_prefix_len((const uint8_t *)
+                                                     &mask->s_addr, 4));
+#else
+    if (value->family == AF_INET)
+        return dcc_allow_trie_insert(trie, DCC_TRIE_INET,
+                                     (const uint8_t *)
+                                     &value->addr.inet.s_addr,
+                                     dcc_mask_prefix_len((const uint8_t *)
+                                                         &mask->addr.inet.s_addr,
+                                                         4));
+    else
+        return dcc_allow_trie_insert(trie, DCC_TRIE_INET6,
+                                     value->addr.inet6.s6_addr,
+                                     dcc_mask_prefix_len(mask->addr.inet6.s6_addr,
+                                                         16));
+#endif
+}
+
+
+/**
+ * Add the rules listed in @p fname to the allow list.  The file holds
+ * IP[/BITS] specifications separated by white space, one per line by
+ * convention; "#" starts a comment.
+ **/
+int dcc_allow_trie_load(struct dcc_allow_trie *trie, const char *fname)
+{
+    char *buf, *line, *next, *word;
+    int lineno = 0, n_rules = 0;
+    int ret;
+
+    if ((ret = dcc_load_file_string(fname, &buf)))
+        return ret;
+
+    for (line = buf; line; line = next) {
+        lineno++;
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        line[strcspn(line, "#")] = '\0';
+
+        for (word = strtok(line, " \t\r"); word;
+             word = strtok(NULL, " \t\r")) {
+            dcc_address_t value, mask;
+
+            if ((ret = dcc_parse_mask(word, &value, &mask))) {
+                rs_log_error("%s:%d: bad address \"%s\"", fname, lineno, word);
+                goto out;
+            }
+            if ((ret = dcc_allow_trie_add(trie, &value, &mask)))
+                goto out;
+            n_rules++;
+        }
+    }
+    rs_trace("loaded %d rules from %s", n_rules, fname);
+
+  out:
+    free(buf);
+    return ret;
+}
+
+
+/**
+ * Check a client against the allow list.
+ *
+ * @returns 0 for allowed, or EXIT_ACCESS_DENIED.
+ **/
+int dcc_allow_trie_check(const struct dcc_allow_trie *trie,
+                         const struct sockaddr *client)
+{
+    int allow;
+
+    if (client->sa_family == AF_INET) {
+        /* The double-cast here avoids warnings from -Wcast-align. */
+        const struct sockaddr_in *sockaddr = (const struct sockaddr_in *) (void *) client;
+
+        allow = dcc_allow_trie_lookup(trie, DCC_TRIE_INET,
+                                      (const uint8_t *)
+                                      &sockaddr->sin_addr.s_addr, 32);
+#ifdef ENABLE_RFC2553
+    } else if (client->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6 *) (void *) client;
+        const struct in6_addr *a6 = &sa6->sin6_addr;
+
+        allow = dcc_allow_trie_lookup(trie, DCC_TRIE_INET6, a6->s6_addr, 128);
+        if (!allow && (IN6_IS_ADDR_V4MAPPED(a6) || IN6_IS_ADDR_V4COMPAT(a6)))
+            allow = dcc_allow_trie_lookup(trie, DCC_TRIE_INET,
+                                          a6->s6_addr + 12, 32);
+#endif
+    } else {
+        rs_log_notice("access denied from unsupported address family %d",
+                      client->sa_family);
+        return EXIT_ACCESS_DENIED;
+    }
+
+    rs_trace("%s client", allow ? "match" : "deny");
+    return allow ? 0 : EXIT_ACCESS_DENIED;
+}
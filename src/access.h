@@ -48,3 +48,14 @@ struct dcc_allow_list {
     dcc_address_t addr, mask;
     struct dcc_allow_list *next;
 };
+
+struct dcc_allow_trie;
+
+struct dcc_allow_trie *dcc_allow_trie_new(void);
+void dcc_allow_trie_free(struct dcc_allow_trie *trie);
+int dcc_allow_trie_add(struct dcc_allow_trie *trie,
+                       const dcc_address_t *value,
+                       const dcc_address_t *mask);
+int dcc_allow_trie_load(struct dcc_allow_trie *trie, const char *fname);
+int dcc_allow_trie_check(const struct dcc_allow_trie *trie,
+                         const struct sockaddr *client);
@@ -36,6 +36,12 @@
  * keep writing), but we can't send from a fifo, because we wouldn't
  * know how many bytes were coming.
  *
+ * Protocol 5 sends results in chunks instead: the stream name and the
+ * uncompressed length, then any number of CHNK tokens each followed by a
+ * piece of the file, then CHNK 0.  Each compressed chunk stands alone, so
+ * the receiver can decompress and write out one piece while the next is
+ * still being compressed and sent.
+ *
  * @note We don't time transmission of files: because the write returns when
  * they've just been written into the OS buffer, we don't really get
  * meaningful numbers except for files that are very large.
@@ -60,6 +66,17 @@
 #include "time.h"
 #include "exitcode.h"
 #include "timeval.h"
+#include "snprintf.h"
+
+
+/**
+ * Largest piece of a file sent in one compressed chunk.
+ *
+ * Small enough that the first chunk goes out soon after we start, and
+ * that decompressing one takes little memory; big enough that LZO still
+ * finds most of its matches and the tokens cost nothing.
+ **/
+#define DCC_CHUNK_SIZE (256 << 10)
 
 
 /**
@@ -220,6 +237,468 @@ int dcc_x_file(int ofd,
 }
 
 
+/**
+ * Transmit a buffer to the network.  Sends TOKEN, LENGTH, BODY in the same
+ * way as dcc_x_file(), for data that is already in memory.
+ **/
+int dcc_x_buf(int ofd,
+              const char *buf,
+              size_t len,
+              const char *token,
+              enum dcc_compress compression)
+{
+    int ret;
+    char *out_buf = NULL;
+    size_t out_len;
+
+    rs_trace("send %lu byte buffer with token %s and compression %d",
+             (unsigned long) len, token, compression);
+
+    if (compression == DCC_COMPRESS_NONE) {
+        if ((ret = dcc_x_token_int(ofd, token, len)))
+            return ret;
+        return len ? dcc_writex(ofd, buf, len) : 0;
+    } else if (compression == DCC_COMPRESS_LZO1X) {
+        /* As a special case, send 0 as 0 */
+        if (len == 0)
+            return dcc_x_token_int(ofd, token, 0);
+        if ((ret = dcc_compress_lzo1x_alloc(buf, len, &out_buf, &out_len)))
+            return ret;
+        if ((ret = dcc_x_token_int(ofd, token, out_len)) == 0)
+            ret = dcc_writex(ofd, out_buf, out_len);
+        free(out_buf);
+        return ret;
+    } else {
+        rs_log_error("invalid compression");
+        return EXIT_PROTOCOL_ERROR;
+    }
+}
+
+
+/**
+ * Send one chunk of a file, compressing it if needed.  @p len must not be
+ * 0, since CHNK 0 ends the file.
+ **/
+static int dcc_x_chunk(int ofd,
+                       const char *buf,
+                       size_t len,
+                       enum dcc_compress compression)
+{
+    int ret;
+    char *out_buf = NULL;
+    size_t out_len;
+
+    if (compression == DCC_COMPRESS_NONE) {
+        if ((ret = dcc_x_token_int(ofd, "CHNK", len)))
+            return ret;
+        return dcc_writex(ofd, buf, len);
+    }
+
+    if ((ret = dcc_compress_lzo1x_alloc(buf, len, &out_buf, &out_len)))
+        return ret;
+    if ((ret = dcc_x_token_int(ofd, "CHNK", out_len)) == 0)
+        ret = dcc_writex(ofd, out_buf, out_len);
+    free(out_buf);
+    return ret;
+}
+
+
+/**
+ * Transmit a buffer to the network in chunks, as for protocol 5.  Sends
+ * TOKEN and the length of @p buf, then its chunks, then CHNK 0.
+ **/
+int dcc_x_buf_chunked(int ofd,
+                      const char *buf,
+                      size_t len,
+                      const char *token,
+                      enum dcc_compress compression)
+{
+    size_t done, n;
+    int ret;
+
+    if (compression != DCC_COMPRESS_NONE
+        && compression != DCC_COMPRESS_LZO1X) {
+        rs_log_error("invalid compression");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    rs_trace("send %lu byte buffer in chunks with token %s and compression %d",
+             (unsigned long) len, token, compression);
+
+    if ((ret = dcc_x_token_int(ofd, token, len)))
+        return ret;
+
+    for (done = 0; done < len; done += n) {
+        n = len - done;
+        if (n > DCC_CHUNK_SIZE)
+            n = DCC_CHUNK_SIZE;
+        if ((ret = dcc_x_chunk(ofd, buf + done, n, compression)))
+            return ret;
+    }
+
+    return dcc_x_token_int(ofd, "CHNK", 0);
+}
+
+
+/**
+ * Transmit a file to the network in chunks, as for protocol 5.
+ *
+ * When compressing, each piece is read, compressed and sent before the next
+ * is read, so the network is busy while we compress the rest.  Otherwise
+ * the whole file goes in one chunk, by sendfile() where we have it.
+ **/
+int dcc_x_file_chunked(int ofd,
+                       const char *fname,
+                       const char *token,
+                       enum dcc_compress compression)
+{
+    int ifd;
+    int ret;
+    off_t f_size, done;
+    size_t n;
+    char *buf = NULL;
+
+    if (compression != DCC_COMPRESS_NONE
+        && compression != DCC_COMPRESS_LZO1X) {
+        rs_log_error("invalid compression");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    if (dcc_open_read(fname, &ifd, &f_size))
+        return EXIT_IO_ERROR;
+    if (ifd == -1)
+        return EXIT_IO_ERROR;
+
+    rs_trace("send %lu byte file %s in chunks with token %s and compression %d",
+             (unsigned long) f_size, fname, token, compression);
+
+    if ((ret = dcc_x_token_int(ofd, token, f_size)))
+        goto out;
+
+    if (f_size == 0) {
+        /* nothing but the end marker */
+    } else if (compression == DCC_COMPRESS_NONE) {
+        if ((ret = dcc_x_token_int(ofd, "CHNK", f_size)))
+            goto out;
+#ifdef HAVE_SENDFILE
+        ret = dcc_pump_sendfile(ofd, ifd, (size_t) f_size);
+#else
+        ret = dcc_pump_readwrite(ofd, ifd, (size_t) f_size);
+#endif
+        if (ret)
+            goto out;
+    } else {
+        if ((buf = malloc(DCC_CHUNK_SIZE)) == NULL) {
+            rs_log_error("failed to allocate chunk buffer");
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+        for (done = 0; done < f_size; done += n) {
+            n = (f_size - done > DCC_CHUNK_SIZE)
+                ? DCC_CHUNK_SIZE : (size_t) (f_size - done);
+            if ((ret = dcc_readx(ifd, buf, n))
+                || (ret = dcc_x_chunk(ofd, buf, n, compression)))
+                goto out;
+        }
+    }
+
+    ret = dcc_x_token_int(ofd, "CHNK", 0);
+
+  out:
+    free(buf);
+    dcc_close(ifd);
+    return ret;
+}
+
+
+/**
+ * Receive the chunks of a file sent by dcc_x_file_chunked() or
+ * dcc_x_buf_chunked(), writing them to @p ofd as they arrive.
+ *
+ * @param size Uncompressed length of the file, which the chunks must add
+ * up to.
+ **/
+int dcc_r_bulk_chunked(int ofd, int ifd, unsigned size,
+                       enum dcc_compress compr)
+{
+    unsigned len, got = 0;
+    char *buf;
+    size_t buf_len;
+    int ret;
+
+    while (1) {
+        if ((ret = dcc_r_token_int(ifd, "CHNK", &len)))
+            return ret;
+        if (len == 0)
+            break;
+
+        if (compr == DCC_COMPRESS_NONE) {
+            if (len > size - got)
+                goto too_long;
+            if ((ret = dcc_pump_readwrite(ofd, ifd, len)))
+                return ret;
+            got += len;
+        } else if (compr == DCC_COMPRESS_LZO1X) {
+            if ((ret = dcc_r_bulk_lzo1x_alloc(ifd, len, &buf, &buf_len)))
+                return ret;
+            if (buf_len > size - got) {
+                free(buf);
+                goto too_long;
+            }
+            ret = dcc_writex(ofd, buf, buf_len);
+            free(buf);
+            if (ret)
+                return ret;
+            got += buf_len;
+        } else {
+            rs_log_error("impossible compression %d", compr);
+            return EXIT_PROTOCOL_ERROR;
+        }
+    }
+
+    if (got != size) {
+        rs_log_error("got %u bytes in chunks, but expected %u", got, size);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    return 0;
+
+  too_long:
+    rs_log_error("chunks run past the expected %u bytes", size);
+    return EXIT_PROTOCOL_ERROR;
+}
+
+
+#if defined(O_TMPFILE) && defined(HAVE_LINKAT)
+/**
+ * Open an unnamed file in the directory that will hold @p filename, for
+ * dcc_r_output_file().  Returns -1 if the system or the filesystem can't
+ * do that, or we couldn't give it a name afterwards because /proc isn't
+ * mounted.
+ **/
+static int dcc_open_unnamed(const char *filename)
+{
+    static int have_proc = -1;
+    char *dir;
+    int fd;
+
+    if (have_proc == -1)
+        have_proc = access("/proc/self/fd", X_OK) == 0;
+    if (!have_proc)
+        return -1;
+
+    if ((dir = strdup(filename)) == NULL)
+        return -1;
+    if (!strchr(dir, '/'))
+        strcpy(dir, ".");
+    else if (strrchr(dir, '/') == dir)
+        strcpy(dir, "/");
+    else
+        dcc_truncate_to_dirname(dir);
+
+    /* The mode is subject to the umask, as for any other new file. */
+    fd = open(dir, O_TMPFILE|O_WRONLY|O_BINARY, 0666);
+    if (fd == -1)
+        rs_trace("can't make an unnamed file in %s: %s", dir, strerror(errno));
+    free(dir);
+    return fd;
+}
+
+
+/**
+ * Give the unnamed file @p fd the name @p filename, replacing whatever had
+ * it.
+ *
+ * linkat() won't replace an existing file, so in that case link it under a
+ * temporary name and rename that over, so that @p filename is never
+ * missing.
+ **/
+static int dcc_link_unnamed(int fd, const char *filename)
+{
+    char proc_path[64];
+    char *tmp_name = NULL;
+    int ret = 0;
+
+    snprintf(proc_path, sizeof proc_path, "/proc/self/fd/%d", fd);
+
+    if (linkat(AT_FDCWD, proc_path, AT_FDCWD, filename,
+               AT_SYMLINK_FOLLOW) == 0)
+        return 0;
+    if (errno != EEXIST)
+        goto failed;
+
+    if (checked_asprintf(&tmp_name, "%s.distcc_%ld", filename,
+                         (long) getpid()) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    /* Anything already there is left over from a client that died. */
+    unlink(tmp_name);
+    /* Registered first, in case we're killed before the rename. */
+    if ((ret = dcc_add_cleanup(tmp_name))) {
+        free(tmp_name);
+        return ret;
+    }
+    if (linkat(AT_FDCWD, proc_path, AT_FDCWD, tmp_name,
+               AT_SYMLINK_FOLLOW) == -1)
+        goto failed;
+    if (rename(tmp_name, filename) == -1) {
+        unlink(tmp_name);
+        goto failed;
+    }
+    free(tmp_name);
+    return 0;
+
+  failed:
+    rs_log_error("failed to link %s: %s", filename, strerror(errno));
+    ret = EXIT_IO_ERROR;
+    free(tmp_name);
+    return ret;
+}
+#endif
+
+
+/**
+ * Receive a compilation result into @p filename, which only appears once
+ * it is complete.  Prints timing statistics.
+ *
+ * Where the system has O_TMPFILE and linkat(), the data goes into an
+ * unnamed file in the target directory, whose space is allocated up front
+ * when we know the size, and which is given its name once the whole file
+ * is in.  A failed transfer, or a client killed partway through, leaves
+ * nothing behind, and the common case of a new output costs one directory
+ * operation.  Otherwise the data goes under a temporary name next to @p
+ * filename, which is renamed into place.
+ *
+ * Anything that already exists under @p filename and is not a regular
+ * file, such as /dev/null or a fifo, is written directly.  So is the file
+ * itself if we may not create files in its directory, as dcc_r_file()
+ * would; a failed transfer then removes it, but a client killed partway
+ * through leaves it truncated.
+ *
+ * @param len For a chunked file, as sent in protocol 5, its uncompressed
+ * length; otherwise the length on the wire.
+ **/
+int dcc_r_output_file(int ifd, const char *filename, unsigned len,
+                      enum dcc_compress compr, int chunked)
+{
+    char *tmp_name = NULL;
+    struct stat s;
+    struct timeval before, after;
+    mode_t mask;
+    int ofd = -1, unnamed = 0, direct = 0, ret;
+
+    if (gettimeofday(&before, NULL))
+        rs_log_warning("gettimeofday failed");
+
+    if (dcc_mk_tmp_ancestor_dirs(filename)) {
+        rs_log_error("failed to create path for '%s'", filename);
+        return EXIT_IO_ERROR;
+    }
+
+    if (stat(filename, &s) == 0 && !S_ISREG(s.st_mode)) {
+        if ((ofd = open(filename, O_WRONLY|O_TRUNC|O_BINARY)) == -1) {
+            rs_log_error("failed to open %s: %s", filename, strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+    } else {
+#if defined(O_TMPFILE) && defined(HAVE_LINKAT)
+        unnamed = (ofd = dcc_open_unnamed(filename)) != -1;
+#endif
+        if (!unnamed) {
+            if (checked_asprintf(&tmp_name, "%s.distcc_XXXXXX",
+                                 filename) == -1)
+                return EXIT_OUT_OF_MEMORY;
+            if ((ofd = mkstemp(tmp_name)) == -1
+                && (errno == EACCES || errno == EROFS)) {
+                /* The directory is closed to us, but perhaps not the
+                 * file. */
+                rs_trace("can't create %s: %s; writing %s directly",
+                         tmp_name, strerror(errno), filename);
+                free(tmp_name);
+                tmp_name = NULL;
+                direct = 1;
+                ofd = open(filename, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY,
+                           0666);
+                if (ofd == -1) {
+                    rs_log_error("failed to create %s: %s", filename,
+                                 strerror(errno));
+                    return EXIT_IO_ERROR;
+                }
+            } else if (ofd == -1) {
+                rs_log_error("failed to create %s: %s", tmp_name,
+                             strerror(errno));
+                free(tmp_name);
+                return EXIT_IO_ERROR;
+            }
+        }
+        if (tmp_name) {
+            if ((ret = dcc_add_cleanup(tmp_name))) {
+                dcc_close(ofd);
+                unlink(tmp_name);
+                free(tmp_name);
+                return ret;
+            }
+            /* mkstemp() makes the file private; give it the mode open()
+             * would have. */
+            mask = umask(0);
+            umask(mask);
+            if (fchmod(ofd, 0666 & ~mask) == -1)
+                rs_log_warning("failed to chmod %s: %s", tmp_name,
+                               strerror(errno));
+        }
+#ifdef HAVE_FALLOCATE
+        /* Only a hint: fallocate() fails rather than writing zeros on
+         * filesystems that can't do it. */
+        if (len > 0 && (chunked || compr == DCC_COMPRESS_NONE)
+            && fallocate(ofd, 0, 0, (off_t) len) == -1)
+            rs_trace("fallocate %s failed: %s", filename, strerror(errno));
+#endif
+    }
+
+    if (chunked)
+        ret = dcc_r_bulk_chunked(ofd, ifd, len, compr);
+    else
+        ret = len ? dcc_r_bulk(ofd, ifd, len, compr) : 0;
+
+#if defined(O_TMPFILE) && defined(HAVE_LINKAT)
+    if (unnamed && !ret)
+        ret = dcc_link_unnamed(ofd, filename);
+#endif
+    if (dcc_close(ofd) && !ret)
+        ret = EXIT_IO_ERROR;
+
+    if (tmp_name) {
+        if (!ret && rename(tmp_name, filename) == -1) {
+            rs_log_error("failed to rename %s to %s: %s",
+                         tmp_name, filename, strerror(errno));
+            ret = EXIT_IO_ERROR;
+        }
+        if (ret)
+            unlink(tmp_name);
+        free(tmp_name);
+    }
+
+    if (ret) {
+        rs_trace("failed to receive %s", filename);
+        if (direct && unlink(filename))
+            rs_log_error("failed to unlink %s after failed transfer: %s",
+                         filename, strerror(errno));
+        return ret;
+    }
+
+    if (gettimeofday(&after, NULL)) {
+        rs_log_warning("gettimeofday failed");
+    } else {
+        double secs, rate;
+
+        dcc_calc_rate(len, &before, &after, &secs, &rate);
+        rs_log_info("%ld bytes received in %.6fs, rate %.0fkB/s",
+                    (long) len, secs, rate);
+    }
+    rs_trace("received %u bytes%s to file %s", len,
+             chunked ? " in chunks" : "", filename);
+    return 0;
+}
+
+
 /**
  * Receive a file stream from the network into a local file.
  * Make all necessary directories if they don't exist.
@@ -299,6 +778,135 @@ int dcc_r_file(int ifd, const char *filename,
 
 
 
+/**
+ * Return 1 if the file @p filename exists and holds exactly the @p len
+ * bytes in @p buf, 0 otherwise.
+ **/
+static int dcc_file_has_contents(const char *filename,
+                                 const char *buf, size_t len)
+{
+    int fd;
+    struct stat s;
+    char *old_buf = NULL;
+    int same = 0;
+
+    if ((fd = open(filename, O_RDONLY|O_BINARY)) == -1)
+        return 0;
+
+    if (fstat(fd, &s) == -1 || !S_ISREG(s.st_mode)
+        || (size_t) s.st_size != len)
+        goto out;
+
+    if (len == 0) {
+        same = 1;
+        goto out;
+    }
+
+    if ((old_buf = malloc(len)) == NULL)
+        goto out;
+
+    if (dcc_readx(fd, old_buf, len) == 0
+        && memcmp(old_buf, buf, len) == 0)
+        same = 1;
+
+out:
+    free(old_buf);
+    close(fd);
+    return same;
+}
+
+
+/**
+ * Receive a file into a directory that may be shared with other jobs,
+ * such as a session root.
+ *
+ * The contents are always read off the wire.  If @p filename already
+ * holds exactly those bytes it is left alone, so that its mtime and any
+ * pages cached for it stay valid.  Otherwise the data is written to a
+ * private temporary name next to it and renamed into place, so that a
+ * concurrent job reading the old file never sees it half-written.
+ **/
+int dcc_r_file_if_changed(int ifd, const char *filename,
+                          unsigned len,
+                          enum dcc_compress compr)
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+    char *tmp_name = NULL;
+    int ofd = -1;
+    int ret;
+
+    if (dcc_mk_ancestor_dirs(filename)) {
+        rs_log_error("failed to create path for '%s'", filename);
+        return EXIT_IO_ERROR;
+    }
+
+    if (compr == DCC_COMPRESS_LZO1X) {
+        if ((ret = dcc_r_bulk_lzo1x_alloc(ifd, len, &buf, &buf_len)))
+            return ret;
+    } else if (compr == DCC_COMPRESS_NONE) {
+        if (len > 0) {
+            if ((buf = malloc(len)) == NULL) {
+                rs_log_error("failed to allocate %u bytes for %s",
+                             len, filename);
+                return EXIT_OUT_OF_MEMORY;
+            }
+            if ((ret = dcc_readx(ifd, buf, len))) {
+                free(buf);
+                return ret;
+            }
+        }
+        buf_len = len;
+    } else {
+        rs_log_error("invalid compression");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    if (dcc_file_has_contents(filename, buf, buf_len)) {
+        rs_trace("%s is unchanged, keeping it", filename);
+        ret = 0;
+        goto out;
+    }
+
+    if (checked_asprintf(&tmp_name, "%s.distccd_%ld", filename,
+                 (long) getpid()) == -1) {
+        tmp_name = NULL;
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    ofd = open(tmp_name, O_TRUNC|O_WRONLY|O_CREAT|O_BINARY, 0666);
+    if (ofd == -1) {
+        rs_log_error("failed to create %s: %s", tmp_name, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    ret = buf_len ? dcc_writex(ofd, buf, buf_len) : 0;
+    if (dcc_close(ofd) && !ret)
+        ret = EXIT_IO_ERROR;
+
+    if (!ret && rename(tmp_name, filename) == -1) {
+        rs_log_error("failed to rename %s to %s: %s",
+                     tmp_name, filename, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+
+    if (ret) {
+        unlink(tmp_name);
+    } else {
+        rs_trace("received %lu bytes to file %s",
+                 (unsigned long) buf_len, filename);
+    }
+
+out:
+    free(tmp_name);
+    free(buf);
+    return ret;
+}
+
+
+
 /**
  * Receive a file and print timing statistics.  Only used for big files.
  *
@@ -23,15 +23,28 @@
 
 int dcc_r_file(int ifd, const char *filename, unsigned,
                enum dcc_compress);
+int dcc_r_file_if_changed(int ifd, const char *filename, unsigned,
+                          enum dcc_compress);
 int dcc_r_fifo(int ifd, const char *fifo_name, size_t len);
 
 int dcc_x_file(int ofd, const char *fname, const char *token,
                enum dcc_compress compression,
                off_t *);
+int dcc_x_buf(int ofd, const char *buf, size_t len, const char *token,
+              enum dcc_compress compression);
 
 int dcc_r_file_timed(int ifd, const char *fname, unsigned size,
                      enum dcc_compress);
 
+int dcc_x_file_chunked(int ofd, const char *fname, const char *token,
+                       enum dcc_compress compression);
+int dcc_x_buf_chunked(int ofd, const char *buf, size_t len,
+                      const char *token, enum dcc_compress compression);
+int dcc_r_bulk_chunked(int ofd, int ifd, unsigned size,
+                       enum dcc_compress compr);
+int dcc_r_output_file(int ifd, const char *filename, unsigned len,
+                      enum dcc_compress compr, int chunked);
+
 int dcc_r_token_file(int ifd,
                      const char *token,
                      const char *fname,
@@ -48,4 +61,5 @@ int dcc_x_many_files(int ofd,
 /* srvrpc.c */
 int dcc_r_many_files(int in_fd,
                      const char *dirname,
-                     enum dcc_compress compr);
+                     enum dcc_compress compr,
+                     int reuse);
@@ -99,6 +99,16 @@ static void dcc_cleanup_tempfiles_inner(int from_signal_handler)//这个算bool
         if (save) {
             rs_trace("skip cleanup of %s", cleanups[i]);//卧槽, 这cleanups哪里来的
         } else {
+#if defined(linux)
+            /* Most entries are files, so try that first: Linux never
+             * unlinks a directory, even for root. */
+            if ((unlink(cleanups[i]) == -1) &&
+                (errno != EISDIR || rmdir(cleanups[i]) == -1) &&
+                (errno != ENOENT)) {
+                rs_log_notice("cleanup %s failed: %s", cleanups[i],
+                              strerror(errno));
+            }
+#else
             /* Try removing it as a directory first, and
              * if that fails, try removing is as a file.
              * Report the error from removing-as-a-file
@@ -109,6 +119,7 @@ static void dcc_cleanup_tempfiles_inner(int from_signal_handler)//这个算bool
                 rs_log_notice("cleanup %s failed: %s", cleanups[i],
                               strerror(errno));
             }
+#endif
             done++;
         }
         n_cleanups = i;
@@ -169,3 +180,39 @@ int dcc_add_cleanup(const char *filename)
 
     return 0;
 }
+
+
+/**
+ * Forget the files to clean up that are @p dir or underneath it, because
+ * somebody else has taken care of the whole tree.
+ *
+ * Entries are moved down one at a time, and the forgotten names freed only
+ * once they're out of the array, so a signal arriving in the middle sees
+ * each remaining name at least once.
+ */
+void dcc_forget_cleanups_under(const char *dir)
+{
+    size_t len = strlen(dir);
+    int i, j, n = n_cleanups;
+    char **forgotten;
+    int n_forgotten = 0;
+
+    if ((forgotten = malloc(n * sizeof *forgotten + 1)) == NULL)
+        return;
+
+    for (i = j = 0; i < n; i++) {
+        char *name = cleanups[i];
+
+        if (strncmp(name, dir, len) == 0
+            && (name[len] == '\0' || name[len] == '/')) {
+            forgotten[n_forgotten++] = name;
+        } else {
+            cleanups[j++] = name;
+        }
+    }
+    n_cleanups = j;
+
+    for (i = 0; i < n_forgotten; i++)
+        free(forgotten[i]);
+    free(forgotten);
+}
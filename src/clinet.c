@@ -77,29 +77,22 @@ const int dcc_connect_timeout = 4; /* seconds */
 
 
 /*
- * Connect to a host given its binary address, with a timeout.
- *
- * host and port are only here to aid printing debug messages.
+ * Create a nonblocking socket and start connecting it to @p sa, whose
+ * printable form is @p s.  On success the connection may still be in
+ * progress; wait for the socket to become writable to find out.
  */
-int dcc_connect_by_addr(struct sockaddr *sa, size_t salen,
-                        int *p_fd)
+static int dcc_start_connect(struct sockaddr *sa, size_t salen,
+                             const char *s, int *p_fd)
 {
     int fd;
-    int ret;
-    char *s;
     int failed;
-    int connecterr;
     int tries = 3;
 
-    dcc_sockaddr_to_string(sa, salen, &s);
-    if (s == NULL) return EXIT_OUT_OF_MEMORY;
-
     rs_trace("started connecting to %s", s);
 
     if ((fd = socket(sa->sa_family, SOCK_STREAM, 0)) == -1) {
         rs_log_error("failed to create socket: %s", strerror(errno));
-        ret = EXIT_CONNECT_FAILED;
-        goto out_failed;
+        return EXIT_CONNECT_FAILED;
     }
 
     dcc_set_nonblocking(fd);
@@ -111,12 +104,36 @@ int dcc_connect_by_addr(struct sockaddr *sa, size_t salen,
            (errno == EINTR ||
             (errno == EAGAIN && tries-- && poll(NULL, 0, 500) == 0)));
 
-   if (failed == -1 && errno != EINPROGRESS) {
-       rs_log(RS_LOG_ERR|RS_LOG_NONAME,
-              "failed to connect to %s: %s", s, strerror(errno));
-       ret = EXIT_CONNECT_FAILED;
-       goto out_failed;
-   }
+    if (failed == -1 && errno != EINPROGRESS) {
+        rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+               "failed to connect to %s: %s", s, strerror(errno));
+        dcc_close(fd);
+        return EXIT_CONNECT_FAILED;
+    }
+
+    *p_fd = fd;
+    return 0;
+}
+
+
+/*
+ * Connect to a host given its binary address, with a timeout.
+ *
+ * host and port are only here to aid printing debug messages.
+ */
+int dcc_connect_by_addr(struct sockaddr *sa, size_t salen,
+                        int *p_fd)
+{
+    int fd;
+    int ret;
+    char *s;
+    int connecterr;
+
+    dcc_sockaddr_to_string(sa, salen, &s);
+    if (s == NULL) return EXIT_OUT_OF_MEMORY;
+
+    if ((ret = dcc_start_connect(sa, salen, s, &fd)))
+        goto out_failed;
 
     do {
        socklen_t len;
@@ -194,6 +211,69 @@ int dcc_connect_by_name(const char *host, int port, int *p_fd)
 }
 
 
+/*
+ * Start connecting to the next of @p c's addresses that will take a
+ * nonblocking connect, or set c->fd to -1 if there are none left.
+ */
+static int dcc_connecting_next(struct dcc_connecting *c)
+{
+    int ret = EXIT_CONNECT_FAILED;
+    char *s;
+
+    c->fd = -1;
+    while (c->next) {
+        struct addrinfo *ai = c->next;
+
+        c->next = ai->ai_next;
+        dcc_sockaddr_to_string(ai->ai_addr, ai->ai_addrlen, &s);
+        if (s == NULL)
+            return EXIT_OUT_OF_MEMORY;
+        ret = dcc_start_connect(ai->ai_addr, ai->ai_addrlen, s, &c->fd);
+        free(s);
+        if (ret == 0)
+            break;
+    }
+    return ret;
+}
+
+
+/**
+ * Start a nonblocking connection to a tcp remote host with the specified
+ * port, without waiting for it to complete.  This lets the caller wait for
+ * many connections at once.
+ *
+ * The host's other addresses are kept in @p c, so that
+ * dcc_connecting_check() can move on to them if this one fails.  Free
+ * them with dcc_connecting_free() even if this fails.
+ **/
+int dcc_start_connect_by_name(const char *host, int port,
+                              struct dcc_connecting *c)
+{
+    struct addrinfo hints;
+    int error;
+    char portname[20];
+
+    c->fd = -1;
+    c->res = c->next = NULL;
+
+    snprintf(portname, sizeof portname, "%d", port);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(host, portname, &hints, &c->res);
+    if (error) {
+        rs_log_error("failed to resolve host %s port %d: %s", host, port,
+                     gai_strerror(error));
+        c->res = NULL;
+        return EXIT_CONNECT_FAILED;
+    }
+
+    c->next = c->res;
+    return dcc_connecting_next(c);
+}
+
+
 #else /* not ENABLE_RFC2553 */
 
 /**
@@ -223,4 +303,102 @@ int dcc_connect_by_name(const char *host, int port, int *p_fd)
                                sizeof sock_out, p_fd);
 }
 
+
+/* Only one address is ever looked up here. */
+static int dcc_connecting_next(struct dcc_connecting *c)
+{
+    c->fd = -1;
+    return EXIT_CONNECT_FAILED;
+}
+
+
+/**
+ * Start a nonblocking connection to a tcp remote host with the specified
+ * port, without waiting for it to complete.  This lets the caller wait for
+ * many connections at once.
+ **/
+int dcc_start_connect_by_name(const char *host, int port,
+                              struct dcc_connecting *c)
+{
+    struct sockaddr_in sock_out;
+    struct hostent *hp;
+    char *s;
+    int ret;
+
+    c->fd = -1;
+    c->res = c->next = NULL;
+
+    hp = gethostbyname(host);
+    if (!hp) {
+        rs_log_error("failed to look up host \"%s\": %s", host,
+                     hstrerror(h_errno));
+        return EXIT_CONNECT_FAILED;
+    }
+
+    memcpy(&sock_out.sin_addr, hp->h_addr, (size_t) hp->h_length);
+    sock_out.sin_port = htons((in_port_t) port);
+    sock_out.sin_family = PF_INET;
+
+    dcc_sockaddr_to_string((struct sockaddr *) &sock_out, sizeof sock_out, &s);
+    if (s == NULL)
+        return EXIT_OUT_OF_MEMORY;
+    ret = dcc_start_connect((struct sockaddr *) &sock_out, sizeof sock_out,
+                            s, &c->fd);
+    free(s);
+    return ret;
+}
+
 #endif /* not ENABLE_RFC2553 */
+
+
+/**
+ * Find out how the connection in @p c is going, once c->fd has polled
+ * ready.  If that address refused the connection, start on the host's
+ * next one; c->fd then changes, and the caller should poll the new socket.
+ *
+ * Sets @p *p_connected if c->fd is now connected.  Returns an error only
+ * once all the host's addresses have failed.
+ **/
+int dcc_connecting_check(struct dcc_connecting *c, int *p_connected)
+{
+    int err;
+    socklen_t len;
+
+    *p_connected = 0;
+    if (c->fd == -1)
+        return EXIT_CONNECT_FAILED;
+
+    err = -1;
+    len = sizeof err;
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (char *) &err, &len) < 0)
+        err = errno;
+    if (err == EINPROGRESS)
+        return 0;
+    if (err == 0) {
+        *p_connected = 1;
+        return 0;
+    }
+
+    rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+           "nonblocking connect failed: %s", strerror(err));
+    dcc_close(c->fd);
+    return dcc_connecting_next(c);
+}
+
+
+/**
+ * Close any connection still in progress in @p c and forget the host's
+ * addresses.  To keep a connection, take c->fd and set it to -1 first.
+ **/
+void dcc_connecting_free(struct dcc_connecting *c)
+{
+    if (c->fd != -1) {
+        dcc_close(c->fd);
+        c->fd = -1;
+    }
+#if defined(ENABLE_RFC2553)
+    if (c->res)
+        freeaddrinfo(c->res);
+#endif
+    c->res = c->next = NULL;
+}
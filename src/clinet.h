@@ -30,3 +30,25 @@ int dcc_connect_by_name(const char *host,
 int dcc_connect_by_addr(struct sockaddr *sa,
                         size_t salen,
                         int *p_fd);
+
+struct addrinfo;
+
+/**
+ * A nonblocking connection to a host that may have several addresses.
+ * While it is in progress @c fd is the socket for the address being
+ * tried, or -1 once every address has failed.
+ **/
+struct dcc_connecting {
+    int fd;
+    struct addrinfo *res;       /* all the host's addresses */
+    struct addrinfo *next;      /* the next one to try */
+};
+
+int dcc_start_connect_by_name(const char *host,
+                              int port,
+                              struct dcc_connecting *c);
+
+int dcc_connecting_check(struct dcc_connecting *c,
+                         int *p_connected);
+
+void dcc_connecting_free(struct dcc_connecting *c);
@@ -105,6 +105,51 @@ int dcc_x_cwd(int fd)
     return ret;
 }
 
+/**
+ * Put the name of the pump session this job belongs to in @p buf, or make
+ * it empty if we're not running under pump.
+ *
+ * The include server socket path is unique to each pump invocation, so
+ * a hash of it makes a good session name that reveals nothing about the
+ * client's file system.
+ **/
+static void dcc_session_name(char *buf, size_t len)
+{
+    const char *port;
+    unsigned long h = 2166136261UL;
+
+    buf[0] = '\0';
+    port = getenv("INCLUDE_SERVER_PORT");
+    if (port == NULL || port[0] == '\0')
+        return;
+
+    /* FNV-1a */
+    for (; *port; port++) {
+        h ^= (unsigned char) *port;
+        h = (h * 16777619UL) & 0xffffffffUL;
+    }
+    snprintf(buf, len, "%08lx", h);
+}
+
+/**
+ * Send the SESS token naming the pump session this job belongs to, so that
+ * the server can keep the mirrored file tree around for the next job from
+ * the same session instead of recreating it.
+ *
+ * If we're not running under pump, nothing is sent and the server falls
+ * back to a private directory.
+ **/
+int dcc_x_session(int fd)
+{
+    char buf[32];
+
+    dcc_session_name(buf, sizeof buf);
+    if (buf[0] == '\0')
+        return 0;
+
+    return dcc_x_token_string(fd, "SESS", buf);
+}
+
 /**
  * Read the "DONE" token from the network that introduces a response.
  **/
@@ -148,6 +193,9 @@ int dcc_r_cc_status(int ifd, int *status)
 
 /**
  * The second half of the client protocol: retrieve all results from the server.
+ *
+ * The object and dependency files only appear under their names once
+ * they have been received in full.
  **/
 int dcc_retrieve_results(int net_fd,
                          int *status,
@@ -159,8 +207,11 @@ int dcc_retrieve_results(int net_fd,
     unsigned len;
     int ret;
     unsigned o_len;
+    int chunked = host->use_stream;
 
-    if ((ret = dcc_r_result_header(net_fd, host->protover)))
+    if ((ret = dcc_r_result_header(net_fd, chunked ? DCC_VER_5
+                                   : host->use_manifest ? DCC_VER_4
+                                   : host->protover)))
         return ret;
 
     /* We've started to see the response, so the server is done
@@ -182,14 +233,18 @@ int dcc_retrieve_results(int net_fd,
        send to the maintainers, though.
     */
 
-    if ((ret = dcc_r_file(net_fd, server_stderr_fname, len, host->compr)))
+    if ((ret = chunked
+         ? dcc_r_output_file(net_fd, server_stderr_fname, len, host->compr, 1)
+         : dcc_r_file(net_fd, server_stderr_fname, len, host->compr)))
         return ret;
 
     if (dcc_add_file_to_log_email("server-side stderr", server_stderr_fname))
         return ret;
 
     if ((ret = dcc_r_token_int(net_fd, "SOUT", &len))
-        || (ret = dcc_r_bulk(STDOUT_FILENO, net_fd, len, host->compr))
+        || (ret = chunked
+            ? dcc_r_bulk_chunked(STDOUT_FILENO, net_fd, len, host->compr)
+            : dcc_r_bulk(STDOUT_FILENO, net_fd, len, host->compr))
         || (ret = dcc_r_token_int(net_fd, "DOTO", &o_len)))
         return ret;
 
@@ -197,12 +252,14 @@ int dcc_retrieve_results(int net_fd,
     /* If the compiler succeeded, then we always retrieve the result,
      * even if it's 0 bytes.  */
     if (*status == 0) {
-        if ((ret = dcc_r_file_timed(net_fd, output_fname, o_len, host->compr)))
+        if ((ret = dcc_r_output_file(net_fd, output_fname, o_len, host->compr,
+                                     chunked)))
             return ret;
         if (host->cpp_where == DCC_CPP_ON_SERVER) {
             if ((ret = dcc_r_token_int(net_fd, "DOTD", &len) == 0)
                 && deps_fname != NULL) {
-                ret = dcc_r_file_timed(net_fd, deps_fname, len, host->compr);
+                ret = dcc_r_output_file(net_fd, deps_fname, len, host->compr,
+                                        chunked);
                 return ret;
             }
         }
@@ -289,3 +346,280 @@ int dcc_x_many_files(int ofd,
     }
     return 0;
 }
+
+
+/**
+ * A manifest being put together in memory before it is sent.
+ **/
+struct dcc_mbuf {
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+static int dcc_mbuf_put(struct dcc_mbuf *b, const void *p, size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 4096;
+        char *grown;
+
+        while (size < b->len + len)
+            size *= 2;
+        if ((grown = realloc(b->buf, size)) == NULL) {
+            rs_log_error("failed to allocate %lu byte manifest",
+                         (unsigned long) size);
+            return EXIT_OUT_OF_MEMORY;
+        }
+        b->buf = grown;
+        b->size = size;
+    }
+    memcpy(b->buf + b->len, p, len);
+    b->len += len;
+    return 0;
+}
+
+/* Words go in network byte order. */
+static int dcc_mbuf_u32(struct dcc_mbuf *b, unsigned v)
+{
+    unsigned char w[4];
+
+    w[0] = (v >> 24) & 0xff;
+    w[1] = (v >> 16) & 0xff;
+    w[2] = (v >> 8) & 0xff;
+    w[3] = v & 0xff;
+    return dcc_mbuf_put(b, w, 4);
+}
+
+/* Strings are their length and then their bytes, without the nul. */
+static int dcc_mbuf_str(struct dcc_mbuf *b, const char *s)
+{
+    size_t len = strlen(s);
+    int ret;
+
+    if ((ret = dcc_mbuf_u32(b, (unsigned) len)))
+        return ret;
+    return dcc_mbuf_put(b, s, len);
+}
+
+
+/**
+ * Describe a job for protocol 4: its features, the compiler command, and
+ * for server-side cpp where it runs and the name, size or link target of
+ * every file in @p files.  Nothing is read from the files yet.
+ **/
+int dcc_make_manifest(enum dcc_compress compr,
+                      enum dcc_cpp_where cpp_where,
+                      int use_session,
+                      char **argv,
+                      char **files,
+                      struct dcc_manifest *m)
+{
+    char session[32];
+    char cwd[MAXPATHLEN + 1];
+    char link_points_to[MAXPATHLEN + 1];
+    struct stat st;
+    unsigned i;
+    int is_link;
+    int ret;
+
+    memset(m, 0, sizeof *m);
+    m->compr = compr;
+    m->cpp_where = cpp_where;
+
+    if ((ret = dcc_copy_argv(argv, &m->argv, 0)))
+        goto fail;
+
+    if (cpp_where != DCC_CPP_ON_SERVER)
+        return 0;
+
+    if (use_session) {
+        dcc_session_name(session, sizeof session);
+        if (session[0] && (m->session = strdup(session)) == NULL)
+            goto oom;
+    }
+    if (getcwd(cwd, MAXPATHLEN) == NULL) {
+        rs_log_error("getcwd failed: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto fail;
+    }
+    if ((m->cwd = strdup(cwd)) == NULL)
+        goto oom;
+
+    m->n_entries = files ? dcc_argv_len(files) : 0;
+    if (m->n_entries == 0)
+        return 0;
+    if ((m->entries = calloc(m->n_entries, sizeof m->entries[0])) == NULL)
+        goto oom;
+
+    for (i = 0; i < m->n_entries; i++) {
+        struct dcc_manifest_entry *e = &m->entries[i];
+
+        if ((ret = dcc_get_original_fname(files[i], &e->name))
+            || (ret = dcc_is_link(files[i], &is_link)))
+            goto fail;
+
+        if (is_link) {
+            if ((ret = dcc_read_link(files[i], link_points_to)))
+                goto fail;
+            if ((e->link_target = strdup(link_points_to)) == NULL)
+                goto oom;
+        } else {
+            /* Already compressed by the include server, as for
+             * dcc_x_many_files(). */
+            if (stat(files[i], &st) == -1) {
+                rs_log_error("failed to stat %s: %s", files[i],
+                             strerror(errno));
+                ret = EXIT_IO_ERROR;
+                goto fail;
+            }
+            e->size = (unsigned) st.st_size;
+        }
+    }
+    return 0;
+
+  oom:
+    rs_log_error("failed to allocate manifest");
+    ret = EXIT_OUT_OF_MEMORY;
+  fail:
+    dcc_free_manifest(m);
+    return ret;
+}
+
+
+/**
+ * Send a manifest made by dcc_make_manifest() as MANI and its length,
+ * followed by:
+ *
+ *   FLAGS                      DCC_MANIFEST_*
+ *   [SESSION]                  if DCC_MANIFEST_SESSION
+ *   [CWD]                      if DCC_MANIFEST_CPP
+ *   ARGC ARG...
+ *   NFILES ENTRY...
+ *
+ * where each ENTRY is 'F' NAME SIZE or 'L' NAME TARGET.  Words are 32
+ * bits in network order, and strings are a word giving their length and
+ * then their bytes.
+ **/
+int dcc_x_manifest(int ofd, const struct dcc_manifest *m)
+{
+    struct dcc_mbuf b;
+    unsigned flags = 0;
+    unsigned i, argc;
+    int ret;
+
+    memset(&b, 0, sizeof b);
+
+    if (m->compr == DCC_COMPRESS_LZO1X)
+        flags |= DCC_MANIFEST_LZO;
+    if (m->cpp_where == DCC_CPP_ON_SERVER)
+        flags |= DCC_MANIFEST_CPP;
+    if (m->session)
+        flags |= DCC_MANIFEST_SESSION;
+    argc = dcc_argv_len(m->argv);
+
+    if ((ret = dcc_mbuf_u32(&b, flags))
+        || (m->session && (ret = dcc_mbuf_str(&b, m->session)))
+        || (m->cwd && (ret = dcc_mbuf_str(&b, m->cwd)))
+        || (ret = dcc_mbuf_u32(&b, argc)))
+        goto out;
+    for (i = 0; i < argc; i++)
+        if ((ret = dcc_mbuf_str(&b, m->argv[i])))
+            goto out;
+
+    if ((ret = dcc_mbuf_u32(&b, m->n_entries)))
+        goto out;
+    for (i = 0; i < m->n_entries; i++) {
+        const struct dcc_manifest_entry *e = &m->entries[i];
+
+        if ((ret = dcc_mbuf_put(&b, e->link_target ? "L" : "F", 1))
+            || (ret = dcc_mbuf_str(&b, e->name))
+            || (ret = e->link_target ? dcc_mbuf_str(&b, e->link_target)
+                                     : dcc_mbuf_u32(&b, e->size)))
+            goto out;
+    }
+
+    if (b.len > DCC_MANIFEST_MAX) {
+        rs_log_error("manifest of %lu bytes is too big to send",
+                     (unsigned long) b.len);
+        ret = EXIT_PROTOCOL_ERROR;
+        goto out;
+    }
+
+    rs_trace("send %lu byte manifest with %u arguments and %u files",
+             (unsigned long) b.len, argc, m->n_entries);
+    if ((ret = dcc_x_token_int(ofd, "MANI", (unsigned) b.len)) == 0)
+        ret = dcc_writex(ofd, b.buf, b.len);
+
+  out:
+    free(b.buf);
+    return ret;
+}
+
+
+/**
+ * Send the bodies of the regular files in @p m, one after another with
+ * nothing between them, in the order they are listed.  @p files are the
+ * local names the manifest was made from.
+ *
+ * Small files, which most headers are, go through the connection's buffer
+ * so that many of them share one write.
+ **/
+int dcc_x_manifest_bodies(int ofd, const struct dcc_manifest *m,
+                          char **files)
+{
+    char small[4096];
+    unsigned i;
+    int ifd;
+    off_t f_size;
+    int ret;
+
+    for (i = 0; i < m->n_entries; i++) {
+        if (m->entries[i].link_target)
+            continue;
+
+        if (dcc_open_read(files[i], &ifd, &f_size) || ifd == -1)
+            return EXIT_IO_ERROR;
+        if (f_size != (off_t) m->entries[i].size) {
+            rs_log_error("%s changed size while it was being sent", files[i]);
+            dcc_close(ifd);
+            return EXIT_IO_ERROR;
+        }
+
+        if (f_size == 0) {
+            ret = 0;
+        } else if ((size_t) f_size <= sizeof small) {
+            if ((ret = dcc_readx(ifd, small, (size_t) f_size)) == 0)
+                ret = dcc_writex(ofd, small, (size_t) f_size);
+        } else {
+#ifdef HAVE_SENDFILE
+            ret = dcc_pump_sendfile(ofd, ifd, (size_t) f_size);
+#else
+            ret = dcc_pump_readwrite(ofd, ifd, (size_t) f_size);
+#endif
+        }
+        dcc_close(ifd);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+
+/**
+ * Read the server's answer to a manifest: ACPT 0 if it takes the job,
+ * otherwise the exit code it turned the job down with, before we sent it
+ * any of the files.
+ **/
+int dcc_r_accept(int ifd)
+{
+    unsigned code;
+    int ret;
+
+    if ((ret = dcc_r_token_int(ifd, "ACPT", &code)))
+        return ret;
+    if (code != 0) {
+        rs_log_warning("server turned the job down with code %u", code);
+        return code < 256 ? (int) code : EXIT_PROTOCOL_ERROR;
+    }
+    return 0;
+}
@@ -32,7 +32,8 @@ int dcc_compile_remote(char **argv,
                        char *server_stderr_fname,
                        pid_t cpp_pid,
                        int local_cpu_lock_fd,
-                       struct dcc_hostdef *host,
+                       struct dcc_hostdef **p_host,
+                       int *cpu_lock_fd,
                        int *status);
 
 /* compile.c */
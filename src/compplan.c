@@ -0,0 +1,905 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Compiler plans: run the compiler's own passes without its driver.
+ *
+ * For "gcc -c" the driver does little but work out the command lines of
+ * cc1 and as and run them, and it works out the same command lines every
+ * time it sees the same options.  So distccd can ask it once, with -###,
+ * and run the passes itself for later jobs, saving the driver's startup.
+ *
+ * The passes' arguments depend on the names of the input, output and
+ * dependency files, which change with every job.  The driver is therefore
+ * asked twice, with two different sets of made-up names, and each argument
+ * of its first answer is turned into a template in which those names,
+ * their directories and their stems are slots.  The plan is trusted only if
+ * filling the templates with the second set of names gives exactly the
+ * second answer.  Otherwise, or for more than two passes, the driver is run
+ * as usual.
+ *
+ * The driver is asked with -pipe added, so that if it can, the assembler
+ * reads the compiler's output through a pipe rather than a temporary file.
+ * The caller also gets to vet each pass's program before a plan is used,
+ * as it vets the compiler.
+ *
+ * Plans are kept in memory, keyed on the working directory and the
+ * compiler command with the per-job names taken out, so each server process
+ * asks the driver about each set of options once.  In pump mode each job's
+ * files are unpacked under a new root, which turns up in the working
+ * directory and the include options; it is a slot too, and is taken out of
+ * the key, so that one job's plan serves the next.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "exec.h"
+#include "snprintf.h"
+#include "compplan.h"
+
+
+#define DCC_PLAN_CACHE_SIZE 64
+#define DCC_PLAN_MAX_STAGES 2
+
+/* Files whose names change from job to job. */
+enum dcc_plan_slot {
+    DCC_PLAN_INPUT,
+    DCC_PLAN_OUTPUT,
+    DCC_PLAN_DEPS,
+    DCC_PLAN_TEMP,              /* between the passes */
+    DCC_PLAN_ROOT,              /* that the job's files are under */
+    DCC_PLAN_SLOTS
+};
+
+/* The parts of those names that can turn up in the passes' arguments, in
+ * the order they are looked for. */
+enum dcc_plan_part {
+    DCC_PLAN_PATH,
+    DCC_PLAN_DIR,
+    DCC_PLAN_STEM,
+    DCC_PLAN_PARTS
+};
+
+/* In a template, a slot is this byte followed by 'a' + slot * PARTS + part. */
+#define DCC_PLAN_MARK '\001'
+
+static const char dcc_plan_slot_names[DCC_PLAN_SLOTS] = "iodtr";
+
+struct dcc_plan_names {
+    const char *part[DCC_PLAN_SLOTS][DCC_PLAN_PARTS];
+};
+
+/* Where the per-job names are in the compiler command. */
+struct dcc_plan_args {
+    int index[DCC_PLAN_SLOTS];          /* -1 if absent */
+    const char *prefix[DCC_PLAN_SLOTS]; /* "-o" or "-MF" if joined on */
+};
+
+struct dcc_plan {
+    char *key;
+    int n_stages;               /* 0 if the driver must be run */
+    char **stage[DCC_PLAN_MAX_STAGES];
+    int piped;                  /* first pass writes to the second's stdin */
+    char *temp_ext;             /* of the file between the passes, if any */
+};
+
+static struct dcc_plan *dcc_plans[DCC_PLAN_CACHE_SIZE];
+static int dcc_plan_next = 0;
+
+
+static void dcc_plan_free(struct dcc_plan *plan)
+{
+    int i;
+
+    if (!plan)
+        return;
+    for (i = 0; i < plan->n_stages; i++)
+        dcc_free_argv(plan->stage[i]);
+    free(plan->temp_ext);
+    free(plan->key);
+    free(plan);
+}
+
+
+/* If @p arg is @p opt followed by a file name, return the name. */
+static const char *dcc_plan_joined(const char *arg, const char *opt)
+{
+    size_t len = strlen(opt);
+
+    if (!strncmp(arg, opt, len) && arg[len])
+        return arg + len;
+    return NULL;
+}
+
+
+/**
+ * Find the input, output and dependency file names in @p argv.
+ *
+ * @returns 0, or -1 if this is not a compilation we can make a plan for.
+ **/
+static int dcc_plan_find_args(char **argv, struct dcc_plan_args *where)
+{
+    char *input, *output;
+    char **scanned = NULL;
+    int i, slot;
+
+    for (slot = 0; slot < DCC_PLAN_SLOTS; slot++) {
+        where->index[slot] = -1;
+        where->prefix[slot] = "";
+    }
+
+    if (dcc_scan_args(argv, &input, &output, &scanned) != 0) {
+        if (scanned)
+            dcc_free_argv(scanned);
+        return -1;
+    }
+
+    for (i = 1; argv[i]; i++) {
+        if (!strcmp(argv[i], "-o") && argv[i+1]) {
+            where->index[DCC_PLAN_OUTPUT] = ++i;
+            where->prefix[DCC_PLAN_OUTPUT] = "";
+        } else if (dcc_plan_joined(argv[i], "-o")) {
+            where->index[DCC_PLAN_OUTPUT] = i;
+            where->prefix[DCC_PLAN_OUTPUT] = "-o";
+        } else if (!strcmp(argv[i], "-MF") && argv[i+1]) {
+            where->index[DCC_PLAN_DEPS] = ++i;
+            where->prefix[DCC_PLAN_DEPS] = "";
+        } else if (dcc_plan_joined(argv[i], "-MF")) {
+            where->index[DCC_PLAN_DEPS] = i;
+            where->prefix[DCC_PLAN_DEPS] = "-MF";
+        } else if (!strcmp(argv[i], input)
+                   && where->index[DCC_PLAN_INPUT] == -1) {
+            where->index[DCC_PLAN_INPUT] = i;
+        }
+    }
+    dcc_free_argv(scanned);
+
+    if (where->index[DCC_PLAN_INPUT] == -1
+        || where->index[DCC_PLAN_OUTPUT] == -1)
+        return -1;
+    return 0;
+}
+
+
+/* The file name in slot @p slot of @p argv. */
+static const char *dcc_plan_arg_name(char **argv,
+                                     const struct dcc_plan_args *where,
+                                     int slot)
+{
+    return argv[where->index[slot]] + strlen(where->prefix[slot]);
+}
+
+
+/* Whether @p name is absolute, relative with a directory, or bare. */
+static char dcc_plan_name_kind(const char *name)
+{
+    if (name[0] == '/')
+        return '/';
+    return strchr(name, '/') ? 'd' : '.';
+}
+
+
+/**
+ * Split @p path into the parts that get their own slots.  The directory and
+ * stem are NULL if they are empty.
+ **/
+static int dcc_plan_split(const char *path, char *part[DCC_PLAN_PARTS])
+{
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+    const char *dot = strrchr(base, '.');
+    size_t stem_len = dot ? (size_t) (dot - base) : strlen(base);
+
+    part[DCC_PLAN_PATH] = strdup(path);
+    part[DCC_PLAN_DIR] = slash && slash != path
+        ? strndup(path, (size_t) (slash - path)) : NULL;
+    part[DCC_PLAN_STEM] = stem_len ? strndup(base, stem_len) : NULL;
+    if (!part[DCC_PLAN_PATH]
+        || (slash && slash != path && !part[DCC_PLAN_DIR])
+        || (stem_len && !part[DCC_PLAN_STEM])) {
+        rs_log_error("failed to allocate file name");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+/**
+ * Turn @p arg into a template by replacing with slots any of @p names in
+ * it: whole paths first, then directories, then stems.
+ **/
+static char *dcc_plan_template(const char *arg,
+                               const struct dcc_plan_names *names)
+{
+    char *t, *q;
+    const char *p;
+
+    if (!(t = malloc(2 * strlen(arg) + 1)))
+        return NULL;
+    for (p = arg, q = t; *p; ) {
+        int part, slot, found = 0;
+
+        for (part = 0; part < DCC_PLAN_PARTS && !found; part++)
+            for (slot = 0; slot < DCC_PLAN_SLOTS && !found; slot++) {
+                const char *s = names->part[slot][part];
+                size_t len;
+
+                if (!s || !(len = strlen(s)) || strncmp(p, s, len))
+                    continue;
+                *q++ = DCC_PLAN_MARK;
+                *q++ = (char) ('a' + slot * DCC_PLAN_PARTS + part);
+                p += len;
+                found = 1;
+            }
+        if (!found)
+            *q++ = *p++;
+    }
+    *q = '\0';
+    return t;
+}
+
+
+/**
+ * The key for @p argv: the working directory, and the arguments with each
+ * per-job name replaced by its kind and its extension, which is all the
+ * driver looks at, and the job's root in @p root replaced by its slot.
+ * Each argument has its length in front, so that no two commands share a
+ * key.
+ **/
+static char *dcc_plan_key(char **argv, const struct dcc_plan_args *where,
+                          const struct dcc_plan_names *root)
+{
+    char cwd[MAXPATHLEN];
+    size_t size;
+    char *dir, *key, *p, *t;
+    int i, slot;
+
+    if (!getcwd(cwd, sizeof cwd) || !(dir = dcc_plan_template(cwd, root)))
+        return NULL;
+
+    size = strlen(dir) + 2;
+    for (i = 0; argv[i]; i++)
+        size += 2 * strlen(argv[i]) + 24;
+    if (!(key = malloc(size))) {
+        free(dir);
+        return NULL;
+    }
+
+    p = key + sprintf(key, "%s\n", dir);
+    free(dir);
+    for (i = 0; argv[i]; i++) {
+        for (slot = 0; slot < DCC_PLAN_SLOTS; slot++)
+            if (where->index[slot] == i)
+                break;
+        if (slot == DCC_PLAN_SLOTS) {
+            if (!(t = dcc_plan_template(argv[i], root))) {
+                free(key);
+                return NULL;
+            }
+            p += sprintf(p, "%lu:%s", (unsigned long) strlen(t), t);
+            free(t);
+        } else {
+            const char *name = dcc_plan_arg_name(argv, where, slot);
+            const char *ext = dcc_find_extension_const(name);
+
+            p += sprintf(p, "%s%c%c%c%s", where->prefix[slot], DCC_PLAN_MARK,
+                         dcc_plan_slot_names[slot],
+                         dcc_plan_name_kind(name), ext ? ext : "");
+        }
+    }
+    return key;
+}
+
+
+/* Fill in template @p t from @p names. */
+static char *dcc_plan_expand(const char *t,
+                             const struct dcc_plan_names *names)
+{
+    size_t size = 1;
+    const char *p, *s;
+    char *arg, *q;
+
+    for (p = t; *p; p++) {
+        if (*p == DCC_PLAN_MARK && p[1]) {
+            int code = *++p - 'a';
+            s = names->part[code / DCC_PLAN_PARTS][code % DCC_PLAN_PARTS];
+            size += s ? strlen(s) : 0;
+        } else {
+            size++;
+        }
+    }
+    if (!(arg = malloc(size)))
+        return NULL;
+    for (p = t, q = arg; *p; p++) {
+        if (*p == DCC_PLAN_MARK && p[1]) {
+            int code = *++p - 'a';
+            s = names->part[code / DCC_PLAN_PARTS][code % DCC_PLAN_PARTS];
+            if (s) {
+                strcpy(q, s);
+                q += strlen(s);
+            }
+        } else {
+            *q++ = *p;
+        }
+    }
+    *q = '\0';
+    return arg;
+}
+
+
+/**
+ * Split one command line as printed by "gcc -###": words separated by
+ * spaces, some in double quotes with backslash escapes.
+ **/
+static int dcc_plan_parse_command(const char *line, char ***argv)
+{
+    char *word;
+    const char *p = line;
+    size_t n = 0, max = 16;
+    char **a;
+
+    if (!(a = malloc(max * sizeof *a)))
+        return EXIT_OUT_OF_MEMORY;
+    while (1) {
+        size_t len = 0;
+
+        while (*p == ' ')
+            p++;
+        if (!*p)
+            break;
+        if (!(word = malloc(strlen(p) + 1)))
+            goto fail;
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) {
+                if (*p == '\\' && p[1])
+                    p++;
+                word[len++] = *p;
+            }
+            if (*p == '"')
+                p++;
+        } else {
+            while (*p && *p != ' ')
+                word[len++] = *p++;
+        }
+        word[len] = '\0';
+        if (n + 2 > max) {
+            char **b;
+            max *= 2;
+            if (!(b = realloc(a, max * sizeof *a))) {
+                free(word);
+                goto fail;
+            }
+            a = b;
+        }
+        a[n++] = word;
+    }
+    a[n] = NULL;
+    *argv = a;
+    return 0;
+
+  fail:
+    a[n] = NULL;
+    dcc_free_argv(a);
+    rs_log_error("failed to allocate compiler pass");
+    return EXIT_OUT_OF_MEMORY;
+}
+
+
+/**
+ * Ask the compiler driver what passes it would run for @p argv, with
+ * -pipe added if @p use_pipe.
+ *
+ * @returns 0 if it gave at most DCC_PLAN_MAX_STAGES passes, piped only
+ * from the first to the second, otherwise nonzero.
+ **/
+static int dcc_plan_ask_driver(char **argv, int use_pipe,
+                               char **stage[DCC_PLAN_MAX_STAGES],
+                               int *n_stages, int *piped)
+{
+    char **cmd = NULL;
+    char *err_fname = NULL, *errs = NULL, *line, *next;
+    size_t len;
+    pid_t pid;
+    int status, ret;
+
+    *n_stages = 0;
+    *piped = 0;
+    if ((ret = dcc_copy_argv(argv, &cmd, 2)))
+        return ret;
+    if ((use_pipe && (ret = dcc_argv_append(cmd, strdup("-pipe"))))
+        || (ret = dcc_argv_append(cmd, strdup("-###"))))
+        goto out;
+
+    if ((ret = dcc_make_tmpnam("distccd", ".plan", &err_fname))
+        || (ret = dcc_spawn_child(cmd, &pid, "/dev/null", "/dev/null",
+                                  err_fname))
+        || (ret = dcc_collect_child("cc -###", pid, &status,
+                                    timeout_null_fd)))
+        goto out;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        ret = EXIT_COMPILER_CRASHED;
+        goto out;
+    }
+    if ((ret = dcc_load_file_string(err_fname, &errs)))
+        goto out;
+
+    for (line = errs; line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        if (line[0] != ' ')
+            continue;           /* not a command */
+        if (*n_stages == DCC_PLAN_MAX_STAGES) {
+            ret = EXIT_DISTCC_FAILED;
+            goto out;
+        }
+        len = strlen(line);
+        if (len > 2 && !strcmp(line + len - 2, " |")) {
+            if (*n_stages != 0) {
+                ret = EXIT_DISTCC_FAILED;
+                goto out;
+            }
+            line[len - 2] = '\0';
+            *piped = 1;
+        }
+        if ((ret = dcc_plan_parse_command(line, &stage[*n_stages])))
+            goto out;
+        ++*n_stages;
+    }
+    if (*n_stages == 0 || (*piped && *n_stages != 2))
+        ret = EXIT_DISTCC_FAILED;
+
+  out:
+    if (ret) {
+        while (*n_stages > 0)
+            dcc_free_argv(stage[--*n_stages]);
+    }
+    if (err_fname)
+        unlink(err_fname);
+    free(errs);
+    free(err_fname);
+    if (cmd)
+        dcc_free_argv(cmd);
+    return ret;
+}
+
+
+/**
+ * Find the file that the first pass writes for the second, as the
+ * argument after its "-o".
+ **/
+static const char *dcc_plan_temp_name(char **stage)
+{
+    int i;
+
+    for (i = 0; stage[i]; i++)
+        if (!strcmp(stage[i], "-o") && stage[i+1])
+            return stage[i+1];
+    return NULL;
+}
+
+
+static void dcc_plan_free_names(char *parts[DCC_PLAN_SLOTS][DCC_PLAN_PARTS])
+{
+    int slot, part;
+
+    for (slot = 0; slot < DCC_PLAN_SLOTS; slot++)
+        for (part = 0; part < DCC_PLAN_PARTS; part++)
+            free(parts[slot][part]);
+}
+
+
+/**
+ * Ask the driver twice about @p argv, with made-up file names and -pipe if
+ * @p use_pipe, and make a plan from the answers if they agree.  The job's
+ * root, if any, is @p root.  Fills in @p plan, leaving it with no stages
+ * if it can't be used.
+ **/
+static void dcc_plan_learn(char **argv, const struct dcc_plan_args *where,
+                           const char *root, int use_pipe,
+                           struct dcc_plan *plan)
+{
+    char *names[2][DCC_PLAN_SLOTS][DCC_PLAN_PARTS];
+    struct dcc_plan_names lookup[2];
+    char **stage[2][DCC_PLAN_MAX_STAGES];
+    int n_stages[2] = { 0, 0 }, piped[2];
+    char **cmd = NULL;
+    int run, slot, part, i, j, ok = 0;
+
+    memset(names, 0, sizeof names);
+    memset(lookup, 0, sizeof lookup);
+
+    for (run = 0; run < 2; run++) {
+        const char *temp;
+
+        if (dcc_copy_argv(argv, &cmd, 0))
+            goto out;
+        for (slot = 0; slot < DCC_PLAN_TEMP; slot++) {
+            const char *name, *ext;
+            char *made_up, kind;
+
+            if (where->index[slot] == -1)
+                continue;
+            name = dcc_plan_arg_name(argv, where, slot);
+            ext = dcc_find_extension_const(name);
+            kind = dcc_plan_name_kind(name);
+            /* Each name gets its own directory, if it has one at all, so
+             * that the driver's use of each can be told apart. */
+            if (kind == '.')
+                checked_asprintf(&made_up, "dccplan%c%c%s",
+                                 dcc_plan_slot_names[slot], "ab"[run],
+                                 ext ? ext : "");
+            else
+                checked_asprintf(&made_up, "%sdcc-plan-%c%c/dccplan%c%c%s",
+                                 kind == '/' ? "/" : "",
+                                 dcc_plan_slot_names[slot], "ab"[run],
+                                 dcc_plan_slot_names[slot], "ab"[run],
+                                 ext ? ext : "");
+            if (!made_up || dcc_plan_split(made_up, names[run][slot]))
+                goto out;
+            free(cmd[where->index[slot]]);
+            checked_asprintf(&cmd[where->index[slot]], "%s%s",
+                             where->prefix[slot], made_up);
+            free(made_up);
+            if (!cmd[where->index[slot]])
+                goto out;
+        }
+
+        if (dcc_plan_ask_driver(cmd, use_pipe, stage[run], &n_stages[run],
+                                &piped[run]))
+            goto out;
+        dcc_free_argv(cmd);
+        cmd = NULL;
+
+        if (n_stages[run] > 1 && !piped[run]) {
+            if (!(temp = dcc_plan_temp_name(stage[run][0]))
+                || !(names[run][DCC_PLAN_TEMP][DCC_PLAN_PATH] = strdup(temp)))
+                goto out;
+        }
+        for (slot = 0; slot < DCC_PLAN_SLOTS; slot++)
+            for (part = 0; part < DCC_PLAN_PARTS; part++)
+                lookup[run].part[slot][part] = names[run][slot][part];
+        lookup[run].part[DCC_PLAN_ROOT][DCC_PLAN_PATH] = root;
+    }
+
+    /* Both answers must have the same shape... */
+    if (n_stages[0] != n_stages[1] || piped[0] != piped[1])
+        goto out;
+    for (i = 0; i < n_stages[0]; i++)
+        if (dcc_argv_len(stage[0][i]) != dcc_argv_len(stage[1][i]))
+            goto out;
+
+    /* ... and the templates from the first must give the second. */
+    for (i = 0; i < n_stages[0]; i++) {
+        for (j = 0; stage[0][i][j]; j++) {
+            char *t, *check;
+
+            if (!(t = dcc_plan_template(stage[0][i][j], &lookup[0])))
+                goto out;
+            check = dcc_plan_expand(t, &lookup[1]);
+            if (!check || strcmp(check, stage[1][i][j])) {
+                rs_trace("no plan: \"%s\" and \"%s\" don't match",
+                         stage[0][i][j], stage[1][i][j]);
+                free(check);
+                free(t);
+                goto out;
+            }
+            free(check);
+            free(stage[0][i][j]);
+            stage[0][i][j] = t;
+        }
+    }
+    if (n_stages[0] > 1 && !piped[0]) {
+        const char *ext =
+            dcc_find_extension_const(names[0][DCC_PLAN_TEMP][DCC_PLAN_PATH]);
+        if (!(plan->temp_ext = strdup(ext ? ext : ".tmp")))
+            goto out;
+    }
+    ok = 1;
+
+  out:
+    if (cmd)
+        dcc_free_argv(cmd);
+    for (run = 0; run < 2; run++) {
+        dcc_plan_free_names(names[run]);
+        for (i = 0; i < n_stages[run]; i++) {
+            if (ok && run == 0)
+                plan->stage[i] = stage[0][i];
+            else
+                dcc_free_argv(stage[run][i]);
+        }
+    }
+    plan->n_stages = ok ? n_stages[0] : 0;
+    plan->piped = ok && piped[0];
+}
+
+
+/**
+ * Find the plan for compiler command @p argv, asking the driver if this is
+ * the first time we've seen its options.  @p root is the directory that
+ * the job's files were unpacked under, or NULL.  When a plan is learned,
+ * @p check is called on the program of each pass, and may replace it; if
+ * it returns nonzero the plan is not used.
+ *
+ * @returns the plan, or NULL if the driver must be run.
+ **/
+const struct dcc_plan *dcc_plan_find(char **argv, const char *root,
+                                     int (*check)(char **program))
+{
+    struct dcc_plan_args where;
+    struct dcc_plan_names root_names;
+    struct dcc_plan *plan;
+    char *key;
+    int i;
+
+    if (dcc_plan_find_args(argv, &where))
+        return NULL;
+    memset(&root_names, 0, sizeof root_names);
+    root_names.part[DCC_PLAN_ROOT][DCC_PLAN_PATH] = root;
+    if (!(key = dcc_plan_key(argv, &where, &root_names)))
+        return NULL;
+
+    for (i = 0; i < DCC_PLAN_CACHE_SIZE; i++) {
+        if (dcc_plans[i] && !strcmp(dcc_plans[i]->key, key)) {
+            free(key);
+            rs_trace("%s plan for these options",
+                     dcc_plans[i]->n_stages ? "found a" : "have no");
+            return dcc_plans[i]->n_stages ? dcc_plans[i] : NULL;
+        }
+    }
+
+    if (!(plan = calloc(1, sizeof *plan))) {
+        free(key);
+        return NULL;
+    }
+    plan->key = key;
+    dcc_plan_learn(argv, &where, root, 1, plan);
+    if (!plan->n_stages)
+        dcc_plan_learn(argv, &where, root, 0, plan);
+    for (i = 0; check && i < plan->n_stages; i++) {
+        if (check(&plan->stage[i][0])) {
+            rs_log_info("not running %s directly", plan->stage[i][0]);
+            while (plan->n_stages > 0)
+                dcc_free_argv(plan->stage[--plan->n_stages]);
+        }
+    }
+    if (plan->n_stages)
+        rs_log_info("learned a %d-pass %splan for %s", plan->n_stages,
+                    plan->piped ? "piped " : "", argv[0]);
+    else
+        rs_log_info("no plan for these options; running %s", argv[0]);
+
+    /* Remember plans that can't be used too, so as not to ask again. */
+    dcc_plan_free(dcc_plans[dcc_plan_next]);
+    dcc_plans[dcc_plan_next] = plan;
+    dcc_plan_next = (dcc_plan_next + 1) % DCC_PLAN_CACHE_SIZE;
+
+    return plan->n_stages ? plan : NULL;
+}
+
+
+/* Fill in the templates of @p stage from @p names, into @p cmd. */
+static int dcc_plan_expand_argv(char **stage,
+                                const struct dcc_plan_names *names,
+                                char ***cmd)
+{
+    int j, ret;
+
+    if ((ret = dcc_copy_argv(stage, cmd, 0)))
+        return ret;
+    for (j = 0; (*cmd)[j]; j++) {
+        char *arg = dcc_plan_expand((*cmd)[j], names);
+        if (!arg) {
+            dcc_free_argv(*cmd);
+            *cmd = NULL;
+            rs_log_error("failed to allocate compiler pass");
+            return EXIT_OUT_OF_MEMORY;
+        }
+        free((*cmd)[j]);
+        (*cmd)[j] = arg;
+    }
+    return 0;
+}
+
+
+/**
+ * Run the two passes @p cmd joined by a pipe, and wait for both.  The
+ * status is the first pass's if it failed, unless it only died because the
+ * second did, and otherwise the second's.
+ **/
+static int dcc_plan_run_piped(char **cmd[2],
+                              const char *stdout_file,
+                              const char *stderr_file,
+                              int in_fd, int *status)
+{
+    int fds[2], first_status = 0, ret, ret2;
+    pid_t pid, pid2;
+
+    if (pipe(fds) == -1) {
+        rs_log_error("failed to create pipe: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    /* Only the children should hold the pipe open. */
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    ret = dcc_spawn_child_fds(cmd[0], &pid, -1, fds[1], "/dev/null",
+                              NULL, stderr_file);
+    close(fds[1]);
+    if (ret) {
+        close(fds[0]);
+        return ret;
+    }
+    ret2 = dcc_spawn_child_fds(cmd[1], &pid2, fds[0], -1, NULL,
+                               stdout_file, stderr_file);
+    close(fds[0]);
+
+    ret = dcc_collect_child("cc", pid, &first_status, in_fd);
+    if (ret2)
+        return ret2;
+    /* If the first pass was killed, the second soon sees the end of its
+     * input. */
+    ret2 = dcc_collect_child("as", pid2, status,
+                             ret ? timeout_null_fd : in_fd);
+    if (ret)
+        return ret;
+    if (ret2)
+        return ret2;
+
+    if ((WIFSIGNALED(first_status) && WTERMSIG(first_status) == SIGPIPE
+         && (!WIFEXITED(*status) || WEXITSTATUS(*status)))
+        || (WIFEXITED(first_status) && !WEXITSTATUS(first_status)))
+        return 0;
+    *status = first_status;
+    return 0;
+}
+
+
+/**
+ * Run the passes of @p plan for compiler command @p argv, whose files are
+ * under @p root as for dcc_plan_find(), either joined by a pipe or one
+ * after the other, stopping at the first that fails.  The other arguments
+ * and the return value are as for running the compiler with
+ * dcc_spawn_child() and dcc_collect_child(), whose errors are returned.
+ **/
+int dcc_plan_run(const struct dcc_plan *plan, char **argv, const char *root,
+                 const char *stdout_file, const char *stderr_file,
+                 int in_fd, int *status)
+{
+    char *parts[DCC_PLAN_SLOTS][DCC_PLAN_PARTS];
+    struct dcc_plan_names names;
+    struct dcc_plan_args where;
+    char *temp = NULL;
+    char **cmd[DCC_PLAN_MAX_STAGES];
+    pid_t pid;
+    int slot, part, i, ret = 0, out_fd = -1;
+
+    memset(parts, 0, sizeof parts);
+    memset(cmd, 0, sizeof cmd);
+    if (dcc_plan_find_args(argv, &where))
+        return EXIT_DISTCC_FAILED;
+    for (slot = 0; slot < DCC_PLAN_TEMP; slot++)
+        if (where.index[slot] != -1
+            && (ret = dcc_plan_split(dcc_plan_arg_name(argv, &where, slot),
+                                     parts[slot])))
+            goto out;
+    if (plan->temp_ext) {
+        if ((ret = dcc_make_tmpnam("distccd", plan->temp_ext, &temp)))
+            goto out;
+        if (!(parts[DCC_PLAN_TEMP][DCC_PLAN_PATH] = strdup(temp))) {
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+    }
+    for (slot = 0; slot < DCC_PLAN_SLOTS; slot++)
+        for (part = 0; part < DCC_PLAN_PARTS; part++)
+            names.part[slot][part] = parts[slot][part];
+    names.part[DCC_PLAN_ROOT][DCC_PLAN_PATH] = root;
+
+    for (i = 0; i < plan->n_stages; i++)
+        if ((ret = dcc_plan_expand_argv(plan->stage[i], &names, &cmd[i])))
+            goto out;
+
+    if (plan->piped) {
+        ret = dcc_plan_run_piped(cmd, stdout_file, stderr_file, in_fd,
+                                 status);
+        goto out;
+    }
+    /* Every pass adds to the same stdout, so it's only truncated once. */
+    if (stdout_file) {
+        out_fd = open(stdout_file, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0666);
+        if (out_fd == -1) {
+            rs_log_error("failed to open %s: %s", stdout_file,
+                         strerror(errno));
+            ret = EXIT_IO_ERROR;
+            goto out;
+        }
+        set_cloexec_flag(out_fd, 1);
+    }
+    for (i = 0; i < plan->n_stages; i++) {
+        ret = dcc_spawn_child_fds(cmd[i], &pid, -1, out_fd, "/dev/null",
+                                  stdout_file, stderr_file);
+        if (ret == 0)
+            ret = dcc_collect_child("cc", pid, status, in_fd);
+        if (ret || !WIFEXITED(*status) || WEXITSTATUS(*status))
+            goto out;
+    }
+
+  out:
+    if (out_fd != -1)
+        close(out_fd);
+    for (i = 0; i < DCC_PLAN_MAX_STAGES; i++)
+        if (cmd[i])
+            dcc_free_argv(cmd[i]);
+    dcc_plan_free_names(parts);
+    if (temp)
+        unlink(temp);
+    free(temp);
+    return ret;
+}
+
+
+/**
+ * Print the passes of @p plan, with the slots shown as <i>, <o.dir> and
+ * so on, for h_compplan.
+ **/
+void dcc_plan_dump(FILE *f, const struct dcc_plan *plan)
+{
+    static const char *const part_names[DCC_PLAN_PARTS] =
+        { "", ".dir", ".stem" };
+    int i, j;
+    const char *p;
+
+    for (i = 0; i < plan->n_stages; i++) {
+        for (j = 0; plan->stage[i][j]; j++) {
+            fputs(j ? " " : "", f);
+            for (p = plan->stage[i][j]; *p; p++) {
+                if (*p == DCC_PLAN_MARK && p[1]) {
+                    int code = *++p - 'a';
+                    fprintf(f, "<%c%s>",
+                            dcc_plan_slot_names[code / DCC_PLAN_PARTS],
+                            part_names[code % DCC_PLAN_PARTS]);
+                } else {
+                    fputc(*p, f);
+                }
+            }
+        }
+        fputs(plan->piped && i == 0 ? " |\n" : "\n", f);
+    }
+}
@@ -0,0 +1,30 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* compplan.c */
+
+struct dcc_plan;
+
+const struct dcc_plan *dcc_plan_find(char **argv, const char *root,
+                                     int (*check)(char **program));
+int dcc_plan_run(const struct dcc_plan *plan, char **argv, const char *root,
+                 const char *stdout_file, const char *stderr_file,
+                 int in_fd, int *status);
+void dcc_plan_dump(FILE *f, const struct dcc_plan *plan);
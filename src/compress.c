@@ -182,6 +182,33 @@ int dcc_compress_lzo1x_alloc(const char *in_buf,
  **/
 int dcc_r_bulk_lzo1x(int out_fd, int in_fd,
                      unsigned in_len)
+{
+    int ret;
+    char *out_buf = NULL;
+    size_t out_len = 0;
+
+    if (in_len == 0)
+        return 0;               /* just check */
+
+    if ((ret = dcc_r_bulk_lzo1x_alloc(in_fd, in_len, &out_buf, &out_len)))
+        return ret;
+
+    ret = dcc_writex(out_fd, out_buf, out_len);
+    free(out_buf);
+    return ret;
+}
+
+
+/**
+ * Receive @p in_len bytes of LZO1X compressed data from @p in_fd and
+ * decompress them into a freshly malloc'd buffer, returned in @p out_ret.
+ * The caller must free it.
+ *
+ * This is the same as dcc_r_bulk_lzo1x() except that the caller gets to
+ * look at the data before deciding where (or whether) to write it.
+ **/
+int dcc_r_bulk_lzo1x_alloc(int in_fd, unsigned in_len,
+                           char **out_ret, size_t *out_len_ret)
 {
     int ret, lzo_ret;
     char *in_buf = NULL, *out_buf = NULL;
@@ -191,8 +218,11 @@ int dcc_r_bulk_lzo1x(int out_fd, int in_fd,
     /* NOTE: out_size is the buffer size, out_len is the amount of actual
      * data. */
 
+    *out_ret = NULL;
+    *out_len_ret = 0;
+
     if (in_len == 0)
-        return 0;               /* just check */
+        return 0;
 
     if ((in_buf = malloc(in_len)) == NULL) {
         rs_log_error("failed to allocate decompression input");
@@ -229,8 +259,9 @@ int dcc_r_bulk_lzo1x(int out_fd, int in_fd,
                  (long) in_len, (long) out_len,
                  (int) (out_len ? 100*in_len / out_len : 0));
 
-        ret = dcc_writex(out_fd, out_buf, out_len);
-
+        *out_ret = out_buf;
+        *out_len_ret = out_len;
+        out_buf = NULL;
         goto out;
     } else if (lzo_ret == LZO_E_OUTPUT_OVERRUN) {
         free(out_buf);
@@ -50,6 +50,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <syslog.h>
 
 #include <sys/stat.h>
@@ -76,6 +77,7 @@
 #include "srvnet.h"
 #include "daemon.h"
 #include "types.h"
+#include "access.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 #endif
@@ -87,6 +89,10 @@ char const *rs_program_name = "distccd";
 /* for serve.c */
 char const *dcc_daemon_wd;  /* The working directory for the server. */
 
+/* The --allow and --allow-file rules, compiled; NULL if there are none. */
+static struct dcc_allow_trie *dcc_allowed = NULL;
+static volatile sig_atomic_t dcc_allow_reload = 0;
+
 
 static int dcc_inetd_server(void);
 static void dcc_setup_real_log(void);
@@ -167,7 +173,7 @@ int main(int argc, char *argv[])
 
     /* check this before redirecting the logs, so that it's really obvious */
     if (!dcc_should_be_inetd())
-        if (opt_allowed == NULL) {
+        if (opt_allowed == NULL && opt_allow_file == NULL) {
             rs_log_error("--allow option is now mandatory; "
                          "you must specify which clients are allowed to connect");
             ret = EXIT_BAD_ARGUMENTS;
@@ -187,6 +193,10 @@ int main(int argc, char *argv[])
     if ((ret = dcc_discard_root()) != 0)
         dcc_exit(ret);
 
+    /* After discarding root, because a reload will run as the same user. */
+    if ((ret = dcc_load_allowed()) != 0)
+        dcc_exit(ret);
+
     /* Discard privileges before opening log so that if it's created, it has
      * the right ownership. */
     dcc_setup_real_log();
@@ -251,11 +261,72 @@ int dcc_set_lifetime(void)
 }
 
 
+/**
+ * Compile the --allow rules and the contents of the --allow-file into the
+ * allow list.  On failure the old list, if any, stays in force.
+ **/
+int dcc_load_allowed(void)
+{
+    struct dcc_allow_trie *trie;
+    struct dcc_allow_list *l;
+    int ret;
+
+    if (opt_allowed == NULL && opt_allow_file == NULL)
+        return 0;               /* open to everybody */
+
+    if (!(trie = dcc_allow_trie_new()))
+        return EXIT_OUT_OF_MEMORY;
+    for (l = opt_allowed; l; l = l->next)
+        if ((ret = dcc_allow_trie_add(trie, &l->addr, &l->mask)))
+            goto fail;
+    if (opt_allow_file
+        && (ret = dcc_allow_trie_load(trie, opt_allow_file)))
+        goto fail;
+
+    dcc_allow_trie_free(dcc_allowed);
+    dcc_allowed = trie;
+    return 0;
+
+  fail:
+    dcc_allow_trie_free(trie);
+    return ret;
+}
+
+
+/**
+ * Note that the allow list should be reloaded before the next client is
+ * checked.  Called from the SIGHUP handler.
+ **/
+void dcc_reload_allowed_later(void)
+{
+    dcc_allow_reload = 1;
+}
+
+
+/**
+ * Return the allow list to check clients against, reloading it first if
+ * that was asked for.  Every process keeps its own copy.
+ **/
+const struct dcc_allow_trie *dcc_get_allowed(void)
+{
+    if (dcc_allow_reload) {
+        dcc_allow_reload = 0;
+        if (dcc_load_allowed() == 0)
+            rs_log_info("reloaded allow list from %s", opt_allow_file);
+        else
+            rs_log_error("failed to reload %s; still using the old allow list",
+                         opt_allow_file);
+    }
+    return dcc_allowed;
+}
+
+
 /**
  * Set log to the final destination after options have been read.
  **/
 static void dcc_setup_real_log(void)
 {
+    rs_logger_fn *logger = opt_log_batch ? rs_logger_batched : rs_logger_file;
     int fd;
 
     /* Even in inetd mode, we might want to log to stderr, because that will
@@ -263,7 +334,7 @@ static void dcc_setup_real_log(void)
 
     if (opt_log_stderr) {
         rs_remove_all_loggers();
-        rs_add_logger(rs_logger_file, opt_log_level_num, 0, STDERR_FILENO);
+        rs_add_logger(logger, opt_log_level_num, 0, STDERR_FILENO);
         return;
     }
 
@@ -276,7 +347,7 @@ static void dcc_setup_real_log(void)
             /* continue and use syslog */
         } else {
             rs_remove_all_loggers();
-            rs_add_logger(rs_logger_file, opt_log_level_num, NULL, fd);
+            rs_add_logger(logger, opt_log_level_num, NULL, fd);
             return;
         }
     }
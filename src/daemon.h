@@ -27,6 +27,10 @@ extern const char *dcc_daemon_wd;
 int dcc_refuse_root(void);
 int dcc_set_lifetime(void);
 int dcc_log_daemon_started(const char *role);
+struct dcc_allow_trie;
+int dcc_load_allowed(void);
+void dcc_reload_allowed_later(void);
+const struct dcc_allow_trie *dcc_get_allowed(void);
 
 
 /* dsignal.c */
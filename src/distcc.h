@@ -101,7 +101,9 @@ enum dcc_cpp_where {
 enum dcc_protover {
     DCC_VER_1   = 1,            /**< vanilla */
     DCC_VER_2   = 2,            /**< LZO sprinkles */
-    DCC_VER_3   = 3             /**< server-side cpp */
+    DCC_VER_3   = 3,            /**< server-side cpp */
+    DCC_VER_4   = 4,            /**< binary request manifest */
+    DCC_VER_5   = 5             /**< results sent in chunks */
 };
 
 
@@ -150,6 +152,7 @@ int dcc_ssh_connect(char *ssh_cmd, char *user,
 
 /* safeguard.c */
 int dcc_increment_safeguard(void);
+char **dcc_safeguard_environ(void);
 int dcc_recursion_safeguard(void);
 
 /* clirpc.c */
@@ -160,11 +163,13 @@ int dcc_x_argv(int fd,
                const char *argv_token,
                char **argv);
 int dcc_x_cwd(int fd);
+int dcc_x_session(int fd);
 int dcc_is_link(const char *fname, int *is_link);
 int dcc_read_link(const char* fname, char *points_to);
 
 /* srvrpc.c */
 int dcc_r_cwd(int ifd, char **cwd);
+int dcc_r_session_cwd(int ifd, char **session, char **cwd);
 
 /* remote.c */
 int dcc_send_job_corked(int net_fd,
@@ -191,6 +196,9 @@ int dcc_enjoyed_host(const struct dcc_hostdef *host);
 int dcc_disliked_host(const struct dcc_hostdef *host);
 int dcc_remove_disliked(struct dcc_hostdef **hostlist);
 
+/* hoststate.c */
+int dcc_hoststate_filter(struct dcc_hostdef **hostlist);
+
 
 
 #define DISTCC_DEFAULT_PORT 3632
@@ -230,6 +238,9 @@ int dcc_r_bulk_lzo1x(int outf_fd,
                       int in_fd,
                       unsigned in_len);
 
+int dcc_r_bulk_lzo1x_alloc(int in_fd, unsigned in_len,
+                           char **out_ret, size_t *out_len_ret);
+
 
 
 int dcc_compress_file_lzo1x(int in_fd,
@@ -281,11 +292,13 @@ int dcc_get_top_dir(char **path_ret) WARN_UNUSED;
 int dcc_get_tmp_top(const char **p_ret) WARN_UNUSED;
 
 int dcc_mk_tmp_ancestor_dirs(const char* file);
+int dcc_mk_ancestor_dirs(const char* file);
 
 /* cleanup.c */
 void dcc_cleanup_tempfiles(void);
 void dcc_cleanup_tempfiles_from_signal_handler(void);
 int dcc_add_cleanup(const char *filename) WARN_UNUSED;
+void dcc_forget_cleanups_under(const char *dir);
 
 /* strip.c */
 int dcc_strip_local_args(char **from, char ***out_argv);
@@ -323,6 +336,10 @@ int dcc_r_str_alloc(int fd, unsigned len, char **buf);
 
 int tcp_cork_sock(int fd, int corked);
 int dcc_close(int fd);
+int dcc_io_buffer(int fd);
+int dcc_io_unbuffer(int fd);
+int dcc_io_flush(int fd);
+size_t dcc_io_take(int fd, void *buf, size_t len);
 int dcc_get_io_timeout(void);
 int dcc_want_mmap(void);
 
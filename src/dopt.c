@@ -41,6 +41,7 @@
 #include "types.h"
 #include "distcc.h"
 #include "trace.h"
+#include "util.h"
 #include "dopt.h"
 #include "exitcode.h"
 #include "daemon.h"
@@ -81,6 +82,9 @@ char *opt_listen_addr = NULL;
 
 struct dcc_allow_list *opt_allowed = NULL;
 
+/** File of further --allow addresses, reread on SIGHUP.  Absolute. **/
+char *opt_allow_file = NULL;
+
 /**
  * If true, don't detach from the parent.  This is probably necessary
  * for use with daemontools or other monitoring programs, and is also
@@ -90,6 +94,12 @@ int opt_no_detach = 0;
 
 int opt_log_stderr = 0;
 
+/**
+ * If true, each job's log messages go to the log file or stderr in one
+ * write, once the client has its result.
+ **/
+int opt_log_batch = 0;
+
 int opt_log_level_num = RS_LOG_NOTICE;
 
 /**
@@ -103,11 +113,24 @@ const char *arg_log_file = NULL;
 
 int opt_job_lifetime = 0;
 
+/**
+ * Seconds a pump session root may sit unused before it is removed.  0 means
+ * don't keep session roots at all.
+ **/
+int opt_session_timeout = 300;
+
+/**
+ * If true, learn each compiler's passes from "cc -###" and run them
+ * directly, skipping the driver.  See compplan.c.
+ **/
+int opt_compiler_plans = 0;
+
 /* Enumeration values for options that don't have single-letter name.  These
  * must be numerically above all the ascii letters. */
 enum {
     opt_log_to_file = 300,
-    opt_log_level
+    opt_log_level,
+    opt_allow_from_file
 };
 
 #ifdef HAVE_AVAHI
@@ -117,6 +140,8 @@ int opt_zeroconf = 0;
 
 const struct poptOption options[] = {
     { "allow", 'a',      POPT_ARG_STRING, 0, 'a', 0, 0 },
+    { "allow-file", 0,   POPT_ARG_STRING, 0, opt_allow_from_file, 0, 0 },
+    { "compiler-plans", 0, POPT_ARG_NONE, &opt_compiler_plans, 0, 0, 0 },
 #ifdef HAVE_GSSAPI
     { "auth", 0,	 POPT_ARG_NONE, &opt_auth_enabled, 'A', 0, 0 },
     { "blacklist", 0,    POPT_ARG_STRING, &arg_list_file, 'b', 0, 0 },
@@ -127,6 +152,7 @@ const struct poptOption options[] = {
     { "inetd", 0,        POPT_ARG_NONE, &opt_inetd_mode, 0, 0, 0 },
     { "lifetime", 0,     POPT_ARG_INT, &opt_lifetime, 0, 0, 0 },
     { "listen", 0,       POPT_ARG_STRING, &opt_listen_addr, 0, 0, 0 },
+    { "log-batch", 0,    POPT_ARG_NONE, &opt_log_batch, 0, 0, 0 },
     { "log-file", 0,     POPT_ARG_STRING, &arg_log_file, 0, 0, 0 },
     { "log-level", 0,    POPT_ARG_STRING, 0, opt_log_level, 0, 0 },
     { "log-stderr", 0,   POPT_ARG_NONE, &opt_log_stderr, 0, 0, 0 },
@@ -137,6 +163,7 @@ const struct poptOption options[] = {
     { "no-fork", 0,      POPT_ARG_NONE, &opt_no_fork, 0, 0, 0 },
     { "pid-file", 'P',   POPT_ARG_STRING, &arg_pid_file, 0, 0, 0 },
     { "port", 'p',       POPT_ARG_INT, &arg_port, 0, 0, 0 },
+    { "session-timeout", 0, POPT_ARG_INT, &opt_session_timeout, 0, 0, 0 },
 #ifdef HAVE_GSSAPI
     { "show-principal", 0,	 POPT_ARG_NONE, 0, 'P', 0, 0 },
 #endif
@@ -173,10 +200,13 @@ static void distccd_show_usage(void)
 "    --user USER                if run by root, change to this persona\n"
 "    --jobs, -j LIMIT           maximum tasks at any time\n"
 "    --job-lifetime SECONDS     maximum lifetime of a compile request\n"
+"    --session-timeout SECONDS  keep idle pump session roots this long\n"
+"    --compiler-plans           run compiler passes without the driver\n"
 "  Networking:\n"
 "    -p, --port PORT            TCP port to listen on\n"
 "    --listen ADDRESS           IP address to listen on\n"
 "    -a, --allow IP[/BITS]      client address access control\n"
+"    --allow-file FILE          read more --allow addresses from FILE\n"
 #ifdef HAVE_GSSAPI
 "    --auth                     enable GSS-API based mutual authenticaton\n"
 "    --blacklist=FILE           control client access through a blacklist\n"
@@ -194,6 +224,7 @@ static void distccd_show_usage(void)
 "    --no-detach                don't detach from parent (for daemontools, etc)\n"
 "    --log-file=FILE            send messages here instead of syslog\n"
 "    --log-stderr               send messages to stderr\n"
+"    --log-batch                write each job's messages when it's done\n"
 "    --wizard                   for running under gdb\n"
 "  Mode of operation:\n"
 "    --inetd                    serve client connected to stdin\n"
@@ -254,6 +285,16 @@ int distccd_parse_options(int argc, const char **argv)
         }
             break;
 
+        case opt_allow_from_file:
+            /* The daemon changes directory, and rereads the file later. */
+            free(opt_allow_file);
+            if (!(opt_allow_file = strdup(dcc_abspath(poptGetOptArg(po), 0)))) {
+                rs_log_crit("strdup failed");
+                exitcode = EXIT_OUT_OF_MEMORY;
+                goto out_exit;
+            }
+            break;
+
 #ifdef HAVE_GSSAPI
 	    /* Set the flag to indicate that authentication is requested. */
         case 'A': {
@@ -24,6 +24,7 @@
 
 /* dopt.c */
 extern struct dcc_allow_list *opt_allowed;
+extern char *opt_allow_file;
 int distccd_parse_options(int argc, const char *argv[]);
 
 extern int arg_port;
@@ -37,9 +38,12 @@ extern int opt_no_prefork;
 extern int opt_no_detach;
 extern int opt_daemon_mode, opt_inetd_mode;
 extern int opt_job_lifetime;
+extern int opt_session_timeout;
+extern int opt_compiler_plans;
 extern const char *arg_log_file;
 extern int opt_no_fifo;
 extern int opt_log_stderr;
+extern int opt_log_batch;
 extern int opt_lifetime;
 extern char *opt_listen_addr;
 extern int opt_niceness;
@@ -20,131 +20,216 @@
 
 #include <config.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "distcc.h"
+#include "trace.h"
 #include "exitcode.h"
 #include "dotd.h"
 #include "snprintf.h"
 
-/* The dotd file is compiler generated,
- * so it should not have lines with more than
- * twice the length of the maximum path length.
+/* Append @p len bytes at @p data to the growing buffer @p *buf, which
+ * holds @p *buf_len bytes in an allocation of @p *buf_size.
+ * Returns 0 if all goes well, EXIT_OUT_OF_MEMORY otherwise.
  */
-#define MAX_DOTD_LINE_LEN (MAXPATHLEN * 2)
-
-/* Replaces the first occurrence of needle in haystack with
-   new_needle. haystack must be of at least hay_size,
-   and hay_size must be large enough to hold the string
-   after the replacement.
-   new_needle should not overlap with the haystack.
-   Returns 0 if all goes well, 1 otherwise.
-*/
-static int dcc_strgraft(char *haystack, size_t hay_size,
-                        const char *needle, const char *new_needle)
+static int dcc_dotd_emit(char **buf, size_t *buf_len, size_t *buf_size,
+                         const char *data, size_t len)
 {
-    char *found;
-    size_t needle_len = 0;
-    size_t new_needle_len = 0;
+    char *new_buf;
+    size_t new_size;
 
-    found = strstr(haystack, needle);
-    if (found == NULL)
-        return 0;
+    if (*buf_len + len > *buf_size) {
+        new_size = *buf_size * 2;
+        if (new_size < *buf_len + len)
+            new_size = *buf_len + len;
+        if ((new_buf = realloc(*buf, new_size)) == NULL) {
+            rs_log_error("failed to allocate %lu byte .d buffer",
+                         (unsigned long) new_size);
+            return EXIT_OUT_OF_MEMORY;
+        }
+        *buf = new_buf;
+        *buf_size = new_size;
+    }
+    memcpy(*buf + *buf_len, data, len);
+    *buf_len += len;
+    return 0;
+}
+
+/* Return the first occurrence of the @p needle_len bytes at @p needle
+ * in the @p hay_len bytes at @p hay, or NULL.
+ */
+static const char *dcc_dotd_find(const char *hay, size_t hay_len,
+                                 const char *needle, size_t needle_len)
+{
+    const char *p, *end;
 
-    needle_len = strlen(needle);
-    new_needle_len = strlen(new_needle);
+    if (needle_len == 0 || needle_len > hay_len)
+        return NULL;
+    end = hay + hay_len - needle_len + 1;
+    for (p = hay; (p = memchr(p, needle[0], end - p)) != NULL; p++) {
+        if (memcmp(p, needle, needle_len) == 0)
+            return p;
+    }
+    return NULL;
+}
 
-    if (strlen(haystack) - needle_len + new_needle_len + 1 > hay_size)
-        return 1;
+/* Rewrite the @p in_len bytes of a dotd file at @p in into @p *out:
+ * on each line, the first occurrence of server_out_name becomes
+ * client_out_name, and every occurrence of root_dir is removed.
+ * Everything is done in one pass over the input, and lines may be of
+ * any length.
+ */
+static int dcc_dotd_rewrite(const char *in, size_t in_len,
+                            const char *root_dir,
+                            const char *client_out_name,
+                            const char *server_out_name,
+                            char **out, size_t *out_len,
+                            size_t *out_size)
+{
+    size_t root_len = strlen(root_dir);
+    size_t client_len = strlen(client_out_name);
+    size_t server_len = strlen(server_out_name);
+    const char *in_end = in + in_len;
+    const char *line, *line_end, *p, *graft, *trim;
+    int ret;
 
-    /* make some room in the haystack for the new needle */
-    memmove(found + new_needle_len,
-            found + needle_len,
-            strlen(found + needle_len) + 1);
-    memcpy(found, new_needle, new_needle_len);
+    for (line = in; line < in_end; line = line_end) {
+        line_end = memchr(line, '\n', in_end - line);
+        line_end = line_end ? line_end + 1 : in_end;
 
+        graft = dcc_dotd_find(line, line_end - line,
+                              server_out_name, server_len);
+        p = line;
+        for (;;) {
+            trim = dcc_dotd_find(p, line_end - p, root_dir, root_len);
+            /* A root_dir that was trimmed may have eaten the start of
+             * the target name. */
+            if (graft && graft < p)
+                graft = NULL;
+            if (graft && (!trim || graft <= trim)) {
+                if ((ret = dcc_dotd_emit(out, out_len, out_size,
+                                         p, graft - p))
+                    || (ret = dcc_dotd_emit(out, out_len, out_size,
+                                            client_out_name, client_len)))
+                    return ret;
+                p = graft + server_len;
+                graft = NULL;
+            } else if (trim) {
+                if ((ret = dcc_dotd_emit(out, out_len, out_size,
+                                         p, trim - p)))
+                    return ret;
+                p = trim + root_len;
+            } else {
+                if ((ret = dcc_dotd_emit(out, out_len, out_size,
+                                         p, line_end - p)))
+                    return ret;
+                break;
+            }
+        }
+    }
     return 0;
 }
 
 /* Given the name of a dotd file, and the name of the directory
- * masquerading as root, write a @p new_dotd file that
- * contains everything in dotd, but with the "root" directory removed.
- * It will also substitute client_out_name for server_out_name,
- * rewriting the dependency target.
+ * masquerading as root, return in @p new_dotd a newly allocated
+ * buffer of @p new_dotd_len bytes that contains everything in dotd,
+ * but with the "root" directory removed.  It will also substitute
+ * client_out_name for server_out_name, rewriting the dependency
+ * target.
+ *
+ * The file is mapped rather than read where possible, so that its
+ * only copy is the rewritten one, which can be sent as it is.
  */
 int dcc_cleanup_dotd(const char *dotd_fname,
-                     char **new_dotd_fname,
+                     char **new_dotd,
+                     size_t *new_dotd_len,
                      const char *root_dir,
                      const char *client_out_name,
                      const char *server_out_name)
 {
-    /* When we do the substitution of server-side output name to
-     * client-side output name, we may end up with a line that
-     * longer than the longest line we expect from the compiler.
-     */
-    char buf[2 * MAX_DOTD_LINE_LEN];
-
-    FILE *dotd, *tmp_dotd;
-    char *found;
+    int fd;
     int ret;
+    struct stat st;
+    char *in = NULL;
+    int mapped = 0;
+    size_t in_len, out_size;
+    ssize_t n;
 
-    dotd = fopen(dotd_fname, "r");
-    if (dotd == NULL) {
-        return 1;
-    }
-    ret = dcc_make_tmpnam(dcc_find_basename(dotd_fname),
-                          ".d", new_dotd_fname);
+    *new_dotd = NULL;
+    *new_dotd_len = 0;
 
-    if (ret) {
-        fclose(dotd);
-        return ret;
+    if ((fd = open(dotd_fname, O_RDONLY|O_BINARY)) == -1) {
+        rs_log_error("failed to open %s: %s", dotd_fname, strerror(errno));
+        return EXIT_IO_ERROR;
     }
-
-    tmp_dotd = fopen(*new_dotd_fname, "w");
-    if (tmp_dotd == NULL) {
-        fclose(dotd);
-        return 1;
+    if (fstat(fd, &st) == -1) {
+        rs_log_error("fstat %s failed: %s", dotd_fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
     }
+    in_len = (size_t) st.st_size;
 
-    while (fgets(buf, MAX_DOTD_LINE_LEN, dotd)) {
-        if ((strchr(buf, '\n') == NULL) && !feof(dotd)) {
-            /* Line length must have exceeded MAX_DOTD_LINE_LEN: bail out. */
-            fclose(dotd);
-            fclose(tmp_dotd);
-            return 1;
-        }
-
-        /* First, the dependency target substitution */
-        if (dcc_strgraft(buf, sizeof(buf),
-                         server_out_name, client_out_name)) {
-            fclose(dotd);
-            fclose(tmp_dotd);
-            return 1;
-        }
-
-        /* Second, the trimming of the "root" directory" */
-        found = strstr(buf, root_dir);
-        while (found) {
-            char *rest_of_buf = found + strlen(root_dir);
-            memmove(found, rest_of_buf, strlen(rest_of_buf) + 1);
-            found = strstr(found, root_dir);
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if (in_len > 0) {
+        in = mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in == MAP_FAILED)
+            in = NULL;
+        else
+            mapped = 1;
+    }
+#endif
+    if (!mapped && in_len > 0) {
+        if ((in = malloc(in_len)) == NULL) {
+            rs_log_error("failed to allocate %lu byte .d buffer",
+                         (unsigned long) in_len);
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
         }
-        if (fprintf(tmp_dotd, "%s", buf) < 0) {
-            fclose(dotd);
-            fclose(tmp_dotd);
-            return 1;
+        if ((n = read(fd, in, in_len)) == -1) {
+            rs_log_error("failed to read %s: %s", dotd_fname,
+                         strerror(errno));
+            ret = EXIT_IO_ERROR;
+            goto out;
         }
+        in_len = (size_t) n;
     }
-    if (ferror(dotd) || ferror(tmp_dotd)) {
-       return 1;
+
+    /* The output is usually a little shorter than the input. */
+    out_size = in_len + 1;
+    if ((*new_dotd = malloc(out_size)) == NULL) {
+        rs_log_error("failed to allocate %lu byte .d buffer",
+                     (unsigned long) out_size);
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
     }
-    fclose(dotd);
-    if (fclose(tmp_dotd) < 0) {
-        return 1;
+
+    ret = dcc_dotd_rewrite(in, in_len, root_dir,
+                           client_out_name, server_out_name,
+                           new_dotd, new_dotd_len, &out_size);
+
+    out:
+    if (mapped)
+        munmap(in, in_len);
+    else
+        free(in);
+    dcc_close(fd);
+    if (ret) {
+        free(*new_dotd);
+        *new_dotd = NULL;
+        *new_dotd_len = 0;
     }
-    return 0;
+    return ret;
 }
 
 /* Go through arguments (in @p argv), and relevant environment variables, and
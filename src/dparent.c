@@ -71,6 +71,7 @@
 #include "daemon.h"
 #include "netutil.h"
 #include "zeroconf.h"
+#include "trash.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 #endif
@@ -156,6 +157,7 @@ int dcc_standalone_server(void)
         ret = 0;
     } else {
         dcc_log_daemon_started("preforking daemon");
+        dcc_trash_start_reaper(listen_fd);
         ret = dcc_preforking_parent(listen_fd);
     }
 
@@ -210,6 +212,8 @@ void dcc_reap_kids(int must_reap)
         if (kid == 0) {
             /* nobody has exited */
             break;
+        } else if (dcc_trash_reaper_exited(kid)) {
+            dcc_log_child_exited(kid, status);
         } else if (kid != -1) {
             /* child exited */
             --dcc_nkids;
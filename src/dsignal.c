@@ -70,6 +70,8 @@
 volatile pid_t dcc_master_pid = 0;
 
 static RETSIGTYPE dcc_daemon_terminate(int);
+static RETSIGTYPE dcc_daemon_reload(int);
+static void dcc_daemon_catch_reload(void);
 
 /**
  * Catch all relevant termination signals.  Set up in parent and also
@@ -82,8 +84,45 @@ void dcc_daemon_catch_signals(void)
 
     signal(SIGTERM, &dcc_daemon_terminate);
     signal(SIGINT, &dcc_daemon_terminate);
-    signal(SIGHUP, &dcc_daemon_terminate);
     signal(SIGALRM, &dcc_daemon_terminate);
+
+    /* With an --allow-file, SIGHUP rereads it rather than stopping us. */
+    if (opt_allow_file)
+        dcc_daemon_catch_reload();
+    else
+        signal(SIGHUP, &dcc_daemon_terminate);
+}
+
+
+static void dcc_daemon_catch_reload(void)
+{
+    struct sigaction act;
+
+    /* sigaction, so that the handler stays and SIGHUP is blocked while
+     * it runs. */
+    memset(&act, 0, sizeof act);
+    act.sa_handler = dcc_daemon_reload;
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &act, NULL);
+}
+
+
+/**
+ * Reload the allow list before checking the next client.
+ *
+ * Each child has its own copy of the list, so the parent passes the signal
+ * on to its process group.  The copy it sends itself stays pending until
+ * the handler returns, and ignoring the signal discards it.
+ **/
+static RETSIGTYPE dcc_daemon_reload(int whichsig)
+{
+    dcc_reload_allowed_later();
+
+    if (getpid() == dcc_master_pid) {
+        kill(0, whichsig);
+        signal(whichsig, SIG_IGN);
+        dcc_daemon_catch_reload();
+    }
 }
 
 
@@ -38,6 +38,12 @@
  * mode.)  This allows us to cleanly kill off all children and all compilers
  * when the parent is terminated.
  *
+ * Where the system has posix_spawnp(), children are started with it rather
+ * than fork() and exec().  The C library can then use vfork() or clone()
+ * and need not copy the page tables of a large parent such as distccd or
+ * the pump client.  Anything it can't do, or any failure, falls back to
+ * fork(), which gives the same diagnostics as before.
+ *
  * @todo On Cygwin, fork() must be emulated and therefore will be
  * slow.  It would be faster to just use their spawn() call, rather
  * than fork/exec.
@@ -60,6 +66,10 @@
 #include <sys/resource.h>
 #include <sys/poll.h>
 
+#ifdef HAVE_SPAWN_H
+#  include <spawn.h>
+#endif
+
 #ifdef __CYGWIN__
     #define NOGDI
     #include <windows.h>
@@ -74,10 +84,16 @@
 #include "hosts.h"
 #include "dopt.h"
 
+#if defined(HAVE_POSIX_SPAWNP) && defined(HAVE_SPAWN_H) \
+    && !defined(__CYGWIN__)
+#  define DCC_POSIX_SPAWN 1
+#endif
+
 const int timeout_null_fd = -1;
 int dcc_job_lifetime = 0;
 
 static void dcc_inside_child(char **argv,
+                             int stdin_fd, int stdout_fd,
                              const char *stdin_file,
                              const char *stdout_file,
                              const char *stderr_file) NORETURN;
@@ -288,6 +304,7 @@ static void dcc_execvp(char **argv)
  * @param what Type of process to be run here (cpp, cc, ...)
  **/
 static void dcc_inside_child(char **argv,
+                             int stdin_fd, int stdout_fd,
                              const char *stdin_file,
                              const char *stdout_file,
                              const char *stderr_file)
@@ -297,6 +314,23 @@ static void dcc_inside_child(char **argv,
     if ((ret = dcc_ignore_sigpipe(0)))
         goto fail;              /* set handler back to default */
 
+    if (stdin_fd != -1) {
+        if (dup2(stdin_fd, STDIN_FILENO) == -1) {
+            rs_log_error("failed to dup2 stdin: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+            goto fail;
+        }
+        stdin_file = NULL;
+    }
+    if (stdout_fd != -1) {
+        if (dup2(stdout_fd, STDOUT_FILENO) == -1) {
+            rs_log_error("failed to dup2 stdout: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+            goto fail;
+        }
+        stdout_file = NULL;
+    }
+
     /* Ignore failure */
     dcc_increment_safeguard();
 
@@ -366,12 +400,105 @@ int dcc_new_pgrp(void)
 }
 
 
+#ifdef DCC_POSIX_SPAWN
+/**
+ * Start @p argv with posix_spawnp(), setting the child up as
+ * dcc_inside_child() would: SIGPIPE back to the default, the recursion
+ * safeguard raised, stdin/out/err redirected, and for remote jobs a new
+ * process group.
+ *
+ * Returns 0, or the error number of the failure.  Nothing is logged, since
+ * the caller retries with fork() to report the error properly.
+ **/
+static int dcc_posix_spawn_child(char **argv, pid_t *pidptr,
+                                 int stdin_fd, int stdout_fd,
+                                 const char *stdin_file,
+                                 const char *stdout_file,
+                                 const char *stderr_file)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdef;
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    char **envp;
+    char *slash;
+    int ret;
+
+    if (!(envp = dcc_safeguard_environ()))
+        return ENOMEM;
+    if ((ret = posix_spawn_file_actions_init(&actions)))
+        goto out_env;
+    if ((ret = posix_spawnattr_init(&attr)))
+        goto out_actions;
+
+    if (stdin_fd != -1) {
+        if ((ret = posix_spawn_file_actions_adddup2(&actions, stdin_fd,
+                                                    STDIN_FILENO)))
+            goto out;
+    } else if (stdin_file
+        && (ret = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                                   stdin_file, O_RDONLY,
+                                                   0666)))
+        goto out;
+    if (stdout_fd != -1) {
+        if ((ret = posix_spawn_file_actions_adddup2(&actions, stdout_fd,
+                                                    STDOUT_FILENO)))
+            goto out;
+    } else if (stdout_file
+        && (ret = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                                   stdout_file,
+                                                   O_WRONLY | O_CREAT
+                                                   | O_TRUNC, 0666)))
+        goto out;
+    /* Append, as in dcc_redirect_fds(). */
+    if (stderr_file
+        && (ret = posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+                                                   stderr_file,
+                                                   O_WRONLY | O_CREAT
+                                                   | O_APPEND, 0666)))
+        goto out;
+
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGPIPE);
+    if ((ret = posix_spawnattr_setsigdefault(&attr, &sigdef)))
+        goto out;
+
+    /* A fresh child is never a group leader, so this is what
+     * dcc_new_pgrp() does for it. */
+    if (stdout_file != NULL || stdout_fd != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        if ((ret = posix_spawnattr_setpgroup(&attr, 0)))
+            goto out;
+    }
+    if ((ret = posix_spawnattr_setflags(&attr, flags)))
+        goto out;
+
+    ret = posix_spawnp(pidptr, argv[0], &actions, &attr, argv, envp);
+
+    /* Search the path for the basename, as dcc_execvp() does. */
+    if (ret == ENOENT && (slash = strrchr(argv[0], '/')))
+        ret = posix_spawnp(pidptr, slash + 1, &actions, &attr, argv, envp);
+
+  out:
+    posix_spawnattr_destroy(&attr);
+  out_actions:
+    posix_spawn_file_actions_destroy(&actions);
+  out_env:
+    free(envp);
+    return ret;
+}
+#endif /* DCC_POSIX_SPAWN */
+
+
 /**
  * Run @p argv in a child asynchronously.
  *
  * stdin, stdout and stderr are redirected as shown, unless those
  * filenames are NULL.  In that case they are left alone.
  *
+ * The child is started with posix_spawnp() if possible, unless
+ * DISTCC_SPAWN=0, and otherwise with fork().
+ *
  * @warning When called on the daemon, where stdin/stdout may refer to random
  * network sockets, all of the standard file descriptors must be redirected!
  **/
@@ -379,8 +506,40 @@ int dcc_spawn_child(char **argv, pid_t *pidptr,
                     const char *stdin_file,
                     const char *stdout_file,
                     const char *stderr_file)
+{
+    return dcc_spawn_child_fds(argv, pidptr, -1, -1,
+                               stdin_file, stdout_file, stderr_file);
+}
+
+
+/**
+ * Run @p argv in a child as dcc_spawn_child() does, except that stdin and
+ * stdout are the open descriptors @p stdin_fd and @p stdout_fd rather than
+ * the named files, when they are not -1.  This joins compiler passes with a
+ * pipe; the caller should make its ends of the pipe close-on-exec.
+ **/
+int dcc_spawn_child_fds(char **argv, pid_t *pidptr,
+                        int stdin_fd, int stdout_fd,
+                        const char *stdin_file,
+                        const char *stdout_file,
+                        const char *stderr_file)
 {
     pid_t pid;
+#ifdef DCC_POSIX_SPAWN
+    int ret;
+
+    if (dcc_getenv_bool("DISTCC_SPAWN", 1)) {
+        dcc_trace_argv("spawning", argv);
+        ret = dcc_posix_spawn_child(argv, &pid, stdin_fd, stdout_fd,
+                                    stdin_file, stdout_file, stderr_file);
+        if (ret == 0) {
+            *pidptr = pid;
+            rs_trace("child started as pid%d", (int) pid);
+            return 0;
+        }
+        rs_trace("posix_spawn failed: %s; trying fork", strerror(ret));
+    }
+#endif
 
     dcc_trace_argv("forking to execute", argv);
 
@@ -396,11 +555,12 @@ int dcc_spawn_child(char **argv, pid_t *pidptr,
          * the compiler has an infinite loop bug, the new group
          * will run forever until you kill it.
          */
-        if (stdout_file != NULL) {
+        if (stdout_file != NULL || stdout_fd != -1) {
             if (dcc_new_pgrp() != 0)
                 rs_trace("Unable to start a new group\n");
         }
-        dcc_inside_child(argv, stdin_file, stdout_file, stderr_file);
+        dcc_inside_child(argv, stdin_fd, stdout_fd,
+                         stdin_file, stdout_file, stderr_file);
         /* !! NEVER RETURN FROM HERE !! */
     } else {
         *pidptr = pid;
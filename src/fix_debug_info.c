@@ -42,7 +42,11 @@
   #include <sys/mman.h>
 #endif
 
+#include "distcc.h"
 #include "trace.h"
+#include "exitcode.h"
+#include "rpc.h"
+#include "bulk.h"
 #include "fix_debug_info.h"
 
 /* XINDEX isn't defined everywhere, but where it is, it's always the
@@ -232,24 +236,32 @@ static int FindElfSection(const void *elf_mapped_base, off_t elf_size,
  * Search in a memory buffer (starting at @p base and of size @p size)
  * for a string (@p search), and replace @p search with @p replace
  * in all null-terminated strings that contain @p search.
+ *
+ * Only candidate positions found by memchr() are compared, so this
+ * costs little more than a single read of the buffer.
  */
 static int replace_string(void *base, size_t size,
                            const char *search, const char *replace) {
   char *start = (char *) base;
   char *end = (char *) base + size;
   int count = 0;
+  char *last;
   char *p;
   size_t search_len = strlen(search);
   size_t replace_len = strlen(replace);
 
   assert(replace_len == search_len);
 
-  if (size < search_len + 1)
+  if (search_len == 0 || size < search_len + 1)
     return 0;
-  for (p = start; p < end - search_len - 1; p++) {
+  last = end - search_len - 1;
+  for (p = start;
+       p < last && (p = memchr(p, search[0], last - p)) != NULL;
+       p++) {
     if (memcmp(p, search, search_len) == 0) {
       memcpy(p, replace, replace_len);
       count++;
+      p += search_len - 1;
     }
   }
   return count;
@@ -283,7 +295,7 @@ static void *mmap_file(const char *path, int *p_fd, struct stat *st) {
     return NULL;
   }
 
-#ifdef HAVE_SYS_MMAP_H
+#ifdef HAVE_SYS_MMAN_H
   base = mmap(NULL, st->st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   if (base == MAP_FAILED) {
     rs_log_error("mmap of file '%s' failed: %s", path, strerror(errno));
@@ -312,7 +324,7 @@ static void *mmap_file(const char *path, int *p_fd, struct stat *st) {
 static int munmap_file(void *base, const char *path, int fd,
                 const struct stat *st) {
   int status = 0;
-#ifdef HAVE_SYS_MMAP_H
+#ifdef HAVE_SYS_MMAN_H
   if (munmap(base, st->st_size) != 0) {
     rs_log_error("munmap of file '%s' failed: %s", path, strerror(errno));
     status = 1;
@@ -345,6 +357,7 @@ static void update_section(const char *path,
                            const void *base,
                            off_t size,
                            const char *desired_section_name,
+                           int expect_one,
                            const char *search,
                            const char *replace) {
   const void *desired_section = NULL;
@@ -368,7 +381,7 @@ static void update_section(const char *path,
       rs_log_info("updated \"%s\" section of file \"%s\": "
                   "replaced %d occurrences of \"%s\" with \"%s\"",
                   desired_section_name, path, count, search, replace);
-      if (count > 1) {
+      if (count > 1 && expect_one) {
         rs_log_warning("only expected to replace one occurrence!");
       }
     }
@@ -377,10 +390,25 @@ static void update_section(const char *path,
   }
 }
 
+/*
+ * Replace all occurrences of @p search with @p replace in the debug
+ * sections of the ELF file @p path, which is loaded at @p base.
+ *
+ * The directory names of DWARF 5 line tables live in ".debug_line_str";
+ * older versions keep them in ".debug_line" itself.  Those tables
+ * usually name the directory many times.
+ */
+static void update_debug_sections(const char *path, void *base, off_t size,
+                                  const char *search, const char *replace) {
+  update_section(path, base, size, ".debug_info", 1, search, replace);
+  update_section(path, base, size, ".debug_str", 1, search, replace);
+  update_section(path, base, size, ".debug_line", 0, search, replace);
+  update_section(path, base, size, ".debug_line_str", 0, search, replace);
+}
+
 /*
  * Update the ELF file residing at @p path, replacing all occurrences
- * of @p search with @p replace in that file's ".debug_info" or
- * ".debug_str" section.
+ * of @p search with @p replace in that file's debug sections.
  * The replacement string must be the same length or shorter than
  * the search string.
  * Returns 0 on success (whether or not ".debug_info" section was
@@ -398,13 +426,41 @@ static int update_debug_info(const char *path, const char *search,
     return 0;
   }
 
-  update_section(path, base, st.st_size, ".debug_info", search, replace);
-  update_section(path, base, st.st_size, ".debug_str", search, replace);
+  update_debug_sections(path, base, st.st_size, search, replace);
 
   return munmap_file(base, path, fd, &st);
 }
 #endif /* HAVE_ELF_H */
 
+/*
+ * Return a copy of @p client_path padded with trailing slashes to the
+ * length of @p server_path, or NULL if out of memory.
+ *
+ * We can only safely replace a string with another of exactly
+ * the same length.  (Replacing a string with a shorter string
+ * results in errors from gdb.)
+ */
+static char *pad_client_path(const char *client_path,
+                             const char *server_path) {
+  size_t client_path_len = strlen(client_path);
+  size_t server_path_len = strlen(server_path);
+  char *client_path_plus_slashes;
+
+  assert(client_path_len <= server_path_len);
+  client_path_plus_slashes = malloc(server_path_len + 1);
+  if (!client_path_plus_slashes) {
+    rs_log_crit("failed to allocate memory");
+    return NULL;
+  }
+  strcpy(client_path_plus_slashes, client_path);
+  while (client_path_len < server_path_len) {
+    client_path_plus_slashes[client_path_len++] = '/';
+  }
+  client_path_plus_slashes[client_path_len] = '\0';
+  rs_log_info("client_path_plus_slashes = %s", client_path_plus_slashes);
+  return client_path_plus_slashes;
+}
+
 /*
  * Edit the ELF file residing at @p path, changing all occurrences of
  * the path @p server_path to @p client_path in the debugging info.
@@ -412,11 +468,11 @@ static int update_debug_info(const char *path, const char *search,
  * We're a bit sloppy about that; rather than properly parsing
  * the DWARF debug info, finding the DW_AT_comp_dir (compilation working
  * directory) field and the DW_AT_name (source file name) field,
- * we just do a search-and-replace in the ".debug_info" and ".debug_str"
- * sections.  But this is good enough.
+ * we just do a search-and-replace in the ".debug_info", ".debug_str",
+ * ".debug_line" and ".debug_line_str" sections.  But this is good enough.
  *
- * Returns 0 on success (whether or not the ".debug_info" and ".debug_str"
- * sections were found or updated).
+ * Returns 0 on success (whether or not the debug sections were found or
+ * updated).
  * Returns 1 on serious error that should cause distcc to fail.
  */
 int dcc_fix_debug_info(const char *path, const char *client_path,
@@ -427,28 +483,82 @@ int dcc_fix_debug_info(const char *path, const char *client_path,
            server_path, client_path, path);
   return 0;
 #else
-  /*
-   * We can only safely replace a string with another of exactly
-   * the same length.  (Replacing a string with a shorter string
-   * results in errors from gdb.)
-   * So we append trailing slashes on the client side path.
-   */
-  size_t client_path_len = strlen(client_path);
-  size_t server_path_len = strlen(server_path);
-  assert(client_path_len <= server_path_len);
-  char *client_path_plus_slashes = malloc(server_path_len + 1);
-  if (!client_path_plus_slashes) {
-    rs_log_crit("failed to allocate memory");
+  char *client_path_plus_slashes;
+  int ret;
+
+  /* So we append trailing slashes on the client side path. */
+  client_path_plus_slashes = pad_client_path(client_path, server_path);
+  if (!client_path_plus_slashes)
     return 1;
+  ret = update_debug_info(path, server_path, client_path_plus_slashes);
+  free(client_path_plus_slashes);
+  return ret;
+#endif
+}
+
+/*
+ * Send the ELF file residing at @p path to @p ofd with @p token, as
+ * dcc_x_file() does, with the debug info fixed as by dcc_fix_debug_info().
+ *
+ * The file is mapped copy-on-write and the replacements are made in the
+ * mapping, which is then sent (or compressed) directly.  So the object is
+ * read only once, only the pages that hold a match get copied, and the
+ * file itself is left alone.  Where that isn't possible, this falls back
+ * to fixing the file in place and sending it.
+ *
+ * If @p chunked, the file is sent in chunks as for protocol 5.
+ *
+ * Returns 0 on success or an error from exitcode.h.
+ */
+int dcc_x_file_fix_debug_info(int ofd, const char *path, const char *token,
+                              enum dcc_compress compression,
+                              const char *client_path,
+                              const char *server_path,
+                              int chunked)
+{
+#if defined(HAVE_ELF_H) && defined(HAVE_SYS_MMAN_H)
+  char *client_path_plus_slashes;
+  struct stat st;
+  void *base;
+  int fd;
+  int ret;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    rs_log_error("error opening file '%s': %s", path, strerror(errno));
+    return EXIT_IO_ERROR;
   }
-  strcpy(client_path_plus_slashes, client_path);
-  while (client_path_len < server_path_len) {
-    client_path_plus_slashes[client_path_len++] = '/';
+  if (fstat(fd, &st) != 0 || st.st_size <= 0
+      || (base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      fd, 0)) == MAP_FAILED) {
+    close(fd);
+    goto fallback;
   }
-  client_path_plus_slashes[client_path_len] = '\0';
-  rs_log_info("client_path_plus_slashes = %s", client_path_plus_slashes);
-  return update_debug_info(path, server_path, client_path_plus_slashes);
+  close(fd);
+
+  client_path_plus_slashes = pad_client_path(client_path, server_path);
+  if (!client_path_plus_slashes) {
+    munmap(base, st.st_size);
+    return EXIT_OUT_OF_MEMORY;
+  }
+  update_debug_sections(path, base, st.st_size, server_path,
+                        client_path_plus_slashes);
+  free(client_path_plus_slashes);
+
+  if (chunked)
+    ret = dcc_x_buf_chunked(ofd, base, (size_t) st.st_size, token,
+                            compression);
+  else
+    ret = dcc_x_buf(ofd, base, (size_t) st.st_size, token, compression);
+  munmap(base, st.st_size);
+  return ret;
+
+ fallback:
 #endif
+  if (dcc_fix_debug_info(path, client_path, server_path))
+    return EXIT_IO_ERROR;
+  if (chunked)
+    return dcc_x_file_chunked(ofd, path, token, compression);
+  return dcc_x_file(ofd, path, token, compression, NULL);
 }
 
 #ifdef TEST
@@ -25,4 +25,10 @@
 int dcc_fix_debug_info(const char *path, const char *client_cwd,
                               const char *server_cwd);
 
+int dcc_x_file_fix_debug_info(int ofd, const char *path, const char *token,
+                              enum dcc_compress compression,
+                              const char *client_path,
+                              const char *server_path,
+                              int chunked);
+
 #endif  /* DISTCC_FIX_DEBUG_INFO_H__ */
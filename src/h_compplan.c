@@ -0,0 +1,107 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Test harness and benchmark for compiler plans.
+ *
+ * Usage: h_compplan COUNT COMPILER ARG ...
+ *
+ * Learns the plan for the compiler command, prints its passes, and then
+ * runs the command COUNT times through the driver and COUNT times from the
+ * plan, printing the time each way took.  Exits with the last run's exit
+ * code, or 1 if there is no plan.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exec.h"
+#include "exitcode.h"
+#include "compplan.h"
+
+const char *rs_program_name = "h_compplan";
+
+
+static long usec_since(const struct timeval *before)
+{
+    struct timeval after;
+
+    gettimeofday(&after, NULL);
+    return (after.tv_sec - before->tv_sec) * 1000000L
+        + (after.tv_usec - before->tv_usec);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const struct dcc_plan *plan;
+    struct timeval before;
+    long usec;
+    int count, i, status = 0, ret;
+    pid_t pid;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: h_compplan COUNT COMPILER ARG ...\n");
+        return EXIT_BAD_ARGUMENTS;
+    }
+    count = atoi(argv[1]);
+
+    if (!(plan = dcc_plan_find(argv + 2, NULL, NULL))) {
+        printf("no plan\n");
+        return 1;
+    }
+    dcc_plan_dump(stdout, plan);
+
+    gettimeofday(&before, NULL);
+    for (i = 0; i < count; i++) {
+        if ((ret = dcc_spawn_child(argv + 2, &pid, "/dev/null",
+                                   "/dev/null", "/dev/null"))
+            || (ret = dcc_collect_child("h_compplan", pid, &status,
+                                        timeout_null_fd)))
+            return ret;
+    }
+    usec = usec_since(&before);
+    printf("driver: %d runs in %ldus, %ldus each\n", count, usec,
+           count ? usec / count : 0L);
+
+    gettimeofday(&before, NULL);
+    for (i = 0; i < count; i++) {
+        if ((ret = dcc_plan_run(plan, argv + 2, NULL, "/dev/null",
+                                "/dev/null", timeout_null_fd, &status)))
+            return ret;
+    }
+    usec = usec_since(&before);
+    printf("plan: %d runs in %ldus, %ldus each\n", count, usec,
+           count ? usec / count : 0L);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_DISTCC_FAILED;
+}
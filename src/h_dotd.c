@@ -42,7 +42,9 @@
 #define USAGE \
 "usage: h_dotd COMMAND ARGS...\n" \
     "where\n" \
-    "  COMMAND is dcc_get_dotd_info, ARGS is NAME\n"
+    "  COMMAND is dcc_get_dotd_info, ARGS is NAME\n" \
+    "  COMMAND is dcc_cleanup_dotd, ARGS is FILE ROOT_DIR CLIENT_OUT" \
+    " SERVER_OUT\n"
 
 const char *rs_program_name = __FILE__;
 
@@ -67,6 +69,18 @@ int main(int argc, char *argv[])
                " 'dotd_target':'%s'}",
                dotd_fname, needs_dotd, sets_dotd_target,
                dotd_target ? dotd_target : "None");
+    } else if (strcmp(argv[1], "dcc_cleanup_dotd") == 0) {
+        char *new_dotd;
+        size_t new_dotd_len;
+        if (argc != 6) {
+            rs_log_error(USAGE);
+            return 1;
+        }
+        if (dcc_cleanup_dotd(argv[2], &new_dotd, &new_dotd_len,
+                             argv[3], argv[4], argv[5]))
+            return 1;
+        fwrite(new_dotd, 1, new_dotd_len, stdout);
+        free(new_dotd);
     } else {
         rs_log_error(USAGE);
         return 1;
@@ -36,6 +36,9 @@
  *
  * "ssh" USER HOST COMMAND
  * "tcp" HOST PORT
+ *
+ * With "-b COUNT", instead reads the host list COUNT times and prints how
+ * long that took, to measure the parser and the host list cache.
  **/
 
 
@@ -48,6 +51,8 @@
 #include <errno.h>
 #include <time.h>
 
+#include <sys/time.h>
+
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -58,9 +63,36 @@
 #include "util.h"
 #include "hosts.h"
 #include "exitcode.h"
+#include "timeval.h"
 
 const char *rs_program_name = "h_hosts";
 
+
+static int bench_hostlist(int count)
+{
+    struct dcc_hostdef *list, *e;
+    struct timeval start, end, elapsed;
+    int nhosts, i;
+    int ret;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+        if ((ret = dcc_get_hostlist(&list, &nhosts)) != 0)
+            return ret;
+        while ((e = list) != NULL) {
+            list = e->next;
+            dcc_free_hostdef(e);
+        }
+    }
+    gettimeofday(&end, NULL);
+    timeval_subtract(&elapsed, &end, &start);
+
+    printf("%d host lists of %d hosts in %ld.%06lds\n", count, nhosts,
+           (long) elapsed.tv_sec, (long) elapsed.tv_usec);
+    return 0;
+}
+
+
 int main(int UNUSED(argc), char **argv)
 {
     struct dcc_hostdef *list, *e;
@@ -71,6 +103,9 @@ int main(int UNUSED(argc), char **argv)
 
     if (argv[1] && !strcmp(argv[1], "-v")) {
         rs_trace_set_level(RS_LOG_DEBUG);
+    } else if (argv[1] && !strcmp(argv[1], "-b") && argv[2]) {
+        rs_trace_set_level(RS_LOG_WARNING);
+        exit(bench_hostlist(atoi(argv[2])));
     }
 
     if ((ret = dcc_get_hostlist(&list, &nhosts)) != 0) {
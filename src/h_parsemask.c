@@ -39,29 +39,78 @@
 
 const char * rs_program_name = "h_parsemask";
 
+#define MAX_MASKS 64
+
+/*
+ * Usage: h_parsemask MASK[,MASK...] CLIENT
+ *
+ * Checks CLIENT against the masks both one by one and through the compiled
+ * allow list, and fails if the two disagree.
+ */
 int main(int argc, char **argv)
 {
-    int ret;
-    dcc_address_t value, mask;
+    int ret, i, n = 0, one_by_one = EXIT_ACCESS_DENIED;
+    dcc_address_t value[MAX_MASKS], mask[MAX_MASKS];
+    struct dcc_allow_trie *trie;
     struct sockaddr_in client_ia;
+#ifdef ENABLE_RFC2553
+    struct sockaddr_in6 client_ia6;
+#endif
+    struct sockaddr *client = (struct sockaddr *) &client_ia;
+    char *spec;
 
     rs_add_logger(rs_logger_file, RS_LOG_DEBUG, NULL, STDERR_FILENO);
     rs_trace_set_level(RS_LOG_INFO);
 
     if (argc != 3) {
-        rs_log_error("usage: h_parsemask MASK CLIENT");
+        rs_log_error("usage: h_parsemask MASK[,MASK...] CLIENT");
         return EXIT_BAD_ARGUMENTS;
     }
 
-    ret = dcc_parse_mask(argv[1], &value, &mask);
-    if (ret)
-        return ret;
+    if (!(trie = dcc_allow_trie_new()))
+        return EXIT_OUT_OF_MEMORY;
+    for (spec = strtok(argv[1], ","); spec; spec = strtok(NULL, ",")) {
+        if (n == MAX_MASKS) {
+            rs_log_error("too many masks");
+            return EXIT_BAD_ARGUMENTS;
+        }
+        ret = dcc_parse_mask(spec, &value[n], &mask[n]);
+        if (ret)
+            return ret;
+        if ((ret = dcc_allow_trie_add(trie, &value[n], &mask[n])))
+            return ret;
+        n++;
+    }
 
-    client_ia.sin_family = AF_INET;
-    if (!inet_aton(argv[2], &client_ia.sin_addr)) {
-        rs_log_error("can't parse client address \"%s\"", argv[2]);
-        return EXIT_BAD_ARGUMENTS;
+#ifdef ENABLE_RFC2553
+    if (strchr(argv[2], ':')) {
+        memset(&client_ia6, 0, sizeof client_ia6);
+        client_ia6.sin6_family = AF_INET6;
+        if (inet_pton(AF_INET6, argv[2], &client_ia6.sin6_addr) != 1) {
+            rs_log_error("can't parse client address \"%s\"", argv[2]);
+            return EXIT_BAD_ARGUMENTS;
+        }
+        client = (struct sockaddr *) &client_ia6;
+    } else
+#endif
+    {
+        client_ia.sin_family = AF_INET;
+        if (!inet_aton(argv[2], &client_ia.sin_addr)) {
+            rs_log_error("can't parse client address \"%s\"", argv[2]);
+            return EXIT_BAD_ARGUMENTS;
+        }
     }
 
-    return dcc_check_address((struct sockaddr *) &client_ia, &value, &mask);
+    for (i = 0; i < n; i++)
+        if (dcc_check_address(client, &value[i], &mask[i]) == 0)
+            one_by_one = 0;
+
+    ret = dcc_allow_trie_check(trie, client);
+    dcc_allow_trie_free(trie);
+    if (ret != one_by_one) {
+        rs_log_error("allow list gave %d, but the masks one by one gave %d",
+                     ret, one_by_one);
+        return EXIT_DISTCC_FAILED;
+    }
+    return ret;
 }
@@ -0,0 +1,104 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Test harness and benchmark for dcc_spawn_child().
+ *
+ * Usage: h_spawn [-m MB] COUNT STDOUT STDERR PROGRAM [ARG ...]
+ *
+ * Runs PROGRAM COUNT times, one after the other, with stdin from /dev/null
+ * and stdout and stderr redirected to the named files, as distccd runs the
+ * compiler.  With -m, first allocates and touches MB megabytes, to see what
+ * starting children costs a large parent.
+ *
+ * Prints the time each run took to start and finish, and exits with the
+ * last run's exit code.  DISTCC_SPAWN=0 times the fork() path.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exec.h"
+#include "exitcode.h"
+
+const char *rs_program_name = "h_spawn";
+
+
+int main(int argc, char *argv[])
+{
+    struct timeval before, after;
+    char *ballast = NULL;
+    long usec;
+    size_t mb = 0;
+    int count, i, status = 0, ret;
+    pid_t pid;
+
+    if (argc > 2 && !strcmp(argv[1], "-m")) {
+        mb = (size_t) atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 5) {
+        fprintf(stderr, "usage: h_spawn [-m MB] COUNT STDOUT STDERR "
+                "PROGRAM [ARG ...]\n");
+        return EXIT_BAD_ARGUMENTS;
+    }
+    count = atoi(argv[1]);
+
+    if (mb) {
+        if (!(ballast = malloc(mb << 20))) {
+            fprintf(stderr, "h_spawn: failed to allocate %luMB\n",
+                    (unsigned long) mb);
+            return EXIT_OUT_OF_MEMORY;
+        }
+        memset(ballast, 1, mb << 20);
+    }
+
+    gettimeofday(&before, NULL);
+    for (i = 0; i < count; i++) {
+        if ((ret = dcc_spawn_child(argv + 4, &pid, "/dev/null",
+                                   argv[2], argv[3]))
+            || (ret = dcc_collect_child("h_spawn", pid, &status,
+                                        timeout_null_fd)))
+            return ret;
+    }
+    gettimeofday(&after, NULL);
+
+    usec = (after.tv_sec - before.tv_sec) * 1000000L
+        + (after.tv_usec - before.tv_usec);
+    printf("%d runs in %ldus, %ldus each\n", count, usec,
+           count ? usec / count : 0L);
+
+    free(ballast);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_DISTCC_FAILED;
+}
@@ -0,0 +1,97 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Test harness for zeroconf-caps.c, standing in for mDNS.
+ *
+ * Usage: h_zeroconf [SLOTS_PER_CPU]
+ *
+ * Input: one announced service per line,
+ *
+ * ADDRESS PORT [KEY=VALUE ...]
+ *
+ * where the KEY=VALUE words are the service's TXT records.
+ *
+ * Output: the host list the zeroconf daemon would write for those
+ * services, one "ADDRESS:PORT/SLOTS" per line, written by the same
+ * dcc_zeroconf_write_hosts().
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "distcc.h"
+#include "hosts.h"
+#include "zeroconf.h"
+#include "exitcode.h"
+
+const char *rs_program_name = "h_zeroconf";
+
+#define MAX_SERVICES 64
+
+
+int main(int argc, char *argv[])
+{
+    static struct dcc_zeroconf_entry services[MAX_SERVICES];
+    char line[1024];
+    int n_slots = 4;
+    int n = 0;
+
+    if (argc > 1)
+        n_slots = atoi(argv[1]);
+
+    while (fgets(line, sizeof line, stdin)) {
+        struct dcc_zeroconf_entry *s;
+        char *word;
+
+        if (!(word = strtok(line, " \t\n")))
+            continue;
+        if (n == MAX_SERVICES) {
+            fprintf(stderr, "h_zeroconf: too many services\n");
+            return EXIT_BAD_ARGUMENTS;
+        }
+        s = &services[n];
+        strncpy(s->address, word, sizeof s->address - 1);
+        if (!(word = strtok(NULL, " \t\n"))) {
+            fprintf(stderr, "h_zeroconf: no port for %s\n", s->address);
+            return EXIT_BAD_ARGUMENTS;
+        }
+        s->port = (unsigned) atoi(word);
+
+        dcc_zeroconf_caps_init(&s->caps);
+        while ((word = strtok(NULL, " \t\n"))) {
+            char *eq = strchr(word, '=');
+            if (!eq)
+                continue;
+            *eq = '\0';
+            dcc_zeroconf_caps_set(&s->caps, word, eq + 1);
+        }
+        n++;
+    }
+
+    return dcc_zeroconf_write_hosts(1, services, n, n_slots);
+}
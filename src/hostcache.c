@@ -0,0 +1,436 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Cache of the parsed host list.
+ *
+ * Every client invocation used to parse the host list from scratch, which
+ * for a long list costs several allocations and string copies per host.
+ * Instead, the parsed list is saved in $DISTCC_DIR/hostcache together with a
+ * key naming where it came from: the text of $DISTCC_HOSTS, or the name,
+ * inode, size, mtime (to the nanosecond where possible) and ctime of a
+ * hosts file.  Later clients with the same key
+ * read the whole file in one go and build each hostdef, with its strings,
+ * in a single allocation.
+ *
+ * The file is only meaningful on the machine that wrote it:
+ *
+ *   struct dcc_hostcache_header
+ *   KEY, padded to a multiple of 8 bytes
+ *   struct dcc_hostcache_entry[n_hosts]
+ *   the strings of each entry in turn, nul-terminated
+ *
+ * Set DISTCC_HOSTS_CACHE=0 to parse every time.
+ **/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "hosts.h"
+
+
+#define DCC_HOSTCACHE_MAGIC 0x44484300 /* "DHC\0" */
+
+/* Bump when the layout of the cache changes. */
+#define DCC_HOSTCACHE_VERSION 4
+
+/* Don't trust anything bigger than this. */
+#define DCC_HOSTCACHE_MAX_SIZE (4 << 20)
+
+static const char dcc_hostcache_name[] = "hostcache";
+
+#define DCC_HOSTCACHE_N_STRINGS 4
+
+struct dcc_hostcache_header {
+    unsigned magic;
+    unsigned version;
+    unsigned header_size;
+    unsigned entry_size;
+    unsigned total_size;
+    unsigned key_len;
+    unsigned n_hosts;
+    int randomize;
+    int local_slots;
+    int local_cpp_slots;
+};
+
+struct dcc_hostcache_entry {
+    int mode;
+    int port;
+    int is_up;
+    int n_slots;
+    int protover;
+    int compr;
+    int cpp_where;
+    int use_session;
+    int use_manifest;
+    int use_stream;
+    int authenticate;
+    /* user, hostname, ssh_command, hostdef_string; -1 if NULL */
+    int str_len[DCC_HOSTCACHE_N_STRINGS];
+};
+
+
+static size_t dcc_hostcache_pad(size_t len)
+{
+    return (len + 7) & ~(size_t) 7;
+}
+
+
+static int dcc_hostcache_path(char **path_ret)
+{
+    char *topdir;
+    int ret;
+
+    if ((ret = dcc_get_top_dir(&topdir)))
+        return ret;
+
+    if (asprintf(path_ret, "%s/%s", topdir, dcc_hostcache_name) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+/**
+ * Build a hostdef whose strings live in the same allocation, from a cache
+ * entry and its strings at @p strings.
+ **/
+static struct dcc_hostdef *
+dcc_hostcache_make_hostdef(const struct dcc_hostcache_entry *e,
+                           const char *strings, size_t strings_len)
+{
+    struct dcc_hostdef *h;
+    char **fields[DCC_HOSTCACHE_N_STRINGS];
+    char *p;
+    int i;
+
+    if ((h = calloc(1, sizeof *h + strings_len)) == NULL) {
+        rs_log_crit("failed to allocate host definition");
+        return NULL;
+    }
+    p = (char *) (h + 1);
+    memcpy(p, strings, strings_len);
+
+    h->mode = e->mode;
+    h->port = e->port;
+    h->is_up = e->is_up;
+    h->n_slots = e->n_slots;
+    h->protover = (enum dcc_protover) e->protover;
+    h->compr = (enum dcc_compress) e->compr;
+    h->cpp_where = (enum dcc_cpp_where) e->cpp_where;
+    h->use_session = e->use_session;
+    h->use_manifest = e->use_manifest;
+    h->use_stream = e->use_stream;
+#ifdef HAVE_GSSAPI
+    h->authenticate = e->authenticate;
+#endif
+    h->packed = 1;
+
+    fields[0] = &h->user;
+    fields[1] = &h->hostname;
+    fields[2] = &h->ssh_command;
+    fields[3] = &h->hostdef_string;
+    for (i = 0; i < DCC_HOSTCACHE_N_STRINGS; i++) {
+        if (e->str_len[i] < 0)
+            continue;
+        *fields[i] = p;
+        p += e->str_len[i] + 1;
+    }
+
+    return h;
+}
+
+
+/**
+ * Check the entries and strings of a cache @p len bytes long at @p buf,
+ * returning the total length of the strings, or -1 if the file is
+ * inconsistent.
+ **/
+static long dcc_hostcache_check(const char *buf, size_t len,
+                                const struct dcc_hostcache_header *hdr)
+{
+    const struct dcc_hostcache_entry *entries;
+    const char *strings, *s;
+    size_t offset, n;
+    unsigned i;
+    int j;
+
+    offset = sizeof *hdr + dcc_hostcache_pad(hdr->key_len);
+    if (hdr->n_hosts > (len - offset) / sizeof *entries)
+        return -1;
+    entries = (const struct dcc_hostcache_entry *) (buf + offset);
+    strings = (const char *) (entries + hdr->n_hosts);
+
+    s = strings;
+    for (i = 0; i < hdr->n_hosts; i++) {
+        for (j = 0; j < DCC_HOSTCACHE_N_STRINGS; j++) {
+            if (entries[i].str_len[j] < 0)
+                continue;
+            n = (size_t) entries[i].str_len[j];
+            if (n >= (size_t) (buf + len - s) || s[n] != '\0')
+                return -1;
+            s += n + 1;
+        }
+    }
+    return (long) (s - strings);
+}
+
+
+/**
+ * Load the host list saved under @p key, if any.  The list is returned in
+ * the order it was parsed; @p ret_randomize says whether it asked to be
+ * shuffled.
+ *
+ * Returns 0 on a hit, or nonzero if the list must be parsed.
+ **/
+int dcc_hostcache_load(const char *key, size_t key_len,
+                       struct dcc_hostdef **ret_list, int *ret_nhosts,
+                       int *ret_randomize)
+{
+    char *path = NULL, *buf = NULL;
+    const struct dcc_hostcache_header *hdr;
+    const struct dcc_hostcache_entry *entries;
+    const char *strings;
+    struct dcc_hostdef *h, **prev;
+    struct stat sb;
+    size_t entry_strings;
+    ssize_t nread;
+    unsigned i;
+    int fd = -1, j;
+    int ret = EXIT_BAD_HOSTSPEC;
+
+    if (!dcc_getenv_bool("DISTCC_HOSTS_CACHE", 1))
+        return ret;
+    if (dcc_hostcache_path(&path))
+        return ret;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        if (errno != ENOENT)
+            rs_log_warning("failed to open %s: %s", path, strerror(errno));
+        goto out;
+    }
+    if (fstat(fd, &sb) == -1
+        || sb.st_size < (off_t) sizeof *hdr
+        || sb.st_size > DCC_HOSTCACHE_MAX_SIZE)
+        goto out;
+    if ((buf = malloc((size_t) sb.st_size)) == NULL)
+        goto out;
+    nread = read(fd, buf, (size_t) sb.st_size);
+    if (nread != (ssize_t) sb.st_size)
+        goto out;
+
+    hdr = (const struct dcc_hostcache_header *) buf;
+    if (hdr->magic != DCC_HOSTCACHE_MAGIC
+        || hdr->version != DCC_HOSTCACHE_VERSION
+        || hdr->header_size != sizeof *hdr
+        || hdr->entry_size != sizeof *entries
+        || hdr->total_size != (unsigned) sb.st_size
+        || hdr->key_len != key_len
+        || sizeof *hdr + dcc_hostcache_pad(key_len) > (size_t) sb.st_size
+        || memcmp(buf + sizeof *hdr, key, key_len) != 0) {
+        rs_trace("%s is for another host list", path);
+        goto out;
+    }
+    if (hdr->n_hosts == 0
+        || dcc_hostcache_check(buf, (size_t) sb.st_size, hdr) < 0) {
+        rs_log_warning("ignoring corrupt %s", path);
+        goto out;
+    }
+
+    entries = (const struct dcc_hostcache_entry *)
+        (buf + sizeof *hdr + dcc_hostcache_pad(key_len));
+    strings = (const char *) (entries + hdr->n_hosts);
+
+    *ret_list = NULL;
+    prev = ret_list;
+    for (i = 0; i < hdr->n_hosts; i++) {
+        entry_strings = 0;
+        for (j = 0; j < DCC_HOSTCACHE_N_STRINGS; j++)
+            if (entries[i].str_len[j] >= 0)
+                entry_strings += entries[i].str_len[j] + 1;
+        if ((h = dcc_hostcache_make_hostdef(&entries[i], strings,
+                                            entry_strings)) == NULL) {
+            while ((h = *ret_list) != NULL) {
+                *ret_list = h->next;
+                free(h);
+            }
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+        strings += entry_strings;
+        *prev = h;
+        prev = &h->next;
+    }
+
+    *ret_nhosts = (int) hdr->n_hosts;
+    *ret_randomize = hdr->randomize;
+    if (hdr->local_slots > 0)
+        dcc_hostdef_local->n_slots = hdr->local_slots;
+    if (hdr->local_cpp_slots > 0)
+        dcc_hostdef_local_cpp->n_slots = hdr->local_cpp_slots;
+
+    rs_trace("read %u hosts from %s", hdr->n_hosts, path);
+    ret = 0;
+
+out:
+    if (fd != -1)
+        close(fd);
+    free(buf);
+    free(path);
+    return ret;
+}
+
+
+/**
+ * Save @p list under @p key.  Failure is not fatal;
+ * the next client will just parse the list again.
+ **/
+int dcc_hostcache_save(const char *key, size_t key_len,
+                       const struct dcc_hostdef *list, int randomize)
+{
+    struct dcc_hostcache_header *hdr;
+    struct dcc_hostcache_entry *e;
+    const struct dcc_hostdef *h;
+    const char *fields[DCC_HOSTCACHE_N_STRINGS];
+    char *path = NULL, *tmp_path = NULL, *buf = NULL, *s;
+    size_t len, n;
+    int fd = -1, i;
+    int n_hosts = 0;
+    int ret = 0;
+
+    if (!dcc_getenv_bool("DISTCC_HOSTS_CACHE", 1))
+        return 0;
+
+    len = sizeof *hdr + dcc_hostcache_pad(key_len);
+    for (h = list; h; h = h->next) {
+        n_hosts++;
+        len += sizeof *e;
+        if (h->user) len += strlen(h->user) + 1;
+        if (h->hostname) len += strlen(h->hostname) + 1;
+        if (h->ssh_command) len += strlen(h->ssh_command) + 1;
+        if (h->hostdef_string) len += strlen(h->hostdef_string) + 1;
+    }
+    if (len > DCC_HOSTCACHE_MAX_SIZE)
+        return 0;
+
+    if ((buf = calloc(1, len)) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    hdr = (struct dcc_hostcache_header *) buf;
+    hdr->magic = DCC_HOSTCACHE_MAGIC;
+    hdr->version = DCC_HOSTCACHE_VERSION;
+    hdr->header_size = sizeof *hdr;
+    hdr->entry_size = sizeof *e;
+    hdr->total_size = (unsigned) len;
+    hdr->key_len = (unsigned) key_len;
+    hdr->n_hosts = (unsigned) n_hosts;
+    hdr->randomize = randomize;
+    hdr->local_slots = dcc_hostdef_local->n_slots;
+    hdr->local_cpp_slots = dcc_hostdef_local_cpp->n_slots;
+    memcpy(buf + sizeof *hdr, key, key_len);
+
+    e = (struct dcc_hostcache_entry *)
+        (buf + sizeof *hdr + dcc_hostcache_pad(key_len));
+    s = (char *) (e + n_hosts);
+    for (h = list; h; h = h->next, e++) {
+        e->mode = h->mode;
+        e->port = h->port;
+        e->is_up = h->is_up;
+        e->n_slots = h->n_slots;
+        e->protover = h->protover;
+        e->compr = h->compr;
+        e->cpp_where = h->cpp_where;
+        e->use_session = h->use_session;
+        e->use_manifest = h->use_manifest;
+        e->use_stream = h->use_stream;
+#ifdef HAVE_GSSAPI
+        e->authenticate = h->authenticate;
+#endif
+        fields[0] = h->user;
+        fields[1] = h->hostname;
+        fields[2] = h->ssh_command;
+        fields[3] = h->hostdef_string;
+        for (i = 0; i < DCC_HOSTCACHE_N_STRINGS; i++) {
+            if (!fields[i]) {
+                e->str_len[i] = -1;
+                continue;
+            }
+            n = strlen(fields[i]);
+            e->str_len[i] = (int) n;
+            memcpy(s, fields[i], n + 1);
+            s += n + 1;
+        }
+    }
+
+    if ((ret = dcc_hostcache_path(&path)))
+        goto out;
+    if (asprintf(&tmp_path, "%s.XXXXXX", path) == -1) {
+        tmp_path = NULL;
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    if ((fd = mkstemp(tmp_path)) == -1) {
+        rs_trace("failed to create %s: %s", tmp_path, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if (write(fd, buf, len) != (ssize_t) len) {
+        rs_log_warning("failed to write %s: %s", tmp_path, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if (close(fd) == -1 || rename(tmp_path, path) == -1) {
+        rs_log_warning("failed to write %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        ret = EXIT_IO_ERROR;
+    } else {
+        rs_trace("saved %d hosts to %s", n_hosts, path);
+    }
+    fd = -1;
+
+out:
+    if (fd != -1) {
+        close(fd);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    free(path);
+    free(buf);
+    return ret;
+}
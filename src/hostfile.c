@@ -53,14 +53,47 @@ int dcc_parse_hosts_file(const char *fname,
                          int *ret_nhosts)
 {
     char *body;
+    char key[4096];
+    int key_len = -1;
+    struct stat sb;
+    long mtime_nsec = 0;
     int ret;
 
     rs_trace("load hosts from %s", fname);
 
+    /* The cached list is keyed by a nul followed by the file's identity,
+     * so editing or replacing the file invalidates it.  The ctime and the
+     * nanoseconds catch edits within the same second that keep the size. */
+    if (stat(fname, &sb) == 0) {
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+        mtime_nsec = (long) sb.st_mtim.tv_nsec;
+#endif
+        key[0] = '\0';
+        key_len = snprintf(key + 1, sizeof key - 1,
+                           "%s %lu %lu %ld %ld.%09ld %ld",
+                           fname, (unsigned long) sb.st_dev,
+                           (unsigned long) sb.st_ino, (long) sb.st_size,
+                           (long) sb.st_mtime, mtime_nsec,
+                           (long) sb.st_ctime);
+        if (key_len < 0 || key_len >= (int) sizeof key - 1)
+            key_len = -1;
+        else
+            key_len++;
+    }
+
+    if (key_len > 0
+        && dcc_get_cached_hostlist(key, (size_t) key_len,
+                                   ret_list, ret_nhosts) == 0)
+        return 0;
+
     if ((ret = dcc_load_file_string(fname, &body)) != 0)
         return ret;
 
-    ret = dcc_parse_hosts(body, fname, ret_list, ret_nhosts, NULL);
+    if (key_len > 0)
+        ret = dcc_parse_and_cache_hosts(body, fname, key, (size_t) key_len,
+                                        ret_list, ret_nhosts);
+    else
+        ret = dcc_parse_hosts(body, fname, ret_list, ret_nhosts, NULL);
 
     free(body);
 
@@ -50,7 +50,7 @@
   OLDSTYLE_TCP_HOST = HOSTID[/LIMIT][:PORT][OPTIONS]
   HOSTID = HOSTNAME | IPV4
   OPTIONS = ,OPTION[OPTIONS]
-  OPTION = lzo | cpp
+  OPTION = lzo | cpp | session
   GLOBAL_OPTION = --randomize
   既支持ssh, 也支持tcp, oldstyle不知道, option看来也只有lzo和cpp, 
   hostname看来是可以dns的
@@ -125,7 +125,10 @@ struct rand_container {
     int rand;
 };
 
-int dcc_randomize_host_list(struct dcc_hostdef **host_list, int length);
+static int dcc_parse_hosts_1(const char *where, const char *source_name,
+                             struct dcc_hostdef **ret_list,
+                             int *ret_nhosts, struct dcc_hostdef **ret_prev,
+                             int *ret_randomize, int *ret_dynamic);
 
 int dcc_compare_container(const void *a, const void *b);
 
@@ -173,7 +176,13 @@ int dcc_get_hostlist(struct dcc_hostdef **ret_list,
 
     if ((env = getenv("DISTCC_HOSTS")) != NULL) {
         rs_trace("read hosts from environment");
-        return dcc_parse_hosts(env, "$DISTCC_HOSTS", ret_list, ret_nhosts, NULL);
+        /* Keys of hosts files start with a nul, so can't match this. */
+        if (dcc_get_cached_hostlist(env, strlen(env) + 1,
+                                    ret_list, ret_nhosts) == 0)
+            return 0;
+        return dcc_parse_and_cache_hosts(env, "$DISTCC_HOSTS",
+                                         env, strlen(env) + 1,
+                                         ret_list, ret_nhosts);
     }
 
     /* $DISTCC_DIR or ~/.distcc */
@@ -240,8 +249,12 @@ static int dcc_parse_multiplier(const char **psrc, struct dcc_hostdef *hostdef)
 /**
  * Parse an optionally present option string.
  *
- * At the moment the only two options we have is "lzo" for compression,
- * and "cpp" if the server supports doing the preprocessing there, also.
+ * At the moment the options we have are "lzo" for compression, "cpp" if
+ * the server supports doing the preprocessing there, also, "session"
+ * to ask the server to keep the files of a pump build between jobs, and
+ * "manifest" to describe each job to the server in one binary block
+ * (protocol 4) before sending any files, and "stream" to do that and also
+ * have the results sent back in chunks (protocol 5).
  **/
 static int dcc_parse_options(const char **psrc,
                              struct dcc_hostdef *host)
@@ -250,6 +263,9 @@ static int dcc_parse_options(const char **psrc,
 
     host->compr = DCC_COMPRESS_NONE;
     host->cpp_where = DCC_CPP_ON_CLIENT;
+    host->use_session = 0;
+    host->use_manifest = 0;
+    host->use_stream = 0;
 #ifdef HAVE_GSSAPI
     host->authenticate = 0;
 #endif
@@ -268,6 +284,19 @@ static int dcc_parse_options(const char **psrc,
             rs_trace("got CPP option");
             host->cpp_where = DCC_CPP_ON_SERVER;
             p += 3;
+        } else if (str_startswith("session", p)) {
+            rs_trace("got session option");
+            host->use_session = 1;
+            p += 7;
+        } else if (str_startswith("manifest", p)) {
+            rs_trace("got manifest option");
+            host->use_manifest = 1;
+            p += 8;
+        } else if (str_startswith("stream", p)) {
+            rs_trace("got stream option");
+            host->use_manifest = 1;
+            host->use_stream = 1;
+            p += 6;
 #ifdef HAVE_GSSAPI
         } else if (str_startswith("auth", p)) {
             rs_trace("got GSSAPI option");
@@ -285,6 +314,10 @@ static int dcc_parse_options(const char **psrc,
         rs_log_error("invalid host options: %s", started);
         return EXIT_BAD_HOSTSPEC;
     }
+    if (host->use_session && host->cpp_where != DCC_CPP_ON_SERVER) {
+        rs_log_error("',session' only makes sense with ',cpp': %s", started);
+        return EXIT_BAD_HOSTSPEC;
+    }
 
     *psrc = p;
 
@@ -481,6 +514,68 @@ int dcc_get_protover_from_features(enum dcc_compress compr,
 int dcc_parse_hosts(const char *where, const char *source_name,
                     struct dcc_hostdef **ret_list,
                     int *ret_nhosts, struct dcc_hostdef **ret_prev)
+{
+    int ret, randomize, dynamic;
+
+    if ((ret = dcc_parse_hosts_1(where, source_name, ret_list, ret_nhosts,
+                                 ret_prev, &randomize, &dynamic)))
+        return ret;
+    if (randomize)
+        return dcc_randomize_host_list(ret_list, *ret_nhosts);
+    return 0;
+}
+
+
+/**
+ * Look for the host list saved under @p key in the host list cache.
+ * Returns 0 if it was found.
+ **/
+int dcc_get_cached_hostlist(const char *key, size_t key_len,
+                            struct dcc_hostdef **ret_list,
+                            int *ret_nhosts)
+{
+    int ret, randomize;
+
+    if ((ret = dcc_hostcache_load(key, key_len, ret_list, ret_nhosts,
+                                  &randomize)))
+        return ret;
+    if (randomize)
+        return dcc_randomize_host_list(ret_list, *ret_nhosts);
+    return 0;
+}
+
+
+/**
+ * Like dcc_parse_hosts(), but also save the result in the host list cache
+ * under @p key, unless it depends on more than the text parsed.
+ **/
+int dcc_parse_and_cache_hosts(const char *where, const char *source_name,
+                              const char *key, size_t key_len,
+                              struct dcc_hostdef **ret_list,
+                              int *ret_nhosts)
+{
+    int ret, randomize, dynamic;
+
+    if ((ret = dcc_parse_hosts_1(where, source_name, ret_list, ret_nhosts,
+                                 NULL, &randomize, &dynamic)))
+        return ret;
+    if (!dynamic)
+        dcc_hostcache_save(key, key_len, *ret_list, randomize);
+    if (randomize)
+        return dcc_randomize_host_list(ret_list, *ret_nhosts);
+    return 0;
+}
+
+
+/**
+ * Parse the host list in @p where, without shuffling it.  @p ret_randomize
+ * is set if it asked to be shuffled, and @p ret_dynamic if it includes
+ * hosts found at run time.
+ **/
+static int dcc_parse_hosts_1(const char *where, const char *source_name,
+                             struct dcc_hostdef **ret_list,
+                             int *ret_nhosts, struct dcc_hostdef **ret_prev,
+                             int *ret_randomize, int *ret_dynamic)
 {
     int ret, flag_randomize = 0;
     struct dcc_hostdef *curr, *_prev;
@@ -490,6 +585,9 @@ int dcc_parse_hosts(const char *where, const char *source_name,
         _prev = NULL;
     }
 
+    *ret_randomize = 0;
+    *ret_dynamic = 0;
+
     /* TODO: Check for '/' in places where it might cause trouble with
      * a lock file name. */
 
@@ -554,6 +652,7 @@ int dcc_parse_hosts(const char *where, const char *source_name,
 #ifdef HAVE_AVAHI
         if (token_len == sizeof(ZEROCONF_MAGIC)-1 &&
             !strncmp(token_start, ZEROCONF_MAGIC, (unsigned) token_len)) {
+            *ret_dynamic = 1;
             if ((ret = dcc_zeroconf_add_hosts(ret_list, ret_nhosts, 4, ret_prev) != 0))
                 return ret;
             goto skip;
@@ -623,9 +722,7 @@ int dcc_parse_hosts(const char *where, const char *source_name,
     }
 
     if (*ret_nhosts) {
-        if (flag_randomize)
-            if ((ret = dcc_randomize_host_list(ret_list, *ret_nhosts)) != 0)
-                return ret;
+        *ret_randomize = flag_randomize;
         return 0;
     } else {
         rs_log_warning("%s contained no hosts; can't distribute work", source_name);
@@ -706,10 +803,12 @@ int dcc_free_hostdef(struct dcc_hostdef *host)
 {
     /* ANSI C requires free() to accept NULL */
 
-    free(host->user);
-    free(host->hostname);
-    free(host->ssh_command);
-    free(host->hostdef_string);
+    if (!host->packed) {
+        free(host->user);
+        free(host->hostname);
+        free(host->ssh_command);
+        free(host->hostdef_string);
+    }
     memset(host, 0xf1, sizeof *host);
     free(host);
 
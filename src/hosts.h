@@ -61,11 +61,24 @@ struct dcc_hostdef {
     /** Where are we doing preprocessing? */
     enum dcc_cpp_where cpp_where;//分为on client和on server
 
+    /** Should the server keep our mirrored files between pump jobs? */
+    int use_session;
+
+    /** Send the request as a protocol 4 manifest? */
+    int use_manifest;
+
+    /** Ask for results in chunks (protocol 5)?  Implies use_manifest. */
+    int use_stream;
+
 #ifdef HAVE_GSSAPI//这个是什么API
     /* Are we autenticating with this host? */
     int authenticate;//还能auth呢?
 #endif
 
+    /** The strings live in the same allocation as this hostdef, as
+     * made by the host list cache, and are not freed separately. */
+    int packed;
+
     struct dcc_hostdef *next;//实际上都是个列表
 };
 
@@ -81,6 +94,17 @@ int dcc_get_hostlist(struct dcc_hostdef **ret_list,
 
 int dcc_free_hostdef(struct dcc_hostdef *host);
 
+int dcc_randomize_host_list(struct dcc_hostdef **host_list, int length);
+
+int dcc_get_cached_hostlist(const char *key, size_t key_len,
+                            struct dcc_hostdef **ret_list,
+                            int *ret_nhosts);
+
+int dcc_parse_and_cache_hosts(const char *where, const char *source_name,
+                              const char *key, size_t key_len,
+                              struct dcc_hostdef **ret_list,
+                              int *ret_nhosts);
+
 int dcc_get_features_from_protover(enum dcc_protover protover,
                                    enum dcc_compress *compr,
                                    enum dcc_cpp_where *cpp_where);
@@ -93,3 +117,10 @@ int dcc_get_protover_from_features(enum dcc_compress compr,
 int dcc_parse_hosts_file(const char *fname,
                          struct dcc_hostdef **ret_list,
                          int *ret_nhosts);
+
+/* hostcache.c */
+int dcc_hostcache_load(const char *key, size_t key_len,
+                       struct dcc_hostdef **ret_list, int *ret_nhosts,
+                       int *ret_randomize);
+int dcc_hostcache_save(const char *key, size_t key_len,
+                       const struct dcc_hostdef *list, int randomize);
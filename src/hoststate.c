@@ -0,0 +1,523 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Remember which TCP servers answered recently.
+ *
+ * Backoff only learns that a server is dead after a job has waited out the
+ * connect timeout on it.  Instead, clients share a small cache in
+ * $DISTCC_DIR/hoststate recording, for each server, whether it accepted a
+ * connection and how long that took.  When the cache is older than
+ * DISTCC_PROBE_PERIOD, the client that notices starts a detached prober that
+ * connects to all the servers at once and rewrites the cache; the client
+ * itself never waits for it.  Servers recently found unreachable are then
+ * left out of the host list, just like disliked ones.
+ *
+ * The cache has one line per server:
+ *
+ *   HOSTNAME PORT UP RTT_USEC PROBE_TIME [COMPILE_USEC]
+ *
+ * "lsdistcc -D" can keep the cache up to date instead, and then also
+ * records how long a test compile took, and marks servers that failed it
+ * as down.
+ *
+ * Servers that answered, but much more slowly than the fastest, are moved
+ * to the end of the host list, so they only get jobs when the others are
+ * full.
+ **/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/poll.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "clinet.h"
+#include "timeval.h"
+#include "hoststate.h"
+
+
+static int dcc_probe_period = 60; /* seconds */
+
+/* A server is only moved back if it is this many times slower than the
+ * fastest, and also slower by more than the margin, so that the ordinary
+ * spread between similar servers doesn't reorder the list. */
+#define DCC_SLOW_FACTOR 4
+#define DCC_SLOW_RTT_MARGIN 50000L          /* usec */
+#define DCC_SLOW_COMPILE_MARGIN 500000L     /* usec */
+
+static const char dcc_hoststate_name[] = "hoststate";
+
+
+int dcc_hoststate_path(const char *suffix, char **path_ret)
+{
+    char *topdir;
+    int ret;
+
+    if ((ret = dcc_get_top_dir(&topdir)))
+        return ret;
+
+    if (asprintf(path_ret, "%s/%s%s", topdir, dcc_hoststate_name,
+                 suffix) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+/**
+ * Read the cache into a newly allocated array.  A missing or unreadable
+ * cache just gives no entries.
+ **/
+static int dcc_hoststate_load(const char *path,
+                              struct dcc_hoststate **states_ret,
+                              int *n_ret)
+{
+    FILE *f;
+    struct dcc_hoststate *states = NULL, *new_states;
+    struct dcc_hoststate st;
+    int n = 0, n_alloc = 0;
+    char line[512];
+    long probed;
+
+    *states_ret = NULL;
+    *n_ret = 0;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        if (errno != ENOENT)
+            rs_log_warning("failed to open %s: %s", path, strerror(errno));
+        return 0;
+    }
+
+    while (fgets(line, sizeof line, f)) {
+        st.compile_usec = -1;
+        if (sscanf(line, "%255s %d %d %ld %ld %ld", st.hostname, &st.port,
+                   &st.up, &st.rtt_usec, &probed, &st.compile_usec) < 5) {
+            rs_trace("ignoring bad line in %s: %s", path, line);
+            continue;
+        }
+        st.probed = (time_t) probed;
+        if (n == n_alloc) {
+            n_alloc = n_alloc ? 2 * n_alloc : 16;
+            new_states = realloc(states, n_alloc * sizeof *states);
+            if (new_states == NULL) {
+                rs_log_error("failed to allocate host state");
+                break;
+            }
+            states = new_states;
+        }
+        states[n++] = st;
+    }
+
+    fclose(f);
+    *states_ret = states;
+    *n_ret = n;
+    return 0;
+}
+
+
+static const struct dcc_hoststate *
+dcc_hoststate_find(const struct dcc_hoststate *states, int n,
+                   const struct dcc_hostdef *host)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (states[i].port == host->port
+            && !strcmp(states[i].hostname, host->hostname))
+            return &states[i];
+    return NULL;
+}
+
+
+/**
+ * Atomically replace the cache at @p path with @p n entries.
+ **/
+int dcc_hoststate_save(const char *path,
+                       const struct dcc_hoststate *states, int n)
+{
+    char *tmp_path;
+    FILE *f;
+    int fd, i;
+    int ret = 0;
+
+    if (asprintf(&tmp_path, "%s.XXXXXX", path) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((fd = mkstemp(tmp_path)) == -1) {
+        rs_log_error("failed to create %s: %s", tmp_path, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if ((f = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        unlink(tmp_path);
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(f, "%s %d %d %ld %ld", states[i].hostname, states[i].port,
+                states[i].up, states[i].rtt_usec, (long) states[i].probed);
+        if (states[i].compile_usec >= 0)
+            fprintf(f, " %ld", states[i].compile_usec);
+        fputc('\n', f);
+    }
+    if (fclose(f) == EOF || rename(tmp_path, path) == -1) {
+        rs_log_error("failed to write %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        ret = EXIT_IO_ERROR;
+    }
+
+out:
+    free(tmp_path);
+    return ret;
+}
+
+
+/**
+ * Connect to every TCP host in @p hostlist at once, wait at most
+ * dcc_connect_timeout for them all to answer, and atomically replace the
+ * cache at @p path with the results.
+ **/
+static int dcc_hoststate_probe(struct dcc_hostdef *hostlist,
+                               const char *path)
+{
+    struct dcc_hostdef *h;
+    struct dcc_hoststate *states;
+    struct dcc_connecting *conns;
+    struct pollfd *pfds;
+    struct timeval *started;
+    struct timeval now, elapsed, deadline;
+    int *slot_of;
+    int n = 0, n_pending = 0, n_poll;
+    int i, connected;
+    int ret = 0;
+
+    for (h = hostlist; h; h = h->next)
+        if (h->mode == DCC_MODE_TCP && h->is_up)
+            n++;
+    if (n == 0)
+        return 0;
+
+    states = calloc(n, sizeof *states);
+    conns = calloc(n, sizeof *conns);
+    for (i = 0; conns && i < n; i++)
+        conns[i].fd = -1;
+    pfds = calloc(n, sizeof *pfds);
+    started = calloc(n, sizeof *started);
+    slot_of = calloc(n, sizeof *slot_of);
+    if (!states || !conns || !pfds || !started || !slot_of) {
+        rs_log_error("failed to allocate probe state");
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    /* Start all the connections... */
+    i = 0;
+    for (h = hostlist; h; h = h->next) {
+        if (h->mode != DCC_MODE_TCP || !h->is_up)
+            continue;
+        strlcpy(states[i].hostname, h->hostname, sizeof states[i].hostname);
+        states[i].port = h->port;
+        states[i].rtt_usec = -1;
+        states[i].compile_usec = -1;
+        gettimeofday(&started[i], NULL);
+        if (dcc_start_connect_by_name(h->hostname, h->port,
+                                      &conns[i]) == 0) {
+            pfds[n_pending].fd = conns[i].fd;
+            pfds[n_pending].events = POLLOUT;
+            slot_of[n_pending] = i;
+            n_pending++;
+        }
+        i++;
+    }
+
+    /* ... and see which ones complete in time.  A host is only down once
+     * all of its addresses have failed, or the time is up. */
+    gettimeofday(&deadline, NULL);
+    deadline.tv_sec += dcc_connect_timeout;
+    while (n_pending > 0) {
+        gettimeofday(&now, NULL);
+        if (timeval_subtract(&elapsed, &deadline, &now))
+            break;
+        n_poll = poll(pfds, n_pending,
+                      elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000 + 1);
+        if (n_poll == -1 && errno == EINTR)
+            continue;
+        if (n_poll <= 0)
+            break;
+
+        gettimeofday(&now, NULL);
+        for (i = 0; i < n_pending; ) {
+            if (pfds[i].revents == 0) {
+                i++;
+                continue;
+            }
+            if (dcc_connecting_check(&conns[slot_of[i]], &connected) == 0
+                && !connected) {
+                /* still going, perhaps now to another address */
+                pfds[i].fd = conns[slot_of[i]].fd;
+                i++;
+                continue;
+            }
+            if (connected) {
+                struct dcc_hoststate *st = &states[slot_of[i]];
+                timeval_subtract(&elapsed, &now, &started[slot_of[i]]);
+                st->up = 1;
+                st->rtt_usec = elapsed.tv_sec * 1000000L + elapsed.tv_usec;
+            }
+            dcc_connecting_free(&conns[slot_of[i]]);
+            n_pending--;
+            pfds[i] = pfds[n_pending];
+            slot_of[i] = slot_of[n_pending];
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        states[i].probed = time(NULL);
+    ret = dcc_hoststate_save(path, states, n);
+
+out:
+    if (conns)
+        for (i = 0; i < n; i++)
+            dcc_connecting_free(&conns[i]);
+    free(slot_of);
+    free(started);
+    free(pfds);
+    free(conns);
+    free(states);
+    return ret;
+}
+
+
+/**
+ * Start a detached process to refresh the cache at @p path, unless another
+ * client already did.  The client carries on without waiting for it.
+ **/
+static void dcc_hoststate_start_prober(struct dcc_hostdef *hostlist,
+                                       const char *path)
+{
+    char *guard_path;
+    struct stat sb;
+    pid_t pid;
+    int fd;
+
+    if (dcc_hoststate_path(".probe", &guard_path))
+        return;
+
+    /* Only one prober at a time; the guard is removed when it is done. */
+    if ((fd = open(guard_path, O_WRONLY|O_CREAT|O_EXCL, 0666)) == -1) {
+        if (errno == EEXIST && stat(guard_path, &sb) == 0
+            && difftime(time(NULL), sb.st_mtime)
+               > 2.0 * (double) dcc_probe_period) {
+            rs_trace("removing stale %s", guard_path);
+            unlink(guard_path);
+        }
+        free(guard_path);
+        return;
+    }
+    close(fd);
+
+    if ((pid = fork()) == -1) {
+        rs_log_warning("fork failed: %s", strerror(errno));
+        unlink(guard_path);
+        free(guard_path);
+        return;
+    } else if (pid == 0) {
+        /* Don't hold on to the client's locks, files or terminal. */
+        dcc_close_fds_from(0);
+        fd = open("/dev/null", O_RDWR);
+        if (fd == 0) {
+            dup2(0, 1);
+            dup2(0, 2);
+        }
+        rs_remove_all_loggers();
+#ifdef HAVE_SETSID
+        setsid();
+#endif
+        dcc_hoststate_probe(hostlist, path);
+        unlink(guard_path);
+        _exit(0);
+    }
+
+    rs_trace("started host prober, pid %d", (int) pid);
+    free(guard_path);
+}
+
+
+/**
+ * Return the entry for @p host if it answered a recent enough probe.
+ **/
+static const struct dcc_hoststate *
+dcc_hoststate_answered(const struct dcc_hoststate *states, int n,
+                       const struct dcc_hostdef *host, time_t now)
+{
+    const struct dcc_hoststate *st;
+
+    if (host->mode != DCC_MODE_TCP || !host->is_up
+        || (st = dcc_hoststate_find(states, n, host)) == NULL || !st->up
+        || difftime(now, st->probed) >= 2.0 * (double) dcc_probe_period)
+        return NULL;
+    return st;
+}
+
+
+static int dcc_hoststate_is_slow(const struct dcc_hoststate *st,
+                                 long min_rtt, long min_compile)
+{
+    if (st->compile_usec >= 0 && min_compile >= 0
+        && st->compile_usec > DCC_SLOW_FACTOR * min_compile
+        && st->compile_usec - min_compile > DCC_SLOW_COMPILE_MARGIN)
+        return 1;
+    return st->rtt_usec >= 0 && min_rtt >= 0
+        && st->rtt_usec > DCC_SLOW_FACTOR * min_rtt
+        && st->rtt_usec - min_rtt > DCC_SLOW_RTT_MARGIN;
+}
+
+
+/**
+ * Move the TCP hosts in @p hostlist that were much slower than the fastest
+ * to connect to, or to run a test compile, to the end of the list, keeping
+ * their order.
+ **/
+static void dcc_hoststate_demote_slow(struct dcc_hostdef **hostlist,
+                                      const struct dcc_hoststate *states,
+                                      int n, time_t now)
+{
+    struct dcc_hostdef *h, *slow = NULL, **slow_tail = &slow;
+    const struct dcc_hoststate *st;
+    long min_rtt = -1, min_compile = -1;
+
+    for (h = *hostlist; h; h = h->next) {
+        if ((st = dcc_hoststate_answered(states, n, h, now)) == NULL)
+            continue;
+        if (st->rtt_usec >= 0 && (min_rtt < 0 || st->rtt_usec < min_rtt))
+            min_rtt = st->rtt_usec;
+        if (st->compile_usec >= 0
+            && (min_compile < 0 || st->compile_usec < min_compile))
+            min_compile = st->compile_usec;
+    }
+
+    while ((h = *hostlist) != NULL) {
+        if ((st = dcc_hoststate_answered(states, n, h, now)) != NULL
+            && dcc_hoststate_is_slow(st, min_rtt, min_compile)) {
+            rs_trace("%s is slow; try it last", h->hostdef_string);
+            *hostlist = h->next;
+            h->next = NULL;
+            *slow_tail = h;
+            slow_tail = &h->next;
+        } else {
+            hostlist = &h->next;
+        }
+    }
+    *hostlist = slow;
+}
+
+
+/**
+ * Walk through @p hostlist and remove any TCP hosts that did not answer the
+ * last probe, move those that were much slower than the rest to the end,
+ * and start a new probe if that one is out of date.
+ *
+ * Setting DISTCC_PROBE_PERIOD to 0 turns all this off.
+ **/
+int dcc_hoststate_filter(struct dcc_hostdef **hostlist)
+{
+    struct dcc_hostdef **start = hostlist;
+    struct dcc_hostdef *h;
+    struct dcc_hoststate *states;
+    const struct dcc_hoststate *st;
+    struct stat sb;
+    char *path, *pp;
+    int n, ret;
+    time_t now;
+
+    pp = getenv("DISTCC_PROBE_PERIOD");
+    if (pp)
+        dcc_probe_period = atoi(pp);
+    if (dcc_probe_period <= 0)
+        return 0;
+
+    for (h = *hostlist; h; h = h->next)
+        if (h->mode == DCC_MODE_TCP && h->is_up)
+            break;
+    if (h == NULL)
+        return 0;
+
+    if ((ret = dcc_hoststate_path("", &path)))
+        return 0;               /* not fatal; just compile without it */
+
+    now = time(NULL);
+    if (stat(path, &sb) == -1
+        || difftime(now, sb.st_mtime) >= (double) dcc_probe_period)
+        dcc_hoststate_start_prober(*hostlist, path);
+
+    dcc_hoststate_load(path, &states, &n);
+    free(path);
+
+    while ((h = *hostlist) != NULL) {
+        if (h->mode == DCC_MODE_TCP && h->is_up
+            && (st = dcc_hoststate_find(states, n, h)) != NULL
+            && !st->up
+            && difftime(now, st->probed) < 2.0 * (double) dcc_probe_period) {
+            rs_trace("%s did not answer the last probe; remove from list",
+                     h->hostdef_string);
+            *hostlist = h->next;
+            free(h);
+        } else {
+            if (h->mode == DCC_MODE_TCP && h->is_up
+                && (st = dcc_hoststate_find(states, n, h)) != NULL && st->up) {
+                if (st->compile_usec >= 0)
+                    rs_trace("%s answered in %ldus, compiled in %ldus",
+                             h->hostdef_string, st->rtt_usec,
+                             st->compile_usec);
+                else
+                    rs_trace("%s answered in %ldus", h->hostdef_string,
+                             st->rtt_usec);
+            }
+            hostlist = &h->next;
+        }
+    }
+
+    dcc_hoststate_demote_slow(start, states, n, now);
+
+    free(states);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* One line of $DISTCC_DIR/hoststate, shared by the client and lsdistcc. */
+struct dcc_hoststate {
+    char hostname[256];
+    int port;
+    int up;
+    long rtt_usec;              /* -1 if it didn't connect */
+    time_t probed;
+    long compile_usec;          /* -1 if no test compile was done */
+};
+
+int dcc_hoststate_path(const char *suffix, char **path_ret);
+int dcc_hoststate_save(const char *path,
+                       const struct dcc_hoststate *states, int n);
@@ -30,9 +30,16 @@
  * This code is not meant to know about our protocol, only to provide
  * a more comfortable layer on top of Unix IO.
  *
- * @todo Perhaps write things out using writev() to reduce the number
- * of system calls, and the risk of small packets when not using
- * TCP_CORK.
+ * The protocol is made of many small tokens, and reading or writing each of
+ * them with its own system call is expensive when a job carries thousands
+ * of files.  So while a connection is registered with dcc_io_buffer(),
+ * small writes to it are collected and sent together with writev(), and
+ * reads from it fetch as much as is available with readv(), keeping the
+ * surplus for the next dcc_readx().  Large transfers still go straight to
+ * and from the caller's buffer.  Pending output is sent before anything
+ * blocks waiting for input, when the socket is uncorked, and by
+ * dcc_io_unbuffer().  Code that reads or writes the fd directly, like the
+ * sendfile() path, must call dcc_io_take() or dcc_io_flush() first.
  */
 
 #include <config.h>
@@ -47,6 +54,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #ifdef HAVE_SYS_SELECT_H
 #  include <sys/select.h>
 #endif
@@ -61,6 +69,10 @@
 #include "exitcode.h"
 
 
+static int dcc_io_readable(int fd);
+static int dcc_io_flush_all(void);
+
+
 //返回io的超时设置
 int dcc_get_io_timeout(void)
 {
@@ -100,6 +112,13 @@ int dcc_select_for_read(int fd,
     int rs;
     struct timeval tv;
 
+    /* Don't wait for what we already have, nor for an answer to what we
+     * haven't sent yet. */
+    if (dcc_io_readable(fd))
+        return 0;
+    if ((rs = dcc_io_flush_all()))
+        return rs;
+
     tv.tv_sec = timeout;
     tv.tv_usec = 0;
 
@@ -189,16 +208,234 @@ int dcc_select_for_write(int fd, int timeout)
 
 
 
+/* Size of each of the read and write buffers of a connection. */
+#define DCC_IO_BUFFER_SIZE 16384
+
+/* A client uses two fds for an ssh connection, and so does the server for
+ * inetd and ssh. */
+#define DCC_IO_MAX_BUFFERED 2
+
+struct dcc_io_buffer {
+    int fd;                     /* -1 if this slot is free */
+    char *rbuf;                 /* NULL when buffering is turned off */
+    size_t rstart, rend;        /* unread bytes are rbuf[rstart..rend) */
+    char *wbuf;
+    size_t wlen;
+    unsigned long n_reads, n_writes;    /* system calls made */
+};
+
+static struct dcc_io_buffer dcc_io_buffers[DCC_IO_MAX_BUFFERED] = {
+    { -1, NULL, 0, 0, NULL, 0, 0, 0 },
+    { -1, NULL, 0, 0, NULL, 0, 0, 0 },
+};
+
+
+static struct dcc_io_buffer *dcc_io_find(int fd)
+{
+    int i;
+
+    if (fd < 0)
+        return NULL;
+    for (i = 0; i < DCC_IO_MAX_BUFFERED; i++)
+        if (dcc_io_buffers[i].fd == fd)
+            return &dcc_io_buffers[i];
+    return NULL;
+}
+
+
+/**
+ * Start buffering IO on the connection @p fd.  Setting DISTCC_IO_BUFFER=0
+ * turns the buffering off, but the system calls are still counted.
+ **/
+int dcc_io_buffer(int fd)
+{
+    struct dcc_io_buffer *b = NULL;
+    int i;
+
+    if (fd < 0 || dcc_io_find(fd))
+        return 0;
+    for (i = 0; i < DCC_IO_MAX_BUFFERED && !b; i++)
+        if (dcc_io_buffers[i].fd == -1)
+            b = &dcc_io_buffers[i];
+    if (b == NULL) {
+        rs_log_warning("too many buffered connections; fd%d is unbuffered",
+                       fd);
+        return 0;
+    }
+
+    memset(b, 0, sizeof *b);
+    b->fd = fd;
+    if (dcc_getenv_bool("DISTCC_IO_BUFFER", 1)) {
+        b->rbuf = malloc(DCC_IO_BUFFER_SIZE);
+        b->wbuf = malloc(DCC_IO_BUFFER_SIZE);
+        if (!b->rbuf || !b->wbuf) {
+            rs_log_warning("failed to allocate buffers for fd%d", fd);
+            free(b->rbuf);
+            free(b->wbuf);
+            b->rbuf = b->wbuf = NULL;
+        }
+    }
+    return 0;
+}
+
+
+/* Forget about @p b, without sending anything still pending. */
+static void dcc_io_release(struct dcc_io_buffer *b)
+{
+    rs_trace("%lu read and %lu write calls on fd%d",
+             b->n_reads, b->n_writes, b->fd);
+    if (b->rstart != b->rend)
+        rs_log_warning("%lu unread bytes left on fd%d",
+                       (unsigned long) (b->rend - b->rstart), b->fd);
+    free(b->rbuf);
+    free(b->wbuf);
+    memset(b, 0, sizeof *b);
+    b->fd = -1;
+}
+
+
+static int dcc_writex_raw(struct dcc_io_buffer *b, int fd,
+                          const void *buf, size_t len)
+{
+    ssize_t r;
+    int ret;
+
+    while (len > 0) {
+        r = write(fd, buf, len);
+        if (b)
+            b->n_writes++;
+
+        //文件被锁定, 就select_for_write(会超时)
+        if (r == -1 && errno == EAGAIN) {
+            if ((ret = dcc_select_for_write(fd, dcc_get_io_timeout())))
+                //select完为什么就返回了?还是select成功就继续写?
+                // 这里看不懂啊
+                return ret;
+            else
+                continue;
+        } else if (r == -1 && errno == EINTR) {//中断是什么意思?
+            continue;
+        } else if (r == -1) { //不知道什么回事, 反正没成功
+            rs_log_error("failed to write: %s", strerror(errno));
+            return EXIT_IO_ERROR;
+        } else {
+            buf = &((const char *) buf)[r];//一次写不完, 继续写, 写完为止
+            len -= r;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Send whatever is waiting in the write buffer of @p fd.
+ **/
+int dcc_io_flush(int fd)
+{
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+    size_t len;
+
+    if (b == NULL || b->wlen == 0)
+        return 0;
+    len = b->wlen;
+    b->wlen = 0;
+    return dcc_writex_raw(b, fd, b->wbuf, len);
+}
+
+
+/* Send everything pending, before waiting for an answer to it. */
+static int dcc_io_flush_all(void)
+{
+    int i, ret;
+
+    for (i = 0; i < DCC_IO_MAX_BUFFERED; i++)
+        if (dcc_io_buffers[i].fd != -1
+            && (ret = dcc_io_flush(dcc_io_buffers[i].fd)))
+            return ret;
+    return 0;
+}
+
+
+/**
+ * Stop buffering @p fd, after sending anything still pending.
+ **/
+int dcc_io_unbuffer(int fd)
+{
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+    int ret;
+
+    if (b == NULL)
+        return 0;
+    ret = dcc_io_flush(fd);
+    dcc_io_release(b);
+    return ret;
+}
+
+
+/* True if bytes from @p fd are waiting in its read buffer. */
+static int dcc_io_readable(int fd)
+{
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+
+    return b && b->rstart != b->rend;
+}
+
+
+/**
+ * Move up to @p len bytes already read from @p fd into @p buf.
+ *
+ * @returns the number of bytes moved, which may be 0.
+ **/
+size_t dcc_io_take(int fd, void *buf, size_t len)
+{
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+    size_t avail;
+
+    if (b == NULL || b->rstart == b->rend)
+        return 0;
+    avail = b->rend - b->rstart;
+    if (len > avail)
+        len = avail;
+    memcpy(buf, b->rbuf + b->rstart, len);
+    b->rstart += len;
+    if (b->rstart == b->rend)
+        b->rstart = b->rend = 0;
+    return len;
+}
+
+
 /**
  * Read exactly @p len bytes from a file.
  **/
 int dcc_readx(int fd, void *buf, size_t len)
 {
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+    struct iovec iov[2];
     ssize_t r;
     int ret;
 
+    if (b) {
+        size_t got = dcc_io_take(fd, buf, len);
+        buf = &((char *) buf)[got];
+        len -= got;
+        if (len > 0 && (ret = dcc_io_flush_all()))
+            return ret;
+    }
+
     while (len > 0) {
-        r = read(fd, buf, len);
+        if (b && b->rbuf) {
+            /* Whatever else has arrived goes in the buffer. */
+            iov[0].iov_base = buf;
+            iov[0].iov_len = len;
+            iov[1].iov_base = b->rbuf;
+            iov[1].iov_len = DCC_IO_BUFFER_SIZE;
+            r = readv(fd, iov, 2);
+        } else {
+            r = read(fd, buf, len);
+        }
+        if (b)
+            b->n_reads++;
 
         if (r == -1 && errno == EAGAIN) {
             if ((ret = dcc_select_for_read(fd, dcc_get_io_timeout())))
@@ -213,6 +450,12 @@ int dcc_readx(int fd, void *buf, size_t len)
         } else if (r == 0) {
             rs_log_error("unexpected eof on fd%d", fd);
             return EXIT_TRUNCATED;
+        } else if ((size_t) r >= len) {
+            if (b && b->rbuf) {
+                b->rstart = 0;
+                b->rend = (size_t) r - len;
+            }
+            len = 0;
         } else {
             buf = &((char *) buf)[r];
             len -= r;
@@ -232,32 +475,48 @@ int dcc_readx(int fd, void *buf, size_t len)
  //二进制写入文件
 int dcc_writex(int fd, const void *buf, size_t len)
 {
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+    struct iovec iov[2];
     ssize_t r;
     int ret;
 
-    while (len > 0) {
-        r = write(fd, buf, len);
+    if (b == NULL || b->wbuf == NULL)
+        return dcc_writex_raw(b, fd, buf, len);
+
+    if (b->wlen + len <= DCC_IO_BUFFER_SIZE) {
+        memcpy(b->wbuf + b->wlen, buf, len);
+        b->wlen += len;
+        return 0;
+    }
+
+    /* Send what is pending together with the new data. */
+    while (b->wlen > 0) {
+        iov[0].iov_base = b->wbuf;
+        iov[0].iov_len = b->wlen;
+        iov[1].iov_base = (void *) buf;
+        iov[1].iov_len = len;
+        r = writev(fd, iov, 2);
+        b->n_writes++;
 
-        //文件被锁定, 就select_for_write(会超时)
         if (r == -1 && errno == EAGAIN) {
             if ((ret = dcc_select_for_write(fd, dcc_get_io_timeout())))
-                //select完为什么就返回了?还是select成功就继续写?
-                // 这里看不懂啊
                 return ret;
-            else
-                continue;
-        } else if (r == -1 && errno == EINTR) {//中断是什么意思?
+        } else if (r == -1 && errno == EINTR) {
             continue;
-        } else if (r == -1) { //不知道什么回事, 反正没成功
+        } else if (r == -1) {
             rs_log_error("failed to write: %s", strerror(errno));
             return EXIT_IO_ERROR;
+        } else if ((size_t) r < b->wlen) {
+            memmove(b->wbuf, b->wbuf + r, b->wlen - r);
+            b->wlen -= r;
         } else {
-            buf = &((char *) buf)[r];//一次写不完, 继续写, 写完为止
-            len -= r;
+            buf = &((const char *) buf)[r - b->wlen];
+            len -= r - b->wlen;
+            b->wlen = 0;
         }
     }
 
-    return 0;
+    return dcc_writex_raw(b, fd, buf, len);
 }
 
 
@@ -267,8 +526,14 @@ int dcc_writex(int fd, const void *buf, size_t len)
  *
  * This is a no-op if we don't think this platform has corks.
  **/
-int tcp_cork_sock(int POSSIBLY_UNUSED(fd), int POSSIBLY_UNUSED(corked))
+int tcp_cork_sock(int fd, int corked)
 {
+    int ret;
+
+    /* Uncorking means the message is complete. */
+    if (!corked && (ret = dcc_io_flush(fd)))
+        return ret;
+
 #if defined(TCP_CORK) && defined(SOL_TCP)
     if (!dcc_getenv_bool("DISTCC_TCP_CORK", 1))
         return 0;
@@ -292,6 +557,11 @@ int tcp_cork_sock(int POSSIBLY_UNUSED(fd), int POSSIBLY_UNUSED(corked))
 
 int dcc_close(int fd)
 {
+    struct dcc_io_buffer *b = dcc_io_find(fd);
+
+    if (b)
+        dcc_io_release(b);
+
     if (close(fd) != 0) {
         rs_log_error("failed to close fd%d: %s", fd, strerror(errno));
         return EXIT_IO_ERROR;
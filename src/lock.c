@@ -101,9 +101,13 @@ struct dcc_hostdef _dcc_local = {
     DCC_VER_1,                  /* protocol (ignored) */
     DCC_COMPRESS_NONE,          /* compression (ignored) */
     DCC_CPP_ON_CLIENT,          /* where to cpp (ignored) */
+    0,                          /* reuse session root (ignored) */
+    0,                          /* binary manifest (ignored) */
+    0,                          /* chunked results (ignored) */
 #ifdef HAVE_GSSAPI
     0,                          /* Authentication? */
 #endif
+    0,                          /* strings packed */
     NULL
 };
 
@@ -121,9 +125,13 @@ struct dcc_hostdef _dcc_local_cpp = {
     DCC_VER_1,                  /* protocol (ignored) */
     DCC_COMPRESS_NONE,          /* compression (ignored) */
     DCC_CPP_ON_CLIENT,          /* where to cpp (ignored) */
+    0,                          /* reuse session root (ignored) */
+    0,                          /* binary manifest (ignored) */
+    0,                          /* chunked results (ignored) */
 #ifdef HAVE_GSSAPI
     0,                          /* Authentication? */
 #endif
+    0,                          /* strings packed */
     NULL
 };
 
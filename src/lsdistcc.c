@@ -41,6 +41,9 @@
  *
  * Changelog:
  *
+ * Added -f and -D options, to keep the client's record of which servers
+ * are up (and how fast they are) in $DISTCC_DIR/hoststate current.
+ *
  * Wed Jun 20 2007 - Manos Renieris, Google
  * Added -P option.
  *
@@ -92,6 +95,7 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <time.h>
 
 #include "distcc.h"
 #include "clinet.h"
@@ -99,6 +103,7 @@
 #include "util.h"
 #include "trace.h"
 #include "rslave.h"
+#include "hoststate.h"
 #include "../lzo/minilzo.h"
 
 /* Linux calls this setrlimit() argument NOFILE; bsd calls it OFILE */
@@ -119,7 +124,10 @@ struct state_s {
     rslave_request_t req;
     rslave_result_t res;
     struct timeval start;
+    struct timeval sent;        /* when the test compile was sent */
     struct timeval deadline;
+    long rtt_usec;              /* connect time, -1 if not connected */
+    long compile_usec;          /* test compile time, -1 if none */
     char curhdrbuf[12];
     int curhdrlen;
     enum status_e status;
@@ -161,6 +169,11 @@ int opt_domain = 0;
 int opt_match = 0;
 int opt_bang_down = 0;
 const char *opt_compiler = NULL;
+const char *opt_state_file = NULL;
+int opt_daemon_period = 0;
+
+/* Set by timeout_handler() when the results are saved to opt_state_file */
+volatile int round_timed_out = 0;
 
 
 const char *protocol_suffix[] = { NULL, /* to make the rest 1-based */
@@ -187,6 +200,7 @@ int bitcompare(const unsigned char *a, const unsigned char *b, int nbits);
 void timeout_handler(int x);
 void get_thename(const char**sformat, const char *domain_name,
                  int i, char *thename);
+void save_state(const struct state_s states[], int n);
 int detect_distcc_servers(const char **argv, int argc, int opti,
                           int bigtimeout, int dnstimeout, int matchbits,
                           int overlap, int dnsgap);
@@ -194,7 +208,7 @@ void server_read_packet_header(state_t *sp);
 void server_handle_event(state_t *sp);
 
 void usage(void) {
-        printf("Usage: lsdistcc [-tTIMEOUT] [-mBITS] [-nvd] [format]\n\
+        printf("Usage: lsdistcc [-tTIMEOUT] [-mBITS] [-nvd] [-fFILE] [-DPERIOD] [format]\n\
 Uses 'for i=1... sprintf(format, i)' to construct names of servers,\n\
 stops after %d seconds or at second server that doesn't resolve,\n\
 prints the names of all such servers listening on distcc's port.\n\
@@ -219,6 +233,9 @@ Options:\n\
 -PPROTOCOL Protocol version to use (1-3) [%d]\n\
 -pCOMPILER Name of compiler to use [%s]\n\
 -d       Append DNS domain name to format\n\
+-fFILE     Also save the results for the distcc client in FILE\n\
+           [$DISTCC_DIR/hoststate with -D]\n\
+-DPERIOD   Check again every PERIOD seconds until killed, printing nothing\n\
 -v       Verbose\n\
 \n\
 Example:\n\
@@ -277,7 +294,8 @@ main()
 #endif
 
 
-/* On timeout, silently terminate program  */
+/* On timeout, silently terminate program, unless the results are to be
+ * saved; then just end this round. */
 void timeout_handler(int x)
 {
     (void) x;
@@ -285,6 +303,11 @@ void timeout_handler(int x)
     if (opt_verbose > 0)
         fprintf(stderr, "Timeout!\n");
 
+    if (opt_state_file) {
+        round_timed_out = 1;
+        return;
+    }
+
     /* FIXME: is it legal to call exit here? */
     exit(0);
 }
@@ -549,6 +572,8 @@ void server_handle_event(state_t *sp)
                     sp->status = STATE_CLOSE;   /* not listening */
                     break;
                 }
+                sp->rtt_usec = (now.tv_sec - sp->start.tv_sec) * 1000000L
+                               + (now.tv_usec - sp->start.tv_usec);
                 if (opt_comptimeout_ms == 0 || !opt_compiler) {
                     /* connect succeeded, don't need to compile */
                     sp->up = 1;
@@ -582,6 +607,7 @@ void server_handle_event(state_t *sp)
                 }
                 sp->status=STATE_READ_DONEPKT;
                 sp->curhdrlen = 0;
+                sp->sent = now;
                 sp->deadline = now;
                 sp->deadline.tv_usec += 1000 * opt_comptimeout_ms;
                 sp->deadline.tv_sec += sp->deadline.tv_usec / 1000000;
@@ -605,6 +631,8 @@ void server_handle_event(state_t *sp)
                  * poll said bytes were ready, so beware of false EOFs here?
                  */
                 sp->up = 1;
+                sp->compile_usec = (now.tv_sec - sp->sent.tv_sec) * 1000000L
+                                   + (now.tv_usec - sp->sent.tv_usec);
                 sp->status = STATE_CLOSE;
             }
           }
@@ -616,7 +644,7 @@ void server_handle_event(state_t *sp)
                 sp->fd = -1;
             }
 
-            if (opt_bang_down || sp->up) {
+            if ((opt_bang_down || sp->up) && !opt_daemon_period) {
                 if (opt_numeric)
                     printf("%d.%d.%d.%d", sp->res.addr[0], sp->res.addr[1],
                            sp->res.addr[2], sp->res.addr[3]);
@@ -887,6 +915,41 @@ void get_thename(const char**sformat, const char *domain_name, int i,
 }
 
 
+/* Save what this round found out about each host that was looked up, for
+ * the distcc client to use when it picks hosts.  A host that did not
+ * resolve, connect or compile is recorded as down.
+ */
+void save_state(const struct state_s states[], int n)
+{
+    struct dcc_hoststate *hs;
+    int i, nhs = 0;
+    time_t now = time(NULL);
+
+    if ((hs = calloc((size_t) n, sizeof *hs)) == NULL) {
+        fprintf(stderr, "lsdistcc: out of memory\n");
+        return;
+    }
+    for (i = 1; i <= n; i++) {
+        const struct state_s *sp = &states[i];
+        if (sp->ntries == 0)
+            continue;
+        strlcpy(hs[nhs].hostname, sp->req.hname, sizeof hs[nhs].hostname);
+        hs[nhs].port = opt_port;
+        hs[nhs].up = sp->up;
+        hs[nhs].rtt_usec = sp->rtt_usec;
+        hs[nhs].compile_usec = sp->compile_usec;
+        hs[nhs].probed = now;
+        nhs++;
+    }
+    if (dcc_hoststate_save(opt_state_file, hs, nhs) != 0)
+        fprintf(stderr, "lsdistcc: failed to write %s\n", opt_state_file);
+    else if (opt_verbose > 0)
+        fprintf(stderr, "lsdistcc: saved %d hosts to %s\n", nhs,
+                opt_state_file);
+    free(hs);
+}
+
+
 /* Detect all listening distcc servers and print their names to stdout.
  * Looks for servers numbered 1 through infinity, stops at
  * first server that doesn't resolve in DNS, or after 'timeout' seconds,
@@ -921,7 +984,9 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
     int nbaddns;
     int nwithtries[MAXTRIES+1];
 
-    struct rslave_s rs;
+    /* Kept for the next round when running with -D */
+    static struct rslave_s rs;
+    static int rs_started = 0;
 
     const char *default_format = DEFAULT_FORMAT;
     const char **sformat = &default_format;
@@ -960,13 +1025,17 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
            maxfds = (int)(rlim.rlim_cur - 10);
     }
 
+    if (!rs_started) {
+        if (rslave_init(&rs))
+            return 0;
+        rs_started = 1;
+    }
+
     /* Don't run longer than bigtimeout seconds */
+    round_timed_out = 0;
     signal(SIGALRM, timeout_handler);
     alarm((unsigned) bigtimeout);
 
-    if (rslave_init(&rs))
-        return 0;
-
     ngotaddr = 0;
     memset(nwithtries, 0, sizeof(nwithtries));
     memset(states, 0, sizeof(states));
@@ -978,6 +1047,8 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
         rslave_request_init(req, thename, i);
         states[i].status = STATE_LOOKUP;
         states[i].ntries = 0;
+        states[i].rtt_usec = -1;
+        states[i].compile_usec = -1;
         nwithtries[0]++;
     }
 
@@ -994,19 +1065,37 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
         if (end_state > n)
             end_state = n;
         orig_end_state = end_state;
-        while (ndone < end_state) {
+        while (ndone < end_state && !round_timed_out) {
             end_state = one_poll_loop(&rs, states, start_state, end_state,
                                       nwithtries, &ngotaddr, &nbaddns,
                                       firstipaddr, dnstimeout_usec,
                                       matchbits, overlap, dnsgap);
         }
-        if (end_state < orig_end_state) {
+        if (round_timed_out || end_state < orig_end_state) {
             /* If we lowered end_state, it means we decided to stop
              * searching early.
              */
             break;
         }
     }
+    alarm(0);
+
+    if (opt_state_file) {
+        /* Whoever is still connecting or compiling took too long. */
+        for (i = 1; i <= n; i++) {
+            switch (states[i].status) {
+            case STATE_CONNECTING:
+            case STATE_READ_DONEPKT:
+            case STATE_READ_STATPKT:
+            case STATE_READ_REST:
+                close(states[i].fd);
+                states[i].status = STATE_DONE;
+                break;
+            default: ;
+            }
+        }
+        save_state(states, n);
+    }
     return nok;
 }
 
@@ -1083,11 +1172,30 @@ int main(int argc, char **argv)
         case 'd':
             opt_domain++;
             break;
+        case 'f':
+            opt_state_file = argv[opti]+2;
+            if (! *opt_state_file)
+                usage();
+            break;
+        case 'D':
+            opt_daemon_period = atoi(argv[opti]+2);
+            if (opt_daemon_period <= 0)
+                usage();
+            break;
         default:
             usage();
         }
     }
 
+    if (opt_daemon_period && !opt_state_file) {
+        char *path;
+        if (dcc_hoststate_path("", &path) != 0) {
+            fprintf(stderr, "lsdistcc: can't find $DISTCC_DIR\n");
+            exit(1);
+        }
+        opt_state_file = path;
+    }
+
     if (opt_compiler)
         generate_query();
 
@@ -1098,6 +1206,17 @@ int main(int argc, char **argv)
                                    opt_overlap,
                                    opt_dnsgap);
 
+    /* Keep the client's host state current until killed. */
+    while (opt_daemon_period) {
+        sleep((unsigned) opt_daemon_period);
+        detect_distcc_servers((const char **)argv, argc, opti,
+                              opt_bigtimeout_sec,
+                              opt_dnstimeout_ms,
+                              opt_match,
+                              opt_overlap,
+                              opt_dnsgap);
+    }
+
     /* return failure if no servers found */
     return (nfound > 0) ? 0 : 1;
 }
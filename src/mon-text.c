@@ -22,6 +22,8 @@
 
 #include <config.h>
 
+#include <sys/time.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +38,7 @@
 #include "exitcode.h"
 #include "snprintf.h"
 #include "mon.h"
+#include "util.h"
 
 
 /**
@@ -43,31 +46,311 @@
  *
  * Plain text monitor program.  Just prints out the state once, or
  * repeatedly, kind of like Linux vmstat.
+ *
+ * With -s, it instead keeps following the jobs and prints a summary
+ * of how busy each host is, how fast jobs are completing, how long
+ * they spend in each phase, and which of the running jobs have taken
+ * longest so far.  To keep up with short phases it looks at the job
+ * table every tick, but it only reads the jobs when a client has
+ * changed something.
  */
 
 
 const char *rs_program_name = "distccmon-text";
 
 
+/* How often to check for changes in -s mode, in seconds. */
+static const double dcc_mon_tick = 0.1;
+
+/* How many of the slowest running jobs to list. */
+#define DCC_MON_TOP_JOBS 5
+
+#define DCC_MON_TRACK_BUCKETS 1024
+
+/* What we remember about a running job between polls. */
+struct dcc_job_track {
+    unsigned long cpid;
+    enum dcc_phase phase;
+    double phase_start;
+    double first_seen;
+    char file[128];
+    char host[128];
+    unsigned long mark;         /* poll in which it was last seen */
+    struct dcc_job_track *next;
+};
+
+/* Slot usage of one host. */
+struct dcc_host_use {
+    char host[128];
+    int busy;                   /* slots in use at the last poll */
+    int n_slots;                /* highest slot ever used, plus one */
+    double busy_time;           /* slot-seconds used in this interval */
+    struct dcc_host_use *next;
+};
+
+static struct dcc_job_track *tracks[DCC_MON_TRACK_BUCKETS];
+static struct dcc_host_use *hosts;
+static unsigned long poll_mark;
+
+static double phase_time[DCC_PHASE_DONE + 1];
+static long phase_count[DCC_PHASE_DONE + 1];
+static long jobs_running, jobs_done, jobs_done_interval;
+static double start_time, interval_start, last_update;
+
+
 static void usage(void)
 {
-    fprintf(stderr, "usage: distccmon-text [DELAY]\n"
+    fprintf(stderr, "usage: distccmon-text [-s] [DELAY]\n"
 "\n"
 "Displays current compilation jobs in text form.\n"
 "\n"
 "If delay is specified, repeatedly updates after that many (fractional)\n"
-"seconds.  Otherwise, runs just once.\n");
+"seconds.  Otherwise, runs just once.\n"
+"\n"
+"With -s, displays a summary of host usage, throughput and phase times\n"
+"every DELAY seconds (default 1) instead of the list of jobs.\n");
+}
+
+
+static double dcc_mon_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void dcc_mon_end_phase(enum dcc_phase phase, double secs)
+{
+    if (phase == DCC_PHASE_DONE)
+        return;
+    /* local and remote states are stamped separately, so the clock may
+     * seem to step back a little between them. */
+    if (secs < 0)
+        secs = 0;
+    phase_time[phase] += secs;
+    phase_count[phase]++;
+}
+
+
+static struct dcc_host_use *dcc_mon_find_host(const char *host)
+{
+    struct dcc_host_use *h;
+
+    for (h = hosts; h; h = h->next)
+        if (!strcmp(h->host, host))
+            return h;
+
+    if ((h = calloc(1, sizeof *h)) == NULL) {
+        rs_log_crit("failed to allocate dcc_host_use");
+        return NULL;
+    }
+    strlcpy(h->host, host, sizeof h->host);
+    h->next = hosts;
+    hosts = h;
+    return h;
+}
+
+
+/**
+ * Fold a fresh list of jobs into the statistics: phase changes end the
+ * previous phase, and jobs that are no longer there have finished.
+ **/
+static int dcc_mon_update(struct dcc_task_state *list, double now)
+{
+    struct dcc_task_state *i;
+    struct dcc_job_track *t, **pt;
+    struct dcc_host_use *h;
+    double start;
+    int b;
+
+    for (h = hosts; h; h = h->next) {
+        h->busy_time += h->busy * (now - last_update);
+        h->busy = 0;
+    }
+    last_update = now;
+    poll_mark++;
+    jobs_running = 0;
+
+    for (i = list; i; i = i->next) {
+        start = i->phase_start_sec + i->phase_start_usec / 1e6;
+        if (!i->phase_start_sec)
+            start = now;
+
+        b = i->cpid % DCC_MON_TRACK_BUCKETS;
+        for (t = tracks[b]; t && t->cpid != i->cpid; t = t->next)
+            ;
+        if (!t) {
+            if ((t = calloc(1, sizeof *t)) == NULL) {
+                rs_log_crit("failed to allocate dcc_job_track");
+                return EXIT_OUT_OF_MEMORY;
+            }
+            t->cpid = i->cpid;
+            t->phase = i->curr_phase;
+            t->phase_start = t->first_seen = start;
+            t->next = tracks[b];
+            tracks[b] = t;
+        } else if (t->phase != i->curr_phase) {
+            dcc_mon_end_phase(t->phase, start - t->phase_start);
+            t->phase = i->curr_phase;
+            t->phase_start = start;
+        }
+        t->mark = poll_mark;
+        strlcpy(t->file, i->file, sizeof t->file);
+        strlcpy(t->host, i->host, sizeof t->host);
+
+        if (i->curr_phase == DCC_PHASE_DONE)
+            continue;
+        jobs_running++;
+        if (i->host[0]) {
+            if ((h = dcc_mon_find_host(i->host)) == NULL)
+                return EXIT_OUT_OF_MEMORY;
+            h->busy++;
+            if (i->slot >= h->n_slots)
+                h->n_slots = i->slot + 1;
+        }
+    }
+
+    for (b = 0; b < DCC_MON_TRACK_BUCKETS; b++) {
+        for (pt = &tracks[b]; (t = *pt) != NULL; ) {
+            if (t->mark == poll_mark) {
+                pt = &t->next;
+                continue;
+            }
+            dcc_mon_end_phase(t->phase, now - t->phase_start);
+            jobs_done++;
+            jobs_done_interval++;
+            *pt = t->next;
+            free(t);
+        }
+    }
+
+    return 0;
+}
+
+
+static void dcc_mon_report(double now)
+{
+    struct dcc_job_track *top[DCC_MON_TOP_JOBS];
+    struct dcc_job_track *t;
+    struct dcc_host_use *h;
+    double interval = now - interval_start;
+    int n_top = 0;
+    int b, j, p;
+
+    printf("%-24s %5s %5s %8s\n", "HOST", "BUSY", "SLOTS", "AVG-BUSY");
+    for (h = hosts; h; h = h->next) {
+        printf("%-24.24s %5d %5d %8.2f\n", h->host, h->busy, h->n_slots,
+               interval > 0 ? h->busy_time / interval : 0.0);
+        h->busy_time = 0;
+    }
+
+    printf("jobs: %ld running, %ld done, %.1f/s now, %.1f/s overall\n",
+           jobs_running, jobs_done,
+           interval > 0 ? jobs_done_interval / interval : 0.0,
+           now > start_time ? jobs_done / (now - start_time) : 0.0);
+
+    printf("average time in:");
+    for (p = 0; p < DCC_PHASE_DONE; p++) {
+        if (phase_count[p])
+            printf(" %s %.2fs", dcc_get_phase_name(p),
+                   phase_time[p] / phase_count[p]);
+    }
+    printf("\n");
+
+    /* Keep the oldest few, oldest first. */
+    for (b = 0; b < DCC_MON_TRACK_BUCKETS; b++) {
+        for (t = tracks[b]; t; t = t->next) {
+            if (t->phase == DCC_PHASE_DONE)
+                continue;
+            for (j = n_top; j > 0 && top[j-1]->first_seen > t->first_seen; j--)
+                if (j < DCC_MON_TOP_JOBS)
+                    top[j] = top[j-1];
+            if (j < DCC_MON_TOP_JOBS) {
+                top[j] = t;
+                if (n_top < DCC_MON_TOP_JOBS)
+                    n_top++;
+            }
+        }
+    }
+    for (j = 0; j < n_top; j++) {
+        t = top[j];
+        printf("%6ld  %-10.10s  %-30.30s %18.18s %6.1fs\n",
+               (long) t->cpid, dcc_get_phase_name(t->phase),
+               t->file, t->host, now - t->first_seen);
+    }
+
+    printf("\n");
+
+    interval_start = now;
+    jobs_done_interval = 0;
 }
 
+
+/**
+ * Follow the jobs forever, printing a summary every @p delay seconds.
+ **/
+static int dcc_mon_text_stats(double delay)
+{
+    struct dcc_task_state *list;
+    unsigned long gen, last_gen = 0;
+    double now, next_report, wait;
+    int ret;
+    int must_poll = 1;
+
+    start_time = interval_start = last_update = dcc_mon_now();
+    next_report = start_time + delay;
+
+    for (;;) {
+        if ((ret = dcc_mon_generation(&gen)))
+            return ret;
+        now = dcc_mon_now();
+
+        /* State files don't bump the generation, so poll at least once
+         * per report anyhow; that also catches clients that died. */
+        if (must_poll || gen != last_gen || now >= next_report) {
+            last_gen = gen;
+            must_poll = 0;
+            if ((ret = dcc_mon_poll(&list)))
+                return ret;
+            ret = dcc_mon_update(list, now);
+            dcc_task_state_free(list);
+            if (ret)
+                return ret;
+        }
+
+        if (now >= next_report) {
+            dcc_mon_report(now);
+            next_report += delay;
+            if (next_report < now)
+                next_report = now + delay;
+        }
+
+        wait = next_report - now;
+        if (wait > dcc_mon_tick)
+            wait = dcc_mon_tick;
+        usleep(wait * 1000000);
+    }
+}
+
+
 int main(int argc, char *argv[])
 {
     struct dcc_task_state *list;
     int ret;
     float delay;
     char *end;
+    int stats = 0;
 
     dcc_set_trace_from_env();
 
+    if (argc > 1 && !strcmp(argv[1], "-s")) {
+        stats = 1;
+        argc--;
+        argv++;
+    }
+
     if (argc == 1)
         delay = 0.0;
     else if (argc == 2) {
@@ -85,6 +368,9 @@ int main(int argc, char *argv[])
      * other program, so make sure we're always line buffered. */
     setvbuf (stdout, NULL, _IOLBF, BUFSIZ);
 
+    if (stats)
+        return dcc_mon_text_stats(delay > 0 ? delay : 1.0);
+
     do {
         struct dcc_task_state *i;
 
@@ -25,6 +25,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #include <signal.h>
 #include <stdio.h>
@@ -111,6 +114,37 @@ static int dcc_mon_kill_old(int fd,
 }
 
 
+/**
+ * Sanity-check a state record read from @p where, and tidy it up for use
+ * in a list.
+ **/
+static int dcc_mon_check_state(struct dcc_task_state *lp,
+                               const char *where)
+{
+    if (lp->magic != DCC_STATE_MAGIC) {
+        rs_log_warning("wrong magic number: %s",
+                       where);
+        return EXIT_IO_ERROR;
+    }
+
+    if (lp->struct_size != sizeof (struct dcc_task_state)) {
+        rs_log_warning("wrong structure size: %s: version mismatch?",
+                       where);
+        return EXIT_IO_ERROR;
+    }
+
+    lp->file[sizeof lp->file - 1] = '\0';
+    lp->host[sizeof lp->host - 1] = '\0';
+    if (lp->curr_phase > DCC_PHASE_DONE) {
+        lp->curr_phase = DCC_PHASE_COMPILE;
+    }
+
+    lp->next = 0;
+
+    return 0;
+}
+
+
 static int dcc_mon_read_state(int fd, char *fullpath,
                               struct dcc_task_state *lp)
 {
@@ -132,29 +166,7 @@ static int dcc_mon_read_state(int fd, char *fullpath,
         return EXIT_IO_ERROR;
     }
 
-    /* sanity-check some fields */
-
-    if (lp->magic != DCC_STATE_MAGIC) {
-        rs_log_warning("wrong magic number: %s",
-                       fullpath);
-        return EXIT_IO_ERROR;
-    }
-
-    if (lp->struct_size != sizeof (struct dcc_task_state)) {
-        rs_log_warning("wrong structure size: %s: version mismatch?",
-                       fullpath);
-        return EXIT_IO_ERROR;
-    }
-
-    lp->file[sizeof lp->file - 1] = '\0';
-    lp->host[sizeof lp->host - 1] = '\0';
-    if (lp->curr_phase > DCC_PHASE_DONE) {
-        lp->curr_phase = DCC_PHASE_COMPILE;
-    }
-
-    lp->next = 0;
-
-    return 0;
+    return dcc_mon_check_state(lp, fullpath);
 }
 
 
@@ -326,6 +338,156 @@ static void dcc_mon_insert_sorted(struct dcc_task_state **list,
 }
 
 
+#ifdef DCC_HAVE_JOBTAB
+/* How many times to retry reading a slot that is being written. */
+static const int dcc_jobtab_read_tries = 100;
+
+
+/**
+ * Return the job table of this user mapped read-only, or NULL if no client
+ * has created it yet.  The mapping is kept from one poll to the next.
+ **/
+static const struct dcc_jobtab *dcc_mon_map_jobtab(const char *dirname)
+{
+    static const struct dcc_jobtab *jobtab;
+    char *fname;
+    int fd;
+    struct stat st;
+    void *p;
+
+    if (jobtab)
+        return jobtab;
+
+    checked_asprintf(&fname, "%s/%s", dirname, dcc_jobtab_name);
+    if (fname == NULL)
+        return NULL;
+
+    if ((fd = open(fname, O_RDONLY|O_BINARY, 0)) == -1) {
+        if (errno != ENOENT)
+            rs_log_warning("failed to open %s: %s", fname, strerror(errno));
+        goto out;
+    }
+
+    /* A client may not have sized it yet; try again next time. */
+    if (fstat(fd, &st) == -1
+        || st.st_size != (off_t) sizeof (struct dcc_jobtab))
+        goto out_close;
+
+    p = mmap(NULL, sizeof (struct dcc_jobtab), PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        rs_log_warning("failed to mmap %s: %s", fname, strerror(errno));
+        goto out_close;
+    }
+    jobtab = p;
+
+    out_close:
+    dcc_close(fd);
+    out:
+    free(fname);
+    return jobtab;
+}
+
+
+/**
+ * Copy out the state held in @p slot, retrying while its owner is in the
+ * middle of an update.
+ **/
+static int dcc_mon_read_slot(const struct dcc_jobtab_slot *slot,
+                             struct dcc_task_state *lp)
+{
+    unsigned long seq;
+    int i;
+
+    for (i = 0; i < dcc_jobtab_read_tries; i++) {
+        seq = slot->seq;
+        if (seq & 1)
+            continue;
+        __sync_synchronize();
+        memcpy(lp, &slot->state, sizeof *lp);
+        __sync_synchronize();
+        if (slot->seq == seq)
+            return 0;
+    }
+
+    rs_trace("gave up reading a busy job slot");
+    return EXIT_IO_ERROR;
+}
+
+
+/**
+ * Add all the jobs in the shared job table to @p p_list.
+ **/
+static int dcc_mon_poll_jobtab(const char *dirname,
+                               struct dcc_task_state **p_list)
+{
+    const struct dcc_jobtab *jobtab;
+    struct dcc_task_state *tl;
+    int i;
+
+    if ((jobtab = dcc_mon_map_jobtab(dirname)) == NULL
+        || jobtab->magic != DCC_JOBTAB_MAGIC)
+        return 0;
+
+    if (jobtab->struct_size != sizeof (struct dcc_jobtab)
+        || jobtab->n_slots != DCC_JOBTAB_SLOTS) {
+        /* Clients that don't agree on the layout use state files. */
+        rs_trace("wrong job table header in %s: version mismatch?",
+                 dirname);
+        return 0;
+    }
+
+    for (i = 0; i < DCC_JOBTAB_SLOTS; i++) {
+        if (jobtab->slots[i].owner == 0)
+            continue;
+
+        tl = calloc(1, sizeof *tl);
+        if (!tl) {
+            rs_log_crit("failed to allocate dcc_task_state");
+            return EXIT_OUT_OF_MEMORY;
+        }
+
+        /* A released slot has its magic cleared, so it fails the check
+         * quietly... */
+        if (dcc_mon_read_slot(&jobtab->slots[i], tl)
+            || tl->magic == 0
+            || dcc_mon_check_state(tl, dirname)
+            /* ...and a slot whose owner died without releasing it is
+             * ignored whatever phase it was in. */
+            || dcc_mon_check_orphans(tl)) {
+            free(tl);
+            continue;
+        }
+
+        dcc_mon_insert_sorted(p_list, tl);
+    }
+
+    return 0;
+}
+#endif /* DCC_HAVE_JOBTAB */
+
+
+int dcc_mon_generation(unsigned long *p_gen)
+{
+#ifdef DCC_HAVE_JOBTAB
+    int ret;
+    char *dirname;
+    const struct dcc_jobtab *jobtab;
+
+    if ((ret = dcc_get_state_dir(&dirname)))
+        return ret;
+
+    if ((jobtab = dcc_mon_map_jobtab(dirname)) != NULL
+        && jobtab->magic == DCC_JOBTAB_MAGIC) {
+        *p_gen = jobtab->generation;
+        return 0;
+    }
+#endif
+
+    *p_gen = 0;
+    return 0;
+}
+
+
 /**
  * Read through the state directory and return information about all
  * processes we find there.
@@ -333,6 +495,10 @@ static void dcc_mon_insert_sorted(struct dcc_task_state **list,
  * This function has to handle any files in there that happen to be
  * corrupt -- that can easily happen if e.g. a client crashes or is
  * interrupted, or is even just in the middle of writing its file.
+ *
+ * Jobs in the shared job table are returned along with those that have
+ * state files, which are written by clients with DISTCC_STATE_FILES set
+ * and by older versions of distcc.
  **/
 int dcc_mon_poll(struct dcc_task_state **p_list)
 {
@@ -365,5 +531,13 @@ int dcc_mon_poll(struct dcc_task_state **p_list)
 
     closedir(d);
 
+#ifdef DCC_HAVE_JOBTAB
+    if ((ret = dcc_mon_poll_jobtab(dirname, p_list))) {
+        dcc_task_state_free(*p_list);
+        *p_list = NULL;
+        return ret;
+    }
+#endif
+
     return 0;
 }
@@ -185,6 +185,11 @@ extern "C" {
       header file which lets you retrieve a descriptive string
       representation of the given enum, suitable for display to the user.
 
+   long phase_start_sec, phase_start_usec
+
+      The time at which the job entered curr_phase, as returned by
+      gettimeofday() on the client.
+
    struct dcc_task_state *next
 
       A pointer to the next dcc_task_state struct in the list, or NULL if this
@@ -216,6 +221,17 @@ int dcc_mon_poll(struct dcc_task_state **ppl);
  **/
 int dcc_task_state_free(struct dcc_task_state *);
 
+/**
+ * Get a counter that changes whenever a client records a new state in the
+ * shared job table.  It is much cheaper than dcc_mon_poll(), so a monitor
+ * can check it often and poll only when it has moved.
+ *
+ * Clients that write state files don't move the counter, so a monitor
+ * should still poll every so often.  @p p_gen is set to 0 if there is no
+ * job table.
+ **/
+int dcc_mon_generation(unsigned long *p_gen);
+
 
 /* A circular buffer of the history of a particular slot.  The most
  * recent record is in past_phases[now]; the previous one is in
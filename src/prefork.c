@@ -121,6 +121,10 @@ void dcc_manage_kids(int listen_fd) {
 static void dcc_create_kids(int listen_fd) {
     pid_t kid;
 
+    /* Pick up a reloaded allow list, so that new children don't each have
+     * to reload it. */
+    dcc_get_allowed();
+
     while (dcc_nkids < dcc_max_kids) {
         if ((kid = fork()) == -1) {
             rs_log_error("fork failed: %s", strerror(errno));
@@ -102,9 +102,15 @@ dcc_pump_readwrite(int ofd, int ifd, size_t n)
     ssize_t r_in, r_out, wanted;
     int ret;
 
+    if ((ret = dcc_io_flush(ofd)) != 0)
+        return ret;
+
     while (n > 0) {
         wanted = (n > sizeof buf) ? (sizeof buf) : n;
-        r_in = read(ifd, buf, (size_t) wanted);
+        /* Start with what was read ahead of a buffered connection. */
+        r_in = (ssize_t) dcc_io_take(ifd, buf, (size_t) wanted);
+        if (r_in == 0)
+            r_in = read(ifd, buf, (size_t) wanted);
 
         if (r_in == -1 && errno == EAGAIN) {
             if ((ret = dcc_select_for_read(ifd, dcc_get_io_timeout())) != 0)
@@ -37,6 +37,8 @@
 
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/poll.h>
 
 #include "distcc.h"
 #include "trace.h"
@@ -49,6 +51,9 @@
 #include "lock.h"
 #include "compile.h"
 #include "bulk.h"
+#include "where.h"
+#include "state.h"
+#include "timeval.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 
@@ -66,21 +71,187 @@ extern gss_ctx_id_t distcc_ctx_handle;
  * might make us block until the other side reads all the data.
  */
 
+/**
+ * Milliseconds from @p now until @p when, or 0 if that has passed.
+ **/
+static int dcc_ms_until(struct timeval *when, struct timeval *now)
+{
+    struct timeval left;
+
+    if (timeval_subtract(&left, when, now))
+        return 0;
+    return (int) (left.tv_sec * 1000 + left.tv_usec / 1000);
+}
+
+
+/**
+ * Connect to the TCP server @p *host, racing a second server against it if
+ * it is slow to answer.
+ *
+ * If DISTCC_CONNECT_RACE is set to a number of milliseconds and @p *host
+ * has not accepted the connection in that time, or has refused it, then a
+ * free slot is locked on another server that can take the same request
+ * (see dcc_lock_alternate_host()) and we connect to that too.  Whichever
+ * accepts first is used, and the other connection and slot are given up.
+ * On return @p *host and @p *cpu_lock_fd describe the server used.
+ *
+ * The second slot is locked without waiting, so it doesn't matter that we
+ * may already hold the local cpp lock.
+ **/
+static int dcc_race_connect(struct dcc_hostdef **host, int *cpu_lock_fd,
+                            int *net_fd)
+{
+    struct dcc_hostdef *cand[2];
+    struct dcc_connecting conn[2];
+    int lock_fd[2] = { -1, -1 };
+    int failed[2] = { 0, 0 };
+    struct pollfd pfd[2];
+    struct timeval now, race_at, deadline;
+    const char *race_env;
+    int race_ms, n_cand = 1, slot = 0, winner = -1;
+    int i, n_ready, wait_ms, connected;
+    int ret;
+
+    race_env = getenv("DISTCC_CONNECT_RACE");
+    race_ms = race_env ? atoi(race_env) : 0;
+    if (race_ms <= 0)
+        return dcc_connect_by_name((*host)->hostname, (*host)->port, net_fd);
+
+    cand[0] = *host;
+    lock_fd[0] = *cpu_lock_fd;
+    /* If the first server fails at once, go straight to the second. */
+    if ((ret = dcc_start_connect_by_name(cand[0]->hostname, cand[0]->port,
+                                         &conn[0])))
+        failed[0] = 1;
+    pfd[0].fd = conn[0].fd;
+    pfd[0].events = POLLOUT;
+    conn[1].fd = -1;
+    conn[1].res = NULL;
+    pfd[1].fd = -1;
+    pfd[1].events = POLLOUT;
+
+    gettimeofday(&now, NULL);
+    race_at = deadline = now;
+    race_at.tv_sec += race_ms / 1000;
+    race_at.tv_usec += (race_ms % 1000) * 1000;
+    if (race_at.tv_usec >= 1000000) {
+        race_at.tv_sec++;
+        race_at.tv_usec -= 1000000;
+    }
+    deadline.tv_sec += dcc_connect_timeout;
+
+    while (winner == -1) {
+        gettimeofday(&now, NULL);
+
+        if (n_cand == 1 && (failed[0] || dcc_ms_until(&race_at, &now) == 0)) {
+            /* Time to bring in a second server, if there is one. */
+            n_cand = 2;
+            if (dcc_lock_alternate_host(cand[0], &cand[1], &lock_fd[1],
+                                        &slot) == 0) {
+                rs_trace("racing %s against %s", cand[1]->hostdef_string,
+                         cand[0]->hostdef_string);
+                if (dcc_start_connect_by_name(cand[1]->hostname,
+                                              cand[1]->port, &conn[1]) != 0)
+                    failed[1] = 1;
+                pfd[1].fd = conn[1].fd;
+            } else {
+                failed[1] = 1;
+            }
+        }
+
+        if (failed[0] && (n_cand == 1 || failed[1]))
+            break;
+
+        wait_ms = dcc_ms_until(&deadline, &now);
+        if (wait_ms == 0) {
+            rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                   "timeout while connecting to %s", cand[0]->hostdef_string);
+            break;
+        }
+        if (n_cand == 1 && dcc_ms_until(&race_at, &now) < wait_ms)
+            wait_ms = dcc_ms_until(&race_at, &now);
+
+        n_ready = poll(pfd, 2, wait_ms + 1);
+        if (n_ready == -1 && errno != EINTR) {
+            rs_log_error("poll failed: %s", strerror(errno));
+            break;
+        }
+        if (n_ready <= 0)
+            continue;
+
+        for (i = 0; i < 2 && winner == -1; i++) {
+            if (pfd[i].fd == -1 || pfd[i].revents == 0)
+                continue;
+            /* A server is only given up once all its addresses fail. */
+            if (dcc_connecting_check(&conn[i], &connected) != 0) {
+                rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                       "failed to connect to %s", cand[i]->hostdef_string);
+                failed[i] = 1;
+            } else if (connected) {
+                winner = i;
+            }
+            pfd[i].fd = conn[i].fd;
+        }
+    }
+
+    if (winner != -1) {
+        *net_fd = conn[winner].fd;
+        conn[winner].fd = -1;
+    }
+
+    /* Give up the connections and the slot we are not using. */
+    for (i = 0; i < 2; i++)
+        dcc_connecting_free(&conn[i]);
+    for (i = 0; i < n_cand; i++) {
+        if (i == winner)
+            continue;
+        if (i == 1 && lock_fd[1] != -1) {
+            dcc_unlock(lock_fd[1]);
+            if (failed[1])
+                dcc_disliked_host(cand[1]);
+        }
+    }
+
+    if (winner == -1) {
+        if (!failed[0])
+            return EXIT_TIMEOUT;
+        return ret ? ret : EXIT_CONNECT_FAILED;
+    }
+
+    if (winner == 1) {
+        rs_trace("%s won the connection race", cand[1]->hostdef_string);
+        dcc_unlock(lock_fd[0]);
+        if (failed[0])
+            dcc_disliked_host(cand[0]);
+        *host = cand[1];
+        *cpu_lock_fd = lock_fd[1];
+        dcc_note_state_slot(slot, DCC_REMOTE);
+        dcc_note_state(DCC_PHASE_CONNECT, NULL, cand[1]->hostname,
+                       DCC_REMOTE);
+    }
+    return 0;
+}
+
+
 /**
  * Open a connection using either a TCP socket or SSH.  Return input
  * and output file descriptors (which may or may not be different.)
+ *
+ * A TCP connection may end up being made to a different server; see
+ * dcc_race_connect().
  **/
-static int dcc_remote_connect(struct dcc_hostdef *host,
+static int dcc_remote_connect(struct dcc_hostdef **p_host,
+                              int *cpu_lock_fd,
                               int *to_net_fd,
                               int *from_net_fd,
                               pid_t *ssh_pid)
 {
+    struct dcc_hostdef *host = *p_host;
     int ret;
 
     if (host->mode == DCC_MODE_TCP) {
         *ssh_pid = 0;
-        if ((ret = dcc_connect_by_name(host->hostname, host->port,
-                                       to_net_fd)) != 0)
+        if ((ret = dcc_race_connect(p_host, cpu_lock_fd, to_net_fd)) != 0)
             return ret;
         *from_net_fd = *to_net_fd;
         return 0;
@@ -127,19 +298,37 @@ static int dcc_wait_for_cpp(pid_t cpp_pid,
  *
  * CPP_PID is the PID of the preprocessor running in the background.
  * We wait for it to complete before reading its output.
+ *
+ * For a host that takes manifests, everything but the file contents goes
+ * in @p manifest, which the caller must free.
  */
 static int
 dcc_send_header(int net_fd,
                 char **argv,
-                struct dcc_hostdef *host)
+                char **files,
+                struct dcc_hostdef *host,
+                struct dcc_manifest *manifest)
 {
     int ret;
 
     tcp_cork_sock(net_fd, 1);
 
+    if (host->use_manifest) {
+        if ((ret = dcc_make_manifest(host->compr, host->cpp_where,
+                                     host->use_session, argv, files,
+                                     manifest))
+            || (ret = dcc_x_req_header(net_fd, host->use_stream
+                                       ? DCC_VER_5 : DCC_VER_4))
+            || (ret = dcc_x_manifest(net_fd, manifest)))
+            return ret;
+        return 0;
+    }
+
     if ((ret = dcc_x_req_header(net_fd, host->protover)))
         return ret;
     if (host->cpp_where == DCC_CPP_ON_SERVER) {
+        if (host->use_session && (ret = dcc_x_session(net_fd)))
+            return ret;
         if ((ret = dcc_x_cwd(net_fd)))
             return ret;
     }
@@ -180,7 +369,11 @@ dcc_send_header(int net_fd,
  * If != -1, the lock must be held on entry to this function,
  * and THIS FUNCTION WILL RELEASE THE LOCK.
  *
- * @param host Definition of host to send this job to.
+ * @param p_host Definition of host to send this job to.  If the job ends
+ * up going to another server (see dcc_race_connect()), it is updated.
+ *
+ * @param cpu_lock_fd The lock held on a slot of @p *p_host, updated along
+ * with it.
  *
  * @param status on return contains the wait-status of the remote
  * compiler.
@@ -201,9 +394,11 @@ int dcc_compile_remote(char **argv,
                        char *server_stderr_fname,
                        pid_t cpp_pid,
                        int local_cpu_lock_fd,
-                       struct dcc_hostdef *host,
+                       struct dcc_hostdef **p_host,
+                       int *cpu_lock_fd,
                        int *status)
 {
+    struct dcc_hostdef *host = *p_host;
     int to_net_fd = -1, from_net_fd = -1;
     int ret;
     pid_t ssh_pid = 0;
@@ -211,6 +406,9 @@ int dcc_compile_remote(char **argv,
     off_t doti_size;
     struct timeval before, after;
     unsigned int n_files;
+    struct dcc_manifest manifest;
+
+    memset(&manifest, 0, sizeof manifest);
 
     if (gettimeofday(&before, NULL))
         rs_log_warning("gettimeofday failed");
@@ -223,8 +421,14 @@ int dcc_compile_remote(char **argv,
      * be over pipes, which are one-way connections. */
 
     *status = 0;
-    if ((ret = dcc_remote_connect(host, &to_net_fd, &from_net_fd, &ssh_pid)))
+    if ((ret = dcc_remote_connect(p_host, cpu_lock_fd,
+                                  &to_net_fd, &from_net_fd, &ssh_pid)))
         goto out;
+    host = *p_host;
+
+    /* Collect the small tokens of the request into few system calls. */
+    dcc_io_buffer(to_net_fd);
+    dcc_io_buffer(from_net_fd);
 
 #ifdef HAVE_GSSAPI
     /* Perform requested security. */
@@ -247,20 +451,39 @@ int dcc_compile_remote(char **argv,
     dcc_note_state(DCC_PHASE_SEND, NULL, NULL, DCC_REMOTE);
 
     if (host->cpp_where == DCC_CPP_ON_SERVER) {
-        if ((ret = dcc_send_header(to_net_fd, argv, host))) {
+        if ((ret = dcc_send_header(to_net_fd, argv, files, host,
+                                   &manifest))) {
           goto out;
         }
 
-        n_files = dcc_argv_len(files);
-        if ((ret = dcc_x_many_files(to_net_fd, n_files, files))) {
-            goto out;
+        if (host->use_manifest) {
+            /* Don't upload anything until the server says it can use it. */
+            tcp_cork_sock(to_net_fd, 0);
+            if ((ret = dcc_r_accept(from_net_fd)))
+                goto out;
+            tcp_cork_sock(to_net_fd, 1);
+            if ((ret = dcc_x_manifest_bodies(to_net_fd, &manifest, files)))
+                goto out;
+        } else {
+            n_files = dcc_argv_len(files);
+            if ((ret = dcc_x_many_files(to_net_fd, n_files, files))) {
+                goto out;
+            }
         }
     } else {
         /* This waits for cpp and puts its status in *status.  If cpp failed,
          * then the connection will have been dropped and we need not bother
          * trying to get any response from the server. */
 
-        if ((ret = dcc_send_header(to_net_fd, argv, host)))
+        if ((ret = dcc_send_header(to_net_fd, argv, NULL, host, &manifest)))
+            goto out;
+
+        /* Let the server see the header while cpp runs.  A manifest must
+         * really go out now, so that its answer is back by the time cpp
+         * is done. */
+        if (host->use_manifest)
+            tcp_cork_sock(to_net_fd, 0);
+        else if ((ret = dcc_io_flush(to_net_fd)))
             goto out;
 
         if ((ret = dcc_wait_for_cpp(cpp_pid, status, input_fname)))
@@ -276,6 +499,12 @@ int dcc_compile_remote(char **argv,
         if (*status != 0)
             goto out;
 
+        if (host->use_manifest) {
+            if ((ret = dcc_r_accept(from_net_fd)))
+                goto out;
+            tcp_cork_sock(to_net_fd, 1);
+        }
+
         if ((ret = dcc_x_file(to_net_fd, cpp_fname, "DOTI", host->compr,
                               &doti_size)))
             goto out;
@@ -316,6 +545,8 @@ int dcc_compile_remote(char **argv,
         local_cpu_lock_fd = -1; /* Not really needed; just for consistency. */
     }
 
+    dcc_free_manifest(&manifest);
+
     /* Close socket so that the server can terminate, rather than
      * making it wait until we've finished our work. */
     if (to_net_fd != from_net_fd) {
@@ -137,7 +137,10 @@ int dcc_explain_mismatch(const char *buf,
     memcpy(extrabuf, buf, buflen);
 
     /* Read a bit more context, and find the printable prefix. */
-    ret = read(ifd, extrabuf + buflen, sizeof extrabuf - 1 - buflen);
+    ret = (ssize_t) dcc_io_take(ifd, extrabuf + buflen,
+                                sizeof extrabuf - 1 - buflen);
+    if (ret == 0)
+        ret = read(ifd, extrabuf + buflen, sizeof extrabuf - 1 - buflen);
     if (ret == -1) {
         ret = 0;                /* pah, use what we've got */
     }
@@ -348,3 +351,23 @@ int dcc_r_argv(int ifd,
 
     return 0;
 }
+
+
+/**
+ * Free everything hanging off a manifest, and clear it.
+ **/
+void dcc_free_manifest(struct dcc_manifest *m)
+{
+    unsigned i;
+
+    if (m->argv)
+        dcc_free_argv(m->argv);
+    for (i = 0; i < m->n_entries; i++) {
+        free(m->entries[i].name);
+        free(m->entries[i].link_target);
+    }
+    free(m->entries);
+    free(m->session);
+    free(m->cwd);
+    memset(m, 0, sizeof *m);
+}
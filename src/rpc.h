@@ -43,8 +43,54 @@ int dcc_r_sometoken_int(int ifd, char *token, unsigned *val);
 
 int dcc_explain_mismatch(const char *buf, size_t buflen, int ifd);
 
+/**
+ * A protocol 4 request: everything the server needs to decide whether it
+ * can take the job, sent as one binary block ahead of any file contents.
+ **/
+struct dcc_manifest_entry {
+    char *name;                 /**< absolute name on the client */
+    char *link_target;          /**< NULL for a regular file */
+    unsigned size;              /**< bytes of file body on the wire */
+};
+
+struct dcc_manifest {
+    enum dcc_compress compr;
+    enum dcc_cpp_where cpp_where;
+    char *session;              /**< may be NULL */
+    char *cwd;                  /**< NULL unless cpp_where is on the server */
+    char **argv;
+    unsigned n_entries;
+    struct dcc_manifest_entry *entries;
+};
+
+/* Flags word at the start of the manifest. */
+#define DCC_MANIFEST_LZO        0x1
+#define DCC_MANIFEST_CPP        0x2
+#define DCC_MANIFEST_SESSION    0x4
+
+/** Biggest manifest the server will read. */
+#define DCC_MANIFEST_MAX        (16 << 20)
+
+void dcc_free_manifest(struct dcc_manifest *);
+
+/* clirpc.c */
+int dcc_make_manifest(enum dcc_compress compr,
+                      enum dcc_cpp_where cpp_where,
+                      int use_session,
+                      char **argv,
+                      char **files,
+                      struct dcc_manifest *m);
+int dcc_x_manifest(int ofd, const struct dcc_manifest *m);
+int dcc_x_manifest_bodies(int ofd, const struct dcc_manifest *m,
+                          char **files);
+int dcc_r_accept(int ifd);
+
 /* srvrpc.c */
 int dcc_r_request_header(int ifd, enum dcc_protover *);
+int dcc_r_manifest(int ifd, struct dcc_manifest *m);
+int dcc_r_manifest_files(int ifd, const struct dcc_manifest *m,
+                         const char *dirname, int reuse);
+int dcc_x_accept(int ofd, int code);
 int dcc_r_argv(int ifd,
                const char *argc_token,
                const char *argv_token,
@@ -50,6 +50,8 @@
 static const char dcc_safeguard_name[] = "_DISTCC_SAFEGUARD";
 static char dcc_safeguard_set[] = "_DISTCC_SAFEGUARD=1";
 static int dcc_safeguard_level;
+
+extern char **environ;
 //safeguard是保护措施的意思, 递归保护措施又是几个意思?
 int dcc_recursion_safeguard(void)
 {
@@ -67,11 +69,16 @@ int dcc_recursion_safeguard(void)
     return dcc_safeguard_level;
 }
 
-//增加safeguard_level, 每次加1
-int dcc_increment_safeguard(void)
+static void dcc_raise_safeguard(void)
 {
     if (dcc_safeguard_level > 0)
     dcc_safeguard_set[sizeof dcc_safeguard_set-2] = dcc_safeguard_level+'1';//卧槽, 这里好机智
+}
+
+//增加safeguard_level, 每次加1
+int dcc_increment_safeguard(void)
+{
+    dcc_raise_safeguard();
     rs_trace("setting safeguard: %s", dcc_safeguard_set);
     if ((putenv(strdup(dcc_safeguard_set)) == -1)) {//然后设回环境变量去
         rs_log_error("putenv failed");
@@ -80,3 +87,33 @@ int dcc_increment_safeguard(void)
 
     return 0;
 }
+
+
+/**
+ * Build the environment for a child started without forking, which can't
+ * call dcc_increment_safeguard() itself: our environment with the
+ * safeguard raised.  Only the array is allocated, the strings are shared
+ * with our own environment.
+ **/
+char **dcc_safeguard_environ(void)
+{
+    char **envp;
+    size_t n, i, j;
+
+    for (n = 0; environ[n]; n++)
+        ;
+    if (!(envp = malloc((n + 2) * sizeof *envp))) {
+        rs_log_error("failed to allocate environment");
+        return NULL;
+    }
+
+    dcc_raise_safeguard();
+    for (i = j = 0; i < n; i++)
+        if (strncmp(environ[i], dcc_safeguard_name,
+                    sizeof dcc_safeguard_name - 1)
+            || environ[i][sizeof dcc_safeguard_name - 1] != '=')
+            envp[j++] = environ[i];
+    envp[j++] = dcc_safeguard_set;
+    envp[j] = NULL;
+    return envp;
+}
@@ -197,6 +197,9 @@ dcc_pump_sendfile(int ofd, int ifd, size_t size)
     off_t offset = 0;
     int ret;
 
+    if ((ret = dcc_io_flush(ofd)) != 0)
+        return ret;
+
     while (size) {
         /* Handle possibility of partial transmission, e.g. if
          * sendfile() is interrupted by a signal.  size is decremented
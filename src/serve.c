@@ -90,6 +90,9 @@
 #include "stringmap.h"
 #include "dotd.h"
 #include "fix_debug_info.h"
+#include "sysroot.h"
+#include "trash.h"
+#include "compplan.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 
@@ -108,7 +111,8 @@ int dcc_auth_enabled = 0;
  **/
 static int dcc_compile_log_fd = -1;
 
-static int dcc_run_job(int in_fd, int out_fd);
+static int dcc_run_job(int in_fd, int out_fd,
+                       struct sockaddr *cli_addr, int cli_len);
 
 
 /**
@@ -168,11 +172,16 @@ int dcc_service_job(int in_fd,
     int ret;
 
     dcc_job_summary_clear();
+    rs_log_batch(1);
+
+    /* Collect the small tokens of the protocol into few system calls. */
+    dcc_io_buffer(in_fd);
+    dcc_io_buffer(out_fd);
 
     /* Log client name and check access if appropriate.  For ssh connections
      * the client comes from a unix-domain socket and that's always
      * allowed. */
-    if ((ret = dcc_check_client(cli_addr, cli_len, opt_allowed)) != 0)
+    if ((ret = dcc_check_client(cli_addr, cli_len, dcc_get_allowed())) != 0)
         goto out;
 
 #ifdef HAVE_GSSAPI
@@ -194,11 +203,20 @@ int dcc_service_job(int in_fd,
     }
 #endif
 
-    ret = dcc_run_job(in_fd, out_fd);
+    ret = dcc_run_job(in_fd, out_fd, cli_addr, cli_len);
+    if (dcc_io_unbuffer(out_fd) != 0 && ret == 0)
+        ret = EXIT_IO_ERROR;
 
     dcc_job_summary();
 
+    /* The client has its answer by now, so this is a good moment to get rid
+     * of session roots nobody has used in a while. */
+    dcc_sysroot_sweep();
+
 out:
+    dcc_io_unbuffer(out_fd);
+    dcc_io_unbuffer(in_fd);
+    rs_log_batch(0);
     return ret;
 }
 
@@ -307,8 +325,11 @@ static int dcc_remap_compiler(char **compiler_name)
  * PATH and they start the daemon from the command line.)
  *
  * At the moment we don't look for the compiler too.
+ *
+ * If @p masqueraded is not NULL, it is set to whether the compiler found is
+ * such a link.
  **/
-static int dcc_check_compiler_masq(char *compiler_name)
+static int dcc_check_compiler_masq(char *compiler_name, int *masqueraded)
 {
     const char *envpath, *p, *n;
     char *buf = NULL;
@@ -316,6 +337,8 @@ static int dcc_check_compiler_masq(char *compiler_name)
     int len;
     char linkbuf[MAXPATHLEN];
 
+    if (masqueraded)
+        *masqueraded = 0;
     if (compiler_name[0] == '/')
         return 0;
 
@@ -350,6 +373,8 @@ static int dcc_check_compiler_masq(char *compiler_name)
         if (strstr(linkbuf, "distcc")) {
             rs_log_warning("%s on distccd's path is %s and really a link to %s",
                            compiler_name, buf, linkbuf);
+            if (masqueraded)
+                *masqueraded = 1;
             break;              /* but use it anyhow */
         } else {
             rs_trace("%s is a safe symlink to %s", buf, linkbuf);
@@ -522,31 +547,48 @@ static int tweak_arguments_for_server(char **argv,
 
 
 /**
- * Read the client working directory from in_fd socket,
- * and set up the server side directory corresponding to that.
+ * Set up the server side directory corresponding to the client working
+ * directory @p client_side_cwd, and change into it.
  * Inputs:
- *   @p in_fd: the file descriptor for the socket.
+ *   @p session: the client's pump session, or NULL.
+ *   @p client_side_cwd: the current directory on the client
+ *   @p cli_addr, @p cli_len: the client, used to find its session root.
  * Outputs:
  *   @p temp_dir: a temporary directory on the server,
  *                corresponding to the client's root directory (/),
- *   @p client_side_cwd: the current directory on the client
  *   @p server_side_cwd: the corresponding directory on the server;
  *                server_side_cwd = temp_dir + client_side_cwd
+ *   @p session_lock_fd: if temp_dir is a session root shared with other
+ *                jobs, the lock that keeps it alive, otherwise -1.
  **/
-static int make_temp_dir_and_chdir_for_cpp(int in_fd,
-        char **temp_dir, char **client_side_cwd, char **server_side_cwd)
+static int make_temp_dir_and_chdir(const char *session,
+        const char *client_side_cwd,
+        struct sockaddr *cli_addr, int cli_len,
+        char **temp_dir, char **server_side_cwd,
+        int *session_lock_fd)
 {
 
         int ret = 0;
 
-        if ((ret = dcc_get_new_tmpdir(temp_dir)))
-            return ret;
-        if ((ret = dcc_r_cwd(in_fd, client_side_cwd)))
-            return ret;
+        *session_lock_fd = -1;
 
-        checked_asprintf(server_side_cwd, "%s%s", *temp_dir, *client_side_cwd);
+        if (session == NULL
+            || dcc_sysroot_open(session, cli_addr, cli_len,
+                                temp_dir, session_lock_fd)) {
+            if ((ret = dcc_get_new_tmpdir(temp_dir)))
+                goto out;
+        }
+
+        checked_asprintf(server_side_cwd, "%s%s", *temp_dir, client_side_cwd);
         if (*server_side_cwd == NULL) {
             ret = EXIT_OUT_OF_MEMORY;
+        } else if (*session_lock_fd != -1) {
+            if ((ret = dcc_mk_ancestor_dirs(*server_side_cwd))
+                || (ret = dcc_mkdir(*server_side_cwd))) {
+                ; /* leave ret the way it is */
+            } else if (chdir(*server_side_cwd) == -1) {
+                ret = EXIT_IO_ERROR;
+            }
         } else if ((ret = dcc_mk_tmp_ancestor_dirs(*server_side_cwd))) {
             ; /* leave ret the way it is */
         } else if ((ret = dcc_mk_tmpdir(*server_side_cwd))) {
@@ -554,7 +596,80 @@ static int make_temp_dir_and_chdir_for_cpp(int in_fd,
         } else if (chdir(*server_side_cwd) == -1) {
             ret = EXIT_IO_ERROR;
         }
+
+out:
+        return ret;
+}
+
+
+/**
+ * Read the client working directory from in_fd socket,
+ * and set up the server side directory corresponding to that.
+ * Inputs:
+ *   @p in_fd: the file descriptor for the socket.
+ * Outputs:
+ *   @p client_side_cwd: the current directory on the client
+ * and the rest as for make_temp_dir_and_chdir().
+ **/
+static int make_temp_dir_and_chdir_for_cpp(int in_fd,
+        struct sockaddr *cli_addr, int cli_len,
+        char **temp_dir, char **client_side_cwd, char **server_side_cwd,
+        int *session_lock_fd)
+{
+        int ret;
+        char *session = NULL;
+
+        *session_lock_fd = -1;
+
+        if ((ret = dcc_r_session_cwd(in_fd, &session, client_side_cwd)) == 0)
+            ret = make_temp_dir_and_chdir(session, *client_side_cwd,
+                                          cli_addr, cli_len, temp_dir,
+                                          server_side_cwd, session_lock_fd);
+        free(session);
+        return ret;
+}
+
+
+/**
+ * Check that we may and can run the compiler @p *compiler_name, which may
+ * be replaced by what DISTCC_CMDLIST maps it to.
+ **/
+static int dcc_check_compiler(char **compiler_name)
+{
+    if (!dcc_remap_compiler(compiler_name))
+        return EXIT_BAD_ARGUMENTS;
+    return dcc_check_compiler_masq(*compiler_name, NULL);
+}
+
+
+/**
+ * Check that a pass of the compiler, such as cc1 or as, may be run without
+ * the driver.  It must be allowed like a compiler, and unlike a compiler
+ * must not be a link to distcc, since nothing guards against the recursion.
+ **/
+static int dcc_check_plan_program(char **program)
+{
+    int ret, masqueraded;
+
+    if (!dcc_remap_compiler(program))
+        return EXIT_BAD_ARGUMENTS;
+    if ((ret = dcc_check_compiler_masq(*program, &masqueraded)))
         return ret;
+    return masqueraded ? EXIT_BAD_ARGUMENTS : 0;
+}
+
+
+/**
+ * Send the file @p fname as part of the result, in chunks if the client
+ * asked for protocol 5.
+ **/
+static int dcc_x_result_file(int out_fd, const char *fname,
+                             const char *token, enum dcc_compress compr,
+                             enum dcc_protover protover)
+{
+    if (protover >= DCC_VER_5)
+        return dcc_x_file_chunked(out_fd, fname, token, compr);
+    return dcc_x_file(out_fd, fname, token, compr, NULL);
 }
 
 
@@ -562,7 +677,9 @@ static int make_temp_dir_and_chdir_for_cpp(int in_fd,
  * Read a request, run the compiler, and send a response.
  **/
 static int dcc_run_job(int in_fd,
-                       int out_fd)
+                       int out_fd,
+                       struct sockaddr *cli_addr,
+                       int cli_len)
 {
     char **argv = NULL;
     char **tweaked_argv = NULL;
@@ -575,6 +692,7 @@ static int dcc_run_job(int in_fd,
     char *orig_input_tmp, *orig_output_tmp;
     char *dotd_target = NULL;
     pid_t cc_pid;
+    const struct dcc_plan *plan;
     enum dcc_protover protover;
     enum dcc_compress compr;
     struct timeval start, end;
@@ -585,7 +703,11 @@ static int dcc_run_job(int in_fd,
     char *server_cwd = NULL;
     char *client_cwd = NULL;
     int changed_directory = 0;
+    int session_lock_fd = -1;
+    struct dcc_manifest manifest;
+    int checked_compiler = 0;
 
+    memset(&manifest, 0, sizeof manifest);
     gettimeofday(&start, NULL);
 
     if ((ret = dcc_make_tmpnam("distcc", ".deps", &deps_fname)))
@@ -615,18 +737,53 @@ static int dcc_run_job(int in_fd,
     if ((ret = dcc_r_request_header(in_fd, &protover)))
         goto out_cleanup;
 
-    dcc_get_features_from_protover(protover, &compr, &cpp_where);
+    if (protover >= DCC_VER_4) {
+        if ((ret = dcc_r_manifest(in_fd, &manifest)))
+            goto out_cleanup;
+        compr = manifest.compr;
+        cpp_where = manifest.cpp_where;
+    } else {
+        dcc_get_features_from_protover(protover, &compr, &cpp_where);
+    }
 
     if (cpp_where == DCC_CPP_ON_SERVER) {
-        if ((ret = make_temp_dir_and_chdir_for_cpp(in_fd,
-                          &temp_dir, &client_cwd, &server_cwd)))
+        if (protover >= DCC_VER_4) {
+            client_cwd = manifest.cwd;
+            manifest.cwd = NULL;
+            ret = make_temp_dir_and_chdir(manifest.session, client_cwd,
+                                          cli_addr, cli_len, &temp_dir,
+                                          &server_cwd, &session_lock_fd);
+        } else {
+            ret = make_temp_dir_and_chdir_for_cpp(in_fd, cli_addr, cli_len,
+                          &temp_dir, &client_cwd, &server_cwd,
+                          &session_lock_fd);
+        }
+        if (ret)
             goto out_cleanup;
         changed_directory = 1;
     }
 
-    if ((ret = dcc_r_argv(in_fd, "ARGC", "ARGV", &argv))
-        || (ret = dcc_scan_args(argv, &orig_input_tmp, &orig_output_tmp,
-                                &tweaked_argv)))
+    if (protover >= DCC_VER_4) {
+        argv = manifest.argv;
+        manifest.argv = NULL;
+    } else if ((ret = dcc_r_argv(in_fd, "ARGC", "ARGV", &argv))) {
+        goto out_cleanup;
+    }
+
+    ret = dcc_scan_args(argv, &orig_input_tmp, &orig_output_tmp,
+                        &tweaked_argv);
+    if (protover >= DCC_VER_4) {
+        /* The client waits to hear whether we'll take the job before it
+         * sends any files for it. */
+        if (ret == 0)
+            ret = dcc_check_compiler(&tweaked_argv[0]);
+        checked_compiler = 1;
+        if (dcc_x_accept(out_fd, ret) == 0) {
+            tcp_cork_sock(out_fd, 0);
+            tcp_cork_sock(out_fd, 1);
+        }
+    }
+    if (ret)
         goto out_cleanup;
 
     /* The orig_input_tmp and orig_output_tmp values returned by dcc_scan_args()
@@ -654,7 +811,11 @@ static int dcc_run_job(int in_fd,
      * in a loop.
      */
     if (cpp_where == DCC_CPP_ON_SERVER) {
-        if (dcc_r_many_files(in_fd, temp_dir, compr)
+        if ((protover >= DCC_VER_4
+             ? dcc_r_manifest_files(in_fd, &manifest, temp_dir,
+                                    session_lock_fd != -1)
+             : dcc_r_many_files(in_fd, temp_dir, compr,
+                                session_lock_fd != -1))
             || dcc_set_output(argv, temp_o)
             || tweak_arguments_for_server(argv, temp_dir, deps_fname,
                                           &dotd_target, &tweaked_argv))
@@ -672,13 +833,21 @@ static int dcc_run_job(int in_fd,
             goto out_cleanup;
     }
 
-    if (!dcc_remap_compiler(&argv[0]))
-    goto out_cleanup;
+    if (!checked_compiler) {
+        if (!dcc_remap_compiler(&argv[0]))
+            goto out_cleanup;
 
-    if ((ret = dcc_check_compiler_masq(argv[0])))
-        goto out_cleanup;
+        if ((ret = dcc_check_compiler_masq(argv[0], NULL)))
+            goto out_cleanup;
+    }
 
-    if ((compile_ret = dcc_spawn_child(argv, &cc_pid,
+    if (opt_compiler_plans
+        && (plan = dcc_plan_find(argv, temp_dir, dcc_check_plan_program))) {
+        if ((compile_ret = dcc_plan_run(plan, argv, temp_dir,
+                                        out_fname, err_fname,
+                                        in_fd, &status)))
+            status = W_EXITCODE(compile_ret, 0);
+    } else if ((compile_ret = dcc_spawn_child(argv, &cc_pid,
                                        "/dev/null", out_fname, err_fname))
         || (compile_ret = dcc_collect_child("cc", cc_pid, &status, in_fd))) {
         /* We didn't get around to finding a wait status from the actual
@@ -688,12 +857,17 @@ static int dcc_run_job(int in_fd,
 
     if ((ret = dcc_x_result_header(out_fd, protover))
         || (ret = dcc_x_cc_status(out_fd, status))
-        || (ret = dcc_x_file(out_fd, err_fname, "SERR", compr, NULL))
-        || (ret = dcc_x_file(out_fd, out_fname, "SOUT", compr, NULL))
+        || (ret = dcc_x_result_file(out_fd, err_fname, "SERR", compr,
+                                    protover))
+        || (ret = dcc_x_result_file(out_fd, out_fname, "SOUT", compr,
+                                    protover))
         || WIFSIGNALED(status)
         || WEXITSTATUS(status)) {
         /* Something went wrong, so send DOTO 0 */
-        dcc_x_token_int(out_fd, "DOTO", 0);
+        if (protover >= DCC_VER_5)
+            dcc_x_buf_chunked(out_fd, NULL, 0, "DOTO", compr);
+        else
+            dcc_x_token_int(out_fd, "DOTO", 0);
 
     if (job_result == -1)
             job_result = STATS_COMPILE_ERROR;
@@ -701,30 +875,41 @@ static int dcc_run_job(int in_fd,
         if (cpp_where == DCC_CPP_ON_SERVER) {
           rs_trace("fixing up debug info");
           /*
-           * We update the debugging information, replacing all occurrences
-           * of temp_dir (the server temp directory that corresponds to the
-           * client's root directory) with "/", to convert server path
-           * names to client path names.  This is safe to do only because
-           * temp_dir is of the form "/var/tmp/distccd-XXXXXX" where XXXXXX
-           * is randomly chosen by mkdtemp(), which makes it inconceivably
-           * unlikely that this pattern could occur in the debug info by
-           * chance.
+           * As we send the object, we update the debugging information,
+           * replacing all occurrences of temp_dir (the server temp
+           * directory that corresponds to the client's root directory)
+           * with "/", to convert server path names to client path names.
+           * This is safe to do only because temp_dir is an absolute path
+           * under the server's $TMPDIR that the client's own paths won't
+           * contain: either "$TMPDIR/distccd_XXXXXX", made by mkdtemp(),
+           * or a session root "$TMPDIR/distccd_s_<client>_<hash>".  The
+           * session root's name can be predicted, but only a source tree
+           * kept inside the server's $TMPDIR could mention it by chance.
            */
-          if ((ret = dcc_fix_debug_info(temp_o, "/", temp_dir)))
+          if ((ret = dcc_x_file_fix_debug_info(out_fd, temp_o, "DOTO", compr,
+                                               "/", temp_dir,
+                                               protover >= DCC_VER_5)))
             goto out_cleanup;
-        }
-        if ((ret = dcc_x_file(out_fd, temp_o, "DOTO", compr, NULL)))
+        } else if ((ret = dcc_x_result_file(out_fd, temp_o, "DOTO", compr,
+                                            protover)))
             goto out_cleanup;
 
         if (cpp_where == DCC_CPP_ON_SERVER) {
             char *cleaned_dotd;
+            size_t cleaned_dotd_len;
             ret = dcc_cleanup_dotd(deps_fname,
                                    &cleaned_dotd,
+                                   &cleaned_dotd_len,
                                    temp_dir,
                                    dotd_target ? dotd_target : orig_output,
                                    temp_o);
             if (ret) goto out_cleanup;
-            ret = dcc_x_file(out_fd, cleaned_dotd, "DOTD", compr, NULL);
+            if (protover >= DCC_VER_5)
+                ret = dcc_x_buf_chunked(out_fd, cleaned_dotd,
+                                        cleaned_dotd_len, "DOTD", compr);
+            else
+                ret = dcc_x_buf(out_fd, cleaned_dotd, cleaned_dotd_len,
+                                "DOTD", compr);
             free(cleaned_dotd);
         }
 
@@ -739,6 +924,9 @@ static int dcc_run_job(int in_fd,
 
     dcc_critique_status(status, argv[0], orig_input, dcc_hostdef_local,
                         0);
+    /* Let the client have the last of its answer before we tidy up. */
+    if (dcc_io_flush(out_fd) && ret == 0)
+        ret = EXIT_IO_ERROR;
     tcp_cork_sock(out_fd, 0);
 
     rs_log(RS_LOG_INFO|RS_LOG_NONAME, "job complete");
@@ -752,6 +940,8 @@ out_cleanup:
       }
     }
 
+    dcc_sysroot_release(session_lock_fd);
+
     switch (ret) {
     case EXIT_BUSY: /* overloaded */
         job_result = STATS_REJ_OVERLOAD;
@@ -799,6 +989,12 @@ out_cleanup:
     }
 
     dcc_remove_log_to_file();
+    /* A pump-mode tree of our own goes to the trash in one rename, rather
+     * than one file at a time. */
+    if (temp_dir && session_lock_fd == -1
+        && !dcc_getenv_bool("DISTCC_SAVE_TEMPS", 0)
+        && dcc_trash_tree(temp_dir) == 0)
+        dcc_forget_cleanups_under(temp_dir);
     dcc_cleanup_tempfiles();
 
     free(orig_input);
@@ -819,6 +1015,7 @@ out_cleanup:
 
     free(client_cwd);
     free(server_cwd);
+    dcc_free_manifest(&manifest);
 
     return ret;
 }
@@ -229,10 +229,9 @@ int is_a_socket(int fd)
  **/
 int dcc_check_client(struct sockaddr *psa,
                      int salen,
-                     struct dcc_allow_list *allowed)
+                     const struct dcc_allow_trie *allowed)
 {
     char *client_ip;
-    struct dcc_allow_list *l;
     int ret;
 
     if ((ret = dcc_sockaddr_to_string(psa, salen, &client_ip)) != 0)
@@ -254,13 +253,7 @@ int dcc_check_client(struct sockaddr *psa,
         return 0;
     }
 
-    for (l = allowed; l; l = l->next) {
-        ret = dcc_check_address(psa, &l->addr, &l->mask);
-        if (ret != EXIT_ACCESS_DENIED)
-            break;
-    }
-
-    if (ret != 0) {
+    if ((ret = dcc_allow_trie_check(allowed, psa)) != 0) {
         rs_log_error("connection from client '%s' denied by access list",
                      client_ip);
     }
@@ -23,5 +23,5 @@
 /* srvnet.c */
 int dcc_socket_listen(int port, int *fd, const char *listen_addr);
 int is_a_socket(int fd);
-struct dcc_allow_list;
-int dcc_check_client(struct sockaddr *, int, struct dcc_allow_list *);
+struct dcc_allow_trie;
+int dcc_check_client(struct sockaddr *, int, const struct dcc_allow_trie *);
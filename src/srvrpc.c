@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #include "distcc.h"
@@ -60,7 +61,7 @@ int dcc_r_request_header(int ifd,
         return ret;
     }
 
-    if (vers > DCC_VER_3) {
+    if (vers > DCC_VER_5) {
         rs_log_error("can't handle requested protocol version is %d", vers);
         return EXIT_PROTOCOL_ERROR;
     }
@@ -79,6 +80,41 @@ int dcc_r_cwd(int ifd, char **cwd)
     return dcc_r_token_string(ifd, "CDIR", cwd);
 }
 
+/**
+ * Read the optional SESS token that a client sends ahead of CDIR when it
+ * wants the server to keep its mirrored file tree for later jobs, followed
+ * by the CDIR itself.  *session is set to NULL if the client did not send
+ * one, so older clients keep working unchanged.
+ **/
+int dcc_r_session_cwd(int ifd, char **session, char **cwd)
+{
+    char token[5];
+    unsigned len;
+    int ret;
+
+    *session = NULL;
+    *cwd = NULL;
+
+    if ((ret = dcc_r_sometoken_int(ifd, token, &len)))
+        return ret;
+
+    if (strncmp(token, "SESS", 4) == 0) {
+        if ((ret = dcc_r_str_alloc(ifd, len, session)))
+            return ret;
+        rs_trace("got session '%s'", *session);
+        return dcc_r_cwd(ifd, cwd);
+    } else if (strncmp(token, "CDIR", 4) == 0) {
+        if ((ret = dcc_r_str_alloc(ifd, len, cwd)))
+            return ret;
+        rs_trace("got '%s'", *cwd);
+        return 0;
+    }
+
+    rs_log_error("protocol derailment: expected token SESS or CDIR, got %s",
+                 token);
+    return EXIT_PROTOCOL_ERROR;
+}
+
 /* @p path must be point to malloc'ed memory
  * Replaces **path with a pointer to a string containing
  * dirname + path.
@@ -96,9 +132,90 @@ static int prepend_dir_to_name(const char *dirname, char **path)
         return 0;
 }
 
+/**
+ * Make @p name a symlink to @p target inside a session root, which other
+ * jobs may be using concurrently.  An existing link with the right target
+ * is left alone; anything else is replaced atomically by renaming a fresh
+ * link over it.  Nothing is registered for cleanup.
+ **/
+static int dcc_r_link_if_changed(const char *target, const char *name)
+{
+    char old_target[MAXPATHLEN + 1];
+    ssize_t n;
+    char *tmp_name = NULL;
+    int ret = 0;
+
+    n = readlink(name, old_target, sizeof old_target - 1);
+    if (n >= 0) {
+        old_target[n] = '\0';
+        if (strcmp(old_target, target) == 0)
+            return 0;
+    }
+
+    if ((ret = dcc_mk_ancestor_dirs(name)))
+        return ret;
+
+    if (checked_asprintf(&tmp_name, "%s.distccd_%ld", name,
+                         (long) getpid()) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    unlink(tmp_name);
+    if (symlink(target, tmp_name) != 0) {
+        rs_log_error("failed to create path for %s: %s", name,
+                     strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else if (rename(tmp_name, name) != 0) {
+        rs_log_error("failed to rename %s to %s: %s", tmp_name, name,
+                     strerror(errno));
+        unlink(tmp_name);
+        ret = EXIT_IO_ERROR;
+    }
+    free(tmp_name);
+    return ret;
+}
+
+/**
+ * Make @p name, whose directory already exists, a symlink to @p target as
+ * the client sent it.  Absolute targets are taken to be in the job's tree
+ * under @p dirname as well.
+ **/
+static int dcc_r_make_link(const char *dirname, const char *target,
+                           const char *name, int reuse)
+{
+    char *full_target = NULL;
+    int ret = 0;
+
+    /* FIXME: verify that target doesn't contain '..'.
+     * But the include server uses '..' to reference system
+     * directories (see _MakeLinkFromMirrorToRealLocation
+     * in include_server/compiler_defaults.py), so we'll need to
+     * modify that first. */
+    if (target[0] == '/') {
+        checked_asprintf(&full_target, "%s%s", dirname, target);
+        if (full_target == NULL)
+            return EXIT_OUT_OF_MEMORY;
+        target = full_target;
+    }
+
+    if (reuse) {
+        ret = dcc_r_link_if_changed(target, name);
+    } else if (symlink(target, name) != 0) {
+        rs_log_error("failed to create path for %s: %s", name,
+                     strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else if ((ret = dcc_add_cleanup(name))) {
+        /* bailing out */
+        unlink(name);
+    }
+
+    free(full_target);
+    return ret;
+}
+
 int dcc_r_many_files(int in_fd,
                      const char *dirname,
-                     enum dcc_compress compr)
+                     enum dcc_compress compr,
+                     int reuse)
 {
     int ret = 0;
     unsigned int n_files;
@@ -130,31 +247,16 @@ int dcc_r_many_files(int in_fd,
             if ((ret = dcc_r_str_alloc(in_fd, link_or_file_len, &link_target))){
                 goto out_cleanup;
             }
-            /* FIXME: verify that link_target doesn't contain '..'.
-             * But the include server uses '..' to reference system
-             * directories (see _MakeLinkFromMirrorToRealLocation
-             * in include_server/compiler_defaults.py), so we'll need to
-             * modify that first. */
-            if (link_target[0] == '/') {
-                if ((ret = prepend_dir_to_name(dirname, &link_target))) {
-                    goto out_cleanup;
-                }
-            }
-            if ((ret = dcc_mk_tmp_ancestor_dirs(name))) {
+            if (!reuse && (ret = dcc_mk_tmp_ancestor_dirs(name))) {
                 goto out_cleanup;
             }
-            if (symlink(link_target, name) != 0) {
-                rs_log_error("failed to create path for %s: %s", name,
-                             strerror(errno));
-                ret = 1;
-                goto out_cleanup;
-            }
-            if ((ret = dcc_add_cleanup(name))) {
-                /* bailing out */
-                unlink(name);
+            ret = dcc_r_make_link(dirname, link_target, name, reuse);
+        } else if (strncmp(token, "FILE", 4) == 0) {
+            if (reuse) {
+                ret = dcc_r_file_if_changed(in_fd, name, link_or_file_len,
+                                            compr);
                 goto out_cleanup;
             }
-        } else if (strncmp(token, "FILE", 4) == 0) {
             if ((ret = dcc_r_file(in_fd, name, link_or_file_len, compr))) {
                 goto out_cleanup;
             }
@@ -188,3 +290,312 @@ out_cleanup:
     }
     return ret;
 }
+
+
+/**
+ * A manifest being taken apart; see dcc_x_manifest() for the layout.
+ **/
+struct dcc_mreader {
+    const unsigned char *p;
+    const unsigned char *end;
+};
+
+static int dcc_mread_truncated(void)
+{
+    rs_log_error("manifest from client is truncated");
+    return EXIT_PROTOCOL_ERROR;
+}
+
+static int dcc_mread_u32(struct dcc_mreader *r, unsigned *v)
+{
+    if (r->end - r->p < 4)
+        return dcc_mread_truncated();
+    *v = ((unsigned) r->p[0] << 24) | ((unsigned) r->p[1] << 16)
+        | ((unsigned) r->p[2] << 8) | (unsigned) r->p[3];
+    r->p += 4;
+    return 0;
+}
+
+static int dcc_mread_str(struct dcc_mreader *r, char **s)
+{
+    unsigned len;
+    int ret;
+
+    if ((ret = dcc_mread_u32(r, &len)))
+        return ret;
+    if ((size_t) (r->end - r->p) < len)
+        return dcc_mread_truncated();
+    if (memchr(r->p, '\0', len)) {
+        rs_log_error("manifest from client has a nul in a string");
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if ((*s = malloc((size_t) len + 1)) == NULL) {
+        rs_log_error("failed to allocate %u byte string", len);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    memcpy(*s, r->p, len);
+    (*s)[len] = '\0';
+    r->p += len;
+    return 0;
+}
+
+/*
+ * Names in the manifest go under the job's directory, so they must be
+ * absolute and must not climb out of it.
+ */
+static int dcc_manifest_name_ok(const char *name)
+{
+    size_t len = strlen(name);
+
+    return name[0] == '/'
+        && strstr(name, "/../") == NULL
+        && !(len >= 3 && strcmp(name + len - 3, "/..") == 0);
+}
+
+
+/**
+ * Read the MANI token of a protocol 4 request and everything in it.
+ *
+ * Unlike the token-per-field protocols this gets the whole job in one
+ * read, and lets the server look at the command and the list of files
+ * before any of their contents arrive.
+ **/
+int dcc_r_manifest(int ifd, struct dcc_manifest *m)
+{
+    struct dcc_mreader r;
+    unsigned char *buf = NULL;
+    unsigned len, flags, argc, i;
+    unsigned char kind;
+    int ret;
+
+    memset(m, 0, sizeof *m);
+
+    if ((ret = dcc_r_token_int(ifd, "MANI", &len)))
+        return ret;
+    if (len > DCC_MANIFEST_MAX) {
+        rs_log_error("client sent a %u byte manifest; the limit is %d",
+                     len, DCC_MANIFEST_MAX);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if ((buf = malloc(len ? len : 1)) == NULL) {
+        rs_log_error("failed to allocate %u byte manifest", len);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    if ((ret = dcc_readx(ifd, buf, len)))
+        goto out;
+    r.p = buf;
+    r.end = buf + len;
+
+    if ((ret = dcc_mread_u32(&r, &flags)))
+        goto out;
+    if ((flags & ~(DCC_MANIFEST_LZO|DCC_MANIFEST_CPP|DCC_MANIFEST_SESSION))
+        || ((flags & DCC_MANIFEST_SESSION) && !(flags & DCC_MANIFEST_CPP))) {
+        rs_log_error("can't handle manifest flags %#x", flags);
+        ret = EXIT_PROTOCOL_ERROR;
+        goto out;
+    }
+    m->compr = (flags & DCC_MANIFEST_LZO)
+        ? DCC_COMPRESS_LZO1X : DCC_COMPRESS_NONE;
+    m->cpp_where = (flags & DCC_MANIFEST_CPP)
+        ? DCC_CPP_ON_SERVER : DCC_CPP_ON_CLIENT;
+
+    if ((flags & DCC_MANIFEST_SESSION)
+        && (ret = dcc_mread_str(&r, &m->session)))
+        goto out;
+    if (flags & DCC_MANIFEST_CPP) {
+        if ((ret = dcc_mread_str(&r, &m->cwd)))
+            goto out;
+        if (m->cwd[0] != '/') {
+            rs_log_error("client working directory \"%s\" is not absolute",
+                         m->cwd);
+            ret = EXIT_PROTOCOL_ERROR;
+            goto out;
+        }
+    }
+
+    /* Every argument takes at least a length word, which bounds argc
+     * before we allocate for it. */
+    if ((ret = dcc_mread_u32(&r, &argc)))
+        goto out;
+    if (argc == 0 || argc > (size_t) (r.end - r.p) / 4) {
+        rs_log_error("manifest has a bad argument count %u", argc);
+        ret = EXIT_PROTOCOL_ERROR;
+        goto out;
+    }
+    if ((m->argv = calloc((size_t) argc + 1, sizeof m->argv[0])) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    for (i = 0; i < argc; i++)
+        if ((ret = dcc_mread_str(&r, &m->argv[i])))
+            goto out;
+
+    /* Likewise each entry is at least a kind byte and two words. */
+    if ((ret = dcc_mread_u32(&r, &m->n_entries)))
+        goto out;
+    if (m->n_entries > (size_t) (r.end - r.p) / 9
+        || (m->n_entries && !(flags & DCC_MANIFEST_CPP))) {
+        rs_log_error("manifest has a bad file count %u", m->n_entries);
+        m->n_entries = 0;
+        ret = EXIT_PROTOCOL_ERROR;
+        goto out;
+    }
+    if (m->n_entries
+        && (m->entries = calloc(m->n_entries,
+                                sizeof m->entries[0])) == NULL) {
+        m->n_entries = 0;
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    for (i = 0; i < m->n_entries; i++) {
+        struct dcc_manifest_entry *e = &m->entries[i];
+
+        if (r.p == r.end) {
+            ret = dcc_mread_truncated();
+            goto out;
+        }
+        kind = *r.p++;
+        if ((ret = dcc_mread_str(&r, &e->name)))
+            goto out;
+        if (!dcc_manifest_name_ok(e->name)) {
+            rs_log_error("bad file name \"%s\" in manifest", e->name);
+            ret = EXIT_PROTOCOL_ERROR;
+            goto out;
+        }
+        if (kind == 'F') {
+            ret = dcc_mread_u32(&r, &e->size);
+        } else if (kind == 'L') {
+            ret = dcc_mread_str(&r, &e->link_target);
+        } else {
+            rs_log_error("bad entry kind %#x in manifest", kind);
+            ret = EXIT_PROTOCOL_ERROR;
+        }
+        if (ret)
+            goto out;
+    }
+
+    if (r.p != r.end) {
+        rs_log_error("%lu extra bytes at the end of the manifest",
+                     (unsigned long) (r.end - r.p));
+        ret = EXIT_PROTOCOL_ERROR;
+        goto out;
+    }
+
+    rs_trace("got %u byte manifest with %u arguments and %u files",
+             len, argc, m->n_entries);
+    dcc_trace_argv("got arguments", m->argv);
+
+  out:
+    free(buf);
+    if (ret)
+        dcc_free_manifest(m);
+    return ret;
+}
+
+
+/**
+ * Tell the client whether we'll take the job it described in its
+ * manifest: 0 to go ahead and send the files, otherwise the exit code we
+ * are failing it with.
+ **/
+int dcc_x_accept(int ofd, int code)
+{
+    return dcc_x_token_int(ofd, "ACPT", (unsigned) code);
+}
+
+
+/**
+ * Receive a body of @p len bytes into @p name, whose directory exists.
+ **/
+static int dcc_r_manifest_body(int ifd, const char *name, unsigned len,
+                               enum dcc_compress compr, int reuse)
+{
+    int ofd;
+    int ret;
+
+    if (reuse)
+        return dcc_r_file_if_changed(ifd, name, len, compr);
+
+    ofd = open(name, O_TRUNC|O_WRONLY|O_CREAT|O_BINARY, 0666);
+    if (ofd == -1) {
+        rs_log_error("failed to create %s: %s", name, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if ((ret = dcc_add_cleanup(name))) {
+        /* bailing out */
+        close(ofd);
+        unlink(name);
+        return ret;
+    }
+
+    ret = len ? dcc_r_bulk(ofd, ifd, len, compr) : 0;
+    if (dcc_close(ofd) && !ret)
+        ret = EXIT_IO_ERROR;
+    if (!ret)
+        rs_trace("received %u bytes to file %s", len, name);
+    return ret;
+}
+
+
+/**
+ * Lay out the files of a manifest under @p dirname, and then receive
+ * their bodies, which follow one after another in the order listed.
+ *
+ * All the directories and links are made before anything is read, each
+ * directory once however many files are in it.  If @p reuse is set the
+ * tree is shared with other jobs, as in dcc_r_many_files().
+ **/
+int dcc_r_manifest_files(int ifd, const struct dcc_manifest *m,
+                         const char *dirname, int reuse)
+{
+    char **names;
+    const char *prev = NULL;
+    size_t prev_dir_len = 0, dir_len;
+    unsigned i;
+    int ret = 0;
+
+    if (m->n_entries == 0)
+        return 0;
+    if ((names = calloc(m->n_entries, sizeof names[0])) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    for (i = 0; i < m->n_entries; i++) {
+        checked_asprintf(&names[i], "%s%s", dirname, m->entries[i].name);
+        if (names[i] == NULL) {
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+
+        /* Headers come in runs from the same directory. */
+        dir_len = strrchr(names[i], '/') - names[i];
+        if (prev == NULL || dir_len != prev_dir_len
+            || strncmp(names[i], prev, dir_len) != 0) {
+            if ((ret = reuse ? dcc_mk_ancestor_dirs(names[i])
+                             : dcc_mk_tmp_ancestor_dirs(names[i]))) {
+                rs_log_error("failed to create path for '%s'", names[i]);
+                goto out;
+            }
+            prev = names[i];
+            prev_dir_len = dir_len;
+        }
+
+        if (m->entries[i].link_target
+            && (ret = dcc_r_make_link(dirname, m->entries[i].link_target,
+                                      names[i], reuse)))
+            goto out;
+    }
+
+    for (i = 0; i < m->n_entries; i++) {
+        if (m->entries[i].link_target)
+            continue;
+        if ((ret = dcc_r_manifest_body(ifd, names[i], m->entries[i].size,
+                                       m->compr, reuse)))
+            goto out;
+    }
+
+  out:
+    for (i = 0; i < m->n_entries; i++)
+        free(names[i]);
+    free(names);
+    return ret;
+}
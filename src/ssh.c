@@ -65,6 +65,11 @@
 
 const char *dcc_default_ssh = "ssh";
 
+/* How long an idle ssh master connection is kept, in seconds.  Off unless
+ * DISTCC_SSH_PERSIST asks for it, since it overrides the user's own
+ * multiplexing settings and needs OpenSSH 5.6 or later. */
+static const int dcc_default_ssh_persist = 0;
+
 
 
 
@@ -148,6 +153,9 @@ static int dcc_run_piped_cmd(char **argv,
         if (from_child_pipe[1] != STDOUT_FILENO)
             close(from_child_pipe[1]);
         dcc_set_blocking(STDIN_FILENO);
+        /* A persistent ssh master forked from this child must not keep
+         * our host locks. */
+        dcc_close_fds_from(STDERR_FILENO + 1);
 
         execvp(argv[0], (char **) argv);
         rs_log_error("failed to exec %s: %s", argv[0], strerror(errno));
@@ -167,6 +175,59 @@ static int dcc_run_piped_cmd(char **argv,
 
 
 
+/**
+ * If DISTCC_SSH_PERSIST is set and @p ssh_cmd is OpenSSH, add options to
+ * @p argv so that the first job to a host starts a master connection under
+ * $DISTCC_DIR/ssh, which stays up for that many seconds after the last
+ * job, and later jobs just open a new session over it.  This skips the key exchange and login for
+ * all but the first job.
+ *
+ * Returns the number of arguments added.
+ **/
+static int dcc_ssh_persist_args(const char *ssh_cmd, char **argv)
+{
+    static char control_path[256];
+    static char control_persist[64];
+    const char *base, *e;
+    char *dir;
+    int persist = dcc_default_ssh_persist;
+
+    if ((e = getenv("DISTCC_SSH_PERSIST")) != NULL)
+        persist = atoi(e);
+    if (persist <= 0)
+        return 0;
+
+    /* Other connection commands may not understand these options. */
+    base = strrchr(ssh_cmd, '/');
+    base = base ? base + 1 : ssh_cmd;
+    if (strcmp(base, "ssh") != 0)
+        return 0;
+
+    if (dcc_get_subdir("ssh", &dir) != 0)
+        return 0;
+    /* Unix socket names are short; leave room for user, host and port. */
+    if (strlen(dir) > 64) {
+        rs_trace("%s is too long for ssh control sockets", dir);
+        free(dir);
+        return 0;
+    }
+    chmod(dir, 0700);
+    snprintf(control_path, sizeof control_path,
+             "ControlPath=%s/%%r@%%h:%%p", dir);
+    snprintf(control_persist, sizeof control_persist,
+             "ControlPersist=%d", persist);
+    free(dir);
+
+    argv[0] = (char *) "-o";
+    argv[1] = (char *) "ControlMaster=auto";
+    argv[2] = (char *) "-o";
+    argv[3] = control_path;
+    argv[4] = (char *) "-o";
+    argv[5] = control_persist;
+    return 6;
+}
+
+
 /**
  * Open a connection to a remote machine over ssh.
  *
@@ -187,7 +248,7 @@ int dcc_ssh_connect(char *ssh_cmd,
                     pid_t *ssh_pid)
 {
     pid_t ret;
-    char *child_argv[10];
+    char *child_argv[16];
     int i;
 
     /* We need to cast away constness.  I promise the strings in the argv[]
@@ -207,6 +268,7 @@ int dcc_ssh_connect(char *ssh_cmd,
 
     i = 0;
     child_argv[i++] = ssh_cmd;
+    i += dcc_ssh_persist_args(ssh_cmd, &child_argv[i]);
     if (user) {
         child_argv[i++] = (char *) "-l";
         child_argv[i++] = user;
@@ -22,7 +22,12 @@
 
 #include <config.h>
 
+#include <sys/types.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +35,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <time.h>
 
 #include "types.h"
@@ -41,11 +47,15 @@
 #include "util.h"
 
 const char *dcc_state_prefix = "binstate_";
+const char *dcc_jobtab_name = "jobtab";
 
 
 static struct dcc_task_state *my_state = NULL;
 static struct dcc_task_state local_state, remote_state;
 
+/* Whether we ever wrote a state file, as opposed to using the job table. */
+static int wrote_state_file = 0;
+
 static struct dcc_task_state *direct_my_state(const enum dcc_host target);
 
 /**
@@ -88,6 +98,15 @@ static struct dcc_task_state *direct_my_state(const enum dcc_host target);
  * These files are considered a private format, and they may change
  * between distcc releases.  The only supported way to read them is
  * through mon.c.
+ *
+ * Where the platform has mmap and atomic builtins, the files above are
+ * only used if DISTCC_STATE_FILES is set.  Otherwise every client claims a
+ * slot in a table file called "jobtab" in the same directory, mapped shared
+ * by all clients, and updates its state in place under a sequence lock.
+ * That saves a create and an unlink of a file per job, and lets a monitor
+ * take a snapshot of all jobs without touching the directory.  The slot is
+ * given back at exit; slots of clients that died are reclaimed by the next
+ * client that finds the table full of them.
  **/
  //天晓得格式说明时候会变, 所以老老实实用mon.c来读取
 
@@ -164,6 +183,190 @@ static int dcc_open_state(int *p_fd,
 }
 
 
+#ifdef DCC_HAVE_JOBTAB
+static struct dcc_jobtab *my_jobtab = NULL;
+static struct dcc_jobtab_slot *my_slot = NULL;
+static int jobtab_disabled = 0;
+
+
+/**
+ * Map the job table of this user, creating it if needed.
+ **/
+static int dcc_jobtab_open(void)
+{
+    int ret;
+    int fd;
+    char *dir, *fname;
+    struct stat st;
+    void *p;
+
+    if ((ret = dcc_get_state_dir(&dir)))
+        return ret;
+    if (asprintf(&fname, "%s/%s", dir, dcc_jobtab_name) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    fd = open(fname, O_CREAT|O_RDWR|O_BINARY, 0666);
+    if (fd == -1) {
+        rs_log_warning("failed to open %s: %s", fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        rs_log_warning("failed to stat %s: %s", fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out_close;
+    }
+
+    /* Several clients may race to size a new table; they all agree on the
+     * size, so that's harmless. */
+    if (st.st_size == 0
+        && ftruncate(fd, (off_t) sizeof (struct dcc_jobtab)) == -1) {
+        rs_log_warning("failed to extend %s: %s", fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out_close;
+    } else if (st.st_size != 0
+               && st.st_size != (off_t) sizeof (struct dcc_jobtab)) {
+        rs_log_warning("wrong size of %s: version mismatch?", fname);
+        ret = EXIT_IO_ERROR;
+        goto out_close;
+    }
+
+    p = mmap(NULL, sizeof (struct dcc_jobtab), PROT_READ|PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        rs_log_warning("failed to mmap %s: %s", fname, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out_close;
+    }
+    my_jobtab = p;
+
+    /* Everyone writes the same header, so it does not matter who wins. */
+    if (my_jobtab->magic == 0) {
+        my_jobtab->struct_size = sizeof (struct dcc_jobtab);
+        my_jobtab->n_slots = DCC_JOBTAB_SLOTS;
+        __sync_synchronize();
+        my_jobtab->magic = DCC_JOBTAB_MAGIC;
+    }
+
+    if (my_jobtab->magic != DCC_JOBTAB_MAGIC
+        || my_jobtab->struct_size != sizeof (struct dcc_jobtab)
+        || my_jobtab->n_slots != DCC_JOBTAB_SLOTS) {
+        rs_log_warning("bad header in %s: version mismatch?", fname);
+        munmap(p, sizeof (struct dcc_jobtab));
+        my_jobtab = NULL;
+        ret = EXIT_IO_ERROR;
+        goto out_close;
+    }
+
+    ret = 0;
+
+    out_close:
+    dcc_close(fd);
+    out:
+    free(fname);
+    return ret;
+}
+
+
+/**
+ * Take ownership of a free slot, or failing that of a slot whose owner has
+ * died.
+ **/
+static int dcc_jobtab_claim(void)
+{
+    unsigned long pid = (unsigned long) getpid();
+    unsigned long owner;
+    struct dcc_jobtab_slot *s;
+    int i;
+
+    for (i = 0; i < DCC_JOBTAB_SLOTS; i++) {
+        s = &my_jobtab->slots[i];
+        if (s->owner == 0
+            && __sync_bool_compare_and_swap(&s->owner, 0, pid))
+            goto claimed;
+    }
+
+    for (i = 0; i < DCC_JOBTAB_SLOTS; i++) {
+        s = &my_jobtab->slots[i];
+        owner = s->owner;
+        if (owner != 0 && owner != pid
+            && kill((pid_t) owner, 0) == -1 && errno == ESRCH
+            && __sync_bool_compare_and_swap(&s->owner, owner, pid)) {
+            rs_trace("reclaimed job slot %d from dead process %lu",
+                     i, owner);
+            goto claimed;
+        }
+    }
+
+    rs_trace("job table is full");
+    return EXIT_IO_ERROR;
+
+    claimed:
+    /* The previous owner may have died halfway through an update. */
+    if (s->seq & 1)
+        s->seq++;
+    my_slot = s;
+    return 0;
+}
+
+
+/**
+ * Publish my_state in our slot of the job table.
+ *
+ * Returns nonzero if the table can't be used, in which case the caller
+ * falls back to a state file.
+ **/
+static int dcc_jobtab_note(void)
+{
+    if (jobtab_disabled)
+        return EXIT_IO_ERROR;
+
+    /* A forked child must not scribble on its parent's slot. */
+    if (my_slot && my_slot->owner != (unsigned long) getpid())
+        my_slot = NULL;
+
+    if (!my_slot) {
+        if ((!my_jobtab && dcc_jobtab_open()) || dcc_jobtab_claim()) {
+            jobtab_disabled = 1;
+            return EXIT_IO_ERROR;
+        }
+    }
+
+    my_slot->seq++;
+    __sync_synchronize();
+    memcpy(&my_slot->state, my_state, sizeof my_slot->state);
+    __sync_synchronize();
+    my_slot->seq++;
+    (void) __sync_fetch_and_add(&my_jobtab->generation, 1);
+
+    return 0;
+}
+
+
+/**
+ * Give our slot back, if we have one.
+ **/
+static void dcc_jobtab_release(void)
+{
+    unsigned long pid = (unsigned long) getpid();
+
+    if (!my_slot || my_slot->owner != pid)
+        return;
+
+    my_slot->seq++;
+    __sync_synchronize();
+    my_slot->state.magic = 0;
+    __sync_synchronize();
+    my_slot->seq++;
+
+    (void) __sync_bool_compare_and_swap(&my_slot->owner, pid, 0);
+    (void) __sync_fetch_and_add(&my_jobtab->generation, 1);
+    my_slot = NULL;
+}
+#endif /* DCC_HAVE_JOBTAB */
+
+
 /**
  * Remove the state file for this process.
  *
@@ -174,6 +377,13 @@ void dcc_remove_state_file (void)
     char *fname;
     int ret;
 
+#ifdef DCC_HAVE_JOBTAB
+    dcc_jobtab_release();
+#endif
+
+    if (!wrote_state_file)
+        return;
+
     if ((ret = dcc_get_state_filename(&fname)))
         return;
     //get到当前进程state文件, 然后删掉它
@@ -231,9 +441,6 @@ int dcc_note_state(enum dcc_phase state,
     my_state->magic = DCC_STATE_MAGIC;
     my_state->cpid = (unsigned long) getpid();
 
-    if ((ret = dcc_get_state_filename(&fname)))
-        return ret;
-
     source_file = dcc_find_basename(source_file);
     if (source_file) {
         strlcpy(my_state->file, source_file, sizeof my_state->file);
@@ -247,6 +454,10 @@ int dcc_note_state(enum dcc_phase state,
         rs_log_error("gettimeofday failed: %s", strerror(errno));
         return EXIT_DISTCC_FAILED;
     }
+    if (my_state->curr_phase != state || !my_state->phase_start_sec) {
+        my_state->phase_start_sec = tv.tv_sec;
+        my_state->phase_start_usec = tv.tv_usec;
+    }
     my_state->curr_phase = state;
 
     rs_trace("note state %d, file \"%s\", host \"%s\"",
@@ -254,6 +465,16 @@ int dcc_note_state(enum dcc_phase state,
              source_file ? source_file : "(NULL)",
              host ? host : "(NULL)");
 
+#ifdef DCC_HAVE_JOBTAB
+    if (!dcc_getenv_bool("DISTCC_STATE_FILES", 0)
+        && dcc_jobtab_note() == 0)
+        return 0;
+#endif
+
+    if ((ret = dcc_get_state_filename(&fname)))
+        return ret;
+
+    wrote_state_file = 1;
     if ((ret = dcc_open_state(&fd, fname))) {
         free(fname);
         return ret;
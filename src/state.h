@@ -83,11 +83,53 @@ struct dcc_task_state {
 
     enum dcc_phase curr_phase; //phase是阶段的意思
 
+    long phase_start_sec;       /**< When curr_phase was entered */
+    long phase_start_usec;
+
     /** In memory, point to the next in a list of all tasks.  In the
      * file, undefined. */
     struct dcc_task_state *next;//这还是个链表呢?
 };
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYNC_BUILTINS)
+#  define DCC_HAVE_JOBTAB 1
+#endif
+
+extern const char *dcc_jobtab_name;
+
+#define DCC_JOBTAB_MAGIC 0x44494a00 /* DIJ\0 */
+#define DCC_JOBTAB_SLOTS 512
+
+/**
+ * One entry of the shared job table.
+ *
+ * @p owner is the pid of the client holding the slot, or 0 if it is free;
+ * it only changes by compare-and-swap.  Only the owner writes @p state, and
+ * it makes @p seq odd while doing so, so that a reader can tell a torn copy
+ * from a good one.
+ **/
+struct dcc_jobtab_slot {
+    volatile unsigned long seq;
+    volatile unsigned long owner;
+    struct dcc_task_state state;
+};
+
+/**
+ * Layout of the job table file in the state directory, mapped shared by
+ * every client and monitor of one user.  A new file is all zeros; the first
+ * process to map it fills in the header.
+ *
+ * @p generation is bumped after every change to a slot, so that a monitor
+ * can cheaply tell whether anything happened since it last looked.
+ **/
+struct dcc_jobtab {
+    volatile unsigned long magic;
+    unsigned long struct_size;
+    unsigned long n_slots;
+    volatile unsigned long generation;
+    struct dcc_jobtab_slot slots[DCC_JOBTAB_SLOTS];
+};
+
 //顾名思义, get一个"阶段"的name
 const char *dcc_get_phase_name(enum dcc_phase);
 
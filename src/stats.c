@@ -415,7 +415,7 @@ dcc_free_space %d MB\n\
     acc_fd = accept(http_fd, (struct sockaddr *) &cli_addr, &cli_len);
     if (dcc_check_client((struct sockaddr *)&cli_addr,
                          (int) cli_len,
-                         opt_allowed) == 0) {
+                         dcc_get_allowed()) == 0) {
         reply_len = snprintf(reply, 2048, replytemplate,
                                dcc_stats.counters[STATS_TCP_ACCEPT],
                                dcc_stats.counters[STATS_REJ_BAD_REQ],
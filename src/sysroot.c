@@ -0,0 +1,399 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Session roots: server-side mirrors of a client's file tree that are kept
+ * between pump jobs.
+ *
+ * In pump mode every job normally gets a fresh mkdtemp() directory into
+ * which all of its headers are written, and which is deleted again when
+ * the job finishes.  Most of the headers are the same for every job of a
+ * build, so when the client asks for it (the ",session" host option) we
+ * instead keep one directory per client and pump session,
+ *
+ *    $TMPDIR/distccd_s_<client address>_<session>
+ *
+ * and only rewrite files whose contents changed.
+ *
+ * Several jobs from the same session may be using the root at the same
+ * time, in different preforked children.  Each of them holds a shared
+ * fcntl() lock on "<root>.lock" for as long as it uses the root.
+ * dcc_sysroot_sweep() removes roots that haven't been used for
+ * --session-timeout seconds: it takes the exclusive lock without waiting,
+ * renames the root out of the way and unlinks the lock file, so a job
+ * that opened the old lock file notices it's gone and starts over.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "snprintf.h"
+#include "dopt.h"
+#include "netutil.h"
+#include "sysroot.h"
+#include "trash.h"
+
+
+static const char sysroot_prefix[] = "distccd_s_";
+static const char sysroot_lock_suffix[] = ".lock";
+static const char sysroot_trash_infix[] = ".trash.";
+
+
+/**
+ * Session names come from the client, so only accept short hex strings;
+ * they end up in a path name.
+ **/
+static int dcc_sysroot_session_ok(const char *session)
+{
+    const char *p;
+
+    if (session[0] == '\0' || strlen(session) > 16)
+        return 0;
+    for (p = session; *p; p++) {
+        if (!((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f')))
+            return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Return a malloc'd name for the client, without the port number and with
+ * anything that doesn't belong in a file name replaced by '_'.
+ **/
+static int dcc_sysroot_client_name(struct sockaddr *cli_addr, int cli_len,
+                                   char **name_ret)
+{
+    char *name, *p;
+
+    if (cli_addr == NULL) {
+        name = strdup("local");
+    } else {
+        dcc_sockaddr_to_string(cli_addr, cli_len, &name);
+        if (name && (cli_addr->sa_family == AF_INET
+#ifdef AF_INET6
+                     || cli_addr->sa_family == AF_INET6
+#endif
+                )) {
+            if ((p = strrchr(name, ':')) != NULL)
+                *p = '\0';
+        }
+    }
+    if (name == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    for (p = name; *p; p++) {
+        if (!((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z')
+              || (*p >= 'A' && *p <= 'Z') || *p == '.'))
+            *p = '_';
+    }
+    *name_ret = name;
+    return 0;
+}
+
+
+/**
+ * Take an fcntl() lock of type @p type on the whole of @p fd.
+ **/
+static int dcc_sysroot_lock(int fd, short type, int block)
+{
+    struct flock lockparam;
+
+    lockparam.l_type = type;
+    lockparam.l_whence = SEEK_SET;
+    lockparam.l_start = 0;
+    lockparam.l_len = 0;
+
+    return fcntl(fd, block ? F_SETLKW : F_SETLK, &lockparam);
+}
+
+
+/**
+ * Open @p lock_fname and lock it with @p type.  Retries if the file was
+ * removed by a sweeper between our open() and getting the lock.
+ *
+ * Returns the locked fd, or -1.
+ **/
+static int dcc_sysroot_open_locked(const char *lock_fname, short type,
+                                   int create, int block)
+{
+    int fd, tries;
+    struct stat fd_st, path_st;
+
+    for (tries = 0; tries < 5; tries++) {
+        fd = open(lock_fname, O_RDWR | (create ? O_CREAT : 0), 0600);
+        if (fd == -1) {
+            if (create)
+                rs_log_warning("failed to open %s: %s", lock_fname,
+                               strerror(errno));
+            return -1;
+        }
+        if (dcc_sysroot_lock(fd, type, block) == -1) {
+            if (block)
+                rs_log_warning("failed to lock %s: %s", lock_fname,
+                               strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (fstat(fd, &fd_st) == -1) {
+            close(fd);
+            return -1;
+        }
+        if (!S_ISREG(fd_st.st_mode) || fd_st.st_uid != geteuid()) {
+            rs_log_warning("%s is not a plain file owned by us", lock_fname);
+            close(fd);
+            return -1;
+        }
+        if (stat(lock_fname, &path_st) == 0
+            && path_st.st_dev == fd_st.st_dev
+            && path_st.st_ino == fd_st.st_ino)
+            return fd;
+
+        /* Swept out from under us; try again. */
+        close(fd);
+        if (!create)
+            return -1;
+    }
+    return -1;
+}
+
+
+/**
+ * Find or create the session root for @p session from @p cli_addr, and
+ * lock it against being swept while this job uses it.
+ *
+ * On success *root_ret is the malloc'd root directory and *lock_fd_ret must
+ * later be passed to dcc_sysroot_release().  On any failure the caller
+ * should just fall back to a private temporary directory.
+ **/
+int dcc_sysroot_open(const char *session,
+                     struct sockaddr *cli_addr, int cli_len,
+                     char **root_ret, int *lock_fd_ret)
+{
+    const char *tmp_top;
+    char *client = NULL, *root = NULL, *lock_fname = NULL;
+    struct stat st;
+    int lock_fd = -1;
+    int ret;
+
+    *root_ret = NULL;
+    *lock_fd_ret = -1;
+
+    if (opt_session_timeout <= 0)
+        return EXIT_DISTCC_FAILED;
+
+    if (!dcc_sysroot_session_ok(session)) {
+        rs_log_warning("ignoring malformed session name from client");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    if ((ret = dcc_get_tmp_top(&tmp_top)))
+        return ret;
+    if ((ret = dcc_sysroot_client_name(cli_addr, cli_len, &client)))
+        return ret;
+
+    if (checked_asprintf(&root, "%s/%s%s_%s", tmp_top, sysroot_prefix,
+                         client, session) == -1
+        || checked_asprintf(&lock_fname, "%s%s", root,
+                            sysroot_lock_suffix) == -1) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    if ((lock_fd = dcc_sysroot_open_locked(lock_fname, F_RDLCK, 1, 1)) == -1) {
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    if (mkdir(root, 0700) == -1 && errno != EEXIST) {
+        rs_log_warning("failed to create %s: %s", root, strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    /* Don't trust anything in a shared /tmp that isn't our own directory. */
+    if (lstat(root, &st) == -1 || !S_ISDIR(st.st_mode)
+        || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        rs_log_warning("%s is not a private directory owned by us", root);
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    /* The mtime of the root is what the sweeper looks at. */
+    if (utimes(root, NULL) == -1)
+        rs_trace("failed to touch %s: %s", root, strerror(errno));
+
+    rs_trace("using session root %s", root);
+    *root_ret = root;
+    *lock_fd_ret = lock_fd;
+    root = NULL;
+    lock_fd = -1;
+    ret = 0;
+
+out:
+    if (lock_fd != -1)
+        close(lock_fd);
+    free(root);
+    free(lock_fname);
+    free(client);
+    return ret;
+}
+
+
+/**
+ * Let go of a session root taken by dcc_sysroot_open().
+ **/
+void dcc_sysroot_release(int lock_fd)
+{
+    if (lock_fd != -1)
+        close(lock_fd);
+}
+
+
+/**
+ * Remove the root whose lock file is @p lock_fname, if nobody is using it
+ * and it has been idle for longer than the session timeout.
+ **/
+static void dcc_sysroot_sweep_one(const char *lock_fname, time_t now)
+{
+    char *root = NULL, *trash = NULL;
+    struct stat st;
+    int fd;
+
+    if ((fd = dcc_sysroot_open_locked(lock_fname, F_WRLCK, 0, 0)) == -1)
+        return;             /* in use, or already gone */
+
+    root = strdup(lock_fname);
+    if (root == NULL)
+        goto out;
+    root[strlen(root) - strlen(sysroot_lock_suffix)] = '\0';
+
+    if (lstat(root, &st) == 0) {
+        if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid())
+            goto out;
+        if (now - st.st_mtime < opt_session_timeout)
+            goto out;
+        if (checked_asprintf(&trash, "%s%s%ld", root, sysroot_trash_infix,
+                             (long) getpid()) == -1)
+            goto out;
+        if (rename(root, trash) == -1) {
+            rs_log_warning("failed to rename %s: %s", root, strerror(errno));
+            goto out;
+        }
+    } else if (errno != ENOENT) {
+        goto out;
+    }
+
+    rs_trace("removing idle session root %s", root);
+    unlink(lock_fname);
+    close(fd);
+    fd = -1;
+
+    if (trash)
+        dcc_trash_tree(trash);
+
+out:
+    if (fd != -1)
+        close(fd);
+    free(trash);
+    free(root);
+}
+
+
+/**
+ * Remove session roots that have been idle for longer than the session
+ * timeout.  This is cheap to call after every job: the directory scan
+ * itself only happens every timeout/2 seconds, as recorded by the mtime of
+ * a stamp file.
+ **/
+void dcc_sysroot_sweep(void)
+{
+    const char *tmp_top;
+    char *stamp = NULL, *path;
+    struct stat st;
+    time_t now;
+    DIR *d;
+    struct dirent *de;
+    size_t len;
+    int fd;
+
+    if (opt_session_timeout <= 0)
+        return;
+    if (dcc_get_tmp_top(&tmp_top))
+        return;
+    if (checked_asprintf(&stamp, "%s/%ssweep", tmp_top, sysroot_prefix) == -1)
+        return;
+
+    now = time(NULL);
+    if (stat(stamp, &st) == 0 && now - st.st_mtime < opt_session_timeout / 2
+        && st.st_mtime <= now) {
+        free(stamp);
+        return;
+    }
+    if ((fd = open(stamp, O_WRONLY|O_CREAT, 0600)) != -1)
+        close(fd);
+    utimes(stamp, NULL);
+    free(stamp);
+
+    if ((d = opendir(tmp_top)) == NULL)
+        return;
+
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, sysroot_prefix,
+                    sizeof sysroot_prefix - 1) != 0)
+            continue;
+        if (checked_asprintf(&path, "%s/%s", tmp_top, de->d_name) == -1)
+            break;
+
+        len = strlen(de->d_name);
+        if (strstr(de->d_name, sysroot_trash_infix)) {
+            /* Left behind by a sweeper that died half-way. */
+            if (lstat(path, &st) == 0 && st.st_uid == geteuid()
+                && now - st.st_mtime >= opt_session_timeout)
+                dcc_trash_tree(path);
+        } else if (len > sizeof sysroot_lock_suffix - 1
+                   && strcmp(de->d_name + len - (sizeof sysroot_lock_suffix - 1),
+                             sysroot_lock_suffix) == 0) {
+            dcc_sysroot_sweep_one(path, now);
+        }
+        free(path);
+    }
+    closedir(d);
+}
@@ -71,9 +71,10 @@
  * tmpnam() is insecure.  mkstemp() does not allow us to set the
  * extension.
  *
- * It sucks that there is no standard function.  The implementation
- * below is inspired by the __gen_tempname() code in glibc; hopefully
- * it will be secure on all platforms.
+ * It sucks that there is no standard function.  Names are made from the
+ * process id and a counter, which is unique among running processes, and
+ * created with O_EXCL, so that a name left behind by a dead process with
+ * the same pid, or put there by somebody else, is just skipped.
  *
  * We need to touch the filename before running commands on it,
  * because we cannot be sure that the compiler will create it
@@ -90,20 +91,23 @@
  **/
 
 /**
- * Create the directory @p path, and register it for deletion when this
- * compilation finished.  If it already exists as a directory
- * we succeed, but we don't register the directory for deletion.
+ * Create the directory @p path, and if @p cleanup is set, register it for
+ * deletion when this compilation finished.  If it already exists as a
+ * directory we succeed, but we don't register the directory for deletion.
  **/
-int dcc_mk_tmpdir(const char *path)
+static int dcc_mk_dir_maybe_cleanup(const char *path, int cleanup)
 {
     struct stat buf;
     int ret;
 
     if (stat(path, &buf) == -1) {
         if (mkdir(path, 0777) == -1) {
+            /* Somebody else sharing the tree may have just made it. */
+            if (!cleanup && errno == EEXIST)
+                return 0;
             return EXIT_IO_ERROR;
         }
-        if ((ret = dcc_add_cleanup(path))) {
+        if (cleanup && (ret = dcc_add_cleanup(path))) {
             /* bailing out */
             rmdir(path);
             return ret;
@@ -123,6 +127,11 @@ int dcc_mk_tmpdir(const char *path)
     return 0;
 }
 
+int dcc_mk_tmpdir(const char *path)
+{
+    return dcc_mk_dir_maybe_cleanup(path, 1);
+}
+
 /**
  * Create the directory @p path.  If it already exists as a directory
  * we succeed.
@@ -217,10 +226,10 @@ int dcc_get_tmp_top(const char **p_ret)
 }
 
 /**
- * Create the full @path. If it already exists as a directory
- * we succeed.
+ * Create all the parent directories of @p path, optionally registering
+ * the ones we made for cleanup.
  */
-int dcc_mk_tmp_ancestor_dirs(const char *path)
+static int dcc_mk_ancestor_dirs_inner(const char *path, int cleanup)
 {
     char *copy = 0;
     char *p;
@@ -239,7 +248,7 @@ int dcc_mk_tmp_ancestor_dirs(const char *path)
 
     /* First, let's try and see if all parent directories
      * exist already */
-    if ((ret = dcc_mk_tmpdir(copy)) == 0) {
+    if ((ret = dcc_mk_dir_maybe_cleanup(copy, cleanup)) == 0) {
         free(copy);
         return 0;
     }
@@ -259,18 +268,38 @@ int dcc_mk_tmp_ancestor_dirs(const char *path)
     for (p = copy; *p != '\0'; ++p) {
         if (*p == '/' && p != copy) {
             *p = '\0';
-            if ((ret = dcc_mk_tmpdir(copy))) {
+            if ((ret = dcc_mk_dir_maybe_cleanup(copy, cleanup))) {
                 free(copy);
                 return ret;
             }
             *p = '/';
         }
     }
-    ret = dcc_mk_tmpdir(copy);
+    ret = dcc_mk_dir_maybe_cleanup(copy, cleanup);
     free(copy);
     return ret;
 }
 
+/**
+ * Create the full @path. If it already exists as a directory
+ * we succeed.
+ */
+int dcc_mk_tmp_ancestor_dirs(const char *path)
+{
+    return dcc_mk_ancestor_dirs_inner(path, 1);
+}
+
+/**
+ * Like dcc_mk_tmp_ancestor_dirs(), but the directories are not removed at
+ * the end of the job.  Used for trees that outlive a single compilation,
+ * such as session roots, which other jobs may be populating at the same
+ * time.
+ */
+int dcc_mk_ancestor_dirs(const char *path)
+{
+    return dcc_mk_ancestor_dirs_inner(path, 0);
+}
+
 /**
  * Return a static string holding DISTCC_DIR, or ~/.distcc.
  * The directory is created if it does not exist.
@@ -378,49 +407,38 @@ int dcc_get_state_dir(char **dir_ret)
  * that it exists with appropriately tight permissions.
  //这个文件迟点还会被重新打开, 可能在子节点中, 但是我们知道我们弄的权限是合适的
  **/
- //创建一个临时文件 $name_ret = $topdir/$prefix_$some_random_bit$suffix
+ //创建一个临时文件 $name_ret = $topdir/$prefix_$pid_$counter$suffix
 int dcc_make_tmpnam(const char *prefix,
                     const char *suffix,
                     char **name_ret)//第三个参数是用来返回的
 {
+    static unsigned long counter;
+    static const char *checked_tempdir;
     char *s = NULL;
     const char *tempdir;
     int ret;
-    unsigned long random_bits;
     int fd;
 
     if ((ret = dcc_get_tmp_top(&tempdir)))//先找到顶级目录
         return ret;
 
-    if (access(tempdir, W_OK|X_OK) == -1) {//然后检查我们有没有相应权限
-        rs_log_error("can't use TMPDIR \"%s\": %s", tempdir, strerror(errno));
-        return EXIT_IO_ERROR;
-    }
-
-    random_bits = (unsigned long) getpid() << 16;//然后弄一个随机数?
-
-# if HAVE_GETTIMEOFDAY
-    {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);//然后还获取一个日期
-        random_bits ^= tv.tv_usec << 16;//还是为了随机数
-        random_bits ^= tv.tv_sec;
+    if (tempdir != checked_tempdir) {
+        if (access(tempdir, W_OK|X_OK) == -1) {//然后检查我们有没有相应权限
+            rs_log_error("can't use TMPDIR \"%s\": %s", tempdir,
+                         strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        checked_tempdir = tempdir;
     }
-# else
-    random_bits ^= time(NULL);//卧槽, 这处理有点复杂
-# endif
-
-#if 0
-    random_bits = 0;            /* FOR TESTING */
-#endif
 
     do {
         free(s);
 
-        if (asprintf(&s, "%s/%s_%08lx%s",
+        if (asprintf(&s, "%s/%s_%lx_%lu%s",
                      tempdir,
                      prefix,
-                     random_bits & 0xffffffffUL,
+                     (unsigned long) getpid(),
+                     counter++,
                      suffix) == -1)
             return EXIT_OUT_OF_MEMORY;
 
@@ -433,7 +451,10 @@ int dcc_make_tmpnam(const char *prefix,
         if (fd == -1) {
             /* try again */
             rs_trace("failed to create %s: %s", s, strerror(errno));
-            random_bits += 7777; /* fairly prime */
+            if (errno != EEXIST) {
+                free(s);
+                return EXIT_IO_ERROR;
+            }
             continue;
         }
 
@@ -342,6 +342,87 @@ rs_logger_file(int flags, const char *fn, char const *fmt, va_list va,
 }
 
 
+/* Messages held back by rs_logger_batched(), all for rs_batch_fd. */
+static char rs_batch_buf[16384];
+static size_t rs_batch_len;
+static int rs_batch_fd = -1;
+
+/* The process collecting a batch, or 0.  Children forked in the middle of a
+ * batch must not write out their copy of it. */
+static pid_t rs_batch_pid;
+
+
+static void rs_log_batch_flush(void)
+{
+    const char *p = rs_batch_buf;
+    size_t len = rs_batch_len;
+    ssize_t ret;
+
+    rs_batch_len = 0;
+    if (rs_batch_pid != getpid())
+        return;
+
+    while (len > 0) {
+        ret = write(rs_batch_fd, p, len);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            ret = write(/* stderr */ 2, p, len);
+            return;
+        }
+        p += ret;
+        len -= ret;
+    }
+}
+
+
+/**
+ * Start or finish a batch of messages for rs_logger_batched().
+ *
+ * Between rs_log_batch(1) and rs_log_batch(0), messages below error
+ * severity are collected in memory, and written out together when the
+ * batch finishes or the buffer fills.  A batch is kept by the process that
+ * started it.
+ **/
+void rs_log_batch(int on)
+{
+    rs_log_batch_flush();
+    rs_batch_pid = on ? getpid() : 0;
+}
+
+
+/**
+ * Like rs_logger_file(), but during a batch it only copies the message to
+ * memory.  Errors are written at once, after anything held back before
+ * them, so that they're not lost if the process dies.
+ **/
+void
+rs_logger_batched(int flags, const char *fn, char const *fmt, va_list va,
+                  void *private_ptr, int log_fd)
+{
+    char buf[4090];
+    size_t len;
+
+    if (rs_batch_pid != getpid() || (flags & RS_LOG_PRIMASK) <= RS_LOG_ERR) {
+        rs_log_batch_flush();
+        rs_logger_file(flags, fn, fmt, va, private_ptr, log_fd);
+        return;
+    }
+
+    rs_format_msg(buf, sizeof buf, flags, fn, fmt, va);
+    len = strlen(buf);
+    if (len > sizeof buf - 2)
+        len = sizeof buf - 2;
+    buf[len++] = '\n';
+
+    if (log_fd != rs_batch_fd || rs_batch_len + len > sizeof rs_batch_buf)
+        rs_log_batch_flush();
+    rs_batch_fd = log_fd;
+    memcpy(rs_batch_buf + rs_batch_len, buf, len);
+    rs_batch_len += len;
+}
+
+
 
 /* ======================================================================== */
 /* functions for handling compilers without varargs macros */
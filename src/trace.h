@@ -130,6 +130,10 @@ void rs_logger_file(int level, const char *fn, char const *fmt, va_list va,
 void rs_logger_syslog(int level, const char *fn, char const *fmt, va_list va,
                       void *, int);
 
+void rs_logger_batched(int level, const char *fn, char const *fmt, va_list va,
+                       void *, int);
+void rs_log_batch(int on);
+
 /** Check whether the library was compiled with debugging trace suport. */
 int             rs_supports_trace(void);
 
@@ -0,0 +1,355 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Removing temporary trees in the background.
+ *
+ * In pump mode each job writes the files it is sent into a fresh tree
+ * under $TMPDIR.  Taking that apart one entry at a time used to keep the
+ * child that ran the job from accepting the next one.  Instead the tree is
+ * renamed into
+ *
+ *    $TMPDIR/distccd_trash_<uid>/
+ *
+ * which costs one rename(), and a byte is written down a pipe to wake the
+ * reaper: a process the standalone daemon starts next to its children,
+ * which empties the trash whenever it is woken.  Idle session roots go the
+ * same way.
+ *
+ * Without a reaper, as under inetd, or if it has died, trees are removed
+ * on the spot.  Anything still in the trash when the daemon stops is
+ * removed by the next reaper to start.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "snprintf.h"
+#include "util.h"
+#include "trash.h"
+
+
+static const char trash_prefix[] = "distccd_trash_";
+
+/** Write end of the pipe to the reaper, or -1 if there is none. */
+static int dcc_trash_fd = -1;
+
+static pid_t dcc_trash_reaper_pid;
+
+
+#if defined(HAVE_UNLINKAT) && defined(HAVE_FDOPENDIR)
+/**
+ * Remove @p name in the directory @p dir_fd, and everything underneath it.
+ * @p d_type is what readdir() said it was, if anything.
+ *
+ * Each directory is opened once and its entries removed relative to it,
+ * so no path is looked up more than once.
+ **/
+static int dcc_rm_tree_at(int dir_fd, const char *name, int d_type)
+{
+    struct dirent *de;
+    DIR *d;
+    int fd, ret = 0;
+
+    if (d_type != DT_DIR) {
+        if (unlinkat(dir_fd, name, 0) == 0 || errno == ENOENT)
+            return 0;
+        /* Linux says EISDIR, and POSIX allows EPERM. */
+        if (errno != EISDIR && errno != EPERM)
+            return EXIT_IO_ERROR;
+    }
+
+    if ((fd = openat(dir_fd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW)) == -1)
+        return errno == ENOENT ? 0 : EXIT_IO_ERROR;
+    if ((d = fdopendir(fd)) == NULL) {
+        close(fd);
+        return EXIT_IO_ERROR;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (dcc_rm_tree_at(fd, de->d_name, de->d_type))
+            ret = EXIT_IO_ERROR;
+    }
+    closedir(d);
+
+    if (unlinkat(dir_fd, name, AT_REMOVEDIR) == -1 && errno != ENOENT)
+        ret = EXIT_IO_ERROR;
+    return ret;
+}
+#endif
+
+
+/**
+ * Remove @p path and everything underneath it.  Symlinks are removed, not
+ * followed.  Files that disappear while we're at it are not an error,
+ * because somebody else may be removing the same tree.
+ **/
+int dcc_rm_tree(const char *path)
+{
+#if defined(HAVE_UNLINKAT) && defined(HAVE_FDOPENDIR)
+    return dcc_rm_tree_at(AT_FDCWD, path, DT_UNKNOWN);
+#else
+    struct stat st;
+    DIR *d;
+    struct dirent *de;
+    char *child;
+    int ret = 0;
+
+    if (lstat(path, &st) == -1)
+        return errno == ENOENT ? 0 : EXIT_IO_ERROR;
+
+    if (!S_ISDIR(st.st_mode)) {
+        if (unlink(path) == -1 && errno != ENOENT)
+            return EXIT_IO_ERROR;
+        return 0;
+    }
+
+    if ((d = opendir(path)) == NULL)
+        return errno == ENOENT ? 0 : EXIT_IO_ERROR;
+
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (checked_asprintf(&child, "%s/%s", path, de->d_name) == -1) {
+            ret = EXIT_OUT_OF_MEMORY;
+            break;
+        }
+        if (dcc_rm_tree(child))
+            ret = EXIT_IO_ERROR;
+        free(child);
+    }
+    closedir(d);
+
+    if (rmdir(path) == -1 && errno != ENOENT)
+        ret = EXIT_IO_ERROR;
+    return ret;
+#endif
+}
+
+
+/**
+ * Return the trash directory, making it if need be.  It must be a private
+ * directory of ours, since the reaper deletes whatever is in it.
+ **/
+static int dcc_trash_dir(const char **dir_ret)
+{
+    static char *cached;
+    const char *tmp_top;
+    char *dir;
+    struct stat st;
+    int ret;
+
+    if (cached) {
+        *dir_ret = cached;
+        return 0;
+    }
+
+    if ((ret = dcc_get_tmp_top(&tmp_top)))
+        return ret;
+    if (checked_asprintf(&dir, "%s/%s%ld", tmp_top, trash_prefix,
+                         (long) geteuid()) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        rs_log_warning("failed to create %s: %s", dir, strerror(errno));
+        free(dir);
+        return EXIT_IO_ERROR;
+    }
+    if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode)
+        || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        rs_log_warning("not using %s for trash: not a private directory",
+                       dir);
+        free(dir);
+        return EXIT_IO_ERROR;
+    }
+
+    *dir_ret = cached = dir;
+    return 0;
+}
+
+
+/**
+ * Remove everything in the trash.
+ **/
+static void dcc_trash_empty(void)
+{
+    const char *dir;
+    char *path;
+    DIR *d;
+    struct dirent *de;
+
+    if (dcc_trash_dir(&dir))
+        return;
+    if ((d = opendir(dir)) == NULL)
+        return;
+
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+#if defined(HAVE_UNLINKAT) && defined(HAVE_FDOPENDIR)
+        path = NULL;
+        if (dcc_rm_tree_at(dirfd(d), de->d_name, de->d_type))
+#else
+        if (checked_asprintf(&path, "%s/%s", dir, de->d_name) == -1)
+            break;
+        if (dcc_rm_tree(path))
+#endif
+            rs_log_warning("failed to remove %s/%s", dir, de->d_name);
+        free(path);
+    }
+    closedir(d);
+}
+
+
+/**
+ * Get rid of the tree @p path: move it to the trash for the reaper if
+ * there is one, and otherwise remove it now.
+ *
+ * Returns 0 if @p path is gone.  Must be called with SIGPIPE ignored, as
+ * it is while serving a job, in case the reaper has died.
+ **/
+int dcc_trash_tree(const char *path)
+{
+    static unsigned long counter;
+    const char *dir;
+    char *target;
+
+    if (dcc_trash_fd == -1 || dcc_trash_dir(&dir))
+        return dcc_rm_tree(path);
+
+    if (checked_asprintf(&target, "%s/%ld_%lu", dir, (long) getpid(),
+                         counter++) == -1)
+        return dcc_rm_tree(path);
+
+    if (rename(path, target) == -1) {
+        rs_trace("failed to move %s to %s: %s", path, target,
+                 strerror(errno));
+        free(target);
+        return dcc_rm_tree(path);
+    }
+
+    /* If the pipe is full, the reaper has plenty of wakeups coming. */
+    if (write(dcc_trash_fd, "", 1) == -1 && errno != EAGAIN) {
+        rs_log_warning("lost the trash reaper: %s", strerror(errno));
+        close(dcc_trash_fd);
+        dcc_trash_fd = -1;
+        dcc_rm_tree(target);
+    } else {
+        rs_trace("moved %s to the trash", path);
+    }
+    free(target);
+    return 0;
+}
+
+
+/**
+ * Main loop of the reaper: empty the trash every time we're woken, until
+ * everybody who could wake us has gone.
+ **/
+static void dcc_trash_reaper(int fd)
+{
+    char buf[256];
+    ssize_t n;
+
+    dcc_trash_empty();
+
+    while ((n = read(fd, buf, sizeof buf)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            rs_log_error("trash reaper read failed: %s", strerror(errno));
+            break;
+        }
+        dcc_trash_empty();
+    }
+}
+
+
+/**
+ * Start the reaper, in the daemon's master process, before any children
+ * that serve jobs.  If that fails, trees are just removed in the
+ * foreground.  The reaper doesn't hold on to @p listen_fd.
+ **/
+void dcc_trash_start_reaper(int listen_fd)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) == -1) {
+        rs_log_warning("pipe failed: %s", strerror(errno));
+        return;
+    }
+
+    if ((pid = fork()) == -1) {
+        rs_log_warning("fork failed: %s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    } else if (pid == 0) {
+        close(fds[1]);
+        close(listen_fd);
+        dcc_trash_reaper(fds[0]);
+        dcc_exit(0);
+    }
+
+    close(fds[0]);
+    set_cloexec_flag(fds[1], 1);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    dcc_trash_fd = fds[1];
+    dcc_trash_reaper_pid = pid;
+    rs_trace("started trash reaper %ld", (long) pid);
+}
+
+
+/**
+ * Called by the master when child @p pid has exited.  If that was the
+ * reaper, children started from now on remove trees themselves.  Returns
+ * 1 if it was the reaper.
+ **/
+int dcc_trash_reaper_exited(pid_t pid)
+{
+    if (pid <= 0 || pid != dcc_trash_reaper_pid)
+        return 0;
+
+    rs_log_warning("trash reaper %ld exited", (long) pid);
+    close(dcc_trash_fd);
+    dcc_trash_fd = -1;
+    dcc_trash_reaper_pid = 0;
+    return 1;
+}
@@ -81,6 +81,7 @@ void dcc_exit(int exitcode)
            (int) children_ru.ru_utime.tv_sec, (int) children_ru.ru_utime.tv_usec,
            (int) children_ru.ru_stime.tv_sec, (int)  children_ru.ru_stime.tv_usec);
 
+    rs_log_batch(0);
     exit(exitcode);
 }
 
@@ -315,6 +316,23 @@ int set_cloexec_flag (int desc, int value)
 }
 
 
+/**
+ * Close every file descriptor from @p first up.  Used in children that may
+ * outlive us, so that they don't hold on to our locks and pipes.
+ **/
+void dcc_close_fds_from(int first)
+{
+    long open_max;
+    int fd;
+
+    open_max = sysconf(_SC_OPEN_MAX);
+    if (open_max < 0 || open_max > 1024)
+        open_max = 1024;
+    for (fd = first; fd < open_max; fd++)
+        close(fd);
+}
+
+
 /**
  * Ignore or unignore SIGPIPE.
  *
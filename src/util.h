@@ -36,6 +36,7 @@ char *dcc_gethostname(void);
 void dcc_exit(int exitcode) NORETURN;
 int dcc_getenv_bool(const char *name, int def_value);
 int set_cloexec_flag (int desc, int value);
+void dcc_close_fds_from(int first);
 int dcc_ignore_sigpipe(int val);
 int dcc_remove_if_exists(const char *fname);
 int dcc_trim_path(const char *compiler_name);
@@ -92,23 +92,39 @@ static int dcc_lock_one(struct dcc_hostdef *hostlist,
                         int *cpu_lock_fd);
 
 
-int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
-                            int *cpu_lock_fd)
+/**
+ * Get the host list, less any hosts known to be unusable.
+ **/
+static int dcc_get_usable_hostlist(struct dcc_hostdef **hostlist)
 {
-    struct dcc_hostdef *hostlist;
     int ret;
     int n_hosts;
 
-    if ((ret = dcc_get_hostlist(&hostlist, &n_hosts)) != 0) {
+    if ((ret = dcc_get_hostlist(hostlist, &n_hosts)) != 0) {
         return EXIT_NO_HOSTS;
     }
+    if ((ret = dcc_hoststate_filter(hostlist)))
+        return ret;
+
     //移除掉不可用的
-    if ((ret = dcc_remove_disliked(&hostlist)))//在backoff.c中实现
+    if ((ret = dcc_remove_disliked(hostlist)))//在backoff.c中实现
         return ret;
 
-    if (!hostlist) {
+    if (!*hostlist) {
         return EXIT_NO_HOSTS;
     }
+    return 0;
+}
+
+
+int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
+                            int *cpu_lock_fd)
+{
+    struct dcc_hostdef *hostlist;
+    int ret;
+
+    if ((ret = dcc_get_usable_hostlist(&hostlist)))
+        return ret;
 
     return dcc_lock_one(hostlist, buildhost, cpu_lock_fd);//后两者是返回值
 
@@ -116,6 +132,59 @@ int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
 }
 
 
+/**
+ * Find another TCP server, not the same as @p host, that could take exactly
+ * the request prepared for @p host, and lock a free slot on it without
+ * waiting.
+ *
+ * Returns EXIT_BUSY if there is no such server with a free slot.  The slot
+ * number is returned in @p slot for dcc_note_state_slot(), should the
+ * caller end up using this server.
+ **/
+int dcc_lock_alternate_host(const struct dcc_hostdef *host,
+                            struct dcc_hostdef **althost,
+                            int *cpu_lock_fd, int *slot)
+{
+    struct dcc_hostdef *hostlist, *h;
+    int i_cpu;
+    int ret;
+
+    if ((ret = dcc_get_usable_hostlist(&hostlist)))
+        return ret;
+
+    for (i_cpu = 0; i_cpu < 50; i_cpu++) {
+        for (h = hostlist; h; h = h->next) {
+            if (i_cpu >= h->n_slots
+                || h->mode != DCC_MODE_TCP
+                || (h->port == host->port
+                    && !strcmp(h->hostname, host->hostname))
+                || h->protover != host->protover
+                || h->compr != host->compr
+                || h->cpp_where != host->cpp_where
+                || h->use_session != host->use_session
+                || h->use_manifest != host->use_manifest
+                || h->use_stream != host->use_stream
+#ifdef HAVE_GSSAPI
+                || h->authenticate != host->authenticate
+#endif
+                )
+                continue;
+
+            ret = dcc_lock_host("cpu", h, i_cpu, 0, cpu_lock_fd);
+            if (ret == 0) {
+                *althost = h;
+                *slot = i_cpu;
+                return 0;
+            } else if (ret != EXIT_BUSY) {
+                return ret;
+            }
+        }
+    }
+
+    return EXIT_BUSY;
+}
+
+
 static void dcc_lock_pause(void)
 {
     /* This could do with some tuning.
@@ -25,6 +25,10 @@
 int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **,
                                         int *cpu_lock_fd);
 
+int dcc_lock_alternate_host(const struct dcc_hostdef *host,
+                            struct dcc_hostdef **althost,
+                            int *cpu_lock_fd, int *slot);
+
 int dcc_lock_local(int *cpu_lock_fd);
 
 int dcc_lock_local_cpp(int *cpu_lock_fd);
@@ -0,0 +1,191 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Weighting of hosts found by zeroconf.
+ *
+ * A distccd started with --zeroconf advertises its CPU count, job limit,
+ * free job slots and load average in TXT records.  The zeroconf daemon
+ * gives each host as many slots as the server will really accept (its job
+ * limit, or the old per-CPU guess for servers that don't say), and lists
+ * the hosts with the most spare capacity first, so that they get the first
+ * jobs of every round.
+ *
+ * Nothing here depends on Avahi, so h_zeroconf can drive it, down to
+ * writing the host file, from fake announcements in the test suite.
+ **/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "zeroconf.h"
+
+
+void dcc_zeroconf_caps_init(struct dcc_zeroconf_caps *caps)
+{
+    caps->n_cpus = 1;
+    caps->max_jobs = 0;
+    caps->free_slots = -1;
+    caps->load = -1.0;
+    caps->slots = 0;
+    caps->spare = 0;
+}
+
+
+/* Parse a nonnegative count; -1 if @p value is not one. */
+static int dcc_zeroconf_parse_count(const char *value)
+{
+    char *end;
+    long n;
+
+    n = strtol(value, &end, 10);
+    if (end == value || *end || n < 0 || n > 10000)
+        return -1;
+    return (int) n;
+}
+
+
+/**
+ * Record one TXT record of a server.  Unknown keys, and values that don't
+ * parse, are ignored.
+ **/
+void dcc_zeroconf_caps_set(struct dcc_zeroconf_caps *caps,
+                           const char *key, const char *value)
+{
+    int n;
+
+    if (!strcmp(key, DCC_ZC_TXT_CPUS)) {
+        if ((n = dcc_zeroconf_parse_count(value)) > 0)
+            caps->n_cpus = n;
+    } else if (!strcmp(key, DCC_ZC_TXT_MAXJOBS)) {
+        if ((n = dcc_zeroconf_parse_count(value)) > 0)
+            caps->max_jobs = n;
+    } else if (!strcmp(key, DCC_ZC_TXT_FREE)) {
+        if ((n = dcc_zeroconf_parse_count(value)) >= 0)
+            caps->free_slots = n;
+    } else if (!strcmp(key, DCC_ZC_TXT_LOAD)) {
+        char *end;
+        double load = strtod(value, &end);
+        if (end != value && !*end && load >= 0)
+            caps->load = load;
+    }
+}
+
+
+/**
+ * Work out how many slots to give the host, and how many of them are
+ * probably free.  @p n_slots is the number of slots per CPU used for
+ * servers that don't advertise their job limit.
+ **/
+void dcc_zeroconf_caps_weigh(struct dcc_zeroconf_caps *caps, int n_slots)
+{
+    if (caps->max_jobs > 0)
+        caps->slots = caps->max_jobs;
+    else
+        caps->slots = n_slots * caps->n_cpus;
+
+    /* A server that doesn't report its free slots is assumed idle, as
+     * before. */
+    if (caps->free_slots < 0)
+        caps->spare = caps->slots;
+    else if (caps->free_slots > caps->slots)
+        caps->spare = caps->slots;
+    else
+        caps->spare = caps->free_slots;
+}
+
+
+/**
+ * Order for the host list: most spare slots first, then the lowest load per
+ * CPU, then the most CPUs.
+ **/
+int dcc_zeroconf_caps_cmp(const struct dcc_zeroconf_caps *a,
+                          const struct dcc_zeroconf_caps *b)
+{
+    double la, lb;
+
+    if (a->spare != b->spare)
+        return a->spare > b->spare ? -1 : 1;
+
+    la = a->load < 0 ? 0 : a->load / a->n_cpus;
+    lb = b->load < 0 ? 0 : b->load / b->n_cpus;
+    if (la != lb)
+        return la < lb ? -1 : 1;
+
+    if (a->n_cpus != b->n_cpus)
+        return a->n_cpus > b->n_cpus ? -1 : 1;
+
+    return 0;
+}
+
+
+/**
+ * Weigh the @p n servers in @p entries, and write them to @p fd as a host
+ * list, one "ADDRESS:PORT/SLOTS" per line with the most spare capacity
+ * first.  Servers of equal weight keep their order, so that the file
+ * doesn't reshuffle between rewrites.
+ **/
+int dcc_zeroconf_write_hosts(int fd, struct dcc_zeroconf_entry *entries,
+                             int n, int n_slots)
+{
+    struct dcc_zeroconf_entry **order;
+    struct dcc_zeroconf_entry *e;
+    char line[256];
+    int i, j, ret = 0;
+
+    if (n == 0)
+        return 0;
+    if (!(order = malloc(n * sizeof *order))) {
+        rs_log_error("failed to allocate host order");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    /* Stable insertion sort by capacity. */
+    for (i = 0; i < n; i++) {
+        e = &entries[i];
+        dcc_zeroconf_caps_weigh(&e->caps, n_slots);
+        for (j = i; j > 0 && dcc_zeroconf_caps_cmp(&order[j-1]->caps,
+                                                   &e->caps) > 0; j--)
+            order[j] = order[j-1];
+        order[j] = e;
+    }
+
+    for (i = 0; i < n; i++) {
+        e = order[i];
+        snprintf(line, sizeof line,
+                 strchr(e->address, ':') ? "[%s]:%u/%d\n" : "%s:%u/%d\n",
+                 e->address, e->port, e->caps.slots);
+        if ((ret = dcc_writex(fd, line, strlen(line))))
+            break;
+    }
+
+    free(order);
+    return ret;
+}
@@ -38,11 +38,15 @@
 #include <avahi-common/error.h>
 #include <avahi-common/alternative.h>
 #include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
 #include <avahi-client/publish.h>
 
 #include "distcc.h"
+#include "hosts.h"
 #include "zeroconf.h"
 #include "trace.h"
+#include "util.h"
+#include "daemon.h"
 #include "exitcode.h"
 
 struct context {
@@ -52,17 +56,85 @@ struct context {
     AvahiEntryGroup *group;
     uint16_t port;
     int n_cpus;
-};
+    AvahiTimeout *refresh;
 
-static void publish_reply(AvahiEntryGroup *g, AvahiEntryGroupState state, void *userdata);
+    /* Empty if the compiler couldn't be asked */
+    char cc_version[64];
+    char cc_machine[64];
+};
 
-static void register_stuff(struct context *ctx) {
 #ifndef ENABLE_RFC2553
-    static const AvahiProtocol dcc_proto = AVAHI_PROTO_INET;
+static const AvahiProtocol dcc_proto = AVAHI_PROTO_INET;
 #else
-    static const AvahiProtocol dcc_proto = AVAHI_PROTO_UNSPEC;
+static const AvahiProtocol dcc_proto = AVAHI_PROTO_UNSPEC;
 #endif
 
+static void publish_reply(AvahiEntryGroup *g, AvahiEntryGroupState state, void *userdata);
+
+/* Build the TXT records describing this server: what it runs, and how
+ * much work it can take right now. */
+static AvahiStringList *make_txt(struct context *ctx) {
+    AvahiStringList *txt = NULL;
+    double loadavg[3];
+    int running;
+
+    txt = avahi_string_list_add(txt, "txtvers=1");
+    txt = avahi_string_list_add_printf(txt, DCC_ZC_TXT_CPUS "=%i", ctx->n_cpus);
+    txt = avahi_string_list_add_printf(txt, DCC_ZC_TXT_MAXJOBS "=%i", dcc_max_kids);
+
+    /* Every running task on the machine, less the one asking, takes a CPU
+     * away from compiles. */
+    if ((running = dcc_getcurrentload()) > 0) {
+        int free_slots = dcc_max_kids - (running - 1);
+        txt = avahi_string_list_add_printf(txt, DCC_ZC_TXT_FREE "=%i",
+                                           free_slots > 0 ? free_slots : 0);
+    }
+
+    dcc_getloadavg(loadavg);
+    if (loadavg[0] >= 0)
+        txt = avahi_string_list_add_printf(txt, DCC_ZC_TXT_LOAD "=%.2f", loadavg[0]);
+
+    txt = avahi_string_list_add(txt, DCC_ZC_TXT_COMPRESS "=lzo");
+    txt = avahi_string_list_add(txt, "distcc="PACKAGE_VERSION);
+    txt = avahi_string_list_add(txt, "gnuhost="GNU_HOST);
+
+    if (ctx->cc_version[0])
+        txt = avahi_string_list_add_pair(txt, "cc_version", ctx->cc_version);
+    if (ctx->cc_machine[0])
+        txt = avahi_string_list_add_pair(txt, "cc_machine", ctx->cc_machine);
+
+    return txt;
+}
+
+/* Republish the TXT records every DCC_ZEROCONF_REFRESH seconds, so that
+ * clients see the current load. */
+static void refresh_txt(AvahiTimeout *t, void *userdata) {
+    struct context *ctx = userdata;
+    const AvahiPoll *api = avahi_threaded_poll_get(ctx->threaded_poll);
+    struct timeval tv;
+
+    if (ctx->group && !avahi_entry_group_is_empty(ctx->group)) {
+        AvahiStringList *txt = make_txt(ctx);
+
+        if (avahi_entry_group_update_service_txt_strlst(
+                    ctx->group,
+                    AVAHI_IF_UNSPEC,
+                    dcc_proto,
+                    0,
+                    ctx->name,
+                    DCC_DNS_SERVICE_TYPE,
+                    NULL,
+                    txt) < 0)
+            rs_log_warning("Failed to update TXT records: %s\n", avahi_strerror(avahi_client_errno(ctx->client)));
+
+        avahi_string_list_free(txt);
+    }
+
+    api->timeout_update(t, avahi_elapse_time(&tv, DCC_ZEROCONF_REFRESH * 1000, 0));
+}
+
+static void register_stuff(struct context *ctx) {
+
     if (!ctx->group) {
 
         if (!(ctx->group = avahi_entry_group_new(ctx->client, publish_reply, ctx))) {
@@ -73,15 +145,13 @@ static void register_stuff(struct context *ctx) {
     }
 
     if (avahi_entry_group_is_empty(ctx->group)) {
-        char cpus[32], machine[64] = "cc_machine=", version[64] = "cc_version=", *m, *v;
-
-        snprintf(cpus, sizeof(cpus), "cpus=%i", ctx->n_cpus);
-        v = dcc_get_gcc_version(version+11, sizeof(version)-11);
-        m = dcc_get_gcc_machine(machine+11, sizeof(machine)-11);
+        AvahiStringList *txt;
+        int r;
 
         /* Register our service */
 
-        if (avahi_entry_group_add_service(
+        txt = make_txt(ctx);
+        r = avahi_entry_group_add_service_strlst(
                     ctx->group,
                     AVAHI_IF_UNSPEC,
                     dcc_proto,
@@ -91,21 +161,18 @@ static void register_stuff(struct context *ctx) {
                     NULL,
                     NULL,
                     ctx->port,
-                    "txtvers=1",
-                    cpus,
-                    "distcc="PACKAGE_VERSION,
-                    "gnuhost="GNU_HOST,
-                    v ? version : NULL,
-                    m ? machine : NULL,
-                    NULL) < 0) {
+                    txt);
+        avahi_string_list_free(txt);
+
+        if (r < 0) {
             rs_log_crit("Failed to add service: %s\n", avahi_strerror(avahi_client_errno(ctx->client)));
             goto fail;
         }
 
-        if (v && m) {
+        if (ctx->cc_version[0] && ctx->cc_machine[0]) {
             char stype[128];
 
-            dcc_make_dnssd_subtype(stype, sizeof(stype), v, m);
+            dcc_make_dnssd_subtype(stype, sizeof(stype), ctx->cc_version, ctx->cc_machine);
 
             if (avahi_entry_group_add_service_subtype(
                         ctx->group,
@@ -226,6 +293,7 @@ static void client_callback(AvahiClient *client, AvahiClientState state, void *u
 void* dcc_zeroconf_register(uint16_t port, int n_cpus) {
     struct context *ctx = NULL;
     char service[256] = "distcc@";
+    struct timeval tv;
     int error;
 
     ctx = malloc(sizeof(struct context));
@@ -233,9 +301,15 @@ void* dcc_zeroconf_register(uint16_t port, int n_cpus) {
     ctx->client = NULL;
     ctx->group = NULL;
     ctx->threaded_poll = NULL;
+    ctx->refresh = NULL;
     ctx->port = port;
     ctx->n_cpus = n_cpus;
 
+    if (!dcc_get_gcc_version(ctx->cc_version, sizeof(ctx->cc_version)))
+        ctx->cc_version[0] = 0;
+    if (!dcc_get_gcc_machine(ctx->cc_machine, sizeof(ctx->cc_machine)))
+        ctx->cc_machine[0] = 0;
+
     /* Prepare service name */
     gethostname(service+7, sizeof(service)-8);
     service[sizeof(service)-1] = 0;
@@ -253,6 +327,12 @@ void* dcc_zeroconf_register(uint16_t port, int n_cpus) {
         goto fail;
     }
 
+    ctx->refresh = avahi_threaded_poll_get(ctx->threaded_poll)->timeout_new(
+            avahi_threaded_poll_get(ctx->threaded_poll),
+            avahi_elapse_time(&tv, DCC_ZEROCONF_REFRESH * 1000, 0),
+            refresh_txt,
+            ctx);
+
     /* Create the mDNS event handler */
     if (avahi_threaded_poll_start(ctx->threaded_poll) < 0) {
         rs_log_crit("Failed to create thread.\n");
@@ -276,6 +356,9 @@ int dcc_zeroconf_unregister(void *u) {
     if (ctx->threaded_poll)
         avahi_threaded_poll_stop(ctx->threaded_poll);
 
+    if (ctx->refresh)
+        avahi_threaded_poll_get(ctx->threaded_poll)->timeout_free(ctx->refresh);
+
     if (ctx->client)
         avahi_client_free(ctx->client);
 
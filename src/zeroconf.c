@@ -72,12 +72,15 @@ struct host {
     AvahiIfIndex interface;
     AvahiProtocol protocol;
     char *service;
+    char *type;
     char *domain;
 
     AvahiAddress address;
     uint16_t port;
-    int n_cpus;
+    struct dcc_zeroconf_caps caps;
 
+    /* Non-zero once address, port and caps are known */
+    int resolved;
     AvahiServiceResolver *resolver;
 };
 
@@ -131,9 +134,11 @@ static time_t fd_last_used(int fd, time_t clip_time) {
 
 static void remove_duplicate_services(struct daemon_data *d);
 
-/* Write host data to host file */
+/* Write host data to host file, best hosts first */
 static int write_hosts(struct daemon_data *d) {
     struct host *h;
+    struct dcc_zeroconf_entry *entries = NULL;
+    int n = 0;
     int r = 0;
     assert(d);
 
@@ -156,27 +161,35 @@ static int write_hosts(struct daemon_data *d) {
 
     remove_duplicate_services(d);
 
-    for (h = d->hosts; h; h = h->next) {
-        char t[256], a[AVAHI_ADDRESS_STR_MAX];
+    for (h = d->hosts; h; h = h->next)
+        n++;
 
-        if (h->resolver)
+    if (n && !(entries = malloc(n * sizeof *entries))) {
+        rs_log_crit("malloc failed\n");
+        r = -1;
+        goto finish;
+    }
+
+    n = 0;
+    for (h = d->hosts; h; h = h->next) {
+        if (!h->resolved)
             /* Not yet fully resolved */
             continue;
-	if (h->address.proto == AVAHI_PROTO_INET6)
-	    snprintf(t, sizeof(t), "[%s]:%u/%i\n", avahi_address_snprint(a, sizeof(a), &h->address), h->port, d->n_slots * h->n_cpus);
-	else
-	    snprintf(t, sizeof(t), "%s:%u/%i\n", avahi_address_snprint(a, sizeof(a), &h->address), h->port, d->n_slots * h->n_cpus);
-
-        if (dcc_writex(d->fd, t, strlen(t)) != 0) {
-            rs_log_crit("write() failed: %s\n", strerror(errno));
-            goto finish;
-        }
+        avahi_address_snprint(entries[n].address, sizeof entries[n].address,
+                              &h->address);
+        entries[n].port = h->port;
+        entries[n].caps = h->caps;
+        n++;
     }
 
-    r = 0;
+    if (dcc_zeroconf_write_hosts(d->fd, entries, n, d->n_slots) != 0) {
+        rs_log_crit("failed to write host file\n");
+        r = -1;
+    }
 
 finish:
 
+    free(entries);
     generic_lock(d->fd, 1, 0, 1);
     return r;
 
@@ -190,6 +203,7 @@ static void free_host(struct host *h) {
         avahi_service_resolver_free(h->resolver);
 
     free(h->service);
+    free(h->type);
     free(h->domain);
     free(h);
 }
@@ -261,16 +275,16 @@ static void resolve_reply(
         case AVAHI_RESOLVER_FOUND: {
             AvahiStringList *i;
 
-            /* Look for the number of CPUs in TXT RRs */
+            /* Look for the server's capacity in TXT RRs */
+            dcc_zeroconf_caps_init(&h->caps);
             for (i = txt; i; i = i->next) {
                 char *key, *value;
 
                 if (avahi_string_list_get_pair(i, &key, &value, NULL) < 0)
                     continue;
 
-                if (!strcmp(key, "cpus"))
-                    if ((h->n_cpus = atoi(value)) <= 0)
-                        h->n_cpus = 1;
+                if (value)
+                    dcc_zeroconf_caps_set(&h->caps, key, value);
 
                 avahi_free(key);
                 avahi_free(value);
@@ -278,6 +292,7 @@ static void resolve_reply(
 
             h->address = *a;
             h->port = port;
+            h->resolved = 1;
 
             avahi_service_resolver_free(h->resolver);
             h->resolver = NULL;
@@ -293,7 +308,12 @@ static void resolve_reply(
             rs_log_warning("Failed to resolve service '%s': %s\n", name,
                            avahi_strerror(avahi_client_errno(h->daemon_data->client)));
 
-            free_host(h);
+            if (h->resolved) {
+                /* A refresh failed; keep what we knew. */
+                avahi_service_resolver_free(h->resolver);
+                h->resolver = NULL;
+            } else
+                remove_service(h->daemon_data, h->interface, h->protocol, h->service, h->domain);
             break;
     }
 
@@ -343,13 +363,16 @@ static void browse_reply(
                 /* Fill in missing data */
                 h->service = strdup(name);
                 assert(h->service);
+                h->type = strdup(type);
+                assert(h->type);
                 h->domain = strdup(domain);
                 assert(h->domain);
                 h->daemon_data = d;
                 h->interface = interface;
                 h->protocol = protocol;
                 h->next = d->hosts;
-                h->n_cpus = 1;
+                dcc_zeroconf_caps_init(&h->caps);
+                h->resolved = 0;
                 d->hosts = h;
             }
 
@@ -378,6 +401,30 @@ static void browse_reply(
     }
 }
 
+/* Resolve all known services again, to pick up changes in the load they
+ * advertise.  The host file is rewritten as the answers come in. */
+static void refresh_hosts(struct daemon_data *d) {
+    struct host *h;
+
+    for (h = d->hosts; h; h = h->next) {
+        if (h->resolver)
+            continue;
+
+        if (!(h->resolver = avahi_service_resolver_new(d->client,
+                                                       h->interface,
+                                                       h->protocol,
+                                                       h->service,
+                                                       h->type,
+                                                       h->domain,
+                                                       AVAHI_PROTO_UNSPEC,
+                                                       0,
+                                                       resolve_reply,
+                                                       h)))
+            rs_log_warning("Failed to create service resolver for '%s': %s\n", h->service,
+                           avahi_strerror(avahi_client_errno(d->client)));
+    }
+}
+
 static void client_callback(AvahiClient *client, AvahiClientState state, void *userdata) {
     struct daemon_data *d = userdata;
 
@@ -401,7 +448,7 @@ static int daemon_proc(const char *host_file, const char *lock_file, int n_slots
     int ret = 1;
     int lock_fd = -1;
     struct daemon_data d;
-    time_t clip_time;
+    time_t clip_time, last_refresh;
     int error;
     char machine[64], version[64], stype[128];
 
@@ -479,6 +526,8 @@ static int daemon_proc(const char *host_file, const char *lock_file, int n_slots
         goto finish;
     }
 
+    last_refresh = time(NULL);
+
     /* Check whether the host file has been used recently */
     while (fd_last_used(d.fd, clip_time) <= MAX_IDLE_TIME) {
 
@@ -487,6 +536,11 @@ static int daemon_proc(const char *host_file, const char *lock_file, int n_slots
             rs_log_crit("Event loop exited abnormaly.\n");
             goto finish;
         }
+
+        if (time(NULL) - last_refresh >= DCC_ZEROCONF_REFRESH) {
+            refresh_hosts(&d);
+            last_refresh = time(NULL);
+        }
     }
 
     /* Wer are idle */
@@ -35,4 +35,44 @@ char* dcc_make_dnssd_subtype(char *stype, size_t nbytes, const char *v, const ch
 
 #define DCC_DNS_SERVICE_TYPE "_distcc._tcp"
 
+/* Keys of the TXT records describing a server's capacity. */
+#define DCC_ZC_TXT_CPUS "cpus"
+#define DCC_ZC_TXT_MAXJOBS "maxjobs"
+#define DCC_ZC_TXT_FREE "free"
+#define DCC_ZC_TXT_LOAD "load"
+#define DCC_ZC_TXT_COMPRESS "compress"
+
+/* Seconds between refreshes of the capacity records, both when a server
+ * publishes them and when the zeroconf daemon re-reads them. */
+#define DCC_ZEROCONF_REFRESH 30
+
+/* What a server advertised about itself, and the weight derived from it. */
+struct dcc_zeroconf_caps {
+    int n_cpus;
+    int max_jobs;               /* 0 if not advertised */
+    int free_slots;             /* -1 if not advertised */
+    double load;                /* 1-minute load average, -1 if unknown */
+
+    /* Set by dcc_zeroconf_caps_weigh() */
+    int slots;
+    int spare;
+};
+
+/* A resolved server, as it goes into the host file. */
+struct dcc_zeroconf_entry {
+    char address[64];           /* printable, without brackets */
+    unsigned port;
+    struct dcc_zeroconf_caps caps;
+};
+
+/* zeroconf-caps.c */
+void dcc_zeroconf_caps_init(struct dcc_zeroconf_caps *caps);
+void dcc_zeroconf_caps_set(struct dcc_zeroconf_caps *caps,
+                           const char *key, const char *value);
+void dcc_zeroconf_caps_weigh(struct dcc_zeroconf_caps *caps, int n_slots);
+int dcc_zeroconf_caps_cmp(const struct dcc_zeroconf_caps *a,
+                          const struct dcc_zeroconf_caps *b);
+int dcc_zeroconf_write_hosts(int fd, struct dcc_zeroconf_entry *entries,
+                             int n, int n_slots);
+
 #endif
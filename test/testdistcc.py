@@ -658,6 +658,34 @@ int main(void) { return 0; }
             del os.environ["DEPENDENCIES_OUTPUT"]
 
 
+class DotDCleanup_Case(SimpleDistCC_Case):
+    """Test rewriting of .d files by dcc_cleanup_dotd."""
+
+    def runtest(self):
+        root = "/tmp/distccd_root"
+        # Lines much longer than the old 2 * MAXPATHLEN limit.
+        deps = " ".join(["%s/usr/include/h%d.h" % (root, i)
+                         for i in range(2000)])
+        cases = [
+            ("/tmp/server.o: %s/src/foo.c %s/src/foo.h\n" % (root, root),
+             "foo.o: /src/foo.c /src/foo.h\n"),
+            ("/tmp/server.o: /tmp/server.o.h \\\n %s/a.h\n\n" % root,
+             "foo.o: /tmp/server.o.h \\\n /a.h\n\n"),
+            ("/tmp/server.o: %s\n%s/x.h:\n" % (deps, root),
+             "foo.o: %s\n/x.h:\n" % deps.replace(root, "")),
+            ("no newline at the end %s/y.h" % root,
+             "no newline at the end /y.h"),
+            ("", ""),
+            ]
+        for (dotd, expected) in cases:
+            f = open("in.d", "w")
+            f.write(dotd)
+            f.close()
+            out, _err = self.runcmd(
+                "h_dotd dcc_cleanup_dotd in.d %s foo.o /tmp/server.o" % root)
+            self.assert_equal(out, expected)
+
+
 class Compile_c_Case(SimpleDistCC_Case):
   """Unit tests for source file 'compile.c.'
   
@@ -809,6 +837,8 @@ class ParseHostSpec_Case(SimpleDistCC_Case):
         angry/44:300
         angry,lzo
         angry:3000,lzo    # some comment
+        angry,lzo,cpp,session
+        angry,manifest
         angry/44,lzo
         @angry,lzo#asdasd
         # oh yeah nothing here
@@ -816,7 +846,7 @@ class ParseHostSpec_Case(SimpleDistCC_Case):
         localhostbutnotreally
         """
 
-        expected="""16
+        expected="""18
    2 LOCAL
    4 TCP 127.0.0.1 3632
    4 SSH (no-user) angry (no-command)
@@ -829,6 +859,8 @@ class ParseHostSpec_Case(SimpleDistCC_Case):
   44 TCP angry 300
    4 TCP angry 3632
    4 TCP angry 3000
+   4 TCP angry 3632
+   4 TCP angry 3632
   44 TCP angry 3632
    4 SSH (no-user) angry (no-command)
    4 SSH (no-user) angry /usr/sbin/distccd
@@ -839,6 +871,129 @@ class ParseHostSpec_Case(SimpleDistCC_Case):
         assert out == expected, "expected %s\ngot %s" % (`expected`, `out`)
 
 
+class HostListCache_Case(SimpleDistCC_Case):
+    def runtest(self):
+        """Check that a cached host list reads back the same as a parsed one.
+
+        Also times the parser against the cache for a long host list."""
+        spec = ("--localslots=3 localhost/2 ted@angry:/bin/distccd "
+                + " ".join(["host%d:%d/%d,lzo" % (i, 3000 + i, 1 + i % 8)
+                            for i in range(200)]))
+        cmd = ("DISTCC_HOSTS=\"%s\" " % spec) + self.valgrind() + "h_hosts"
+        parsed, err = self.runcmd("DISTCC_HOSTS_CACHE=0 " + cmd)
+        self.assert_no_file(os.environ['DISTCC_DIR'] + "/hostcache")
+        first, err = self.runcmd(cmd)
+        self.assert_equal(first, parsed)
+        assert os.path.exists(os.environ['DISTCC_DIR'] + "/hostcache")
+        cached, err = self.runcmd(cmd + " -v")
+        self.assert_equal(cached, parsed)
+        self.assert_re_search("read 202 hosts from", err)
+
+        # A different spec, or a changed hosts file, must not use the cache.
+        out, err = self.runcmd("DISTCC_HOSTS=\"angry:4200\" "
+                               + self.valgrind() + "h_hosts")
+        self.assert_equal(out, "1\n   4 TCP angry 4200\n")
+        hosts_file = os.environ['DISTCC_DIR'] + "/hosts"
+        open(hosts_file, 'w').write("angry:4201\n")
+        out, err = self.runcmd("env -u DISTCC_HOSTS " + self.valgrind()
+                               + "h_hosts")
+        self.assert_equal(out, "1\n   4 TCP angry 4201\n")
+        # Same size, and most likely within the same second.
+        open(hosts_file, 'w').write("angry:4203\n")
+        out, err = self.runcmd("env -u DISTCC_HOSTS " + self.valgrind()
+                               + "h_hosts")
+        self.assert_equal(out, "1\n   4 TCP angry 4203\n")
+        open(hosts_file, 'w').write("angry:4202/7 ted@angry\n")
+        out, err = self.runcmd("env -u DISTCC_HOSTS " + self.valgrind()
+                               + "h_hosts")
+        self.assert_equal(out, "2\n   7 TCP angry 4202\n"
+                          "   4 SSH ted angry (no-command)\n")
+
+        for env in ["DISTCC_HOSTS_CACHE=0 ", ""]:
+            out, err = self.runcmd(env + ("DISTCC_HOSTS=\"%s\" " % spec)
+                                   + "h_hosts -b 1000")
+            self.log("%s%s" % (env, out))
+
+
+class ZeroconfWeight_Case(SimpleDistCC_Case):
+    def runtest(self):
+        """Check the host list built from the capacity servers advertise.
+
+        h_zeroconf stands in for mDNS: it takes announced services with
+        their TXT records on stdin and prints the host file that the
+        zeroconf daemon would write for them."""
+        announced = ("10.0.0.1 3632 txtvers=1 cpus=2\n"
+                     "10.0.0.2 3632 cpus=16 maxjobs=18 free=10 load=3.50\n"
+                     "10.0.0.3 3632 cpus=8 maxjobs=10 free=0 load=9.00\n"
+                     "fe80::1 3632 cpus=4 maxjobs=6 free=6 load=0.10\n"
+                     "10.0.0.5 3633 cpus=bogus maxjobs=-3 free=x load=\n"
+                     "10.0.0.6 3632 cpus=4 maxjobs=6 free=6 load=2.00\n")
+        out, err = self.runcmd("printf '%s' | %sh_zeroconf"
+                               % (announced, self.valgrind()))
+        # Most spare slots first; servers that don't say are taken as idle
+        # and get the old 4 slots per CPU; ties go to the lower load.
+        self.assert_equal(out, "10.0.0.2:3632/18\n"
+                          "10.0.0.1:3632/8\n"
+                          "[fe80::1]:3632/6\n"
+                          "10.0.0.6:3632/6\n"
+                          "10.0.0.5:3633/4\n"
+                          "10.0.0.3:3632/10\n")
+
+        out, err = self.runcmd("printf '10.0.0.1 3632 cpus=3\\n' | "
+                               + self.valgrind() + "h_zeroconf 2")
+        self.assert_equal(out, "10.0.0.1:3632/6\n")
+
+
+class SpawnChild_Case(SimpleDistCC_Case):
+    def runtest(self):
+        """Check that children are set up the same with and without fork.
+
+        h_spawn runs a program the way distccd runs the compiler, and
+        also times it."""
+        child = ("sh -c 'echo $_DISTCC_SAFEGUARD; echo oops >&2; exit 3'")
+        for spawn in ['1', '0']:
+            if os.path.exists('spawn.err'):
+                os.unlink('spawn.err')
+            self.runcmd("DISTCC_SPAWN=%s %sh_spawn 3 spawn.out spawn.err %s"
+                        % (spawn, self.valgrind(), child),
+                        expectedResult=3)
+            # stdout is truncated for each run and stderr appended to
+            self.assert_equal(open('spawn.out').read(), "1\n")
+            self.assert_equal(open('spawn.err').read(), "oops\n" * 3)
+
+            # A missing compiler is looked for on the path by its basename
+            self.runcmd("DISTCC_SPAWN=%s %sh_spawn 1 spawn.out spawn.err "
+                        "/no/such/dir/sh -c 'exit 4'"
+                        % (spawn, self.valgrind()),
+                        expectedResult=4)
+            self.runcmd("DISTCC_SPAWN=%s %sh_spawn 1 spawn.out spawn.err "
+                        "/no/such/dir/nosuchcc"
+                        % (spawn, self.valgrind()),
+                        expectedResult=EXIT_COMPILER_MISSING)
+
+
+class CompilerPlan_Case(SimpleDistCC_Case):
+    def runtest(self):
+        """Check that a plan learned from cc -### builds the same object.
+
+        h_compplan learns the plan, and also compares its speed with the
+        driver's."""
+        open("hello.c", "w").write("int main(void) { return 0; }\n")
+        self.runcmd(_gcc + " -c hello.c -o driver.o")
+        out, err = self.runcmd(self.valgrind() + "h_compplan 2 " + _gcc
+                               + " -c hello.c -o sub.o -MD -MF sub.d")
+        self.assert_re_search(r'<i>', out)
+        self.assert_re_search(r'-MF <d>', out)
+        self.assert_equal(open("sub.o").read(), open("driver.o").read())
+        if not os.path.exists("sub.d"):
+            self.fail("plan didn't write the dependencies")
+
+        # A compile error comes from the plan as from the driver
+        open("broken.c", "w").write("int main(void) { return }\n")
+        self.runcmd(self.valgrind() + "h_compplan 1 " + _gcc
+                    + " -c broken.c -o broken.o", expectedResult=1)
+
+
 class Compilation_Case(WithDaemon_Case):
     '''Test distcc by actually compiling a file'''
     def setup(self):
@@ -1403,6 +1558,308 @@ class DashONoSpace_Case(CompileHello_Case):
             CompileHello_Case.runtest (self)
 
 
+class ConnectRace_Case(CompileHello_Case):
+    """Test that a refused connection races on to another server."""
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        # Nothing listens on port 1, and it is listed first, so the
+        # first slot locked is on a server that refuses the connection.
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:1%s 127.0.0.1:%d%s' %
+          (_server_options, self.server_port, _server_options))
+        os.environ['DISTCC_CONNECT_RACE'] = '200'
+        os.environ['DISTCC_PROBE_PERIOD'] = '0'
+        os.environ['DISTCC_BACKOFF_PERIOD'] = '0'
+
+    def teardown(self):
+        for name in ['DISTCC_CONNECT_RACE', 'DISTCC_PROBE_PERIOD',
+                     'DISTCC_BACKOFF_PERIOD']:
+            del os.environ[name]
+        CompileHello_Case.teardown(self)
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r"127\.0\.0\.1:%d\S* won the connection race"
+                              % self.server_port, log)
+
+
+class ConnectRaceBadName_Case(ConnectRace_Case):
+    """Test that a server whose name doesn't resolve races on to another."""
+    def setupEnv(self):
+        ConnectRace_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = ('nosuchhost.invalid%s 127.0.0.1:%d%s' %
+          (_server_options, self.server_port, _server_options))
+
+
+class SlowHost_Case(CompileHello_Case):
+    """Test that a server recorded as slow is tried after the others."""
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        # Nothing listens on port 1, so the compile only works remotely if
+        # the server that is listed first is not tried first.
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:1%s 127.0.0.1:%d%s' %
+          (_server_options, self.server_port, _server_options))
+        os.environ['DISTCC_PROBE_PERIOD'] = '3600'
+        now = int(time.time())
+        open(os.environ['DISTCC_DIR'] + "/hoststate", 'w').write(
+            "127.0.0.1 1 1 900 %d 5000000\n"
+            "127.0.0.1 %d 1 100 %d 200000\n" % (now, self.server_port, now))
+
+    def teardown(self):
+        del os.environ['DISTCC_PROBE_PERIOD']
+        CompileHello_Case.teardown(self)
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r"127\.0\.0\.1:1\S* is slow; try it last", log)
+        self.assert_equal(re.search(r"connecting to 127\.0\.0\.1:1\b", log),
+                          None)
+
+
+class ProbeDeadAddress_Case(CompileHello_Case):
+    """Test that the host prober tries all of a server's addresses.
+
+    The server is given by a name whose first address has nothing listening
+    on it, so it is only seen to be up if the prober moves on to 127.0.0.1."""
+    def setup(self):
+        self.server_name = None
+        for name in ['localhost', 'ip6-localhost', socket.gethostname()]:
+            try:
+                addrs = [ai[4][0] for ai in
+                         socket.getaddrinfo(name, None, 0, socket.SOCK_STREAM)]
+            except socket.error:
+                continue
+            if '127.0.0.1' in addrs[1:]:
+                self.server_name = name
+                break
+        CompileHello_Case.setup(self)
+
+    def daemon_command(self):
+        return (CompileHello_Case.daemon_command(self)
+                + " --listen 127.0.0.1")
+
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        if self.server_name:
+            os.environ['DISTCC_HOSTS'] = ('%s:%d%s' %
+              (self.server_name, self.server_port, _server_options))
+        os.environ['DISTCC_PROBE_PERIOD'] = '60'
+
+    def teardown(self):
+        del os.environ['DISTCC_PROBE_PERIOD']
+        CompileHello_Case.teardown(self)
+
+    def runtest(self):
+        if not self.server_name:
+            raise comfychair.NotRunError(
+                'no name resolves to another address before 127.0.0.1')
+        CompileHello_Case.runtest(self)
+        # The prober runs in the background; give it time to finish.
+        state_file = os.environ['DISTCC_DIR'] + "/hoststate"
+        for i in range(50):
+            if os.path.exists(state_file):
+                break
+            time.sleep(0.2)
+        self.assert_re_search("^%s %d 1 [0-9]+ [0-9]+"
+                              % (re.escape(self.server_name), self.server_port),
+                              open(state_file).read())
+
+
+class ConnectRaceDeadAddress_Case(ProbeDeadAddress_Case):
+    """Test that the connection race tries all of a server's addresses."""
+    def setupEnv(self):
+        ProbeDeadAddress_Case.setupEnv(self)
+        os.environ['DISTCC_CONNECT_RACE'] = '200'
+        os.environ['DISTCC_PROBE_PERIOD'] = '0'
+
+    def teardown(self):
+        del os.environ['DISTCC_CONNECT_RACE']
+        ProbeDeadAddress_Case.teardown(self)
+
+    def runtest(self):
+        if not self.server_name:
+            raise comfychair.NotRunError(
+                'no name resolves to another address before 127.0.0.1')
+        CompileHello_Case.runtest(self)
+
+
+class SshPersist_Case(CompileHello_Case):
+    """Test compiling over ssh, asking ssh to keep a master connection.
+
+    A fake ssh records its arguments and runs distccd --inetd locally."""
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.mkdir("fakessh")
+        self.ssh_log = os.path.join(os.getcwd(), "ssh.log")
+        ssh = os.path.join(os.getcwd(), "fakessh", "ssh")
+        open(ssh, 'w').write('#! /bin/sh\n'
+                             'echo "$*" >> %s\n'
+                             'while [ $# -gt 3 ]; do shift; done\n'
+                             'exec "$2" "$3"\n' % _ShellSafe(self.ssh_log))
+        os.chmod(ssh, 0755)
+        os.environ['DISTCC_HOSTS'] = '@localhost'
+        os.environ['DISTCC_SSH'] = ssh
+
+    def teardown(self):
+        del os.environ['DISTCC_SSH']
+        CompileHello_Case.teardown(self)
+
+    def runtest(self):
+        # Left alone unless asked for.
+        CompileHello_Case.runtest(self)
+        self.assert_equal(open(self.ssh_log).read(),
+                          "localhost distccd --inetd\n")
+        os.remove(self.ssh_log)
+        self.runcmd("DISTCC_SSH_PERSIST=60 " + self.compileCmd())
+        self.assert_re_search(r"^-o ControlMaster=auto -o ControlPath=%s/ssh/"
+                              r"%%r@%%h:%%p -o ControlPersist=60 localhost "
+                              r"distccd --inetd$"
+                              % re.escape(os.environ['DISTCC_DIR']),
+                              open(self.ssh_log).read())
+
+
+class BufferedIO_Case(CompileHello_Case):
+    """Test that buffering the protocol saves system calls.
+
+    Compiles once with DISTCC_IO_BUFFER=0 and once with the default, and
+    compares the read and write calls the client counted on the
+    connection."""
+    def syscalls(self):
+        log = open(os.environ['DISTCC_LOG']).read()
+        calls = re.findall(r"(\d+) read and (\d+) write calls on fd", log)
+        self.assert_notequal(calls, [])
+        return (sum([int(r) for r, w in calls]),
+                sum([int(w) for r, w in calls]))
+
+    def runtest(self):
+        os.environ['DISTCC_IO_BUFFER'] = '0'
+        try:
+            self.compile()
+        finally:
+            del os.environ['DISTCC_IO_BUFFER']
+        unbuffered = self.syscalls()
+        open(os.environ['DISTCC_LOG'], 'w').close()
+        self.compile()
+        buffered = self.syscalls()
+        self.log("reads, writes: unbuffered %s, buffered %s"
+                 % (unbuffered, buffered))
+        assert buffered[0] < unbuffered[0]
+        assert buffered[1] < unbuffered[1]
+        self.link()
+        self.checkBuiltProgram()
+
+
+class ManifestCompile_Case(CompileHello_Case):
+    """Test compiling with the binary request manifest of protocol 4."""
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] += ',manifest'
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        self.assert_re_search(r"send \d+ byte manifest with \d+ arguments",
+                              open(os.environ['DISTCC_LOG']).read())
+
+
+class ManifestRefused_Case(ManifestCompile_Case):
+    """Test that a server turning down a manifest is sent no files.
+
+    The server only allows a compiler we don't use."""
+    def startDaemon(self):
+        cmdlist = os.path.join(os.getcwd(), "cmdlist")
+        open(cmdlist, 'w').write("/usr/bin/nosuchcc\n")
+        os.environ['DISTCC_CMDLIST'] = cmdlist
+        try:
+            ManifestCompile_Case.startDaemon(self)
+        finally:
+            del os.environ['DISTCC_CMDLIST']
+
+    def runtest(self):
+        result, out, err = self.runcmd_unchecked(self.compileCmd())
+        self.assert_notequal(result, 0)
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r"server turned the job down", log)
+        self.assert_equal(log.find("DOTI"), -1)
+
+
+class StreamCompile_Case(CompileHello_Case):
+    """Test getting results back in chunks, with protocol 5.
+
+    The object is big enough to take several chunks."""
+    def source(self):
+        return """
+#include <stdio.h>
+#include "%s"
+char ballast[1 << 20] = { 1 };
+int main(void) {
+    puts(HELLO_WORLD);
+    return ballast[0] - 1;
+}
+""" % self.headerFilename()
+
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] += ',lzo,stream'
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        self.assert_re_search(r"received \d+ bytes in chunks to file testtmp.o",
+                              open(os.environ['DISTCC_LOG']).read())
+        self.assert_equal(glob.glob("testtmp.o.distcc_*"), [])
+
+
+class StreamDevNull_Case(StreamCompile_Case):
+    """Test that chunked results go straight into something not a file."""
+    def runtest(self):
+        self.compile()
+
+    def compileCmd(self):
+        return self.distcc_without_fallback() + _gcc + \
+               " -c -o /dev/null %s" % (self.sourceFilename())
+
+
+class ReplaceOutput_Case(CompileHello_Case):
+    """Test that an existing object is replaced, not written over.
+
+    Another name for the old file must still see its old contents."""
+    def runtest(self):
+        open("testtmp.o", "w").write("old object\n")
+        os.link("testtmp.o", "old.o")
+        self.compile()
+        self.assert_equal(open("old.o").read(), "old object\n")
+        self.assert_notequal(os.stat("testtmp.o")[ST_INO],
+                             os.stat("old.o")[ST_INO])
+        self.assert_equal(glob.glob("testtmp.o.distcc_*"), [])
+        self.link()
+        self.checkBuiltProgram()
+
+
+class ReadOnlyDirOutput_Case(CompileHello_Case):
+    """Test writing an object that is writable in a directory that is not.
+
+    No temporary file can be made next to it, so it is written directly."""
+    def compileCmd(self):
+        return self.distcc_without_fallback() + \
+               _gcc + " -o ro/testtmp.o " + self.compileOpts() + \
+               " -c %s" % (self.sourceFilename())
+
+    def runtest(self):
+        if os.geteuid() == 0:
+            raise comfychair.NotRunError('root may create files anywhere')
+        os.mkdir("ro")
+        open("ro/testtmp.o", "w").write("old object\n")
+        os.chmod("ro", 0555)
+        try:
+            self.compile()
+            self.assert_equal(os.listdir("ro"), ["testtmp.o"])
+        finally:
+            os.chmod("ro", 0755)
+        os.rename("ro/testtmp.o", "testtmp.o")
+        self.link()
+        self.checkBuiltProgram()
+
+
 class WriteDevNull_Case(CompileHello_Case):
     def runtest(self):
         self.compile()
@@ -2022,6 +2479,113 @@ class AccessDenied_Case(CompileHello_Case):
         self.assert_re_search(r'failed to distribute', errs)
 
 
+class AllowFile_Case(CompileHello_Case):
+    """Take the allowed clients from --allow-file, and reread it on SIGHUP."""
+    def setup(self):
+        self.allow_file = os.path.join(os.getcwd(), "allow.txt")
+        open(self.allow_file, 'w').write("# test clients\n"
+                                         "10.0.0.0/8 192.168.0.0/16\n"
+                                         "127.0.0.1\n")
+        CompileHello_Case.setup(self)
+
+    def daemon_command(self):
+        return (self.distccd()
+                + "--verbose --lifetime=%d --daemon --log-file %s "
+                  "--pid-file %s --port %d --allow-file %s"
+                % (self.daemon_lifetime(),
+                   _ShellSafe(self.daemon_logfile),
+                   _ShellSafe(self.daemon_pidfile),
+                   self.server_port,
+                   _ShellSafe(self.allow_file)))
+
+    def runtest(self):
+        self.compile()
+
+        open(self.allow_file, 'w').write("127.0.0.2\n")
+        pid = int(open(self.daemon_pidfile, 'rt').read())
+        os.kill(pid, signal.SIGHUP)
+        time.sleep(1)
+        rc, msgs, errs = self.runcmd_unchecked(self.distcc_without_fallback()
+                                               + _gcc
+                                               + " -o testtmp.o -c testtmp.c")
+        self.assert_notequal(rc, 0)
+        log = open(self.daemon_logfile).read()
+        self.assert_re_search(r'reloaded allow list', log)
+        self.assert_re_search(r'denied by access list', log)
+        # still running
+        os.kill(pid, 0)
+
+
+class CompilerPlans_Case(CompileHello_Case):
+    """Run the compiler's passes from a learned plan, skipping the driver."""
+    def daemon_command(self):
+        return CompileHello_Case.daemon_command(self) + " --compiler-plans"
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        log = open(self.daemon_logfile).read()
+        self.assert_re_search(r'learned a [12]-pass (piped )?plan', log)
+
+        # Errors from the passes get back to the client
+        open("broken.c", "w").write("int main(void) { return }\n")
+        rc, msgs, errs = self.runcmd_unchecked(self.distcc_without_fallback()
+                                               + _gcc
+                                               + " -o broken.o -c broken.c")
+        self.assert_notequal(rc, 0)
+        self.assert_re_search(r'error', errs)
+
+
+class CompilerPlansRepeat_Case(CompilerPlans_Case):
+    """Check that a plan learned in pump mode serves the next job too,
+    though each job's files are unpacked under a new root."""
+    def daemon_command(self):
+        # One server process, so that it sees both jobs.
+        return CompilerPlans_Case.daemon_command(self) + " --jobs 1"
+
+    def runtest(self):
+        if _server_options.find('cpp') == -1:
+            raise comfychair.NotRunError('per-job trees only exist in pump mode')
+        learned = r'learned a [12]-pass (piped )?plan'
+        self.compile()
+        log = open(self.daemon_logfile).read()
+        self.assert_equal(len(re.findall(learned, log)), 1)
+        self.compile()
+        log = open(self.daemon_logfile).read()
+        self.assert_equal(len(re.findall(learned, log)), 1)
+        self.assert_re_search(r'found a plan for these options', log)
+        self.link()
+        self.checkBuiltProgram()
+
+
+class CompilerPlansMasq_Case(CompilerPlans_Case):
+    """Don't run a pass directly if it is a link to distcc on the PATH."""
+    def setup(self):
+        # The link's target names distcc, but leads to the real assembler,
+        # so that the driver still works.
+        self.masq_dir = os.path.join(os.getcwd(), "masq")
+        os.mkdir(self.masq_dir)
+        os.mkdir("distcc-bin")
+        real_as, err = self.runcmd("command -v as")
+        os.symlink(real_as.strip(), "distcc-bin/as")
+        os.symlink("../distcc-bin/as", os.path.join(self.masq_dir, "as"))
+        CompilerPlans_Case.setup(self)
+
+    def daemon_command(self):
+        return ("PATH=%s:$PATH " % _ShellSafe(self.masq_dir)
+                + CompilerPlans_Case.daemon_command(self))
+
+    def runtest(self):
+        # distccd's warning about the link comes back with the compile
+        self.runcmd(self.compileCmd())
+        self.link()
+        self.checkBuiltProgram()
+        log = open(self.daemon_logfile).read()
+        if not re.search(r'learned a 1-pass', log):
+            self.assert_re_search(r'not running as directly', log)
+            if re.search(r'learned a 2-pass', log):
+                self.fail("plan runs a masqueraded assembler")
+
+
 class ParseMask_Case(comfychair.TestCase):
     """Test code for matching IP masks."""
     values = [
@@ -2038,6 +2602,13 @@ class ParseMask_Case(comfychair.TestCase):
         ('1.2.3.4/8', '4.3.2.1', EXIT_ACCESS_DENIED),
         ('192.168.1.64/28', '192.168.1.70', 0),
         ('192.168.1.64/28', '192.168.1.7', EXIT_ACCESS_DENIED),
+        # several masks, compiled into one allow list
+        ('10.0.0.0/8,192.168.1.64/28,127.0.0.1', '192.168.1.70', 0),
+        ('10.0.0.0/8,192.168.1.64/28,127.0.0.1', '127.0.0.2',
+         EXIT_ACCESS_DENIED),
+        ('10.1.2.0/24,10.0.0.0/8', '10.200.3.4', 0),
+        ('10.0.0.0/8,10.1.2.0/24', '10.1.3.4', 0),
+        ('10.1.2.0/24,10.1.3.128/25', '10.1.3.127', EXIT_ACCESS_DENIED),
         ]
     def runtest(self):
         for mask, client, expected in ParseMask_Case.values:
@@ -2062,6 +2633,87 @@ class HostFile_Case(CompileHello_Case):
         CompileHello_Case.teardown(self)
 
 
+class SessionRoot_Case(CompileHello_Case):
+    """Check that ',session' keeps the server-side file tree between jobs."""
+
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] += ',session'
+
+    def runtest(self):
+        if _server_options.find('cpp') == -1:
+            raise comfychair.NotRunError('sessions only apply to pump mode')
+        daemon_tmpdir = os.environ['TMPDIR'] + "/daemon_tmp"
+        self.compile()
+        roots = [f for f in os.listdir(daemon_tmpdir)
+                 if f.startswith('distccd_s_') and os.path.isdir(
+                     os.path.join(daemon_tmpdir, f))]
+        self.assert_equal(len(roots), 1)
+        root = os.path.join(daemon_tmpdir, roots[0])
+        mirrored_header = root + os.path.abspath(self.headerFilename())
+        self.assert_equal(open(mirrored_header).read(), self.headerSource())
+        # The second job finds the header already there, and must leave
+        # the root in place again.
+        self.compile()
+        self.assert_equal(open(mirrored_header).read(), self.headerSource())
+        self.link()
+        self.checkBuiltProgram()
+
+
+class TempTrash_Case(CompileHello_Case):
+    """Check that the server's per-job trees are moved aside and removed."""
+
+    def jobTrees(self, daemon_tmpdir):
+        return [f for f in os.listdir(daemon_tmpdir)
+                if f.startswith('distccd_') and len(f) == len('distccd_XXXXXX')
+                and os.path.isdir(os.path.join(daemon_tmpdir, f))]
+
+    def runtest(self):
+        if _server_options.find('cpp') == -1:
+            raise comfychair.NotRunError('per-job trees only exist in pump mode')
+        daemon_tmpdir = os.environ['TMPDIR'] + "/daemon_tmp"
+        trash = os.path.join(daemon_tmpdir, 'distccd_trash_%d' % os.geteuid())
+        self.compile()
+        # The reaper runs in the background, so give it a moment.
+        for i in range(50):
+            if not self.jobTrees(daemon_tmpdir) and not os.listdir(trash):
+                break
+            time.sleep(0.1)
+        self.assert_equal(self.jobTrees(daemon_tmpdir), [])
+        self.assert_equal(os.listdir(trash), [])
+        self.link()
+        self.checkBuiltProgram()
+
+
+class LogBatch_Case(CompileHello_Case):
+    """Check that --log-batch writes each job's messages together."""
+
+    def daemon_command(self):
+        return CompileHello_Case.daemon_command(self) + " --log-batch"
+
+    def runtest(self):
+        self.compile()
+        # The server writes the batch after the client has its answer.
+        for i in range(50):
+            log = open(self.daemon_logfile).read()
+            if log.find('job complete') != -1 and log.find('COMPILE_OK') != -1:
+                break
+            time.sleep(0.1)
+        lines = log.splitlines()
+        job = [i for i in range(len(lines))
+               if lines[i].find('job complete') != -1]
+        self.assert_equal(len(job), 1)
+        prefix = lines[job[0]].split(' ', 1)[0]
+        start = [i for i in range(job[0])
+                 if lines[i].find('connection from') != -1][-1]
+        end = [i for i in range(job[0], len(lines))
+               if lines[i].find('COMPILE_OK') != -1][0]
+        for line in lines[start:end + 1]:
+            self.assert_equal(line.split(' ', 1)[0], prefix)
+        self.link()
+        self.checkBuiltProgram()
+
+
 class Lsdistcc_Case(WithDaemon_Case):
     """Check lsdistcc"""
 
@@ -2119,6 +2771,28 @@ class Lsdistcc_Case(WithDaemon_Case):
           self.assert_re_search("127.0.0.4:%d\n" % self.server_port, out)
           self.assert_re_search("127.0.0.5:%d\n" % self.server_port, out)
 
+        # Test "lsdistcc -f": the results are also saved for the client,
+        # with the connect and test compile times.
+        state_file = os.environ['DISTCC_DIR'] + "/hoststate"
+        out, err = self.runcmd(lsdistcc + " -f%s -p%s localhost"
+                               " anInvalidHostname" % (state_file, _gcc))
+        self.assert_equal(out, "localhost:%d\n" % self.server_port)
+        lines = open(state_file).read().splitlines()
+        lines.sort()
+        self.assert_equal(len(lines), 2)
+        self.assert_re_search("^anInvalidHostname %d 0 -1 [0-9]+$"
+                              % self.server_port, lines[0])
+        self.assert_re_search("^localhost %d 1 [0-9]+ [0-9]+ [0-9]+$"
+                              % self.server_port, lines[1])
+
+        # Test "lsdistcc -D": it keeps rewriting the file, printing nothing.
+        os.unlink(state_file)
+        rc, out, err = self.runcmd_unchecked("timeout 3 " + lsdistcc
+                                             + " -D1 -t1 -c500 localhost")
+        self.assert_equal(out, "")
+        self.assert_re_search("^localhost %d 1 [0-9]+ [0-9]+$"
+                              % self.server_port, open(state_file).read())
+
 class Getline_Case(comfychair.TestCase):
     """Test getline()."""
     values = [
@@ -2183,7 +2857,12 @@ tests = [
          BadLogFile_Case,
          ScanArgs_Case,
          ParseMask_Case,
+         AllowFile_Case,
+         CompilerPlans_Case,
+         CompilerPlansRepeat_Case,
+         CompilerPlansMasq_Case,
          DotD_Case,
+         DotDCleanup_Case,
          DashMD_DashMF_DashMT_Case,
          Compile_c_Case,
          ImplicitCompilerScan_Case,
@@ -2191,6 +2870,19 @@ tests = [
          StartStopDaemon_Case,
          CompressedCompile_Case,
          DashONoSpace_Case,
+         ConnectRace_Case,
+         ConnectRaceBadName_Case,
+         SlowHost_Case,
+         ProbeDeadAddress_Case,
+         ConnectRaceDeadAddress_Case,
+         SshPersist_Case,
+         BufferedIO_Case,
+         ManifestCompile_Case,
+         ManifestRefused_Case,
+         StreamCompile_Case,
+         StreamDevNull_Case,
+         ReplaceOutput_Case,
+         ReadOnlyDirOutput_Case,
          WriteDevNull_Case,
          CppError_Case,
          BadInclude_Case,
@@ -2214,6 +2906,10 @@ tests = [
          NoServer_Case,
          InvalidHostSpec_Case,
          ParseHostSpec_Case,
+         HostListCache_Case,
+         ZeroconfWeight_Case,
+         SpawnChild_Case,
+         CompilerPlan_Case,
          ImpliedOutput_Case,
          SyntaxError_Case,
          NoHosts_Case,
@@ -2223,6 +2919,9 @@ tests = [
          ModeBits_Case,
          EmptySource_Case,
          HostFile_Case,
+         SessionRoot_Case,
+         TempTrash_Case,
+         LogBatch_Case,
          AbsSourceFilename_Case,
          Getline_Case,
          # slow tests below here